@@ -0,0 +1,241 @@
+/*
+ * Times BVH queries against brute force over the same bounds: overlap and rays against a
+ * loop over every box, frustums against the flat SIMD culler
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <SDL2/SDL_timer.h>
+
+#include <video/bvh.h>
+#include <video/culling.h>
+
+#define DEFAULT_OBJECTS 100000
+#define WORLD_SIZE 1000.f
+#define QUERIES 1000
+#define QUERY_SIZE 50.f
+#define FRUSTUMS 100
+#define RAYS 10000
+
+static double
+elapsed_ms(Uint64 start) {
+    return (double)(SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+}
+
+static float
+random_float(float max) {
+    return (float)rand() / RAND_MAX * max;
+}
+
+static AABB
+random_box(float size) {
+    AABB box;
+
+    for (int k = 0; k < 3; k++) {
+        box.min[k] = random_float(WORLD_SIZE);
+        box.max[k] = box.min[k] + 1.f + random_float(size);
+    }
+
+    return box;
+}
+
+static bool
+overlaps(const AABB *a, const AABB *b) {
+    for (int k = 0; k < 3; k++)
+        if (a->max[k] < b->min[k] || a->min[k] > b->max[k])
+            return false;
+
+    return true;
+}
+
+static bool
+ray_box(const float3 origin, const float3 inv_dir, const AABB *box, float max_t, float *t) {
+    float t0 = 0.f, t1 = max_t;
+
+    for (int k = 0; k < 3; k++) {
+        float near = (box->min[k] - origin[k]) * inv_dir[k];
+        float far = (box->max[k] - origin[k]) * inv_dir[k];
+
+        if (near > far) {
+            const float tmp = near;
+            near = far;
+            far = tmp;
+        }
+
+        t0 = near > t0 ? near : t0;
+        t1 = far < t1 ? far : t1;
+
+        if (t0 > t1)
+            return false;
+    }
+
+    *t = t0;
+
+    return true;
+}
+
+// camera at eye looking down -z, row vectors like the rest of video
+static void
+camera_matrix(matrix4 out, const float3 eye) {
+    const float n = 1.f, f = 400.f, fy = 1.f / tanf(0.5f);
+    const matrix4 projection = {{fy, 0.f, 0.f, 0.f}, {0.f, fy, 0.f, 0.f}, {0.f, 0.f, (n + f) / (n - f), -1.f},
+                                {0.f, 0.f, 2.f * n * f / (n - f), 0.f}};
+    const matrix4 view = {{1.f, 0.f, 0.f, 0.f}, {0.f, 1.f, 0.f, 0.f}, {0.f, 0.f, 1.f, 0.f}, {-eye[0], -eye[1], -eye[2], 1.f}};
+
+    for (int i = 0; i < 4; i++)
+        for (int j = 0; j < 4; j++)
+            out[i][j] = view[i][0] * projection[0][j] + view[i][1] * projection[1][j] +
+                        view[i][2] * projection[2][j] + view[i][3] * projection[3][j];
+}
+
+int
+main(int argc, char *argv[]) {
+    const int objects = argc > 1 ? atoi(argv[1]) : DEFAULT_OBJECTS;
+
+    if (objects <= 0) {
+        fprintf(stderr, "usage: %s [objects]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    AABB *boxes = malloc(sizeof(AABB) * objects);
+    int32_t *proxies = malloc(sizeof(int32_t) * objects);
+    uint32_t *users = malloc(sizeof(uint32_t) * objects);
+
+    if (!boxes || !proxies || !users) {
+        fprintf(stderr, "can't alloc %d objects\n", objects);
+        return EXIT_FAILURE;
+    }
+
+    srand(1);
+
+    for (int i = 0; i < objects; i++)
+        boxes[i] = random_box(4.f);
+
+    // exact bounds, so both sides find the same objects
+    VIDEO_BVH bvh = new_bvh(objects, 0.f);
+    CULLING_SET set = new_culling_set(objects);
+    matrix4 identity = {{1.f, 0.f, 0.f, 0.f}, {0.f, 1.f, 0.f, 0.f}, {0.f, 0.f, 1.f, 0.f}, {0.f, 0.f, 0.f, 1.f}};
+
+    Uint64 start = SDL_GetPerformanceCounter();
+    for (int i = 0; i < objects; i++)
+        proxies[i] = bvh_insert(&bvh, &boxes[i], i);
+    const double build = elapsed_ms(start);
+
+    for (int i = 0; i < objects; i++)
+        culling_set_add(&set, &boxes[i], identity, i);
+
+    printf("%d objects, bvh built in %.3f ms, height %d, %u nodes\n", objects, build, bvh_height(&bvh), bvh.count);
+
+    // overlap
+    double tree = 0.0, brute = 0.0;
+    uint64_t tree_found = 0, brute_found = 0;
+
+    for (int q = 0; q < QUERIES; q++) {
+        const AABB query = random_box(QUERY_SIZE);
+
+        start = SDL_GetPerformanceCounter();
+        tree_found += bvh_query_aabb(&bvh, &query, users, objects);
+        tree += elapsed_ms(start);
+
+        start = SDL_GetPerformanceCounter();
+        for (int i = 0; i < objects; i++)
+            brute_found += overlaps(&boxes[i], &query);
+        brute += elapsed_ms(start);
+    }
+
+    printf("%-8s bvh %8.4f ms  brute %8.4f ms  %7.1fx  found %llu / %llu\n", "overlap", tree / QUERIES, brute / QUERIES,
+           brute / tree, (unsigned long long)tree_found, (unsigned long long)brute_found);
+
+    // frustum
+    tree = brute = 0.0;
+    tree_found = brute_found = 0;
+
+    for (int q = 0; q < FRUSTUMS; q++) {
+        const float3 eye = {random_float(WORLD_SIZE), random_float(WORLD_SIZE), random_float(WORLD_SIZE)};
+        matrix4 pv;
+        VIDEO_FRUSTUM frustum;
+
+        camera_matrix(pv, eye);
+        frustum_from_matrix(&frustum, pv);
+
+        start = SDL_GetPerformanceCounter();
+        tree_found += bvh_query_frustum(&bvh, &frustum, users, objects);
+        tree += elapsed_ms(start);
+
+        start = SDL_GetPerformanceCounter();
+        brute_found += cull_frustum(&set, &frustum, users);
+        brute += elapsed_ms(start);
+    }
+
+    printf("%-8s bvh %8.4f ms  flat  %8.4f ms  %7.1fx  found %llu / %llu\n", "frustum", tree / FRUSTUMS, brute / FRUSTUMS,
+           brute / tree, (unsigned long long)tree_found, (unsigned long long)brute_found);
+
+    // rays
+    tree = brute = 0.0;
+    uint32_t tree_hits = 0, brute_hits = 0, mismatches = 0;
+
+    for (int q = 0; q < RAYS; q++) {
+        const float3 origin = {random_float(WORLD_SIZE), random_float(WORLD_SIZE), random_float(WORLD_SIZE)};
+        float3 dir = {random_float(2.f) - 1.f, random_float(2.f) - 1.f, random_float(2.f) - 1.f};
+        const float length = sqrtf(dir[0] * dir[0] + dir[1] * dir[1] + dir[2] * dir[2]) + FLT_EPSILON;
+        float3 inv_dir;
+
+        for (int k = 0; k < 3; k++) {
+            dir[k] /= length;
+            inv_dir[k] = 1.f / dir[k];
+        }
+
+        uint32_t user = 0;
+        float t = 0.f;
+
+        start = SDL_GetPerformanceCounter();
+        const bool hit = bvh_raycast(&bvh, origin, dir, WORLD_SIZE, &user, &t);
+        tree += elapsed_ms(start);
+
+        start = SDL_GetPerformanceCounter();
+        float nearest = FLT_MAX;
+        for (int i = 0; i < objects; i++) {
+            float bt;
+            if (ray_box(origin, inv_dir, &boxes[i], WORLD_SIZE, &bt) && bt < nearest)
+                nearest = bt;
+        }
+        brute += elapsed_ms(start);
+
+        tree_hits += hit;
+        brute_hits += nearest < FLT_MAX;
+        mismatches += hit != (nearest < FLT_MAX) || (hit && fabsf(t - nearest) > 1e-3f);
+    }
+
+    printf("%-8s bvh %8.4f ms  brute %8.4f ms  %7.1fx  hits %u / %u, %u mismatches\n", "ray", tree / RAYS, brute / RAYS,
+           brute / tree, tree_hits, brute_hits, mismatches);
+
+    // moves, a tenth of the objects a frame with the default margin
+    free_bvh(&bvh);
+    bvh = new_bvh(objects, BVH_DEFAULT_MARGIN);
+    for (int i = 0; i < objects; i++)
+        proxies[i] = bvh_insert(&bvh, &boxes[i], i);
+
+    uint32_t reinserted = 0;
+    start = SDL_GetPerformanceCounter();
+    for (int i = 0; i < objects; i += 10) {
+        for (int k = 0; k < 3; k++) {
+            const float step = random_float(0.4f) - 0.2f;
+            boxes[i].min[k] += step;
+            boxes[i].max[k] += step;
+        }
+
+        reinserted += bvh_move(&bvh, proxies[i], &boxes[i]);
+    }
+    printf("%-8s %d moved in %.3f ms, %u reinserted, height %d\n", "move", (objects + 9) / 10, elapsed_ms(start), reinserted,
+           bvh_height(&bvh));
+
+    free_culling_set(&set);
+    free_bvh(&bvh);
+    free(boxes);
+    free(proxies);
+    free(users);
+
+    return EXIT_SUCCESS;
+}
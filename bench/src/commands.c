@@ -0,0 +1,214 @@
+/*
+ * Times the packed command stream against the fixed-size VIDEO_COMMAND array it replaced:
+ * recording, walking the commands back and the memory both take for the same frame
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SDL2/SDL_timer.h>
+
+#include <video/gl.h>
+#include <core/arena.h>
+#include <video/commandbuffer.h>
+
+#define DEFAULT_DRAWS 20000
+#define ITERATIONS 100
+
+// the old layout, blocks of unions in the buffer's arena with uniform values copied aside
+#define FIXED_BLOCK_SIZE 256
+
+typedef struct FixedBlock {
+    struct FixedBlock   *next;
+    uint32_t            count;
+    VIDEO_COMMAND       commands[FIXED_BLOCK_SIZE];
+} FIXED_BLOCK;
+
+typedef struct FixedBuffer {
+    ARENA               arena;
+    FIXED_BLOCK         *first_block;
+    FIXED_BLOCK         *last_block;
+    uint32_t            count;
+} FIXED_BUFFER;
+
+static double
+elapsed_ms(Uint64 start) {
+    return (double)(SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+}
+
+static VIDEO_COMMAND *
+fixed_push(FIXED_BUFFER *fb) {
+    FIXED_BLOCK *block = fb->last_block;
+
+    if (!block || block->count == FIXED_BLOCK_SIZE) {
+        block = arena_alloc(&fb->arena, sizeof(FIXED_BLOCK));
+        block->next = NULL;
+        block->count = 0;
+
+        if (fb->last_block)
+            fb->last_block->next = block;
+        else
+            fb->first_block = block;
+
+        fb->last_block = block;
+    }
+
+    fb->count++;
+
+    return &block->commands[block->count++];
+}
+
+static void
+fixed_uniform(FIXED_BUFFER *fb, int location, uint32_t type, const void *data, uint32_t size) {
+    void *values = arena_alloc(&fb->arena, size);
+    memcpy(values, data, size);
+
+    *fixed_push(fb) = (VIDEO_COMMAND){.type = VC_UNIFORM_COMMAND,
+                                      .uniform = {.location = location, .type = type, .size = size, .count = 1, .data = values}};
+}
+
+// a shader, vertex array and texture bind, a matrix and an int, then the draw
+static void
+record_fixed(FIXED_BUFFER *fb, int draws) {
+    arena_reset(&fb->arena);
+    fb->first_block = fb->last_block = NULL;
+    fb->count = 0;
+
+    for (int i = 0; i < draws; i++) {
+        float m[16];
+        for (int k = 0; k < 16; k++)
+            m[k] = (float)i;
+
+        *fixed_push(fb) = (VIDEO_COMMAND){.type = VC_BIND_SHADER_COMMAND, .bind_shader = {1 + i % 4}};
+        *fixed_push(fb) = (VIDEO_COMMAND){.type = VC_BIND_VERTEX_ARRAY_COMMAND, .bind_vertex_array = {1 + i % 7}};
+        *fixed_push(fb) = (VIDEO_COMMAND){.type = VC_BIND_TEXTURE_COMMAND, .bind_texture = {0, GL_TEXTURE_2D, 3, 4, 2}};
+        fixed_uniform(fb, 1, UNIFORM_MATRIX4, m, sizeof(m));
+        fixed_uniform(fb, 2, UNIFORM_INT, &i, sizeof(i));
+        *fixed_push(fb) = (VIDEO_COMMAND){.type = VC_DRAW_ELEMENTS_COMMAND,
+                                          .draw_elements = {GL_TRIANGLES, GL_UNSIGNED_SHORT, 36, i, i * 2}};
+    }
+}
+
+static void
+record_packed(VIDEO_COMMAND_BUFFER *cb, int draws) {
+    clear_command_buffers(1, &cb);
+
+    for (int i = 0; i < draws; i++) {
+        float m[16];
+        for (int k = 0; k < 16; k++)
+            m[k] = (float)i;
+
+        bind_shader_command(cb, 1 + i % 4);
+        bind_vertex_array_command(cb, 1 + i % 7);
+        bind_texture_command(cb, GL_TEXTURE_2D, 0, 3, 4, 2);
+        uniform_command(cb, 1, UNIFORM_MATRIX4, m, 1);
+        uniform_command(cb, 2, UNIFORM_INT, &i, 1);
+        draw_elements_command(cb, GL_TRIANGLES, GL_UNSIGNED_SHORT, 36, i * 2, i);
+    }
+}
+
+// what submit reads of each command, so neither walk can be optimized away
+static uint64_t
+touch_command(const VIDEO_COMMAND *command) {
+    switch (command->type) {
+    case VC_BIND_SHADER_COMMAND:
+        return command->bind_shader.program;
+    case VC_BIND_VERTEX_ARRAY_COMMAND:
+        return command->bind_vertex_array.array;
+    case VC_BIND_TEXTURE_COMMAND:
+        return command->bind_texture.unit + command->bind_texture.texture + command->bind_texture.sampler;
+    case VC_UNIFORM_COMMAND:
+        return command->uniform.location + *(const uint8_t*)command->uniform.data;
+    case VC_DRAW_ELEMENTS_COMMAND:
+        return command->draw_elements.count + command->draw_elements.base_vertex + command->draw_elements.indices_offset;
+    }
+
+    return 0;
+}
+
+static bool
+same_command(const VIDEO_COMMAND *a, const VIDEO_COMMAND *b) {
+    if (a->type != b->type)
+        return false;
+
+    switch (a->type) {
+    case VC_BIND_TEXTURE_COMMAND:
+        return memcmp(&a->bind_texture, &b->bind_texture, sizeof(a->bind_texture)) == 0;
+    case VC_UNIFORM_COMMAND:
+        return a->uniform.location == b->uniform.location && a->uniform.type == b->uniform.type &&
+               a->uniform.size == b->uniform.size && memcmp(a->uniform.data, b->uniform.data, a->uniform.size) == 0;
+    case VC_DRAW_ELEMENTS_COMMAND:
+        return memcmp(&a->draw_elements, &b->draw_elements, sizeof(a->draw_elements)) == 0;
+    }
+
+    return touch_command(a) == touch_command(b);
+}
+
+int
+main(int argc, char *argv[]) {
+    const int draws = argc > 1 ? atoi(argv[1]) : DEFAULT_DRAWS;
+
+    if (draws <= 0) {
+        fprintf(stderr, "usage: %s [draws]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    FIXED_BUFFER fixed = {.arena = new_arena(0)};
+    VIDEO_COMMAND_BUFFER packed = new_command_buffer(NULL);
+
+    double fixed_record = 0.0, packed_record = 0.0, fixed_walk = 0.0, packed_walk = 0.0;
+    uint64_t fixed_sum = 0, packed_sum = 0;
+
+    for (int r = 0; r < ITERATIONS; r++) {
+        Uint64 start = SDL_GetPerformanceCounter();
+        record_fixed(&fixed, draws);
+        fixed_record += elapsed_ms(start);
+
+        start = SDL_GetPerformanceCounter();
+        record_packed(&packed, draws);
+        packed_record += elapsed_ms(start);
+
+        start = SDL_GetPerformanceCounter();
+        for (const FIXED_BLOCK *block = fixed.first_block; block; block = block->next)
+            for (uint32_t i = 0; i < block->count; i++)
+                fixed_sum += touch_command(&block->commands[i]);
+        fixed_walk += elapsed_ms(start);
+
+        start = SDL_GetPerformanceCounter();
+        VIDEO_COMMAND_ITERATOR it = first_command(&packed);
+        VIDEO_COMMAND command;
+        while (next_command(&it, &command))
+            packed_sum += touch_command(&command);
+        packed_walk += elapsed_ms(start);
+    }
+
+    uint32_t decoded = 0, mismatches = 0;
+    const FIXED_BLOCK *block = fixed.first_block;
+    uint32_t index = 0;
+    VIDEO_COMMAND_ITERATOR it = first_command(&packed);
+    VIDEO_COMMAND command;
+
+    while (next_command(&it, &command)) {
+        if (block && index == block->count) {
+            block = block->next;
+            index = 0;
+        }
+
+        mismatches += !block || !same_command(&command, &block->commands[index++]);
+        decoded++;
+    }
+
+    mismatches += decoded != fixed.count || fixed_sum != packed_sum;
+
+    printf("%d draws, %u commands, %d iterations\n", draws, fixed.count, ITERATIONS);
+    printf("%-8s fixed %8.3f ms  packed %8.3f ms  %5.2fx\n", "record", fixed_record / ITERATIONS,
+           packed_record / ITERATIONS, fixed_record / packed_record);
+    printf("%-8s fixed %8.3f ms  packed %8.3f ms  %5.2fx  %u mismatches\n", "walk", fixed_walk / ITERATIONS,
+           packed_walk / ITERATIONS, fixed_walk / packed_walk, mismatches);
+    printf("%-8s fixed %8zu B   packed %8zu B   %5.2fx\n", "memory", fixed.arena.used, packed.arena.used,
+           (double)fixed.arena.used / packed.arena.used);
+
+    free_command_buffer(&packed);
+    free_arena(&fixed.arena);
+
+    return mismatches ? EXIT_FAILURE : EXIT_SUCCESS;
+}
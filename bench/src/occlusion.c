@@ -0,0 +1,170 @@
+/*
+ * Headless check of the occlusion rasterizer: a wall in front of the camera has to hide
+ * what is behind it and nothing else, with and without workers. Then times a scene of
+ * many occluders single threaded against the worker pool. Exits with failure on a wrong
+ * answer
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <SDL2/SDL_timer.h>
+
+#include <video/occlusion.h>
+#include <video/vertex.h>
+
+#define BUFFER_WIDTH 320
+#define BUFFER_HEIGHT 180
+#define DEFAULT_ITERATIONS 100
+#define WALLS_SIDE 32
+
+typedef struct OcclusionCase {
+    const char  *name;
+    AABB        bound;
+    bool        visible;
+} OCCLUSION_CASE;
+
+static const OCCLUSION_CASE cases[] = {
+    {"behind", {{-1.f, -1.f, -11.f}, {1.f, 1.f, -10.f}}, false},
+    {"front", {{-1.f, -1.f, -3.f}, {1.f, 1.f, -2.f}}, true},
+    {"side", {{1.f, -1.f, -11.f}, {3.f, 1.f, -10.f}}, true},
+    {"crossing", {{-1.f, -1.f, -1.f}, {1.f, 1.f, 1.f}}, true},
+    {"partial", {{-1.f, -1.f, -11.f}, {2.5f, 1.f, -10.f}}, true},
+    {"offscreen", {{-1.f, 50.f, -11.f}, {1.f, 52.f, -10.f}}, false},
+};
+
+static matrix4 identity = {{1.f, 0.f, 0.f, 0.f}, {0.f, 1.f, 0.f, 0.f}, {0.f, 0.f, 1.f, 0.f}, {0.f, 0.f, 0.f, 1.f}};
+
+static double
+elapsed_ms(Uint64 start) {
+    return (double)(SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+}
+
+// camera at the origin looking down -z, row vectors like the rest of video
+static void
+projection_matrix(matrix4 out) {
+    const float n = 0.1f, f = 100.f, fy = 1.f / tanf(0.5f);
+    const matrix4 projection = {{fy, 0.f, 0.f, 0.f}, {0.f, fy, 0.f, 0.f}, {0.f, 0.f, (n + f) / (n - f), -1.f},
+                                {0.f, 0.f, 2.f * n * f / (n - f), 0.f}};
+
+    for (int i = 0; i < 4; i++)
+        for (int j = 0; j < 4; j++)
+            out[i][j] = projection[i][j];
+}
+
+static int
+check_wall(int threads) {
+    const float wall[4][3] = {{-1.f, -1.f, -5.f}, {1.f, -1.f, -5.f}, {1.f, 1.f, -5.f}, {-1.f, 1.f, -5.f}};
+    const uint16_t indices[6] = {0, 1, 2, 0, 2, 3};
+    const size_t cases_count = sizeof(cases) / sizeof(cases[0]);
+
+    OCCLUSION_BUFFER *buffer = new_occlusion_buffer(BUFFER_WIDTH, BUFFER_HEIGHT, threads);
+    matrix4 pv;
+    int failures = 0;
+
+    projection_matrix(pv);
+
+    // a few frames, so reused bins and cleared depth are checked too
+    for (int frame = 0; frame < 3; frame++) {
+        occlusion_begin(buffer, pv);
+        occlusion_add_occluder(buffer, wall, sizeof(wall[0]), indices, IF_UI16, 6, identity);
+        occlusion_rasterize(buffer);
+
+        for (size_t i = 0; i < cases_count; i++) {
+            const bool visible = occlusion_test_aabb(buffer, &cases[i].bound, identity);
+
+            if (visible != cases[i].visible) {
+                printf("%u workers, frame %d: %s is %s, expected %s\n", buffer->workers_count, frame, cases[i].name,
+                       visible ? "visible" : "occluded", cases[i].visible ? "visible" : "occluded");
+                failures++;
+            }
+        }
+    }
+
+    printf("wall     %u workers  %u triangles  %u binned  %s\n", buffer->workers_count, buffer->stats.occluder_triangles,
+           buffer->stats.binned_triangles, failures ? "FAILED" : "ok");
+
+    free_occlusion_buffer(buffer);
+
+    return failures;
+}
+
+// a grid of small walls at different depths, most of the screen covered many times over
+static double
+time_walls(int threads, int iterations, uint32_t *workers_count) {
+    float (*vertices)[3] = malloc(sizeof(float[3]) * WALLS_SIDE * WALLS_SIDE * 4);
+    uint32_t *indices = malloc(sizeof(uint32_t) * WALLS_SIDE * WALLS_SIDE * 6);
+
+    if (!vertices || !indices) {
+        fprintf(stderr, "can't alloc walls\n");
+        exit(EXIT_FAILURE);
+    }
+
+    uint32_t v = 0, i = 0;
+    for (int y = 0; y < WALLS_SIDE; y++)
+        for (int x = 0; x < WALLS_SIDE; x++) {
+            const float z = -5.f - (float)((x * 7 + y * 13) % 20);
+            const float size = -z / WALLS_SIDE * 2.f;
+            const float cx = ((float)x / WALLS_SIDE * 2.f - 1.f) * -z * 0.6f;
+            const float cy = ((float)y / WALLS_SIDE * 2.f - 1.f) * -z * 0.4f;
+            const float corners[4][2] = {{-1.f, -1.f}, {1.f, -1.f}, {1.f, 1.f}, {-1.f, 1.f}};
+
+            for (int k = 0; k < 4; k++) {
+                vertices[v + k][0] = cx + corners[k][0] * size;
+                vertices[v + k][1] = cy + corners[k][1] * size;
+                vertices[v + k][2] = z;
+            }
+
+            indices[i++] = v;
+            indices[i++] = v + 1;
+            indices[i++] = v + 2;
+            indices[i++] = v;
+            indices[i++] = v + 2;
+            indices[i++] = v + 3;
+            v += 4;
+        }
+
+    OCCLUSION_BUFFER *buffer = new_occlusion_buffer(BUFFER_WIDTH, BUFFER_HEIGHT, threads);
+    matrix4 pv;
+    double total = 0.0;
+
+    projection_matrix(pv);
+
+    for (int k = 0; k < iterations; k++) {
+        const Uint64 start = SDL_GetPerformanceCounter();
+        occlusion_begin(buffer, pv);
+        occlusion_add_occluder(buffer, vertices, sizeof(vertices[0]), indices, IF_UI32, i, identity);
+        occlusion_rasterize(buffer);
+        total += elapsed_ms(start);
+    }
+
+    *workers_count = buffer->workers_count;
+
+    free_occlusion_buffer(buffer);
+    free(vertices);
+    free(indices);
+
+    return total / iterations;
+}
+
+int
+main(int argc, char *argv[]) {
+    const int iterations = argc > 1 ? atoi(argv[1]) : DEFAULT_ITERATIONS;
+
+    if (iterations <= 0) {
+        fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // -1 rasterizes on the caller only, the fixed count runs the workers even on one core
+    const int failures = check_wall(-1) + check_wall(3);
+
+    // 0 adds a worker per spare core
+    uint32_t single_workers = 0, pool_workers = 0;
+    const double single = time_walls(-1, iterations, &single_workers);
+    const double pool = time_walls(0, iterations, &pool_workers);
+
+    printf("walls    %d triangles  %u workers %8.3f ms  %u workers %8.3f ms  %5.2fx\n", WALLS_SIDE * WALLS_SIDE * 2,
+           single_workers, single, pool_workers, pool, single / pool);
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,203 @@
+/*
+ * Times the vertex kernels against the per-vertex scalar code they replaced
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <SDL2/SDL_timer.h>
+
+#include <video/vertops.h>
+
+#define DEFAULT_ITERATIONS 50
+#define VERTICES_COUNT (1 << 20)
+#define GRID_SIZE 512
+
+static double
+elapsed_ms(Uint64 start) {
+    return (double)(SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+}
+
+static void
+scalar_transform(v3t2n3_t *vertices, size_t count, matrix4 m) {
+    for (size_t i = 0; i < count; i++) {
+        float *p = vertices[i].position;
+        const float x = p[0], y = p[1], z = p[2];
+
+        p[0] = x * m[0][0] + y * m[1][0] + z * m[2][0] + m[3][0];
+        p[1] = x * m[0][1] + y * m[1][1] + z * m[2][1] + m[3][1];
+        p[2] = x * m[0][2] + y * m[1][2] + z * m[2][2] + m[3][2];
+    }
+}
+
+static void
+scalar_bounds(const v3t2n3_t *vertices, size_t count, float3 min, float3 max) {
+    for (int k = 0; k < 3; k++) {
+        min[k] = FLT_MAX;
+        max[k] = -FLT_MAX;
+    }
+
+    for (size_t i = 0; i < count; i++)
+        for (int k = 0; k < 3; k++) {
+            const float v = vertices[i].position[k];
+            min[k] = v < min[k] ? v : min[k];
+            max[k] = v > max[k] ? v : max[k];
+        }
+}
+
+static void
+fill_vertices(v3t2n3_t *vertices, size_t count) {
+    srand(1);
+
+    for (size_t i = 0; i < count; i++) {
+        for (int k = 0; k < 3; k++)
+            vertices[i].position[k] = (float)rand() / RAND_MAX * 200.f - 100.f;
+
+        vertices[i].texcoord[0] = vertices[i].texcoord[1] = 0.f;
+        vertices[i].normal[0] = vertices[i].normal[1] = 0.f;
+        vertices[i].normal[2] = 1.f;
+    }
+}
+
+static float
+max_difference(const v3t2n3_t *a, const v3t2n3_t *b, size_t count) {
+    float diff = 0.f;
+
+    for (size_t i = 0; i < count; i++)
+        for (int k = 0; k < 3; k++)
+            diff = fmaxf(diff, fabsf(a[i].position[k] - b[i].position[k]));
+
+    return diff;
+}
+
+static void
+report(const char *name, double scalar, double kernel, int iterations) {
+    printf("%-10s scalar %8.3f ms  kernel %8.3f ms  %5.2fx\n", name, scalar / iterations, kernel / iterations, scalar / kernel);
+}
+
+static void
+bench_transform_bounds(int iterations) {
+    v3t2n3_t *a = malloc(sizeof(v3t2n3_t) * VERTICES_COUNT);
+    v3t2n3_t *b = malloc(sizeof(v3t2n3_t) * VERTICES_COUNT);
+
+    if (!a || !b) {
+        fprintf(stderr, "can't alloc vertices\n");
+        exit(EXIT_FAILURE);
+    }
+
+    fill_vertices(a, VERTICES_COUNT);
+    memcpy(b, a, sizeof(v3t2n3_t) * VERTICES_COUNT);
+
+    // close to identity so positions stay in range over the iterations
+    matrix4 m = {{0.99f, 0.01f, 0.f, 0.f}, {-0.01f, 0.99f, 0.f, 0.f}, {0.f, 0.f, 1.f, 0.f}, {0.1f, -0.1f, 0.05f, 1.f}};
+
+    double scalar = 0.0, kernel = 0.0;
+
+    for (int i = 0; i < iterations; i++) {
+        Uint64 start = SDL_GetPerformanceCounter();
+        scalar_transform(a, VERTICES_COUNT, m);
+        scalar += elapsed_ms(start);
+
+        start = SDL_GetPerformanceCounter();
+        vertops_transform(b, sizeof(v3t2n3_t), VERTICES_COUNT, m);
+        kernel += elapsed_ms(start);
+    }
+
+    report("transform", scalar, kernel, iterations);
+    printf("           max difference %g\n", max_difference(a, b, VERTICES_COUNT));
+
+    float3 smin, smax, kmin, kmax;
+    scalar = kernel = 0.0;
+
+    for (int i = 0; i < iterations; i++) {
+        Uint64 start = SDL_GetPerformanceCounter();
+        scalar_bounds(a, VERTICES_COUNT, smin, smax);
+        scalar += elapsed_ms(start);
+
+        start = SDL_GetPerformanceCounter();
+        vertops_bounds(a, sizeof(v3t2n3_t), VERTICES_COUNT, kmin, kmax);
+        kernel += elapsed_ms(start);
+    }
+
+    report("bounds", scalar, kernel, iterations);
+
+    for (int k = 0; k < 3; k++)
+        if (smin[k] != kmin[k] || smax[k] != kmax[k])
+            printf("           bounds differ on axis %d\n", k);
+
+    free(a);
+    free(b);
+}
+
+// normals and tangents have no scalar path to compare with, they are timed per vertex
+static void
+bench_normals_tangents(int iterations) {
+    const size_t count = (GRID_SIZE + 1) * (GRID_SIZE + 1);
+    const size_t indices_count = GRID_SIZE * GRID_SIZE * 6;
+
+    v3t2n3t3_t *vertices = malloc(sizeof(v3t2n3t3_t) * count);
+    uint32_t *indices = malloc(sizeof(uint32_t) * indices_count);
+
+    if (!vertices || !indices) {
+        fprintf(stderr, "can't alloc grid\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (size_t y = 0; y <= GRID_SIZE; y++)
+        for (size_t x = 0; x <= GRID_SIZE; x++) {
+            v3t2n3t3_t *v = &vertices[y * (GRID_SIZE + 1) + x];
+            v->position[0] = x;
+            v->position[1] = sinf(x * 0.1f) * cosf(y * 0.1f);
+            v->position[2] = y;
+            v->texcoord[0] = (float)x / GRID_SIZE;
+            v->texcoord[1] = (float)y / GRID_SIZE;
+        }
+
+    uint32_t *i = indices;
+    for (uint32_t y = 0; y < GRID_SIZE; y++)
+        for (uint32_t x = 0; x < GRID_SIZE; x++) {
+            const uint32_t v = y * (GRID_SIZE + 1) + x;
+            *i++ = v;
+            *i++ = v + GRID_SIZE + 1;
+            *i++ = v + 1;
+            *i++ = v + 1;
+            *i++ = v + GRID_SIZE + 1;
+            *i++ = v + GRID_SIZE + 2;
+        }
+
+    double normals = 0.0, tangents = 0.0;
+
+    for (int k = 0; k < iterations; k++) {
+        Uint64 start = SDL_GetPerformanceCounter();
+        vertops_normals(vertices, sizeof(v3t2n3t3_t), offsetof(v3t2n3t3_t, normal), count, indices, IF_UI32, indices_count);
+        normals += elapsed_ms(start);
+
+        start = SDL_GetPerformanceCounter();
+        vertops_tangents(vertices, count, indices, IF_UI32, indices_count);
+        tangents += elapsed_ms(start);
+    }
+
+    printf("%-10s %8.3f ms  %6.2f ns a vertex\n", "normals", normals / iterations, normals * 1e6 / iterations / count);
+    printf("%-10s %8.3f ms  %6.2f ns a vertex\n", "tangents", tangents / iterations, tangents * 1e6 / iterations / count);
+
+    free(vertices);
+    free(indices);
+}
+
+int
+main(int argc, char *argv[]) {
+    const int iterations = argc > 1 ? atoi(argv[1]) : DEFAULT_ITERATIONS;
+
+    if (iterations <= 0) {
+        fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    printf("vertops %s, %d vertices, %d iterations\n", vertops_isa(), VERTICES_COUNT, iterations);
+
+    bench_transform_bounds(iterations);
+    bench_normals_tangents(iterations);
+
+    return EXIT_SUCCESS;
+}
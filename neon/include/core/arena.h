@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stddef.h>
+
+#define ARENA_ALIGN 16
+#define DEFAULT_ARENA_CHUNK_SIZE 65536
+
+struct ArenaChunk;
+
+// bump allocator over a chain of chunks, reset keeps the chunks for reuse
+// chunks skip memtrack, so an arena may grow on whichever thread owns it
+typedef struct Arena {
+    struct ArenaChunk   *first;
+    struct ArenaChunk   *current;
+    size_t              chunk_size;
+
+    size_t              used;       // since last reset
+    size_t              peak;       // high-water mark of used
+    size_t              reserved;   // held in chunks
+} ARENA;
+
+// position to roll back to, for scratch memory that lives shorter than the arena
+typedef struct ArenaMark {
+    struct ArenaChunk   *chunk;
+    size_t              offset;
+    size_t              used;
+} ARENA_MARK;
+
+ARENA new_arena(size_t chunk_size);
+void free_arena(ARENA *arena);
+
+void *arena_alloc(ARENA *arena, size_t size);
+void arena_reset(ARENA *arena);
+
+ARENA_MARK arena_mark(const ARENA *arena);
+void arena_rewind(ARENA *arena, ARENA_MARK mark);
@@ -25,6 +25,7 @@ typedef struct ImageData {
     void            *pixels;
     size_t          size;
     int             mipmaps;
+    int             levels;         // mips stored after each other in pixels, 0 or 1 for the base only
     int             bpp;
 } IMAGE_DATA;
 
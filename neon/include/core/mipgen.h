@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum MipgenFilter {
+    MIPGEN_FILTER_BOX,
+    MIPGEN_FILTER_KAISER        // 6 taps a level, sharper than the box
+};
+
+enum MipgenFlags {
+    MIPGEN_SRGB             = 0x1,  // first three components are sRGB encoded
+    MIPGEN_ALPHA_COVERAGE   = 0x2   // keep the share of alpha over alpha_reference on every level
+};
+
+typedef struct MipgenOptions {
+    int         filter;
+    uint32_t    flags;
+    int         components;         // 1 to 4 bytes a pixel, the 4th is alpha
+    float       alpha_reference;    // alpha test cutoff, 0..1
+    int         threads;            // 0 for one a core
+} MIPGEN_OPTIONS;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+const char* mipgen_isa(void);
+uint32_t mipgen_levels(int width, int height);
+size_t mipgen_chain_size(int width, int height, int components, uint32_t levels);
+
+/*
+ * The whole chain of 8 bit pixels, base first and tightly packed, in a buffer of
+ * mipgen_chain_size. Levels are filtered in linear space from the one above them, rows of
+ * each level are split between threads.
+ */
+uint8_t* generate_mipmaps(const uint8_t *pixels, int width, int height, const MIPGEN_OPTIONS *options);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdint.h>
+#include <SDL2/SDL_rwops.h>
+
+#include "core/image.h"
+
+/*
+ * Cooked textures: the header, then every level from the base down, tightly packed. The smallest
+ * levels are one read at the end of the file, streaming starts with them.
+ */
+#define TEXFILE_MAGIC (('P' << 24) + ('I' << 16) + ('M' << 8) + 'T')
+#define TEXFILE_VERSION 0x0100
+#define TEXFILE_MAX_LEVELS 16
+
+#define TEXFILE_FLAG_SRGB 0x0001
+
+#pragma pack(push, texfile_header_align)
+#pragma pack(1)
+typedef struct TexfileHeader {
+    uint32_t    magic;
+    uint32_t    version;
+    uint32_t    width;
+    uint32_t    height;
+    uint32_t    levels;
+    uint32_t    internalformat;
+    uint32_t    format;
+    uint32_t    type;
+    uint32_t    flags;
+    uint32_t    level_sizes[TEXFILE_MAX_LEVELS];
+} TEXFILE_HEADER;
+#pragma pack(pop, texfile_header_align)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int read_texfile_header(SDL_RWops *rw, TEXFILE_HEADER *header);
+// levels from first to the smallest into one image, rw stays open
+int read_texfile_levels(SDL_RWops *rw, const TEXFILE_HEADER *header, uint32_t first, IMAGE_DATA *image);
+// the whole chain, texture reader of .tmip
+int load_texfile(SDL_RWops *rw, IMAGE_DATA *image);
+
+#ifdef __cplusplus
+}
+#endif
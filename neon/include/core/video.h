@@ -1,8 +1,11 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+#define VIDEO_FRAMES_IN_FLIGHT 2
+
 typedef struct Screen {
     int     width;
     int     height;
@@ -11,6 +14,8 @@ typedef struct Screen {
     bool    fullscreen;
     int     msaa;
     bool    srgb_capable;
+    bool    render_thread;  // set before video_init, see video_submit_passes
+    bool    upload_thread;  // set before video_init, see video/uploader.h
 } SCREEN;
 
 typedef struct VideoMode {
@@ -52,5 +57,27 @@ void video_show_cursor(bool show);
 void video_apply_changes(void);
 void video_set_title(const char *title);
 
+struct VideoCommandPass;
+struct VideoCommandBuffer;
+
+/*
+ * With screen.render_thread the GL context lives on a render thread that submits and swaps
+ * frame N while the main thread records frame N + 1. Submits are queued until video_swap_buffers,
+ * so buffers and passes of a frame must stay untouched until its fence is done: keep
+ * VIDEO_FRAMES_IN_FLIGHT sets and record into the one of video_frame_slot. GL calls from the main
+ * thread go between video_lock_context and video_unlock_context, on_init and on_cleanup already do.
+ * Without the render thread these submit right away and the lock does nothing.
+ */
+void video_submit_passes(size_t count, struct VideoCommandPass **passes);
+void video_submit_buffers(size_t count, struct VideoCommandBuffer **buffers);
+
+uint32_t video_frame_slot(void);
+uint32_t video_frame_fence(void);   // of the frame being recorded
+bool video_frame_done(uint32_t fence);
+void video_wait_frame(uint32_t fence);
+
+void video_lock_context(void);
+void video_unlock_context(void);
+
 extern SCREEN           screen;
 extern VIDEO_INFO       video;
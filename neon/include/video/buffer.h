@@ -57,6 +57,7 @@ VIDEO_BUFFER new_index_buffer(const void *indices, size_t size, unsigned int usa
 
 #ifndef GL_ES_VERSION_2_0
 VIDEO_BUFFER new_texture_buffer(const void *data, size_t size, unsigned int usage);
+VIDEO_BUFFER new_pixel_buffer(const void *pixels, size_t size, unsigned int usage);
 #endif
 
 void free_video_buffer(VIDEO_BUFFER *buffer);
@@ -0,0 +1,56 @@
+/*
+ * Dynamic AABB tree for ray, overlap and frustum queries
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "base/math_ext.h"
+#include "base/intersection.h"
+#include "video/culling.h"
+
+#define BVH_NULL_NODE (-1)
+#define BVH_STACK_SIZE 128
+#define BVH_DEFAULT_MARGIN 0.1f
+
+typedef struct BvhNode {
+    AABB        bound;      // fattened by margin for leaves
+    union {
+        int32_t parent;
+        int32_t next;       // free list link
+    };
+    int32_t     left;
+    int32_t     right;
+    int32_t     height;     // leaf 0, free -1
+    uint32_t    user;
+} BVH_NODE;
+
+typedef struct VideoBvh {
+    BVH_NODE    *nodes;
+    int32_t     root;
+    int32_t     free_list;
+    uint32_t    count;
+    uint32_t    capacity;
+    uint32_t    leaves;
+    float       margin;
+} VIDEO_BVH;
+
+VIDEO_BVH new_bvh(uint32_t capacity, float margin);
+void free_bvh(VIDEO_BVH *bvh);
+
+int32_t bvh_insert(VIDEO_BVH *bvh, const AABB *bound, uint32_t user);
+void bvh_remove(VIDEO_BVH *bvh, int32_t proxy);
+// returns true when the leaf left its fat bound and was reinserted
+bool bvh_move(VIDEO_BVH *bvh, int32_t proxy, const AABB *bound);
+// recomputes internal bounds bottom-up after leaves were changed in place
+void bvh_refit(VIDEO_BVH *bvh);
+
+uint32_t bvh_get_user(const VIDEO_BVH *bvh, int32_t proxy);
+int32_t bvh_height(const VIDEO_BVH *bvh);
+
+// queries write user values and return how many were found, at most max_count
+uint32_t bvh_query_aabb(const VIDEO_BVH *bvh, const AABB *bound, uint32_t *users, uint32_t max_count);
+uint32_t bvh_query_frustum(const VIDEO_BVH *bvh, const VIDEO_FRUSTUM *frustum, uint32_t *users, uint32_t max_count);
+// nearest leaf bound hit by origin + t * dir, t in [0, max_t]
+bool bvh_raycast(const VIDEO_BVH *bvh, const float3 origin, const float3 dir, float max_t, uint32_t *user, float *t);
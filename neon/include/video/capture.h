@@ -0,0 +1,75 @@
+/*
+ * Command stream capture and replay
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "video/commandbuffer.h"
+
+#define VIDEO_CAPTURE_MAGIC 0x5041434e // NCAP
+#define VIDEO_CAPTURE_VERSION 2
+
+enum VideoCaptureRecord {
+    CAPTURE_PROGRAM,
+    CAPTURE_TEXTURE,
+    CAPTURE_SAMPLER,
+    CAPTURE_BUFFER,
+    CAPTURE_VERTEX_ARRAY,
+    CAPTURE_RENDERBUFFER,
+    CAPTURE_FRAMEBUFFER,
+    CAPTURE_OBJECT_TYPES,
+
+    CAPTURE_GROUP = CAPTURE_OBJECT_TYPES
+};
+
+typedef struct VideoCaptureRemap {
+    uint32_t    captured;
+    uint32_t    id;
+} VIDEO_CAPTURE_REMAP;
+
+typedef struct VideoCaptureLocation {
+    uint32_t    program;    // captured name
+    int         captured;
+    int         location;
+} VIDEO_CAPTURE_LOCATION;
+
+// one submit call, a merged group was submitted as a pass
+typedef struct VideoCaptureGroup {
+    bool                merged;
+    VIDEO_COMMAND_PASS  pass;
+} VIDEO_CAPTURE_GROUP;
+
+typedef struct VideoCapture {
+    int32_t                 width;
+    int32_t                 height;
+
+    VIDEO_CAPTURE_GROUP     *groups;
+    uint32_t                groups_count;
+
+    VIDEO_COMMAND_BUNDLE    **bundles;      // one per splice, referenced from the groups
+    uint32_t                bundles_count;
+
+    // captured object names and the objects recreated for them
+    VIDEO_CAPTURE_REMAP     *objects[CAPTURE_OBJECT_TYPES];
+    uint32_t                objects_count[CAPTURE_OBJECT_TYPES];
+
+    VIDEO_CAPTURE_LOCATION  *locations;
+    uint32_t                locations_count;
+} VIDEO_CAPTURE;
+
+// records every submit until the next video_swap_buffers, together with a snapshot
+// of the programs, textures, samplers, buffers, vertex arrays and framebuffers they use
+void capture_frame(const char *filename);
+bool capture_active(void);
+void capture_frame_end(void);
+
+void capture_submit_buffers(size_t count, VIDEO_COMMAND_BUFFER **buffers);
+void capture_submit_passes(size_t count, VIDEO_COMMAND_PASS **passes);
+
+// needs a current GL context, recreates the objects and rebuilds the command buffers
+bool load_capture(VIDEO_CAPTURE *capture, const char *filename);
+void free_capture(VIDEO_CAPTURE *capture);
+int replay_capture_group(VIDEO_CAPTURE *capture, uint32_t group);
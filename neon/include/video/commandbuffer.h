@@ -1,11 +1,17 @@
 #pragma once
 
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <sys/types.h>
 
+#include "core/arena.h"
 #include "video/state.h"
 
-#define MAX_COMMANDS 512
+#define VIDEO_COMMAND_BLOCK_BYTES 4096
+#define VIDEO_PACKET_MAX_TEXTURES 8
+#define VIDEO_PACKET_MAX_UNIFORMS 32
+#define VIDEO_SORT_LAYERS 256
 
 enum UniformType {
     UNIFORM_INT,
@@ -15,6 +21,7 @@ enum UniformType {
     UNIFORM_FLOAT4,
     UNIFORM_MATRIX3,
     UNIFORM_MATRIX4,
+    UNIFORM_BLOCK,      // std140 contents, count in vec4s, location is the binding point
 };
 
 enum VideoCommandType {
@@ -33,14 +40,29 @@ enum VideoCommandType {
     VC_BIND_TEXTURE_COMMAND,
     VC_BIND_VERTEX_ARRAY_COMMAND,
 
-    VC_UNIFORM_COMMAND
+    VC_UNIFORM_COMMAND,
+
+    VC_DRAW_PACKET_COMMAND,
+
+    VC_UNIFORM_REFERENCE_COMMAND,   // values are read from the caller's memory on submit
+    VC_BUNDLE_COMMAND
 };
 
 // TODO: set flags for seperate state usage
 enum VideoCommandBufferFlags {
-    VCB_NO_STATES_BIT = 0x0001
+    VCB_NO_STATES_BIT = 0x0001,
+    VCB_SORTED_BIT    = 0x0002, // draws become packets sorted between other commands
+    VCB_BUNDLE_BIT    = 0x0004  // baked, packets are already in order
 };
 
+enum VideoDepthOrder {
+    DEPTH_ORDER_FRONT_TO_BACK,
+    DEPTH_ORDER_BACK_TO_FRONT
+};
+
+struct VideoDrawPacket;
+struct VideoCommandBundle;
+
 typedef struct VideoCommand {
     int type;
     union {
@@ -112,12 +134,74 @@ typedef struct VideoCommand {
             int location;
             uint32_t type;
             uint32_t size;
-            uint32_t offset;
             uint32_t count;
+            const void *data;
         } uniform;
+
+        struct {
+            uint64_t key;
+            const struct VideoDrawPacket *packet;
+        } draw_packet;
+
+        struct {
+            struct VideoCommandBundle *bundle;
+        } bundle;
     };
 } VIDEO_COMMAND;
 
+// everything one sorted draw needs, state is applied explicitly on submit
+typedef struct VideoDrawPacket {
+    uint32_t            program;
+    uint32_t            vertex_array;
+    uint32_t            textures_count;
+    uint32_t            uniforms_count;
+    const VIDEO_COMMAND *textures;
+    const VIDEO_COMMAND *uniforms;  // latest value per location since the shader bind
+    VIDEO_COMMAND       draw;
+} VIDEO_DRAW_PACKET;
+
+/*
+ * sort key, high to low bits
+ * opaque:      layer 8 | 0 | shader 10 | texture 12 | vertex array 9 | depth 24
+ * translucent: layer 8 | 1 | depth 24 (back to front) | shader 10 | texture 12 | vertex array 9
+ */
+typedef struct VideoSortState {
+    uint8_t             layer;
+    bool                translucent;
+    float               depth;      // 0 near .. 1 far
+
+    uint32_t            program;
+    uint32_t            vertex_array;
+    VIDEO_COMMAND       textures[VIDEO_PACKET_MAX_TEXTURES];
+    uint32_t            textures_count;
+    VIDEO_COMMAND       uniforms[VIDEO_PACKET_MAX_UNIFORMS];
+    uint32_t            uniforms_count;
+
+    // shared by packets until textures or uniforms change
+    const VIDEO_COMMAND *textures_snapshot;
+    const VIDEO_COMMAND *uniforms_snapshot;
+    const VIDEO_DRAW_PACKET *last_copy;    // last packet appended by copy_command
+
+    uint32_t            back_to_front[VIDEO_SORT_LAYERS / 32];
+} VIDEO_SORT_STATE;
+
+/*
+ * Recorded commands are packed into blocks as an opcode byte followed by the fields the command
+ * uses, uniform values are stored inline after their command. A command never spans blocks,
+ * VIDEO_COMMAND is only the decoded form.
+ */
+typedef struct VideoCommandBlock {
+    struct VideoCommandBlock    *next;
+    uint32_t                    size;       // bytes used
+    uint32_t                    capacity;
+    uint8_t                     data[];
+} VIDEO_COMMAND_BLOCK;
+
+typedef struct VideoCommandIterator {
+    const VIDEO_COMMAND_BLOCK   *block;
+    uint32_t                    offset;
+} VIDEO_COMMAND_ITERATOR;
+
 typedef struct VideoCommandBuffer {
     int                 target; // framenuffer
     int                 result; // framenuffer
@@ -127,8 +211,11 @@ typedef struct VideoCommandBuffer {
     uint32_t                id;
     uint32_t                flags;
 
-    VIDEO_COMMAND       commands[MAX_COMMANDS]; // TODO: make dynamic
-    int                 commands_count;
+    // blocks are allocated from the arena and dropped with it on clear
+    VIDEO_COMMAND_BLOCK *first_block;
+    VIDEO_COMMAND_BLOCK *last_block;
+    uint32_t            commands_count;
+    uint32_t            commands_peak;
 
     size_t              shader_bindings;
     size_t              texture_bindings;
@@ -137,23 +224,65 @@ typedef struct VideoCommandBuffer {
     RASTERIZER_STATE    rasterizer;
     DEPTH_STENCIL_STATE depth;
 
-    // for unifroms
-    void                *memory;
-    size_t              memory_size;
-    size_t              memory_offset;
+    // recorder state for VCB_SORTED_BIT
+    VIDEO_SORT_STATE    sort;
+
+    // commands and unifroms
+    ARENA               arena;
 } VIDEO_COMMAND_BUFFER;
 
+// commands recorded once and spliced into frames, see bake_command_bundle
+typedef struct VideoCommandBundle {
+    VIDEO_COMMAND_BUFFER    commands;
+} VIDEO_COMMAND_BUNDLE;
+
 typedef struct VideoCommandBufferInfo {
-    size_t memory_cache_size;
+    size_t memory_cache_size; // arena chunk size
 } VIDEO_COMMAND_BUFFER_INFO;
 
+/*
+ * Parallel recording: a pass owns one buffer per worker. Recording into a buffer only touches
+ * that buffer, its arena grows with the plain allocator and not through memtrack, so workers
+ * may record concurrently as long as no two threads share a buffer.
+ * Buffers are submitted in index order, sorted passes are sorted across all buffers,
+ * so the result depends on how the work was split and not on thread timing.
+ */
+typedef struct VideoCommandPass {
+    // copied into every buffer by begin_command_pass
+    uint32_t                flags;
+    unsigned int            mask;
+    float                   color[4]; // rgba
+    COLOR_BLEND_STATE       blend;
+    RASTERIZER_STATE        rasterizer;
+    DEPTH_STENCIL_STATE     depth;
+
+    uint32_t                buffers_count;
+    VIDEO_COMMAND_BUFFER    *buffers;
+} VIDEO_COMMAND_PASS;
+
 unsigned int get_gl_uniform_type(unsigned int type);
+// bytes a value of the type takes, 0 for unknown types
+size_t uniform_size(unsigned int type);
+// to the current program, skipped when it already has the values
+void set_uniform(int location, uint32_t type, const void *data, uint32_t count);
 
 VIDEO_COMMAND_BUFFER new_command_buffer(const VIDEO_COMMAND_BUFFER_INFO *info);
 void free_command_buffer(VIDEO_COMMAND_BUFFER *buffer);
 
 void clear_command_buffers(size_t count, VIDEO_COMMAND_BUFFER **buffers);
+// submit sorts in a scratch arena of its own, made on the first submit
 int submit_command_buffers(size_t count, VIDEO_COMMAND_BUFFER **buffers);
+// after the render thread stopped
+void command_buffers_cleanup(void);
+
+VIDEO_COMMAND_PASS new_command_pass(const VIDEO_COMMAND_BUFFER_INFO *info, uint32_t workers);
+void free_command_pass(VIDEO_COMMAND_PASS *pass);
+
+// main thread, before workers start recording
+void begin_command_pass(VIDEO_COMMAND_PASS *pass);
+VIDEO_COMMAND_BUFFER *pass_command_buffer(VIDEO_COMMAND_PASS *pass, uint32_t worker);
+// main thread, after all workers finished recording
+int submit_command_passes(size_t count, VIDEO_COMMAND_PASS **passes);
 
 void clear_command(VIDEO_COMMAND_BUFFER *cb);
 void viewport_command(VIDEO_COMMAND_BUFFER *cb, int viewport[4]);
@@ -171,3 +300,29 @@ void bind_texture_command(VIDEO_COMMAND_BUFFER *cb, uint32_t target, uint32_t un
 void bind_vertex_array_command(VIDEO_COMMAND_BUFFER *cb, uint32_t va);
 
 void uniform_command(VIDEO_COMMAND_BUFFER *cb, int location, uint32_t type, const void *ptr, uint32_t count);
+// ptr must stay valid and is read on every submit, for values that change under a bundle
+void uniform_reference_command(VIDEO_COMMAND_BUFFER *cb, int location, uint32_t type, const void *ptr, uint32_t count);
+// size is a multiple of 16, streamed through the uniform ring on submit and bound at binding
+void uniform_block_command(VIDEO_COMMAND_BUFFER *cb, int binding, const void *ptr, size_t size);
+// once for every draw that follows, a barrier in sorted buffers
+void frame_uniform_block_command(VIDEO_COMMAND_BUFFER *cb, int binding, const void *ptr, size_t size);
+
+// appends a recorded command as is, uniform data and draw packets are copied into the buffer
+void copy_command(VIDEO_COMMAND_BUFFER *cb, const VIDEO_COMMAND *command);
+
+// walks the recorded stream in order, uniform data of the decoded command points into the buffer
+VIDEO_COMMAND_ITERATOR first_command(const VIDEO_COMMAND_BUFFER *cb);
+bool next_command(VIDEO_COMMAND_ITERATOR *it, VIDEO_COMMAND *command);
+
+/*
+ * Copies a recorded buffer into a bundle that is never changed again. Packets of a sorted buffer
+ * are sorted once here, submit dispatches bundles as they are. Bundles may be spliced into any
+ * number of buffers and must outlive their submits.
+ */
+VIDEO_COMMAND_BUNDLE bake_command_bundle(const VIDEO_COMMAND_BUFFER *recorded);
+void free_command_bundle(VIDEO_COMMAND_BUNDLE *bundle);
+void bundle_command(VIDEO_COMMAND_BUFFER *cb, VIDEO_COMMAND_BUNDLE *bundle);
+
+// sorted buffers only, applies to the following draws
+void draw_sort_params(VIDEO_COMMAND_BUFFER *cb, uint8_t layer, bool translucent, float depth);
+void layer_depth_order(VIDEO_COMMAND_BUFFER *cb, uint8_t layer, uint32_t order);
@@ -0,0 +1,54 @@
+/*
+ * Frustum culling of world-space bounds
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "base/math_ext.h"
+#include "base/intersection.h"
+#include "video/vertices.h"
+#include "video/commandbuffer.h"
+
+#define CULLING_SET_BATCH 8
+
+enum FrustumPlanes {
+    FRUSTUM_LEFT,
+    FRUSTUM_RIGHT,
+    FRUSTUM_BOTTOM,
+    FRUSTUM_TOP,
+    FRUSTUM_NEAR,
+    FRUSTUM_FAR,
+    FRUSTUM_PLANES_NUM
+};
+
+typedef struct VideoFrustum {
+    float4      planes[FRUSTUM_PLANES_NUM]; // ax + by + cz + d >= 0 is inside
+} VIDEO_FRUSTUM;
+
+// bounds stored as structure of arrays, padded to CULLING_SET_BATCH
+typedef struct CullingSet {
+    float       *min_x, *min_y, *min_z;
+    float       *max_x, *max_y, *max_z;
+    uint32_t    *user;
+
+    uint32_t    count;
+    uint32_t    capacity;
+} CULLING_SET;
+
+CULLING_SET new_culling_set(uint32_t capacity);
+void free_culling_set(CULLING_SET *set);
+void culling_set_clear(CULLING_SET *set);
+
+uint32_t culling_set_add(CULLING_SET *set, const AABB *bound, matrix4 transform, uint32_t user);
+void culling_set_update(CULLING_SET *set, uint32_t index, const AABB *bound, matrix4 transform);
+void culling_set_add_objects(CULLING_SET *set, const VIDEO_VERTICES_INFO *info, matrix4 transform);
+
+void frustum_from_matrix(VIDEO_FRUSTUM *frustum, matrix4 projection_view);
+
+// writes user values of visible bounds, returns visible count
+uint32_t cull_frustum(const CULLING_SET *set, const VIDEO_FRUSTUM *frustum, uint32_t *visible);
+
+// lods holds a level per listed object, see select_lod, or NULL for full detail
+void draw_objects_command(VIDEO_COMMAND_BUFFER *cb, const VIDEO_VERTICES_INFO *info, const uint32_t *objects, const uint32_t *lods, uint32_t count);
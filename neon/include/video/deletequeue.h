@@ -0,0 +1,36 @@
+/*
+ * GL objects deleted once the GPU is done with them
+ */
+#pragma once
+
+#include <stdint.h>
+
+#define DELETE_QUEUE_BUDGET     64  // GL objects deleted at the end of a frame, the rest waits
+#define DELETE_QUEUE_LATENCY    3   // frames an object waits without fences
+
+enum VideoObjectType {
+    VIDEO_OBJECT_TEXTURE,
+    VIDEO_OBJECT_SAMPLER,
+    VIDEO_OBJECT_RENDERBUFFER,
+    VIDEO_OBJECT_FRAMEBUFFER,
+    VIDEO_OBJECT_BUFFER,
+    VIDEO_OBJECT_VERTEX_ARRAY,
+    VIDEO_OBJECT_PROGRAM,
+    VIDEO_OBJECT_SHADER,
+    VIDEO_OBJECT_TYPES
+};
+
+/*
+ * free_* functions queue their GL names tagged with video_frame_fence, the frame being recorded,
+ * as its commands may still use them. The end of that frame on the GL thread puts a fence after
+ * it, and once the fence passed its names are deleted, at most DELETE_QUEUE_BUDGET a frame, so
+ * freeing a level does not stall the driver nor spike a frame. Names are counted from creation
+ * to deletion, delete_queue_cleanup reports the ones never freed.
+ */
+void track_video_object(uint32_t type);
+void delete_video_object(uint32_t type, uint32_t id);
+
+// once per frame after its last draw, by video_swap_buffers
+void delete_queue_next_frame(void);
+// deletes everything queued, then reports leaks, last of video_cleanup
+void delete_queue_cleanup(void);
@@ -0,0 +1,39 @@
+/*
+ * Shared vertex and index heaps for static meshes
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "video/buffer.h"
+
+#define GEOMETRY_HEAP_VERTICES  65536           // initial vertices of a format heap, doubled when full
+#define GEOMETRY_HEAP_INDICES   (1024 * 1024)   // initial bytes of the index heap
+#define GEOMETRY_INDEX_ALIGN    4
+
+/*
+ * Meshes uploaded with VERTICES_DESC.shared get a range of the vertex buffer of their format and a
+ * range of the one index buffer. Every format has one vertex array, so draws of shared meshes with
+ * the same format bind it once. Heaps grow by copying into a bigger buffer, ranges keep their
+ * offsets. geometry_defragment packs live ranges to the start of new buffers and changes offsets:
+ * record draws after it, command buffers and bundles recorded before it draw the old layout.
+ */
+
+// where a shared mesh lives, add to the object base_vertex and ib_offset
+typedef struct GeometryPlacement {
+    uint32_t    base_vertex;
+    uint32_t    ib_offset;
+} GEOMETRY_PLACEMENT;
+
+// returns the allocation, vertices and indices are copied into the heaps
+uint32_t geometry_alloc(uint32_t vf, const void *vertices, uint32_t vertices_count, const void *indices, size_t indices_size);
+void geometry_free(uint32_t geometry);
+
+GEOMETRY_PLACEMENT geometry_placement(uint32_t geometry);
+VERTEX_ARRAY *geometry_vertex_array(uint32_t vf);
+
+// between frames on the GL thread, returns true when ranges moved
+bool geometry_defragment(void);
+void geometry_cleanup(void);
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <core/logerr.h>
+#include <video/commandbuffer.h>
+#include <video/state.h>
 
 /*#define gfx_texture(tex) (all_resources.textures[tex])
 #define gfx_sampler(sam) (all_resources.samplers[sam])
@@ -9,35 +11,36 @@
 #define gfx_uniformbuffer(ub) (all_resources.uniformbuffers[ub])
 #define gfx_shader(shd) (all_resources.shaders[shd])*/
 
-#define gfx_uniform1f(shader, name, x) glUniform1f(shader_get_uniform(shader, name), x)
-#define gfx_uniform1fv(shader, name, ptr, count) glUniform1fv(shader_get_uniform(shader, name), count, ptr)
-#define gfx_uniform2f(shader, name, x, y) glUniform2f(shader_get_uniform(shader, name), x, y)
-#define gfx_uniform3f(shader, name, x, y, z) glUniform3f(shader_get_uniform(shader, name), x, y, z)
-#define gfx_uniform4f(shader, name, x, y, z, w) glUniform4f(shader_get_uniform(shader, name), x, y, z, w)
-#define gfx_uniform4fv(shader, name, ptr, count) glUniform4fv(shader_get_uniform(shader, name), count, ptr)
-#define gfx_uniform1i(shader, name, x) glUniform1i(shader_get_uniform(shader, name), x)
-#define gfx_uniform_matrix4f(shader, name, m) glUniformMatrix4fv(shader_get_uniform(shader, name), 1, GL_FALSE, m)
+// the shader must be current, values it already has are not sent again
+#define gfx_uniform1f(shader, name, x) set_uniform(shader_get_uniform(shader, name), UNIFORM_FLOAT, (const float[]){x}, 1)
+#define gfx_uniform1fv(shader, name, ptr, count) set_uniform(shader_get_uniform(shader, name), UNIFORM_FLOAT, ptr, count)
+#define gfx_uniform2f(shader, name, x, y) set_uniform(shader_get_uniform(shader, name), UNIFORM_FLOAT2, (const float[]){x, y}, 1)
+#define gfx_uniform3f(shader, name, x, y, z) set_uniform(shader_get_uniform(shader, name), UNIFORM_FLOAT3, (const float[]){x, y, z}, 1)
+#define gfx_uniform4f(shader, name, x, y, z, w) set_uniform(shader_get_uniform(shader, name), UNIFORM_FLOAT4, (const float[]){x, y, z, w}, 1)
+#define gfx_uniform4fv(shader, name, ptr, count) set_uniform(shader_get_uniform(shader, name), UNIFORM_FLOAT4, ptr, count)
+#define gfx_uniform1i(shader, name, x) set_uniform(shader_get_uniform(shader, name), UNIFORM_INT, (const int[]){x}, 1)
+#define gfx_uniform_matrix4f(shader, name, m) set_uniform(shader_get_uniform(shader, name), UNIFORM_MATRIX4, m, 1)
 #define gfx_uniform_location(shader, name) shader_get_uniform(shader, name)
 #define gfx_uniform_buffer_connect(point, shader, buffer, name) uniform_buffer_connect(point, shader, buffer, name)
 #define gfx_uniform_buffer_map(buffer, access) uniform_buffer_map(buffer, access)
-#define gfx_use_shader(shader) glUseProgram((shader)->pid)
+#define gfx_use_shader(shader) state_use_program((shader)->pid)
 #define gfx_framebuffer_width(fb) ((fb)->width)
 #define gfx_framebuffer_height(fb) ((fb)->height)
 #define gfx_use_framebuffer(framebuffer) do {\
-    glBindFramebuffer(GL_FRAMEBUFFER, (framebuffer)->id); \
-    glViewport(0, 0, (framebuffer)->width, (framebuffer)->height); \
-    if (screen.srgb_capable) (framebuffer)->id == 0 ? glDisable(GL_FRAMEBUFFER_SRGB) : glEnable(GL_FRAMEBUFFER_SRGB); \
+    state_bind_framebuffer((framebuffer)->id); \
+    state_viewport(0, 0, (framebuffer)->width, (framebuffer)->height); \
+    if (screen.srgb_capable) state_enable(GL_FRAMEBUFFER_SRGB, (framebuffer)->id != 0); \
     } while(0)
 
 #define gfx_draw_elements(va, primitive, count) do { \
-    glBindVertexArray(va); \
+    state_bind_vertex_array(va); \
     glDrawElements(primitive, count, GL_UNSIGNED_SHORT, 0); \
-    glBindVertexArray(0); \
+    state_bind_vertex_array(0); \
     } while(0)
 #define gfx_draw_arrays(va, primitive, count) do { \
-    glBindVertexArray(va); \
+    state_bind_vertex_array(va); \
     glDrawArrays(primitive, 0, count); \
-    glBindVertexArray(0); \
+    state_bind_vertex_array(0); \
     } while(0)
 
 #define gfx_bind_texture(unit, texture) bind_texture(unit, texture)
@@ -81,10 +84,10 @@
     } while(0)
 
 #define gfx_bind_vertex_array_command(cb, va) \
-    bind_vertex_array_command(&(cb), all_resources.arrays[va].id)
+    bind_vertex_array_command(&(cb), get_vertex_array(va)->id)
 
 #define gfx_draw_elements_command(cb, va, count, offset, base_vertex) \
-    draw_elements_command(&(cb), all_resources.arrays[va].mode, all_resources.arrays[va].type, count, offset, base_vertex);
+    draw_elements_command(&(cb), get_vertex_array(va)->mode, get_vertex_array(va)->type, count, offset, base_vertex);
 
 #define gfx_draw_command(cb, msh) \
     bind_vertex_array(&(cb), gfx_mesh(msh).vertex_array); \
@@ -0,0 +1,62 @@
+/*
+ * Automatic instancing of sorted draws
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "video/shader.h"
+
+/*
+ * Per instance uniforms are recorded with uniform_command at INSTANCE_LOCATION(offset), the offset
+ * is in vec4 texels. Sorted packets of an instanced shader that share vertex array, draw, textures
+ * and every other uniform become one instanced draw, their instance uniforms are packed into a
+ * texture buffer and read back in the shader with the INSTANCE_* macros below.
+ * Instanced shaders read their instance data from the buffer only, draw them from sorted buffers.
+ */
+#define INSTANCE_LOCATION_BASE      0x10000
+#define INSTANCE_LOCATION(offset)   (INSTANCE_LOCATION_BASE + (offset))
+#define IS_INSTANCE_LOCATION(l)     ((l) >= INSTANCE_LOCATION_BASE)
+
+#define INSTANCE_TEXTURE_UNIT       15
+#define INSTANCE_BUFFER_TEXELS      65536 // GL_MAX_TEXTURE_BUFFER_SIZE minimum
+
+// pass as definitions to upload_shader_ext, ints and floats are stored in .x, matrices by columns
+#define INSTANCE_SHADER_DEFINITIONS \
+    "#define NEON_INSTANCING 1\n" \
+    "uniform samplerBuffer neon_instance_data;\n" \
+    "uniform int neon_instance_base;\n" \
+    "uniform int neon_instance_stride;\n" \
+    "#define INSTANCE_TEXEL(offset) texelFetch(neon_instance_data, neon_instance_base + gl_InstanceID * neon_instance_stride + (offset))\n" \
+    "#define INSTANCE_INT(offset) int(INSTANCE_TEXEL(offset).x)\n" \
+    "#define INSTANCE_FLOAT(offset) INSTANCE_TEXEL(offset).x\n" \
+    "#define INSTANCE_VEC2(offset) INSTANCE_TEXEL(offset).xy\n" \
+    "#define INSTANCE_VEC3(offset) INSTANCE_TEXEL(offset).xyz\n" \
+    "#define INSTANCE_VEC4(offset) INSTANCE_TEXEL(offset)\n" \
+    "#define INSTANCE_MAT3(offset) mat3(INSTANCE_VEC3(offset), INSTANCE_VEC3((offset) + 1), INSTANCE_VEC3((offset) + 2))\n" \
+    "#define INSTANCE_MAT4(offset) mat4(INSTANCE_VEC4(offset), INSTANCE_VEC4((offset) + 1), INSTANCE_VEC4((offset) + 2), INSTANCE_VEC4((offset) + 3))\n"
+
+typedef struct InstancedProgram {
+    uint32_t    program;
+    int         data_location;
+    int         base_location;
+    int         stride_location;
+} INSTANCED_PROGRAM;
+
+// after the shader is built or rebuilt
+void instanced_shader(const SHADER *shader);
+void instanced_program(uint32_t program);
+void forget_instanced_program(uint32_t program);
+const INSTANCED_PROGRAM *find_instanced_program(uint32_t program);
+
+uint32_t instance_uniform_texels(uint32_t type);
+
+// space for texels in the current frame buffer, returns the first texel
+float *begin_instances(uint32_t texels, uint32_t *base);
+void end_instances(uint32_t base, uint32_t texels);
+void bind_instances(const INSTANCED_PROGRAM *instanced, uint32_t base, uint32_t stride);
+
+// start of a submit, earlier instance data stays with the draws that used it
+void reset_instances(void);
+void instancing_cleanup(void);
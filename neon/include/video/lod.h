@@ -0,0 +1,31 @@
+/*
+ * Mesh simplification and level of detail selection
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "base/math_ext.h"
+#include "video/vertices.h"
+
+#define VIDEO_LOD_RATIO 0.5f
+#define VIDEO_LOD_SCREEN_SIZE 256.f // projected diameter in pixels where LOD 1 starts
+#define VIDEO_LOD_HYSTERESIS 0.15f
+
+// quadric error edge collapse onto existing vertices, identical vertices are welded first,
+// uv and normal seams and borders stay locked
+// returns the new index count, error is relative to the mesh extent
+size_t simplify_mesh(uint32_t *destination, const uint32_t *indices, size_t indices_count,
+                     const void *vertices, size_t stride, size_t vertices_count,
+                     size_t target_count, float *error);
+
+// fills levels 1.. of the object, level 0 is the original index range
+uint32_t generate_lods(const VERTICES_DATA *data, uint32_t vf, uint32_t ef, uint32_t levels,
+                       void *lod_indices[], uint32_t lod_counts[], float lod_errors[]);
+
+// viewport height / (2 * tan(fovy / 2)), fovy in degrees
+float lod_pixel_scale(float fovy, int viewport_height);
+
+uint32_t select_lod(const struct VerticesObjectInfo *object, matrix4 transform, const float3 eye,
+                    float pixel_scale, uint32_t current);
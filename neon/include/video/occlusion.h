@@ -0,0 +1,67 @@
+/*
+ * CPU occlusion culling, low resolution depth rasterizer
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <SDL2/SDL_thread.h>
+#include <SDL2/SDL_mutex.h>
+#include <SDL2/SDL_atomic.h>
+
+#include "base/math_ext.h"
+#include "base/intersection.h"
+#include "video/vertices.h"
+
+#define OCCLUSION_TILE_WIDTH 64
+#define OCCLUSION_TILE_HEIGHT 32
+#define OCCLUSION_HIZ_BLOCK 8
+
+struct OcclusionTriangle;
+struct OcclusionBin;
+
+typedef struct OcclusionStats {
+    uint32_t    occluder_triangles;
+    uint32_t    binned_triangles;
+    uint32_t    tested;
+    uint32_t    occluded;
+} OCCLUSION_STATS;
+
+// depth is NDC z cleared to 1, hiz keeps the farthest depth of each block
+typedef struct OcclusionBuffer {
+    uint32_t                    width, height;
+    uint32_t                    tiles_x, tiles_y;
+    float                       *depth;
+    float                       *hiz;
+    matrix4                     projection_view;
+
+    struct OcclusionTriangle    *triangles;
+    uint32_t                    triangles_count;
+    uint32_t                    triangles_capacity;
+    struct OcclusionBin         *bins;
+
+    SDL_Thread                  **workers;
+    uint32_t                    workers_count;
+    SDL_sem                     *start;
+    SDL_sem                     *done;
+    SDL_atomic_t                next_tile;
+    SDL_atomic_t                quit;
+
+    OCCLUSION_STATS             stats;
+} OCCLUSION_BUFFER;
+
+// threads 0 picks one worker per spare core, the caller always rasterizes too
+OCCLUSION_BUFFER *new_occlusion_buffer(uint32_t width, uint32_t height, int threads);
+void free_occlusion_buffer(OCCLUSION_BUFFER *buffer);
+
+void occlusion_begin(OCCLUSION_BUFFER *buffer, matrix4 projection_view);
+void occlusion_add_occluder(OCCLUSION_BUFFER *buffer, const void *vertices, size_t stride,
+                            const void *indices, uint32_t ef, size_t indices_count, matrix4 transform);
+void occlusion_rasterize(OCCLUSION_BUFFER *buffer);
+
+// false only when the bound is hidden behind rasterized occluders or off screen
+bool occlusion_test_aabb(OCCLUSION_BUFFER *buffer, const AABB *bound, matrix4 transform);
+// filters an object list, for example the output of cull_frustum, may run in place
+uint32_t occlusion_cull_objects(OCCLUSION_BUFFER *buffer, const VIDEO_VERTICES_INFO *info, matrix4 transform,
+                                const uint32_t *objects, uint32_t count, uint32_t *visible);
@@ -9,25 +9,28 @@
 #include "video/buffer.h"
 #include "video/vertices.h"
 
-enum VideoLimits {
-    MAX_TEXTURES        = 20,
-    MAX_SAMPLERS        = 5,
-    MAX_RENDERBUFFERS   = 5,
-    MAX_FRAMEBUFFERS    = 10,
-    MAX_BUFFERS         = 20,
-    MAX_VERTEX_ARRAYS   = 10,
-    MAX_SHADERS         = 20
-};
+/*
+ * Stored resources live in pools of fixed chunks, so the pointers store_* returns stay valid while
+ * pools grow. Each one also has a 32-bit handle: slot index, pool type and a generation that
+ * changes when the slot is reused, so handles of released resources resolve to NULL instead of
+ * to whatever took their place. store_* returns a resource holding one reference. The last
+ * release_resource queues it, resources_process frees it, unless it was stored again meanwhile.
+ * Textures with a hash are shared: storing one that is already there adds a reference.
+ */
+typedef uint32_t VIDEO_HANDLE;
 
-typedef struct VideoResources {
-    TEXTURE         textures[MAX_TEXTURES];
-    SAMPLER         samplers[MAX_SAMPLERS];
-    RENDERBUFFER    renderbuffers[MAX_RENDERBUFFERS];
-    FRAMEBUFFER     framebuffers[MAX_FRAMEBUFFERS];
-    VIDEO_BUFFER    buffers[MAX_BUFFERS];
-    VERTEX_ARRAY    arrays[MAX_VERTEX_ARRAYS];
-    SHADER          shaders[MAX_SHADERS];        
-} VIDEO_RESOURCES;
+#define VIDEO_NULL_HANDLE 0
+
+enum VideoResourceType {
+    RESOURCE_TEXTURE,
+    RESOURCE_SAMPLER,
+    RESOURCE_RENDERBUFFER,
+    RESOURCE_FRAMEBUFFER,
+    RESOURCE_BUFFER,
+    RESOURCE_VERTEX_ARRAY,
+    RESOURCE_SHADER,
+    RESOURCE_TYPES
+};
 
 #define store_new_texture2D(...) store_texture(new_texture2D(&(IMAGE_DATA){__VA_ARGS__}))
 #define store_new_sampler(...) store_sampler(new_sampler(&(SAMPLER_INFO){__VA_ARGS__}))
@@ -39,6 +42,21 @@ FRAMEBUFFER* store_framebuffer(const FRAMEBUFFER framebuffer);
 VIDEO_BUFFER* store_buffer(const VIDEO_BUFFER buffer);
 VERTEX_ARRAY* store_vertex_array(const VERTEX_ARRAY array);
 SHADER* store_shader(const SHADER shader);
+// shared meshes return the vertex array of their geometry heap, it has no handle
 VERTEX_ARRAY* store_vertices_buffers(const VIDEO_VERTICES_INFO *info);
 
-extern VIDEO_RESOURCES all_resources;
+// of a resource returned by store_*
+VIDEO_HANDLE resource_handle(const void *resource);
+// NULL when the handle is stale or of another type
+void *get_resource(VIDEO_HANDLE handle, uint32_t type);
+void acquire_resource(VIDEO_HANDLE handle);
+void release_resource(VIDEO_HANDLE handle);
+uint32_t resources_count(uint32_t type);
+
+#define get_texture(handle) ((TEXTURE*)get_resource(handle, RESOURCE_TEXTURE))
+#define get_sampler(handle) ((SAMPLER*)get_resource(handle, RESOURCE_SAMPLER))
+#define get_renderbuffer(handle) ((RENDERBUFFER*)get_resource(handle, RESOURCE_RENDERBUFFER))
+#define get_framebuffer(handle) ((FRAMEBUFFER*)get_resource(handle, RESOURCE_FRAMEBUFFER))
+#define get_buffer(handle) ((VIDEO_BUFFER*)get_resource(handle, RESOURCE_BUFFER))
+#define get_vertex_array(handle) ((VERTEX_ARRAY*)get_resource(handle, RESOURCE_VERTEX_ARRAY))
+#define get_shader(handle) ((SHADER*)get_resource(handle, RESOURCE_SHADER))
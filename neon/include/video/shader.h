@@ -2,12 +2,15 @@
 
 #include <video/gl.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 #define UNIFORMS_HASHED_SEARCH
 #define ATTRIBUTES_HASHED_SEARCH
 #define MAX_SHADER_UNIFORMS         1000
 #define MAX_UNIFORM_NAME_SIZE       80
 #define MAX_ATTRIBUTE_NAME_SIZE     80
+#define MAX_SHADOWED_LOCATIONS      4096
 
 #ifdef GL_ES_VERSION_2_0
 #define MAX_SHADER_TYPES_SUPPORTED  2
@@ -21,8 +24,20 @@ typedef struct Uniform {
     int             location;
     int             num;
     unsigned int    type;
+    uint32_t        offset;     // in the shadow values
+    uint32_t        size;       // bytes for all elements, 0 when not shadowed
 } UNIFORM;
 
+// last values sent to a program, laid out by its uniform reflection
+typedef struct UniformShadow {
+    GLuint          program;
+    const UNIFORM   *uniforms;
+    int16_t         *locations;         // uniform index, -1 for none
+    uint8_t         *valid;             // by location, set once a value was sent
+    int             locations_count;
+    uint8_t         *values;
+} UNIFORM_SHADOW;
+
 typedef struct Attribute {
     char            name[MAX_ATTRIBUTE_NAME_SIZE];
     unsigned        name_hash;
@@ -58,6 +73,8 @@ typedef struct Shader {
     ATTRIBUTE       *attributes;
     int             attributes_count;
 
+    UNIFORM_SHADOW  *shadow;
+
     // TODO: save feedback varying
 
     uint32_t        shaders[MAX_SHADER_TYPES_SUPPORTED];
@@ -98,3 +115,8 @@ void unbind_shader(SHADER *shader);
 int shader_get_uniform(SHADER *shader, const char *name);
 int shader_get_attribute(SHADER *shader, const char *name);
 unsigned int shader_uniform_type(SHADER *shader, const char *name);
+
+// samplers and block members are not shadowed, set_uniform goes through the current program's shadow
+UNIFORM_SHADOW *find_uniform_shadow(uint32_t program);
+// false when the values match the last ones sent, otherwise the shadow takes them
+bool uniform_shadow_changed(UNIFORM_SHADOW *shadow, int location, const void *data, size_t size);
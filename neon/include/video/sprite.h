@@ -6,6 +6,7 @@
 #include "video/vertex.h"
 #include "video/state.h"
 #include "video/buffer.h"
+#include "video/streambuffer.h"
 #include "video/texture.h"
 
 typedef struct VideoSpriteBatchInfo {
@@ -23,9 +24,10 @@ typedef struct VideoSpriteBatch {
 
     size_t      capacity;
     size_t      count;
+    uint32_t    base_vertex;    // of this frame's vertices in the stream
 
     VERTEX_ARRAY va;
-    VIDEO_BUFFER vb;
+    VIDEO_STREAM_BUFFER vb;
     VIDEO_BUFFER ib;
 } VIDEO_SPRITE_BATCH;
 
@@ -39,3 +39,29 @@ void set_depth_stencil_state(const DEPTH_STENCIL_STATE *restrict state);
 void clear_color_blend_state(void);
 void clear_rasterizer_state(void);
 void clear_depth_stencil_state(void);
+
+// shadowed GL state, calls matching the current state are skipped and counted in video_stats
+// call reset_state_cache after touching GL state directly or deleting bound objects
+#define VIDEO_STATE_MAX_TEXTURE_UNITS 32
+
+void reset_state_cache(void);
+// called before a call that isn't elided reaches GL, NULL for none
+void state_set_change_callback(void (*callback)(void));
+
+void state_enable(uint32_t cap, bool enable);
+void state_blend_func(uint32_t sfactor, uint32_t dfactor);
+void state_cull_face(uint32_t mode);
+void state_polygon_mode(uint32_t mode);
+void state_depth_func(uint32_t func);
+void state_depth_mask(bool write);
+void state_stencil_func(uint32_t face, uint32_t func, int ref, uint32_t mask);
+void state_stencil_op(uint32_t face, uint32_t sfail, uint32_t dpfail, uint32_t dppass);
+void state_viewport(int x, int y, int width, int height);
+
+void state_use_program(uint32_t program);
+uint32_t state_current_program(void);  // ~0 when unknown
+void state_bind_vertex_array(uint32_t array);
+void state_bind_framebuffer(uint32_t framebuffer);
+void state_bind_texture(uint32_t unit, uint32_t target, uint32_t texture);
+void state_bind_sampler(uint32_t unit, uint32_t sampler);
+void state_sampler_uniform(int location, uint32_t unit);
@@ -1,9 +1,33 @@
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 
 typedef struct VideoStats {
-    uint32_t    dips;
+    uint32_t    draws;                      // draw commands submitted
+    uint32_t    dips;                       // GL draw calls issued, a multi-draw counts once
+    uint32_t    shader_binds;
+    uint32_t    texture_binds;
+    uint32_t    state_calls;                // GL state calls issued through the state cache
+    uint32_t    state_elided;               // redundant ones skipped
+    uint32_t    uniform_calls;              // glUniform calls issued through set_uniform
+    uint32_t    uniform_elided;             // values the program already had
+    uint32_t    uniform_blocks;             // blocks streamed through the uniform ring
+    size_t      uniform_block_bytes;
+    uint32_t    uniform_ring_waits;         // segments still in use by the GPU when reached
+    size_t      stream_bytes;               // vertices and indices written to stream buffers
+    uint32_t    stream_waits;               // frame regions still in use by the GPU when reached
+    uint32_t    stream_orphans;             // frames that outgrew their region
+    uint32_t    deletes;                    // GL objects deleted by the delete queue
+    uint32_t    deletes_queued;             // waiting for their fence or the next frame budget
+    size_t      texture_upload_bytes;       // pixels sent through the pixel unpack ring
+    uint32_t    texture_uploads_queued;     // textures still missing levels
+
+    uint32_t    commands;
+    uint32_t    commands_peak;              // sum of per buffer high-water marks
+    size_t      commands_memory;
+    size_t      commands_memory_peak;
+    size_t      commands_memory_reserved;
 } VIDEO_STATS;
 
 extern VIDEO_STATS video_stats;
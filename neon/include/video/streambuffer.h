@@ -0,0 +1,41 @@
+/*
+ * Ring buffers for vertices and indices rewritten every frame
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <video/gl.h>
+
+#include "video/buffer.h"
+
+#define STREAM_BUFFER_FRAMES 3 // frame regions, a region is written again once its fence passed
+
+/*
+ * Each frame writes into its own region with unsynchronized, range invalidating maps. The region
+ * left behind is fenced on the first write of the next frame and waited on before it comes round
+ * again. A frame that outgrows its region orphans the whole buffer and starts over in fresh storage.
+ */
+typedef struct VideoStreamBuffer {
+    VIDEO_BUFFER    buffer;
+    size_t          region_size;
+    size_t          head;
+    uint32_t        region;
+    uint32_t        frame;
+    #ifndef GL_ES_VERSION_2_0
+    GLsync          fences[STREAM_BUFFER_FRAMES];
+    #endif // NO GL_ES_VERSION_2_0
+} VIDEO_STREAM_BUFFER;
+
+// target is GL_ARRAY_BUFFER, GL_ELEMENT_ARRAY_BUFFER or GL_PIXEL_UNPACK_BUFFER
+// frame_size is what one frame writes at most, a multiple of the write alignment so regions start
+// aligned, the buffer holds STREAM_BUFFER_FRAMES of them
+VIDEO_STREAM_BUFFER new_stream_buffer(uint32_t target, size_t frame_size);
+void free_stream_buffer(VIDEO_STREAM_BUFFER *stream);
+
+// copies data into the current frame region, returns its offset, a multiple of alignment
+size_t stream_buffer_write(VIDEO_STREAM_BUFFER *stream, const void *data, size_t size, size_t alignment);
+
+// once per frame after its last draw, by video_swap_buffers
+void stream_buffers_next_frame(void);
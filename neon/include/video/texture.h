@@ -6,7 +6,8 @@
 
 enum TextureFlags {
     TEXTURE_DATA_BIT    = 0x00000001,
-    TEXTURE_MIPMAPS_BIT = 0x00000002
+    TEXTURE_MIPMAPS_BIT = 0x00000002,
+    TEXTURE_PENDING_BIT = 0x00000004    // storage allocated, levels still uploading
 };
 
 typedef struct TextureInputs {
@@ -24,6 +25,7 @@ typedef struct Texture {
     int             width;
     int             height;
     int             depth;
+    int             internalformat;
 
     uint32_t        hash;
     uint32_t        usage;
@@ -41,3 +43,8 @@ TEXTURE upload_cubemap_textures(const char *name);
 void bind_texture(uint32_t unit, TEXTURE *tex);
 void unbind_texture(uint32_t unit, uint32_t target);
 void generate_mipmap_texture(TEXTURE *tex);
+
+// bytes of a pixel, 0 for packed or unknown layouts
+uint32_t texture_pixel_size(uint32_t format, uint32_t type);
+// every level of a cooked chain into the bound GL_TEXTURE_2D, packed back to back in pixels
+void upload_texture_levels(const IMAGE_DATA *image);
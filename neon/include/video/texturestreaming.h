@@ -0,0 +1,42 @@
+/*
+ * Cooked textures streamed level by level under a memory budget
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "video/texture.h"
+
+#define STREAMING_PLACEHOLDER_SIZE 64                       // largest side of the levels always resident
+#define STREAMING_MEMORY_BUDGET (256 * 1024 * 1024)         // default, bytes of resident levels
+#define STREAMING_UPLOADS 4                                 // chains started a frame
+#define STREAMING_REQUEST_FRAMES 30                         // a request is kept that long
+
+typedef uint32_t STREAMED_TEXTURE;
+
+/*
+ * load_streamed_texture reads a .tmip header and uploads only the levels up to
+ * STREAMING_PLACEHOLDER_SIZE, so the texture is bindable right away. Each frame the textures
+ * request their on-screen size, texture_streaming_update grants levels by priority (screen size
+ * times the texture hint) while the budget lasts and queues the chains through queue_texture2D.
+ * A finished chain replaces the texture, the old one goes through the delete queue. Textures not
+ * requested for STREAMING_REQUEST_FRAMES, or over the budget, are evicted to smaller chains. The
+ * placeholders are always resident and always counted. Load and free on the GL thread, like
+ * upload_texture; bind whatever streamed_texture returns at the time of recording.
+ */
+STREAMED_TEXTURE load_streamed_texture(const char *name);
+void free_streamed_texture(STREAMED_TEXTURE texture);
+TEXTURE* streamed_texture(STREAMED_TEXTURE texture);
+
+// screen size in pixels of the largest side, the largest request of a frame wins
+void request_streamed_texture(STREAMED_TEXTURE texture, float screen_size);
+// scales the priority, 1 by default
+void hint_streamed_texture(STREAMED_TEXTURE texture, float priority);
+void set_streaming_budget(size_t bytes);
+size_t texture_streaming_resident(void);
+
+// once per frame on the main thread, takes the context only when there is work
+void texture_streaming_update(void);
+void texture_streaming_cleanup(void);
@@ -0,0 +1,33 @@
+/*
+ * Texture pixels streamed through pixel unpack buffers over several frames
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "core/image.h"
+#include "video/texture.h"
+
+#define TEXTURE_UPLOAD_BUDGET (4 * 1024 * 1024) // bytes of pixels sent a frame, and a frame region of the ring
+
+/*
+ * queue_texture2D allocates every level at once, with glTexStorage2D when there is one, and
+ * returns a bindable texture flagged TEXTURE_PENDING_BIT. At the end of each frame rows of
+ * queued textures are copied into a stream buffer of pixel unpack regions and sent with
+ * glTexSubImage2D until the frame budget is spent. Images with levels upload their whole chain,
+ * images with only mipmaps set get glGenerateMipmap once the base level is there. Sample a
+ * texture only after texture_upload_done cleared the flag. Everything runs on the GL thread,
+ * but pixels are freed by queue_texture2D and texture_upload_done on the main thread, not by
+ * the render thread that finished the upload.
+ */
+// the queue owns image.pixels from here on
+TEXTURE queue_texture2D(IMAGE_DATA image);
+// clears TEXTURE_PENDING_BIT when complete
+bool texture_upload_done(TEXTURE *texture);
+// by free_texture
+void cancel_texture_upload(uint32_t texture);
+
+// once per frame after its last draw, by video_swap_buffers
+void texture_uploads_process(void);
+void texture_uploads_cleanup(void);
@@ -0,0 +1,25 @@
+/*
+ * Streaming uniform buffer for per draw and per frame blocks
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "video/shader.h"
+
+#define UNIFORM_RING_SIZE       (4 * 1024 * 1024)
+#define UNIFORM_RING_SEGMENTS   4   // fenced separately, an allocation never spans two
+
+/*
+ * Blocks are recorded with uniform_block_command or frame_uniform_block_command and copied into
+ * the ring on submit, then bound with glBindBufferRange at their binding point. A segment is
+ * fenced when the ring leaves it and waited on before it is written again. With ARB_buffer_storage
+ * the ring stays mapped and blocks are plain copies, otherwise they go through glBufferSubData.
+ */
+
+// points the shader's block at the ring binding, call once after the shader is built
+void uniform_ring_connect(const SHADER *shader, const char *block_name, int binding_point);
+
+void bind_uniform_block(int binding_point, const void *data, size_t size);
+void uniform_ring_cleanup(void);
@@ -0,0 +1,38 @@
+/*
+ * Texture and buffer uploads on a loader thread
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <SDL2/SDL_video.h>
+
+#include "core/image.h"
+#include "video/texture.h"
+#include "video/buffer.h"
+
+#define UPLOAD_QUEUE_SIZE 64 // uploads submitted and not taken yet, doubled when they are not taken in time
+
+typedef uint32_t VIDEO_UPLOAD;
+
+/*
+ * With screen.upload_thread a loader thread owns a second GL context shared with the main one. It
+ * creates and fills the objects, fences them and flushes. upload_take_* makes the context it is
+ * called on wait for that fence, on the GPU, and returns the object, so call it on the GL thread,
+ * between video_lock_context and video_unlock_context with the render thread. The loader only
+ * runs GL: decode on any thread, the upload owns image pixels and buffer data and frees them when
+ * taken. Without the thread uploads happen at submit and take only returns them.
+ */
+void uploader_start(SDL_Window *window, SDL_GLContext context);
+void uploader_cleanup(void);
+
+VIDEO_UPLOAD upload_texture2D_async(IMAGE_DATA image);
+VIDEO_UPLOAD upload_vertex_buffer_async(void *vertices, size_t size, unsigned int usage);
+VIDEO_UPLOAD upload_index_buffer_async(void *indices, size_t size, unsigned int usage);
+
+bool upload_done(VIDEO_UPLOAD upload);
+// waits for the loader when not done, every upload is taken once
+TEXTURE upload_take_texture(VIDEO_UPLOAD upload);
+VIDEO_BUFFER upload_take_buffer(VIDEO_UPLOAD upload);
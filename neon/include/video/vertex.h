@@ -15,7 +15,8 @@ enum VERTEX_FORMAT {
     VF_V3T2,
     VF_V3T2N3,
     VF_V3T2C4,
-    VF_V2T2C4
+    VF_V2T2C4,
+    VF_V3T2N3T3
 };
 
 enum INDEX_FORMAT {
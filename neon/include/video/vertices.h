@@ -8,6 +8,8 @@
 #include "base/intersection.h"
 #include "video/buffer.h"
 
+#define VIDEO_MAX_LODS 4
+
 typedef struct VerticesData {
     void            *vertices;
     void            *indices;
@@ -17,6 +19,8 @@ typedef struct VerticesData {
 
 typedef struct VerticesDesc {
     uint32_t        primitive, vf, ef;
+    uint32_t        lods; // extra simplified levels generated at load
+    bool            shared; // placed in the geometry heap of its format, see video/geometry.h
 } VERTICES_DESC;
 
 typedef struct VerticesInfo {
@@ -29,6 +33,7 @@ typedef struct VideoVerticesInfo {
     VIDEO_BUFFER    vertices;
     VIDEO_BUFFER    elements;
     VERTICES_DESC   desc;
+    uint32_t        geometry; // heap allocation of shared vertices, offsets below are relative to it
 
     struct VerticesObjectInfo {
         uint32_t    vb_offset;
@@ -37,10 +42,21 @@ typedef struct VideoVerticesInfo {
         uint32_t    base_vertex;
         uint32_t    base_index;
         AABB        bound;
+
+        struct VerticesLod {
+            uint32_t    ib_offset;
+            uint32_t    count;
+            float       error;
+        }           lods[VIDEO_MAX_LODS];
+        uint32_t    lods_count;
     }               *objects;
     uint32_t        objects_count;
 } VIDEO_VERTICES_INFO;
 
+size_t vertex_format_size(uint32_t vf);
+// attributes of the format in the bound vertex array, read from the bound array buffer
+void vertices_array_format(VERTEX_ARRAY *array, VIDEO_BUFFER *vertices, uint32_t vf);
+
 VIDEO_VERTICES_INFO new_vertices_buffers(VERTICES_DATA *data, size_t count, const VERTICES_DESC *desc);
 void cleanup_vertices_info(VIDEO_VERTICES_INFO *info);
 void free_vertices_info(VIDEO_VERTICES_INFO *info);
@@ -50,6 +66,7 @@ typedef struct GenSphereInfo {
     int         rings;
     int         sectors;
     float       radius;
+    bool        tangents;   // V3T2N3T3 instead of V3T2N3
 } GEN_SHPERE_INFO;
 
 typedef struct GenTorusInfo {
@@ -57,11 +74,13 @@ typedef struct GenTorusInfo {
     float outerRadius;
     uint32_t numberSlices;
     uint32_t numberStacks;
+    bool tangents;          // V3T2N3T3 instead of V3T2N3
 } GEN_TORUS_INFO;
 
 typedef struct GenRibbonInfo {
     int segments;
     float width;
+    bool tangents;          // V3T2N3T3 instead of V3T2N3
 } GEN_RIBBON_INFO;
 
 typedef struct GenRectangularGridPlane {
@@ -70,6 +89,7 @@ typedef struct GenRectangularGridPlane {
     uint32_t rows;
     uint32_t columns;
     bool triangleStrip;
+    bool tangents;          // V3T2N3T3 instead of V3T2N3, triangle lists only
 } GEN_RECTANGULAR_GRID_PLANE;
 
 VERTICES_INFO vertgen_cube(matrix4 transform);
@@ -78,3 +98,6 @@ VERTICES_INFO vertgen_quad_plane(matrix4 transform);
 VERTICES_INFO vertgen_torus(const GEN_TORUS_INFO *info, matrix4 transform);
 VERTICES_INFO vertgen_ribbon(const GEN_RIBBON_INFO *info, matrix4 transform);
 VERTICES_INFO vertgen_rectangular_grid_plane(const GEN_RECTANGULAR_GRID_PLANE *info, matrix4 transform);
+
+// V3T2N3 triangle lists to V3T2N3T3, the generators do it when asked for tangents
+void vertgen_tangents(VERTICES_INFO *info);
@@ -0,0 +1,21 @@
+/*
+ * Bulk vertex array kernels (SSE2/AVX2 with scalar fallback)
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "base/math_ext.h"
+#include "video/vertex.h"
+
+// All kernels expect position at offset 0 of each vertex, like every v*_t in vertex.h
+
+void vertops_transform(void *vertices, size_t stride, size_t count, matrix4 transform);
+void vertops_bounds(const void *vertices, size_t stride, size_t count, float3 min, float3 max);
+
+void vertops_normals(void *vertices, size_t stride, size_t normal_offset, size_t count,
+                     const void *indices, uint32_t ef, size_t indices_count);
+void vertops_tangents(v3t2n3t3_t *vertices, size_t count, const void *indices, uint32_t ef, size_t indices_count);
+
+const char *vertops_isa(void);
@@ -16,6 +16,7 @@
 #include <core/application.h>
 #include "core/video.h"
 #include "video/resources_detail.h"
+#include "video/texturestreaming.h"
 #include <core/audio.h>
 
 static int              running = 1;
@@ -32,14 +33,18 @@ application_next_state(unsigned int state) {
 
     push_stack(states_stack, &allstates[state]);
 
+    video_lock_context();
     ((APP_STATE*)top_stack(states_stack))->on_init();
+    video_unlock_context();
 
     frame_flush();
 }
 
 NEON_API void
 application_back_state(void) {
+    video_lock_context();
     ((APP_STATE*)pop_stack(states_stack))->on_cleanup();
+    video_unlock_context();
     frame_flush();
 }
 
@@ -118,6 +123,7 @@ application_exec(const char *title, APP_STATE *states, size_t states_n) {
 
         asset_process();
         resources_process();
+        texture_streaming_update();
 
         last = current;
         current = SDL_GetPerformanceCounter();
@@ -0,0 +1,128 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+// no memtrack: its block list is not locked and command buffer arenas grow on worker threads
+
+#include "core/logerr.h"
+#include "core/arena.h"
+
+struct ArenaChunk {
+    struct ArenaChunk   *next;
+    size_t              size;
+    size_t              offset;
+};
+
+#define ALIGN_UP(x) (((x) + (ARENA_ALIGN - 1)) & ~(size_t)(ARENA_ALIGN - 1))
+#define CHUNK_HEADER_SIZE ALIGN_UP(sizeof(struct ArenaChunk))
+
+static inline char *
+chunk_data(struct ArenaChunk *chunk) {
+    return (char*)chunk + CHUNK_HEADER_SIZE;
+}
+
+static struct ArenaChunk *
+new_chunk(ARENA *arena, size_t size) {
+    struct ArenaChunk *chunk = malloc(CHUNK_HEADER_SIZE + size);
+
+    if (!chunk) {
+        LOG_CRITICAL("%s\n", "Can't alloc memory");
+        exit(EXIT_FAILURE);
+    }
+
+    chunk->next = NULL;
+    chunk->size = size;
+    chunk->offset = 0;
+
+    arena->reserved += size;
+
+    return chunk;
+}
+
+extern ARENA
+new_arena(size_t chunk_size) {
+    ARENA arena;
+    memset(&arena, 0, sizeof(arena));
+
+    arena.chunk_size = ALIGN_UP(chunk_size > 0 ? chunk_size : DEFAULT_ARENA_CHUNK_SIZE);
+    arena.first = new_chunk(&arena, arena.chunk_size);
+    arena.current = arena.first;
+
+    return arena;
+}
+
+extern void
+free_arena(ARENA *arena) {
+    assert(arena != NULL);
+
+    struct ArenaChunk *chunk = arena->first;
+
+    while (chunk) {
+        struct ArenaChunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+
+    memset(arena, 0, sizeof(ARENA));
+}
+
+extern void *
+arena_alloc(ARENA *arena, size_t size) {
+    assert(arena != NULL);
+    assert(arena->current != NULL);
+
+    size = ALIGN_UP(size);
+
+    struct ArenaChunk *chunk = arena->current;
+
+    while (chunk->offset + size > chunk->size) {
+        // reuse chunks kept from earlier frames, otherwise grow the chain
+        if (chunk->next && chunk->next->size >= size) {
+            chunk = chunk->next;
+            chunk->offset = 0;
+            continue;
+        }
+
+        struct ArenaChunk *grown = new_chunk(arena, size > arena->chunk_size ? size : arena->chunk_size);
+        grown->next = chunk->next;
+        chunk->next = grown;
+        chunk = grown;
+    }
+
+    arena->current = chunk;
+
+    void *p = chunk_data(chunk) + chunk->offset;
+    chunk->offset += size;
+
+    arena->used += size;
+    if (arena->used > arena->peak)
+        arena->peak = arena->used;
+
+    return p;
+}
+
+extern void
+arena_reset(ARENA *arena) {
+    assert(arena != NULL);
+
+    arena->current = arena->first;
+    arena->first->offset = 0;
+    arena->used = 0;
+}
+
+extern ARENA_MARK
+arena_mark(const ARENA *arena) {
+    assert(arena != NULL);
+
+    return (ARENA_MARK){arena->current, arena->current->offset, arena->used};
+}
+
+extern void
+arena_rewind(ARENA *arena, ARENA_MARK mark) {
+    assert(arena != NULL);
+    assert(mark.chunk != NULL);
+
+    arena->current = mark.chunk;
+    arena->current->offset = mark.offset;
+    arena->used = mark.used;
+}
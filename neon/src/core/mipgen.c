@@ -0,0 +1,441 @@
+#include <assert.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <memtrack.h>
+#include <SDL2/SDL_cpuinfo.h>
+#include <SDL2/SDL_thread.h>
+
+#include "core/logerr.h"
+#include "core/mipgen.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define MIPGEN_AVX2
+#define MIPGEN_SSE2
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define MIPGEN_SSE2
+#endif
+
+#define MIPGEN_TAPS 6
+#define MIPGEN_KAISER_ALPHA 4.f
+#define MIPGEN_BAND_ROWS 16         // fewer rows are not worth a thread
+#define MIPGEN_SRGB_LUT 4096
+#define MIPGEN_COVERAGE_STEPS 16
+
+// linear RGBA floats whatever the components
+typedef struct MipgenLevel {
+    float       *pixels;
+    int         width;
+    int         height;
+} MIPGEN_LEVEL;
+
+typedef struct MipgenJob {
+    void                (*run)(const struct MipgenJob *job);
+    const MIPGEN_LEVEL  *src;
+    MIPGEN_LEVEL        *dst;
+    float               *temp;      // rows of src filtered to the width of dst
+    int                 first;
+    int                 last;
+} MIPGEN_JOB;
+
+static float srgb_to_linear[256];
+static uint8_t linear_to_srgb[MIPGEN_SRGB_LUT + 1];
+static float kaiser_weights[MIPGEN_TAPS];
+static bool tables_ready;
+
+static void *
+alloc_memory(size_t size) {
+    void *p = malloc(size);
+
+    if (!p) {
+        LOG_CRITICAL("%s\n", "Can't alloc memory");
+        exit(EXIT_FAILURE);
+    }
+
+    return p;
+}
+
+static inline int
+level_size(int size, uint32_t level) {
+    return size >> level > 0 ? size >> level : 1;
+}
+
+static inline int
+clamp_index(int i, int size) {
+    return i < 0 ? 0 : (i >= size ? size - 1 : i);
+}
+
+extern const char *
+mipgen_isa(void) {
+#if defined(MIPGEN_AVX2)
+    return "AVX2";
+#elif defined(MIPGEN_SSE2)
+    return "SSE2";
+#else
+    return "scalar";
+#endif
+}
+
+extern uint32_t
+mipgen_levels(int width, int height) {
+    uint32_t levels = 1;
+
+    while ((width | height) >> levels)
+        levels++;
+
+    return levels;
+}
+
+extern size_t
+mipgen_chain_size(int width, int height, int components, uint32_t levels) {
+    size_t size = 0;
+
+    for (uint32_t i = 0; i < levels; i++)
+        size += (size_t)level_size(width, i) * level_size(height, i) * components;
+
+    return size;
+}
+
+static float
+bessel_i0(float x) {
+    float sum = 1.f;
+    float term = 1.f;
+
+    for (int k = 1; k < 32 && term > sum * 1e-7f; k++) {
+        term *= (x * 0.5f / k) * (x * 0.5f / k);
+        sum += term;
+    }
+
+    return sum;
+}
+
+static void
+init_tables(void) {
+    if (tables_ready)
+        return;
+
+    for (int i = 0; i < 256; i++) {
+        const float c = i / 255.f;
+        srgb_to_linear[i] = c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+    }
+
+    for (int i = 0; i <= MIPGEN_SRGB_LUT; i++) {
+        const float l = (float)i / MIPGEN_SRGB_LUT;
+        const float s = l <= 0.0031308f ? l * 12.92f : 1.055f * powf(l, 1.f / 2.4f) - 0.055f;
+        linear_to_srgb[i] = (uint8_t)(s * 255.f + 0.5f);
+    }
+
+    // taps sit at -2.5..2.5 source pixels from the center, a windowed sinc of the target rate
+    const float radius = MIPGEN_TAPS * 0.5f;
+    float sum = 0.f;
+
+    for (int k = 0; k < MIPGEN_TAPS; k++) {
+        const float d = k - (MIPGEN_TAPS - 1) * 0.5f;
+        const float t = d * 0.5f * (float)M_PI;
+        const float r = d / radius;
+
+        kaiser_weights[k] = sinf(t) / t * bessel_i0(MIPGEN_KAISER_ALPHA * sqrtf(1.f - r * r)) / bessel_i0(MIPGEN_KAISER_ALPHA);
+        sum += kaiser_weights[k];
+    }
+
+    for (int k = 0; k < MIPGEN_TAPS; k++)
+        kaiser_weights[k] /= sum;
+
+    tables_ready = true;
+}
+
+static void
+decode_base(const uint8_t *pixels, const MIPGEN_OPTIONS *options, MIPGEN_LEVEL *level) {
+    const size_t count = (size_t)level->width * level->height;
+    const int components = options->components;
+    const bool srgb = options->flags & MIPGEN_SRGB;
+
+    for (size_t i = 0; i < count; i++) {
+        const uint8_t *p = pixels + i * components;
+        float *out = level->pixels + i * 4;
+
+        for (int c = 0; c < 4; c++)
+            if (c >= components)
+                out[c] = c == 3 ? 1.f : 0.f;
+            else if (c < 3 && srgb)
+                out[c] = srgb_to_linear[p[c]];
+            else
+                out[c] = p[c] / 255.f;
+    }
+}
+
+static void
+box_rows(const MIPGEN_JOB *job) {
+    const MIPGEN_LEVEL *src = job->src;
+    MIPGEN_LEVEL *dst = job->dst;
+
+    for (int y = job->first; y < job->last; y++) {
+        const float *r0 = src->pixels + (size_t)clamp_index(y * 2, src->height) * src->width * 4;
+        const float *r1 = src->pixels + (size_t)clamp_index(y * 2 + 1, src->height) * src->width * 4;
+        float *out = dst->pixels + (size_t)y * dst->width * 4;
+        int x = 0;
+
+#if defined(MIPGEN_AVX2)
+        // two target pixels an iteration, a 128-bit lane each
+        const __m256 quarter = _mm256_set1_ps(0.25f);
+
+        for (; x + 2 <= dst->width && x * 2 + 3 < src->width; x += 2) {
+            const __m256 a = _mm256_add_ps(_mm256_loadu_ps(r0 + x * 8), _mm256_loadu_ps(r1 + x * 8));
+            const __m256 b = _mm256_add_ps(_mm256_loadu_ps(r0 + x * 8 + 8), _mm256_loadu_ps(r1 + x * 8 + 8));
+            const __m256 sum = _mm256_add_ps(_mm256_permute2f128_ps(a, b, 0x20), _mm256_permute2f128_ps(a, b, 0x31));
+
+            _mm256_storeu_ps(out + x * 4, _mm256_mul_ps(sum, quarter));
+        }
+#endif // MIPGEN_AVX2
+
+        for (; x < dst->width; x++) {
+            const int x0 = clamp_index(x * 2, src->width) * 4;
+            const int x1 = clamp_index(x * 2 + 1, src->width) * 4;
+
+#if defined(MIPGEN_SSE2)
+            const __m128 sum = _mm_add_ps(_mm_add_ps(_mm_loadu_ps(r0 + x0), _mm_loadu_ps(r0 + x1)),
+                                          _mm_add_ps(_mm_loadu_ps(r1 + x0), _mm_loadu_ps(r1 + x1)));
+
+            _mm_storeu_ps(out + x * 4, _mm_mul_ps(sum, _mm_set1_ps(0.25f)));
+#else
+            for (int c = 0; c < 4; c++)
+                out[x * 4 + c] = (r0[x0 + c] + r0[x1 + c] + r1[x0 + c] + r1[x1 + c]) * 0.25f;
+#endif // MIPGEN_SSE2
+        }
+    }
+}
+
+// src rows to the target width
+static void
+kaiser_columns(const MIPGEN_JOB *job) {
+    const MIPGEN_LEVEL *src = job->src;
+    const int width = job->dst->width;
+
+    for (int y = job->first; y < job->last; y++) {
+        const float *row = src->pixels + (size_t)y * src->width * 4;
+        float *out = job->temp + (size_t)y * width * 4;
+
+        for (int x = 0; x < width; x++) {
+#if defined(MIPGEN_SSE2)
+            __m128 sum = _mm_setzero_ps();
+
+            for (int k = 0; k < MIPGEN_TAPS; k++) {
+                const int sx = clamp_index(x * 2 - MIPGEN_TAPS / 2 + 1 + k, src->width);
+                sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(row + sx * 4), _mm_set1_ps(kaiser_weights[k])));
+            }
+
+            _mm_storeu_ps(out + x * 4, sum);
+#else
+            float sum[4] = {0.f, 0.f, 0.f, 0.f};
+
+            for (int k = 0; k < MIPGEN_TAPS; k++) {
+                const int sx = clamp_index(x * 2 - MIPGEN_TAPS / 2 + 1 + k, src->width);
+
+                for (int c = 0; c < 4; c++)
+                    sum[c] += row[sx * 4 + c] * kaiser_weights[k];
+            }
+
+            memcpy(out + x * 4, sum, sizeof(sum));
+#endif // MIPGEN_SSE2
+        }
+    }
+}
+
+// filtered rows down to the target height, rows are contiguous so whole floats go at once
+static void
+kaiser_rows(const MIPGEN_JOB *job) {
+    MIPGEN_LEVEL *dst = job->dst;
+    const int floats = dst->width * 4;
+
+    for (int y = job->first; y < job->last; y++) {
+        const float *rows[MIPGEN_TAPS];
+        float *out = dst->pixels + (size_t)y * floats;
+
+        for (int k = 0; k < MIPGEN_TAPS; k++)
+            rows[k] = job->temp + (size_t)clamp_index(y * 2 - MIPGEN_TAPS / 2 + 1 + k, job->src->height) * floats;
+
+        int i = 0;
+
+#if defined(MIPGEN_AVX2)
+        for (; i + 8 <= floats; i += 8) {
+            __m256 sum = _mm256_setzero_ps();
+
+            for (int k = 0; k < MIPGEN_TAPS; k++)
+                sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_loadu_ps(rows[k] + i), _mm256_set1_ps(kaiser_weights[k])));
+
+            _mm256_storeu_ps(out + i, sum);
+        }
+#endif // MIPGEN_AVX2
+
+#if defined(MIPGEN_SSE2)
+        for (; i + 4 <= floats; i += 4) {
+            __m128 sum = _mm_setzero_ps();
+
+            for (int k = 0; k < MIPGEN_TAPS; k++)
+                sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(rows[k] + i), _mm_set1_ps(kaiser_weights[k])));
+
+            _mm_storeu_ps(out + i, sum);
+        }
+#endif // MIPGEN_SSE2
+
+        for (; i < floats; i++) {
+            float sum = 0.f;
+
+            for (int k = 0; k < MIPGEN_TAPS; k++)
+                sum += rows[k][i] * kaiser_weights[k];
+
+            out[i] = sum;
+        }
+    }
+}
+
+static int
+mipgen_worker(void *data) {
+    const MIPGEN_JOB *job = data;
+
+    job->run(job);
+
+    return 0;
+}
+
+// rows split into bands, the last one runs on the caller
+static void
+run_bands(MIPGEN_JOB job, int rows, int threads) {
+    int bands = rows / MIPGEN_BAND_ROWS;
+
+    if (bands > threads)
+        bands = threads;
+    if (bands < 1)
+        bands = 1;
+
+    MIPGEN_JOB jobs[bands];
+    SDL_Thread *workers[bands];
+
+    for (int i = 0; i < bands; i++) {
+        jobs[i] = job;
+        jobs[i].first = rows * i / bands;
+        jobs[i].last = rows * (i + 1) / bands;
+        workers[i] = NULL;
+    }
+
+    for (int i = 0; i < bands - 1; i++)
+        if ((workers[i] = SDL_CreateThread(mipgen_worker, "mipgen", &jobs[i])) == NULL)
+            job.run(&jobs[i]);
+
+    job.run(&jobs[bands - 1]);
+
+    for (int i = 0; i < bands - 1; i++)
+        if (workers[i])
+            SDL_WaitThread(workers[i], NULL);
+}
+
+static float
+alpha_coverage(const MIPGEN_LEVEL *level, float scale, float reference) {
+    const size_t count = (size_t)level->width * level->height;
+    size_t covered = 0;
+
+    for (size_t i = 0; i < count; i++)
+        if (level->pixels[i * 4 + 3] * scale > reference)
+            covered++;
+
+    return (float)covered / count;
+}
+
+// the alpha scale that brings the level back to the coverage of the base
+static float
+coverage_scale(const MIPGEN_LEVEL *level, float coverage, float reference) {
+    float low = 0.f;
+    float high = 4.f;
+
+    for (int i = 0; i < MIPGEN_COVERAGE_STEPS; i++) {
+        const float mid = (low + high) * 0.5f;
+
+        if (alpha_coverage(level, mid, reference) > coverage)
+            high = mid;
+        else
+            low = mid;
+    }
+
+    return (low + high) * 0.5f;
+}
+
+static void
+encode_level(const MIPGEN_LEVEL *level, const MIPGEN_OPTIONS *options, float alpha_scale, uint8_t *pixels) {
+    const size_t count = (size_t)level->width * level->height;
+    const int components = options->components;
+    const bool srgb = options->flags & MIPGEN_SRGB;
+
+    for (size_t i = 0; i < count; i++) {
+        const float *p = level->pixels + i * 4;
+        uint8_t *out = pixels + i * components;
+
+        for (int c = 0; c < components; c++) {
+            float v = c == 3 ? p[c] * alpha_scale : p[c];
+            v = v < 0.f ? 0.f : (v > 1.f ? 1.f : v);
+
+            if (c < 3 && srgb)
+                out[c] = linear_to_srgb[(int)(v * MIPGEN_SRGB_LUT + 0.5f)];
+            else
+                out[c] = (uint8_t)(v * 255.f + 0.5f);
+        }
+    }
+}
+
+extern uint8_t*
+generate_mipmaps(const uint8_t *pixels, int width, int height, const MIPGEN_OPTIONS *options) {
+    assert(pixels != NULL);
+    assert(options != NULL);
+    assert(options->components >= 1 && options->components <= 4);
+    assert(width > 0 && height > 0);
+
+    init_tables();
+
+    const int components = options->components;
+    const uint32_t levels = mipgen_levels(width, height);
+    const int threads = options->threads > 0 ? options->threads : SDL_GetCPUCount();
+    const bool coverage = (options->flags & MIPGEN_ALPHA_COVERAGE) && components == 4;
+
+    uint8_t *chain = alloc_memory(mipgen_chain_size(width, height, components, levels));
+    size_t offset = (size_t)width * height * components;
+    memcpy(chain, pixels, offset);
+
+    MIPGEN_LEVEL src = {.pixels = alloc_memory((size_t)width * height * 4 * sizeof(float)), .width = width, .height = height};
+    decode_base(pixels, options, &src);
+
+    const float base_coverage = coverage ? alpha_coverage(&src, 1.f, options->alpha_reference) : 0.f;
+
+    for (uint32_t i = 1; i < levels; i++) {
+        MIPGEN_LEVEL dst = {.width = level_size(width, i), .height = level_size(height, i)};
+        dst.pixels = alloc_memory((size_t)dst.width * dst.height * 4 * sizeof(float));
+
+        MIPGEN_JOB job = {.src = &src, .dst = &dst};
+
+        if (options->filter == MIPGEN_FILTER_KAISER) {
+            job.temp = alloc_memory((size_t)dst.width * src.height * 4 * sizeof(float));
+
+            job.run = kaiser_columns;
+            run_bands(job, src.height, threads);
+            job.run = kaiser_rows;
+            run_bands(job, dst.height, threads);
+
+            free(job.temp);
+        } else {
+            job.run = box_rows;
+            run_bands(job, dst.height, threads);
+        }
+
+        const float alpha_scale = coverage ? coverage_scale(&dst, base_coverage, options->alpha_reference) : 1.f;
+        encode_level(&dst, options, alpha_scale, chain + offset);
+        offset += (size_t)dst.width * dst.height * components;
+
+        free(src.pixels);
+        src = dst;
+    }
+
+    free(src.pixels);
+
+    return chain;
+}
@@ -1,6 +1,7 @@
 #include <assert.h>
 #include <core/reader.h>
 #include <core/targa.h>
+#include <core/texfile.h>
 #include <core/asset.h>
 #include <core/logerr.h>
 
@@ -23,6 +24,7 @@ ASSET_READER asset_reader = {
     .textures = (TEXTURE_READER[]) {
         {.ext = ".tga", .read = load_targa},
         {.ext = ".tpic",.read =  load_targa},
+        {.ext = ".tmip", .read = load_texfile},
         {.ext = {0}, .read = NULL}
     },
     .sounds = (SOUND_READER[]) {
@@ -61,6 +63,20 @@ read_text(const char *name, TEXT_DATA *text) {
     return -1;
 }
 
+// the packer cooks .tga into .tmip under the same name, no targa starts with the magic
+static bool
+is_texfile(SDL_RWops *rw) {
+    uint32_t magic = 0;
+
+    if (!rw || SDL_RWread(rw, &magic, sizeof(magic), 1) != 1)
+        magic = 0;
+
+    if (rw)
+        SDL_RWseek(rw, 0, RW_SEEK_SET);
+
+    return magic == TEXFILE_MAGIC;
+}
+
 int
 read_texture(const char *name, IMAGE_DATA *image) {
     assert(name != NULL);
@@ -71,8 +87,9 @@ read_texture(const char *name, IMAGE_DATA *image) {
     for (size_t i = 0; asset_reader.textures[i].read; i++)
         if (strcasecmp(ext, asset_reader.textures[i].ext) == 0) {
             SDL_RWops *rw = asset_request(name);
+            TEXTURE_READ_FN read = is_texfile(rw) ? load_texfile : asset_reader.textures[i].read;
 
-            if(asset_reader.textures->read(rw, image) != 0) {
+            if(read(rw, image) != 0) {
                 LOG_ERROR("Can\'t read texture %s\n", name);
                 return -1;
             }
@@ -0,0 +1,130 @@
+#include "core/texfile.h"
+#include "core/logerr.h"
+#include "core/video.h"
+#include "video/texture.h"
+#include <memtrack.h>
+
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+
+extern int
+read_texfile_header(SDL_RWops *rw, TEXFILE_HEADER *header) {
+    assert(header != NULL);
+
+    if (!rw) {
+        LOG_ERROR("Can't open file %p\n", (void*)rw);
+        return -1;
+    }
+
+    if (SDL_RWread(rw, header, sizeof(TEXFILE_HEADER), 1) != 1) {
+        LOG_ERROR("%s\n", "Can't read texture header");
+        return -1;
+    }
+
+    if (header->magic != TEXFILE_MAGIC || header->version != TEXFILE_VERSION) {
+        LOG_ERROR("Unknown texture file %#x version %#x\n", header->magic, header->version);
+        return -1;
+    }
+
+    if (header->width == 0 || header->height == 0) {
+        LOG_ERROR("Bad texture size %ux%u\n", header->width, header->height);
+        return -1;
+    }
+
+    // no more levels than halvings of the largest side down to 1
+    uint32_t max_levels = 1;
+    while (max_levels < 32 && ((header->width | header->height) >> max_levels) > 0)
+        max_levels++;
+
+    if (header->levels == 0 || header->levels > TEXFILE_MAX_LEVELS || header->levels > max_levels) {
+        LOG_ERROR("Bad texture levels %u\n", header->levels);
+        return -1;
+    }
+
+    const uint32_t pixel_size = texture_pixel_size(header->format, header->type);
+
+    if (pixel_size == 0) {
+        LOG_ERROR("Unknown texture layout %#x %#x\n", header->format, header->type);
+        return -1;
+    }
+
+    // readers trust the sizes to walk the chain
+    for (uint32_t i = 0; i < header->levels; i++) {
+        const uint64_t width = header->width >> i > 0 ? header->width >> i : 1;
+        const uint64_t height = header->height >> i > 0 ? header->height >> i : 1;
+
+        if (header->level_sizes[i] != width * height * pixel_size) {
+            LOG_ERROR("Bad texture level %u size %u\n", i, header->level_sizes[i]);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+extern int
+read_texfile_levels(SDL_RWops *rw, const TEXFILE_HEADER *header, uint32_t first, IMAGE_DATA *image) {
+    assert(header != NULL);
+    assert(image != NULL);
+    assert(first < header->levels);
+
+    size_t offset = sizeof(TEXFILE_HEADER);
+    size_t size = 0;
+
+    for (uint32_t i = 0; i < header->levels; i++)
+        if (i < first)
+            offset += header->level_sizes[i];
+        else
+            size += header->level_sizes[i];
+
+    uint8_t *data = malloc(size);
+    if (!data) {
+        LOG_CRITICAL("%s\n", "Can't alloc memory");
+        exit(EXIT_FAILURE);
+    }
+
+    if (SDL_RWseek(rw, offset, RW_SEEK_SET) < 0 || SDL_RWread(rw, data, size, 1) != 1) {
+        LOG_ERROR("Can't read texture levels %u-%u\n", first, header->levels - 1);
+        free(data);
+        return -1;
+    }
+
+    const uint32_t width = header->width >> first;
+    const uint32_t height = header->height >> first;
+    const uint32_t base_size = header->level_sizes[first];
+
+    memset(image, 0, sizeof(IMAGE_DATA));
+    image->internalformat = header->internalformat;
+    image->width = width > 0 ? width : 1;
+    image->height = height > 0 ? height : 1;
+    image->format = header->format;
+    image->type = header->type;
+    image->pixels = data;
+    image->size = size;
+    image->levels = header->levels - first;
+    image->mipmaps = image->levels > 1;
+    image->bpp = base_size / (image->width * image->height) * 8;
+
+    // sRGB storage follows what the framebuffer can do, like targa textures
+    if (header->flags & TEXFILE_FLAG_SRGB)
+        image->internalformat = image->bpp == 24 ? video.i_rgb8 : video.i_rgba8;
+
+    return 0;
+}
+
+extern int
+load_texfile(SDL_RWops *rw, IMAGE_DATA *image) {
+    TEXFILE_HEADER header;
+
+    if (read_texfile_header(rw, &header) != 0) {
+        if (rw)
+            SDL_RWclose(rw);
+        return -1;
+    }
+
+    const int result = read_texfile_levels(rw, &header, 0, image);
+    SDL_RWclose(rw);
+
+    return result;
+}
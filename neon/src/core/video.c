@@ -1,3 +1,5 @@
+#include <assert.h>
+#include <string.h>
 #include <SDL2/SDL_video.h>
 #include <SDL2/SDL.h>
 #include <video/gl.h>
@@ -15,6 +17,17 @@
 #include "video/resources.h"
 #include <video/resources_detail.h>
 #include "video/info.h"
+#include "video/state.h"
+#include "video/capture.h"
+#include "video/commandbuffer.h"
+#include "video/instancing.h"
+#include "video/uniformring.h"
+#include "video/streambuffer.h"
+#include "video/geometry.h"
+#include "video/deletequeue.h"
+#include "video/uploader.h"
+#include "video/textureupload.h"
+#include "video/texturestreaming.h"
 
 SCREEN          screen = {.srgb_capable = false};
 VIDEO_INFO      video = {.debug = true};
@@ -149,6 +162,147 @@ video_init_formats(void) {
 static SDL_Window *window;
 static SDL_GLContext context;
 
+#define FRAME_MAX_SUBMITS 64
+#define FRAME_MAX_TARGETS 256
+
+typedef struct FrameSubmit {
+    bool        passes;
+    uint32_t    first;
+    uint32_t    count;
+} FRAME_SUBMIT;
+
+// submits of one frame, replayed in order by the render thread
+typedef struct QueuedFrame {
+    FRAME_SUBMIT            submits[FRAME_MAX_SUBMITS];
+    uint32_t                submits_count;
+    VIDEO_COMMAND_PASS      *passes[FRAME_MAX_TARGETS];
+    uint32_t                passes_count;
+    VIDEO_COMMAND_BUFFER    *buffers[FRAME_MAX_TARGETS];
+    uint32_t                buffers_count;
+} QUEUED_FRAME;
+
+static struct {
+    SDL_Thread      *thread;
+    SDL_mutex       *lock;
+    SDL_cond        *wake;      // render thread: frame queued, context wanted, quit
+    SDL_cond        *done;      // main thread: frame done, context released
+
+    QUEUED_FRAME    frames[VIDEO_FRAMES_IN_FLIGHT];
+    uint32_t        queued;     // frames handed over by video_swap_buffers
+    uint32_t        completed;  // frames swapped by the render thread
+
+    bool            quit;
+    bool            wanted;     // by the main thread
+    bool            owned;      // current on the render thread
+    int             locks;      // main thread nesting
+} render;
+
+static void
+run_frame(QUEUED_FRAME *frame) {
+    for (uint32_t i = 0; i < frame->submits_count; i++) {
+        const FRAME_SUBMIT *submit = &frame->submits[i];
+
+        if (submit->passes)
+            submit_command_passes(submit->count, &frame->passes[submit->first]);
+        else
+            submit_command_buffers(submit->count, &frame->buffers[submit->first]);
+    }
+
+    capture_frame_end();
+    texture_uploads_process();
+    stream_buffers_next_frame();
+    delete_queue_next_frame();
+    SDL_GL_SwapWindow(window);
+}
+
+static int
+render_thread(void *data) {
+    UNUSED(data);
+
+    SDL_LockMutex(render.lock);
+
+    for (;;) {
+        const bool pending = render.queued != render.completed;
+
+        if (render.wanted && render.owned) {
+            SDL_GL_MakeCurrent(window, NULL);
+            render.owned = false;
+            SDL_CondBroadcast(render.done);
+            continue;
+        }
+
+        if (render.quit && (render.wanted || !pending))
+            break;
+
+        if (render.wanted || !pending) {
+            SDL_CondWait(render.wake, render.lock);
+            continue;
+        }
+
+        if (!render.owned) {
+            SDL_GL_MakeCurrent(window, context);
+            render.owned = true;
+        }
+
+        QUEUED_FRAME *frame = &render.frames[(render.completed + 1) % VIDEO_FRAMES_IN_FLIGHT];
+
+        // the main thread only writes the slot after this one
+        SDL_UnlockMutex(render.lock);
+        run_frame(frame);
+        SDL_LockMutex(render.lock);
+
+        render.completed++;
+        SDL_CondBroadcast(render.done);
+    }
+
+    if (render.owned) {
+        SDL_GL_MakeCurrent(window, NULL);
+        render.owned = false;
+    }
+
+    SDL_UnlockMutex(render.lock);
+
+    return 0;
+}
+
+static void
+start_render_thread(void) {
+    render.lock = SDL_CreateMutex();
+    render.wake = SDL_CreateCond();
+    render.done = SDL_CreateCond();
+
+    if (!render.lock || !render.wake || !render.done) {
+        LOG_ERROR("%s\n", SDL_GetError());
+        exit(EXIT_FAILURE);
+    }
+
+    SDL_GL_MakeCurrent(window, NULL);
+
+    if ((render.thread = SDL_CreateThread(render_thread, "render", NULL)) == NULL) {
+        LOG_ERROR("%s\n", SDL_GetError());
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void
+stop_render_thread(void) {
+    SDL_LockMutex(render.lock);
+    render.quit = true;
+    SDL_CondSignal(render.wake);
+    SDL_UnlockMutex(render.lock);
+
+    SDL_WaitThread(render.thread, NULL);
+
+    SDL_DestroyCond(render.done);
+    SDL_DestroyCond(render.wake);
+    SDL_DestroyMutex(render.lock);
+
+    if (render.locks == 0)
+        SDL_GL_MakeCurrent(window, context);
+
+    render.thread = NULL;
+}
+
 typedef void (*VOIDFUNC)(void);
 static inline VOIDFUNC
 fn_cast(void *ptr) {
@@ -243,6 +397,7 @@ video_init(const char *title) {
 #endif // GL_ES_VERSION_2_0
 
     glLoadFunctions();
+    reset_state_cache();
     gpu_memory_info_init(window);
     LOG("%s\n", video_get_opengl_info());
 
@@ -309,12 +464,29 @@ video_init(const char *title) {
     video_warp_mouse(screen.width / 2, screen.height / 2);    
 
     resources_init();
+
+    if (screen.upload_thread)
+        uploader_start(window, context);
+
+    if (screen.render_thread)
+        start_render_thread();
 }
 
 extern void
 video_cleanup(void) {
+    if (render.thread)
+        stop_render_thread();
+
+    uploader_cleanup();
+    texture_streaming_cleanup();
+    texture_uploads_cleanup();
     glyph_cache_cleanup();
+    uniform_ring_cleanup();
+    command_buffers_cleanup();
+    instancing_cleanup();
+    geometry_cleanup();
     resources_cleanup();
+    delete_queue_cleanup();
 
     free(video.modes);
     video.modes = NULL;
@@ -325,7 +497,144 @@ video_cleanup(void) {
 
 extern void
 video_swap_buffers(void) {
-    SDL_GL_SwapWindow(window);
+    if (!render.thread) {
+        capture_frame_end();
+        texture_uploads_process();
+        stream_buffers_next_frame();
+        delete_queue_next_frame();
+        SDL_GL_SwapWindow(window);
+
+        render.queued++;
+        render.completed++;
+        return;
+    }
+
+    assert(render.locks == 0);
+
+    SDL_LockMutex(render.lock);
+    render.queued++;
+    SDL_CondSignal(render.wake);
+
+    // the next frame is recorded into the slot of the oldest one in flight
+    while (render.queued - render.completed >= VIDEO_FRAMES_IN_FLIGHT)
+        SDL_CondWait(render.done, render.lock);
+    SDL_UnlockMutex(render.lock);
+
+    QUEUED_FRAME *next = &render.frames[video_frame_slot()];
+    next->submits_count = 0;
+    next->passes_count = 0;
+    next->buffers_count = 0;
+}
+
+static QUEUED_FRAME *
+queue_submit(bool passes, size_t count, uint32_t first) {
+    QUEUED_FRAME *frame = &render.frames[video_frame_slot()];
+
+    if (frame->submits_count == FRAME_MAX_SUBMITS || first + count > FRAME_MAX_TARGETS) {
+        LOG_ERROR("%s\n", "Too many submits in a frame");
+        return NULL;
+    }
+
+    frame->submits[frame->submits_count++] = (FRAME_SUBMIT){passes, first, (uint32_t)count};
+
+    return frame;
+}
+
+extern void
+video_submit_passes(size_t count, VIDEO_COMMAND_PASS **passes) {
+    if (!render.thread) {
+        submit_command_passes(count, passes);
+        return;
+    }
+
+    QUEUED_FRAME *frame = queue_submit(true, count, render.frames[video_frame_slot()].passes_count);
+    if (!frame)
+        return;
+
+    memcpy(&frame->passes[frame->passes_count], passes, sizeof(VIDEO_COMMAND_PASS*) * count);
+    frame->passes_count += count;
+}
+
+extern void
+video_submit_buffers(size_t count, VIDEO_COMMAND_BUFFER **buffers) {
+    if (!render.thread) {
+        submit_command_buffers(count, buffers);
+        return;
+    }
+
+    QUEUED_FRAME *frame = queue_submit(false, count, render.frames[video_frame_slot()].buffers_count);
+    if (!frame)
+        return;
+
+    memcpy(&frame->buffers[frame->buffers_count], buffers, sizeof(VIDEO_COMMAND_BUFFER*) * count);
+    frame->buffers_count += count;
+}
+
+extern uint32_t
+video_frame_slot(void) {
+    return (render.queued + 1) % VIDEO_FRAMES_IN_FLIGHT;
+}
+
+extern uint32_t
+video_frame_fence(void) {
+    return render.queued + 1;
+}
+
+extern bool
+video_frame_done(uint32_t fence) {
+    if (!render.thread)
+        return (int32_t)(render.completed - fence) >= 0;
+
+    SDL_LockMutex(render.lock);
+    const bool done = (int32_t)(render.completed - fence) >= 0;
+    SDL_UnlockMutex(render.lock);
+
+    return done;
+}
+
+extern void
+video_wait_frame(uint32_t fence) {
+    // a frame still being recorded never completes
+    assert((int32_t)(render.queued - fence) >= 0);
+
+    if (!render.thread)
+        return;
+
+    SDL_LockMutex(render.lock);
+    while ((int32_t)(render.completed - fence) < 0)
+        SDL_CondWait(render.done, render.lock);
+    SDL_UnlockMutex(render.lock);
+}
+
+extern void
+video_lock_context(void) {
+    if (!render.thread || render.locks++ > 0)
+        return;
+
+    // queued frames wait until the context is back
+    SDL_LockMutex(render.lock);
+    render.wanted = true;
+    SDL_CondSignal(render.wake);
+    while (render.owned)
+        SDL_CondWait(render.done, render.lock);
+    SDL_UnlockMutex(render.lock);
+
+    SDL_GL_MakeCurrent(window, context);
+}
+
+extern void
+video_unlock_context(void) {
+    assert(!render.thread || render.locks > 0);
+
+    if (!render.thread || --render.locks > 0)
+        return;
+
+    SDL_GL_MakeCurrent(window, NULL);
+
+    SDL_LockMutex(render.lock);
+    render.wanted = false;
+    SDL_CondSignal(render.wake);
+    SDL_UnlockMutex(render.lock);
 }
 
 extern void
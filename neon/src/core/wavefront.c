@@ -8,6 +8,7 @@
 #include "core/wavefront.h"
 #include "core/logerr.h"
 #include "core/rwtext.h"
+#include "video/vertops.h"
 
 //#define WAVEFRONT_DEBUG
 #ifdef WAVEFRONT_DEBUG
@@ -164,93 +165,120 @@ free_wavefront(struct Wavefront *wavefront) {
     wavefront->num_faces = 0;
 }
 
-static v3_t *
-build_v3(const struct Wavefront *wavefront) {
+static v3n3_t *
+build_v3n3(const struct Wavefront *wavefront) {
     assert(wavefront != NULL);
 
     int count = (wavefront->num_faces);
-    v3_t *vertices = malloc(sizeof(v3_t) * count * 3);
+    v3n3_t *vertices = malloc(sizeof(v3n3_t) * count * 3);
 
-    memset(vertices, 0, sizeof(v3_t) * count * 3);
+    memset(vertices, 0, sizeof(v3n3_t) * count * 3);
 
     for (int i = 0; i < count; i++) {
         memcpy(vertices[i * 3 + 0].position, wavefront->positions[wavefront->faces[i].positions[0] - 1], sizeof(float3));
         memcpy(vertices[i * 3 + 1].position, wavefront->positions[wavefront->faces[i].positions[1] - 1], sizeof(float3));
         memcpy(vertices[i * 3 + 2].position, wavefront->positions[wavefront->faces[i].positions[2] - 1], sizeof(float3));
+
+        memcpy(vertices[i * 3 + 0].normal, wavefront->normals[wavefront->faces[i].normals[0] - 1], sizeof(float3));
+        memcpy(vertices[i * 3 + 1].normal, wavefront->normals[wavefront->faces[i].normals[1] - 1], sizeof(float3));
+        memcpy(vertices[i * 3 + 2].normal, wavefront->normals[wavefront->faces[i].normals[2] - 1], sizeof(float3));
     }
 
     return vertices;
 }
 
-
-static v3n3_t *
-build_v3n3(const struct Wavefront *wavefront) {
+static v3t2n3_t *
+build_v3t2n3(const struct Wavefront *wavefront) {
     assert(wavefront != NULL);
 
     int count = (wavefront->num_faces);
-    v3n3_t *vertices = malloc(sizeof(v3n3_t) * count * 3);
+    v3t2n3_t *vertices = malloc(sizeof(v3t2n3_t) * count * 3);
 
-    memset(vertices, 0, sizeof(v3n3_t) * count * 3);
+    memset(vertices, 0, sizeof(v3t2n3_t) * count * 3);
 
     for (int i = 0; i < count; i++) {
         memcpy(vertices[i * 3 + 0].position, wavefront->positions[wavefront->faces[i].positions[0] - 1], sizeof(float3));
         memcpy(vertices[i * 3 + 1].position, wavefront->positions[wavefront->faces[i].positions[1] - 1], sizeof(float3));
         memcpy(vertices[i * 3 + 2].position, wavefront->positions[wavefront->faces[i].positions[2] - 1], sizeof(float3));
 
-        memcpy(vertices[i * 3 + 0].normal, wavefront->positions[wavefront->faces[i].normals[0] - 1], sizeof(float3));
-        memcpy(vertices[i * 3 + 1].normal, wavefront->positions[wavefront->faces[i].normals[1] - 1], sizeof(float3));
-        memcpy(vertices[i * 3 + 2].normal, wavefront->positions[wavefront->faces[i].normals[2] - 1], sizeof(float3));
+        memcpy(vertices[i * 3 + 0].texcoord, wavefront->uvs[wavefront->faces[i].uvs[0] - 1], sizeof(float2));
+        memcpy(vertices[i * 3 + 1].texcoord, wavefront->uvs[wavefront->faces[i].uvs[1] - 1], sizeof(float2));
+        memcpy(vertices[i * 3 + 2].texcoord, wavefront->uvs[wavefront->faces[i].uvs[2] - 1], sizeof(float2));
+
+        memcpy(vertices[i * 3 + 0].normal, wavefront->normals[wavefront->faces[i].normals[0] - 1], sizeof(float3));
+        memcpy(vertices[i * 3 + 1].normal, wavefront->normals[wavefront->faces[i].normals[1] - 1], sizeof(float3));
+        memcpy(vertices[i * 3 + 2].normal, wavefront->normals[wavefront->faces[i].normals[2] - 1], sizeof(float3));
     }
 
     return vertices;
 }
 
-static v3t2_t *
-build_v3t2(const struct Wavefront *wavefront) {
+// textured meshes get tangents for normal mapping
+static v3t2n3t3_t *
+build_v3t2n3t3(const struct Wavefront *wavefront) {
     assert(wavefront != NULL);
 
-    int count = (wavefront->num_faces);
-    v3t2_t *vertices = malloc(sizeof(v3t2_t) * count * 3);
-
-    memset(vertices, 0, sizeof(v3t2_t) * count * 3);
+    const int count = wavefront->num_faces * 3;
+    v3t2n3_t *src = build_v3t2n3(wavefront);
+    v3t2n3t3_t *vertices = malloc(sizeof(v3t2n3t3_t) * count);
+    if (!src || !vertices) {
+        LOG_CRITICAL("%s\n", "Can't alloc memory");
+        exit(EXIT_FAILURE);
+    }
 
     for (int i = 0; i < count; i++) {
-        memcpy(vertices[i * 3 + 0].position, wavefront->positions[wavefront->faces[i].positions[0] - 1], sizeof(float3));
-        memcpy(vertices[i * 3 + 1].position, wavefront->positions[wavefront->faces[i].positions[1] - 1], sizeof(float3));
-        memcpy(vertices[i * 3 + 2].position, wavefront->positions[wavefront->faces[i].positions[2] - 1], sizeof(float3));
-
-        memcpy(vertices[i * 3 + 0].texcoord, wavefront->positions[wavefront->faces[i].uvs[0] - 1], sizeof(float2));
-        memcpy(vertices[i * 3 + 1].texcoord, wavefront->positions[wavefront->faces[i].uvs[1] - 1], sizeof(float2));
-        memcpy(vertices[i * 3 + 2].texcoord, wavefront->positions[wavefront->faces[i].uvs[2] - 1], sizeof(float2));
+        memcpy(vertices[i].position, src[i].position, sizeof(float3));
+        memcpy(vertices[i].texcoord, src[i].texcoord, sizeof(float2));
+        memcpy(vertices[i].normal, src[i].normal, sizeof(float3));
     }
 
+    free(src);
+
+    // one vertex a corner, no indices needed
+    vertops_tangents(vertices, count, NULL, IF_UI16, count);
+
     return vertices;
 }
 
-static v3t2n3_t *
-build_v3t2n3(const struct Wavefront *wavefront) {
+// smooth normal per position for files without 'vn' records
+static void
+generate_wavefront_normals(struct Wavefront *wavefront) {
     assert(wavefront != NULL);
 
-    int count = (wavefront->num_faces);
-    v3t2n3_t *vertices = malloc(sizeof(v3t2n3_t) * count * 3);
+    v3n3_t *points = malloc(sizeof(v3n3_t) * wavefront->num_positions);
+    uint32_t *indices = malloc(sizeof(uint32_t) * wavefront->num_faces * 3);
+    if (!points || !indices) {
+        LOG_CRITICAL("%s\n", "Can't alloc memory");
+        exit(EXIT_FAILURE);
+    }
 
-    memset(vertices, 0, sizeof(v3t2n3_t) * count * 3);
+    for (size_t i = 0; i < wavefront->num_positions; i++)
+        memcpy(points[i].position, wavefront->positions[i], sizeof(float3));
 
-    for (int i = 0; i < count; i++) {
-        memcpy(vertices[i * 3 + 0].position, wavefront->positions[wavefront->faces[i].positions[0] - 1], sizeof(float3));
-        memcpy(vertices[i * 3 + 1].position, wavefront->positions[wavefront->faces[i].positions[1] - 1], sizeof(float3));
-        memcpy(vertices[i * 3 + 2].position, wavefront->positions[wavefront->faces[i].positions[2] - 1], sizeof(float3));
+    for (size_t i = 0; i < wavefront->num_faces; i++)
+        for (int k = 0; k < 3; k++) {
+            indices[i * 3 + k] = wavefront->faces[i].positions[k] - 1;
+            wavefront->faces[i].normals[k] = wavefront->faces[i].positions[k];
+        }
 
-        memcpy(vertices[i * 3 + 0].texcoord, wavefront->positions[wavefront->faces[i].uvs[0] - 1], sizeof(float2));
-        memcpy(vertices[i * 3 + 1].texcoord, wavefront->positions[wavefront->faces[i].uvs[1] - 1], sizeof(float2));
-        memcpy(vertices[i * 3 + 2].texcoord, wavefront->positions[wavefront->faces[i].uvs[2] - 1], sizeof(float2));
+    vertops_normals(points, sizeof(v3n3_t), offsetof(v3n3_t, normal), wavefront->num_positions,
+                    indices, IF_UI32, wavefront->num_faces * 3);
 
-        memcpy(vertices[i * 3 + 0].normal, wavefront->positions[wavefront->faces[i].normals[0] - 1], sizeof(float3));
-        memcpy(vertices[i * 3 + 1].normal, wavefront->positions[wavefront->faces[i].normals[1] - 1], sizeof(float3));
-        memcpy(vertices[i * 3 + 2].normal, wavefront->positions[wavefront->faces[i].normals[2] - 1], sizeof(float3));
+    free(wavefront->normals);
+    wavefront->normals = malloc(sizeof(float3) * wavefront->num_positions);
+    if (!wavefront->normals) {
+        LOG_CRITICAL("%s\n", "Can't alloc memory");
+        exit(EXIT_FAILURE);
     }
+    wavefront->num_normals = wavefront->num_positions;
 
-    return vertices;
+    for (size_t i = 0; i < wavefront->num_positions; i++)
+        memcpy(wavefront->normals[i], points[i].normal, sizeof(float3));
+
+    free(points);
+    free(indices);
+
+    wavefront->vf = wavefront->vf == VF_V3T2 ? VF_V3T2N3 : VF_V3N3;
 }
 
 static unsigned short *
@@ -418,30 +446,23 @@ load_wavefront(SDL_RWops *rw, void **_vertices, int *_vertices_num, void **_indi
         }
     }
 
+    if (wavefront.vf == VF_V3 || wavefront.vf == VF_V3T2)
+        generate_wavefront_normals(&wavefront);
+
+    // files without normals got them above, only V3N3 and V3T2N3 are left
     switch (wavefront.vf) {
-    case VF_V3:
-        *_vertices = build_v3(&wavefront);
-        *_indices = build_indices(&wavefront);
-        *_vertices_num = faces_count * 3;
-        *_indices_num = faces_count * 3;
-        break;
     case VF_V3N3:
         *_vertices = build_v3n3(&wavefront);
         *_indices = build_indices(&wavefront);
         *_vertices_num = faces_count * 3;
         *_indices_num = faces_count * 3;
         break;
-    case VF_V3T2:
-        *_vertices = build_v3t2(&wavefront);
-        *_indices = build_indices(&wavefront);
-        *_vertices_num = faces_count * 3;
-        *_indices_num = faces_count * 3;
-        break;
     case VF_V3T2N3:
-        *_vertices = build_v3t2n3(&wavefront);
+        *_vertices = build_v3t2n3t3(&wavefront);
         *_indices = build_indices(&wavefront);
         *_vertices_num = faces_count * 3;
         *_indices_num = faces_count * 3;
+        wavefront.vf = VF_V3T2N3T3;
         break;
     default:
         LOG_ERROR("%s\n", "Unknown vertex format");
@@ -6,6 +6,8 @@
 #include "core/common.h"
 #include "core/logerr.h"
 #include "video/buffer.h"
+#include "video/state.h"
+#include "video/deletequeue.h"
 
 #ifndef GL_ES_VERSION_2_0
 
@@ -13,6 +15,7 @@ extern VIDEO_BUFFER
 new_uniform_buffer(const void *data, size_t size, unsigned int usage) {
     GLuint buffer = 0;
     glGenBuffers(1, &buffer);
+    track_video_object(VIDEO_OBJECT_BUFFER);
 
     glBindBuffer(GL_UNIFORM_BUFFER, buffer);
     glBufferData(GL_UNIFORM_BUFFER, size, data, usage);
@@ -49,6 +52,7 @@ extern VIDEO_BUFFER
 new_vertex_buffer(const void *vertices, size_t size, unsigned int usage) {
     GLuint buffer;
     glGenBuffers(1, &buffer);
+    track_video_object(VIDEO_OBJECT_BUFFER);
 
     glBindBuffer(GL_ARRAY_BUFFER, buffer);
     glBufferData(GL_ARRAY_BUFFER, size, vertices, usage);
@@ -60,6 +64,7 @@ extern VIDEO_BUFFER
 new_index_buffer(const void *indices, size_t size, unsigned int usage) {
     GLuint buffer;
     glGenBuffers(1, &buffer);
+    track_video_object(VIDEO_OBJECT_BUFFER);
 
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer);
     glBufferData(GL_ELEMENT_ARRAY_BUFFER, size, indices, usage);
@@ -72,6 +77,7 @@ extern VIDEO_BUFFER
 new_texture_buffer(const void *data, size_t size, unsigned int usage) {
     GLuint buffer;
     glGenBuffers(1, &buffer);
+    track_video_object(VIDEO_OBJECT_BUFFER);
 
     glBindBuffer(GL_TEXTURE_BUFFER, buffer);
     glBufferData(GL_TEXTURE_BUFFER, size, data, usage);
@@ -79,12 +85,25 @@ new_texture_buffer(const void *data, size_t size, unsigned int usage) {
 
     return (VIDEO_BUFFER){.id = buffer, .target = GL_TEXTURE_BUFFER, .size = size};
 }
+
+extern VIDEO_BUFFER
+new_pixel_buffer(const void *pixels, size_t size, unsigned int usage) {
+    GLuint buffer;
+    glGenBuffers(1, &buffer);
+    track_video_object(VIDEO_OBJECT_BUFFER);
+
+    // left bound it would turn client pointers of texture uploads into offsets
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, size, pixels, usage);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    return (VIDEO_BUFFER){.id = buffer, .target = GL_PIXEL_UNPACK_BUFFER, .size = size};
+}
 #endif // NO GL_ES_VERSION_2_0
 
 extern void
 free_video_buffer(VIDEO_BUFFER *buffer) {
-    if (glIsBuffer(buffer->id))
-        glDeleteBuffers(1, &buffer->id);
+    delete_video_object(VIDEO_OBJECT_BUFFER, buffer->id);
 
     buffer->id = 0;
 }
@@ -110,7 +129,13 @@ extern void
 video_buffer_update(VIDEO_BUFFER *buffer, size_t offset, const void *data, size_t size) {    
     glBindBuffer(buffer->target, buffer->id);
 #ifndef GL_ES_VERSION_2_0
-    void *ptr = glMapBufferRange(buffer->target, offset, size, GL_MAP_WRITE_BIT);
+    // the range is replaced as a whole, the driver may hand out fresh memory instead of waiting
+    void *ptr = glMapBufferRange(buffer->target, offset, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+
+    if (!ptr) {
+        glBufferSubData(buffer->target, offset, size, data);
+        return;
+    }
 
     memcpy(ptr, data, size);
 
@@ -127,6 +152,7 @@ new_vertex_array(void) {
 #ifndef GL_ES_VERSION_2_0
     GLuint va;
     glGenVertexArrays(1, &va);
+    track_video_object(VIDEO_OBJECT_VERTEX_ARRAY);
 
     return (VERTEX_ARRAY){.id = va};
 #else
@@ -138,8 +164,7 @@ new_vertex_array(void) {
 extern void
 free_vertex_array(VERTEX_ARRAY *array) {
 #ifndef GL_ES_VERSION_2_0
-    if (glIsVertexArray(array->id))
-        glDeleteVertexArrays(1, &array->id);
+    delete_video_object(VIDEO_OBJECT_VERTEX_ARRAY, array->id);
 
     array->id = 0;
 #else
@@ -150,7 +175,7 @@ free_vertex_array(VERTEX_ARRAY *array) {
 extern void
 bind_vertex_arrays(VERTEX_ARRAY *array) {
 #ifndef GL_ES_VERSION_2_0
-    glBindVertexArray(array->id);
+    state_bind_vertex_array(array->id);
 #else
     if (array->vertices_buffer) {
         glBindBuffer(GL_ARRAY_BUFFER, array->vertices_buffer);
@@ -173,7 +198,7 @@ unbind_vertex_array(VERTEX_ARRAY *array) {
 #ifndef GL_ES_VERSION_2_0
     UNUSED(array);
 
-    glBindVertexArray(0);
+    state_bind_vertex_array(0);
 #else
     for (size_t i = 0; i < array->attributes_count; i++)
         glDisableVertexAttribArray(array->attributes[i].attribindex);
@@ -0,0 +1,658 @@
+#include <assert.h>
+#include <math.h>
+#include <float.h>
+#include <stdlib.h>
+#include <string.h>
+#include <memtrack.h>
+
+#include "core/common.h"
+#include "core/logerr.h"
+#include "video/bvh.h"
+
+static inline void
+aabb_combine(AABB *out, const AABB *a, const AABB *b) {
+    for (int i = 0; i < 3; i++) {
+        out->min[i] = fminf(a->min[i], b->min[i]);
+        out->max[i] = fmaxf(a->max[i], b->max[i]);
+    }
+}
+
+static inline bool
+aabb_contains(const AABB *outer, const AABB *inner) {
+    for (int i = 0; i < 3; i++)
+        if (inner->min[i] < outer->min[i] || inner->max[i] > outer->max[i])
+            return false;
+
+    return true;
+}
+
+static inline bool
+aabb_overlaps(const AABB *a, const AABB *b) {
+    for (int i = 0; i < 3; i++)
+        if (a->max[i] < b->min[i] || a->min[i] > b->max[i])
+            return false;
+
+    return true;
+}
+
+static inline float
+aabb_area(const AABB *a) {
+    const float dx = a->max[0] - a->min[0];
+    const float dy = a->max[1] - a->min[1];
+    const float dz = a->max[2] - a->min[2];
+
+    return 2.f * (dx * dy + dy * dz + dz * dx);
+}
+
+static int32_t
+alloc_node(VIDEO_BVH *bvh) {
+    if (bvh->free_list == BVH_NULL_NODE) {
+        const uint32_t capacity = bvh->capacity * 2;
+
+        bvh->nodes = realloc(bvh->nodes, capacity * sizeof(BVH_NODE));
+        if (!bvh->nodes) {
+            LOG_CRITICAL("%s\n", "Can't alloc memory");
+            exit(EXIT_FAILURE);
+        }
+
+        for (uint32_t i = bvh->capacity; i < capacity; i++) {
+            bvh->nodes[i].next = i + 1 < capacity ? (int32_t)i + 1 : BVH_NULL_NODE;
+            bvh->nodes[i].height = -1;
+        }
+
+        bvh->free_list = bvh->capacity;
+        bvh->capacity = capacity;
+    }
+
+    const int32_t id = bvh->free_list;
+    BVH_NODE *node = &bvh->nodes[id];
+
+    bvh->free_list = node->next;
+    node->parent = BVH_NULL_NODE;
+    node->left = BVH_NULL_NODE;
+    node->right = BVH_NULL_NODE;
+    node->height = 0;
+    node->user = 0;
+    bvh->count++;
+
+    return id;
+}
+
+static void
+release_node(VIDEO_BVH *bvh, int32_t id) {
+    assert(id >= 0 && (uint32_t)id < bvh->capacity);
+    assert(bvh->count > 0);
+
+    bvh->nodes[id].next = bvh->free_list;
+    bvh->nodes[id].height = -1;
+    bvh->free_list = id;
+    bvh->count--;
+}
+
+extern VIDEO_BVH
+new_bvh(uint32_t capacity, float margin) {
+    VIDEO_BVH bvh;
+    memset(&bvh, 0, sizeof(bvh));
+
+    bvh.capacity = capacity > 0 ? capacity : 16;
+    bvh.nodes = malloc(bvh.capacity * sizeof(BVH_NODE));
+    if (!bvh.nodes) {
+        LOG_CRITICAL("%s\n", "Can't alloc memory");
+        exit(EXIT_FAILURE);
+    }
+
+    for (uint32_t i = 0; i < bvh.capacity; i++) {
+        bvh.nodes[i].next = i + 1 < bvh.capacity ? (int32_t)i + 1 : BVH_NULL_NODE;
+        bvh.nodes[i].height = -1;
+    }
+
+    bvh.root = BVH_NULL_NODE;
+    bvh.free_list = 0;
+    bvh.margin = margin;
+
+    return bvh;
+}
+
+extern void
+free_bvh(VIDEO_BVH *bvh) {
+    assert(bvh != NULL);
+
+    free(bvh->nodes);
+    memset(bvh, 0, sizeof(VIDEO_BVH));
+    bvh->root = BVH_NULL_NODE;
+    bvh->free_list = BVH_NULL_NODE;
+}
+
+static inline void
+fix_node(VIDEO_BVH *bvh, int32_t id) {
+    BVH_NODE *node = &bvh->nodes[id];
+    const BVH_NODE *l = &bvh->nodes[node->left];
+    const BVH_NODE *r = &bvh->nodes[node->right];
+
+    aabb_combine(&node->bound, &l->bound, &r->bound);
+    node->height = 1 + (l->height > r->height ? l->height : r->height);
+}
+
+// AVL style rotation, promotes the taller grandchild when |balance| > 1
+static int32_t
+balance(VIDEO_BVH *bvh, int32_t ia) {
+    BVH_NODE *a = &bvh->nodes[ia];
+    if (a->height < 2)
+        return ia;
+
+    const int32_t ib = a->left;
+    const int32_t ic = a->right;
+    BVH_NODE *b = &bvh->nodes[ib];
+    BVH_NODE *c = &bvh->nodes[ic];
+
+    const int32_t diff = c->height - b->height;
+
+    if (diff > 1) {
+        // rotate c up
+        const int32_t if_ = c->left;
+        const int32_t ig = c->right;
+        BVH_NODE *f = &bvh->nodes[if_];
+        BVH_NODE *g = &bvh->nodes[ig];
+
+        c->left = ia;
+        c->parent = a->parent;
+        a->parent = ic;
+
+        if (c->parent != BVH_NULL_NODE) {
+            BVH_NODE *p = &bvh->nodes[c->parent];
+            if (p->left == ia)
+                p->left = ic;
+            else
+                p->right = ic;
+        } else
+            bvh->root = ic;
+
+        if (f->height > g->height) {
+            c->right = if_;
+            a->right = ig;
+            g->parent = ia;
+        } else {
+            c->right = ig;
+            a->right = if_;
+            f->parent = ia;
+        }
+
+        fix_node(bvh, ia);
+        fix_node(bvh, ic);
+
+        return ic;
+    }
+
+    if (diff < -1) {
+        // rotate b up
+        const int32_t id = b->left;
+        const int32_t ie = b->right;
+        BVH_NODE *d = &bvh->nodes[id];
+        BVH_NODE *e = &bvh->nodes[ie];
+
+        b->left = ia;
+        b->parent = a->parent;
+        a->parent = ib;
+
+        if (b->parent != BVH_NULL_NODE) {
+            BVH_NODE *p = &bvh->nodes[b->parent];
+            if (p->left == ia)
+                p->left = ib;
+            else
+                p->right = ib;
+        } else
+            bvh->root = ib;
+
+        if (d->height > e->height) {
+            b->right = id;
+            a->left = ie;
+            e->parent = ia;
+        } else {
+            b->right = ie;
+            a->left = id;
+            d->parent = ia;
+        }
+
+        fix_node(bvh, ia);
+        fix_node(bvh, ib);
+
+        return ib;
+    }
+
+    return ia;
+}
+
+static void
+walk_up(VIDEO_BVH *bvh, int32_t id) {
+    while (id != BVH_NULL_NODE) {
+        id = balance(bvh, id);
+        fix_node(bvh, id);
+        id = bvh->nodes[id].parent;
+    }
+}
+
+static void
+insert_leaf(VIDEO_BVH *bvh, int32_t leaf) {
+    if (bvh->root == BVH_NULL_NODE) {
+        bvh->root = leaf;
+        bvh->nodes[leaf].parent = BVH_NULL_NODE;
+        return;
+    }
+
+    // descend by surface area heuristic
+    const AABB leaf_bound = bvh->nodes[leaf].bound;
+    int32_t index = bvh->root;
+
+    while (bvh->nodes[index].height > 0) {
+        const BVH_NODE *node = &bvh->nodes[index];
+        const float area = aabb_area(&node->bound);
+
+        AABB combined;
+        aabb_combine(&combined, &node->bound, &leaf_bound);
+        const float combined_area = aabb_area(&combined);
+
+        const float cost = 2.f * combined_area;
+        const float inheritance = 2.f * (combined_area - area);
+
+        float child_cost[2];
+        const int32_t children[2] = {node->left, node->right};
+
+        for (int i = 0; i < 2; i++) {
+            const BVH_NODE *child = &bvh->nodes[children[i]];
+            AABB box;
+            aabb_combine(&box, &leaf_bound, &child->bound);
+
+            if (child->height == 0)
+                child_cost[i] = aabb_area(&box) + inheritance;
+            else
+                child_cost[i] = aabb_area(&box) - aabb_area(&child->bound) + inheritance;
+        }
+
+        if (cost < child_cost[0] && cost < child_cost[1])
+            break;
+
+        index = child_cost[0] < child_cost[1] ? children[0] : children[1];
+    }
+
+    const int32_t sibling = index;
+    const int32_t old_parent = bvh->nodes[sibling].parent;
+    const int32_t new_parent = alloc_node(bvh);
+
+    BVH_NODE *np = &bvh->nodes[new_parent];
+    np->parent = old_parent;
+    np->left = sibling;
+    np->right = leaf;
+    aabb_combine(&np->bound, &leaf_bound, &bvh->nodes[sibling].bound);
+    np->height = bvh->nodes[sibling].height + 1;
+
+    if (old_parent != BVH_NULL_NODE) {
+        BVH_NODE *op = &bvh->nodes[old_parent];
+        if (op->left == sibling)
+            op->left = new_parent;
+        else
+            op->right = new_parent;
+    } else
+        bvh->root = new_parent;
+
+    bvh->nodes[sibling].parent = new_parent;
+    bvh->nodes[leaf].parent = new_parent;
+
+    walk_up(bvh, bvh->nodes[leaf].parent);
+}
+
+static void
+remove_leaf(VIDEO_BVH *bvh, int32_t leaf) {
+    if (leaf == bvh->root) {
+        bvh->root = BVH_NULL_NODE;
+        return;
+    }
+
+    const int32_t parent = bvh->nodes[leaf].parent;
+    const int32_t grand_parent = bvh->nodes[parent].parent;
+    const int32_t sibling = bvh->nodes[parent].left == leaf ? bvh->nodes[parent].right : bvh->nodes[parent].left;
+
+    if (grand_parent != BVH_NULL_NODE) {
+        BVH_NODE *gp = &bvh->nodes[grand_parent];
+        if (gp->left == parent)
+            gp->left = sibling;
+        else
+            gp->right = sibling;
+
+        bvh->nodes[sibling].parent = grand_parent;
+        release_node(bvh, parent);
+
+        walk_up(bvh, grand_parent);
+    } else {
+        bvh->root = sibling;
+        bvh->nodes[sibling].parent = BVH_NULL_NODE;
+        release_node(bvh, parent);
+    }
+}
+
+static inline void
+fatten(AABB *out, const AABB *bound, float margin) {
+    for (int i = 0; i < 3; i++) {
+        out->min[i] = bound->min[i] - margin;
+        out->max[i] = bound->max[i] + margin;
+    }
+}
+
+extern int32_t
+bvh_insert(VIDEO_BVH *bvh, const AABB *bound, uint32_t user) {
+    assert(bvh != NULL);
+    assert(bound != NULL);
+
+    const int32_t leaf = alloc_node(bvh);
+
+    fatten(&bvh->nodes[leaf].bound, bound, bvh->margin);
+    bvh->nodes[leaf].user = user;
+    bvh->leaves++;
+
+    insert_leaf(bvh, leaf);
+
+    return leaf;
+}
+
+extern void
+bvh_remove(VIDEO_BVH *bvh, int32_t proxy) {
+    assert(bvh != NULL);
+    assert(proxy >= 0 && (uint32_t)proxy < bvh->capacity);
+    assert(bvh->nodes[proxy].height == 0);
+
+    remove_leaf(bvh, proxy);
+    release_node(bvh, proxy);
+    bvh->leaves--;
+}
+
+extern bool
+bvh_move(VIDEO_BVH *bvh, int32_t proxy, const AABB *bound) {
+    assert(bvh != NULL);
+    assert(proxy >= 0 && (uint32_t)proxy < bvh->capacity);
+    assert(bvh->nodes[proxy].height == 0);
+
+    if (aabb_contains(&bvh->nodes[proxy].bound, bound))
+        return false;
+
+    remove_leaf(bvh, proxy);
+    fatten(&bvh->nodes[proxy].bound, bound, bvh->margin);
+    insert_leaf(bvh, proxy);
+
+    return true;
+}
+
+static void
+refit_node(VIDEO_BVH *bvh, int32_t id) {
+    if (bvh->nodes[id].height == 0)
+        return;
+
+    refit_node(bvh, bvh->nodes[id].left);
+    refit_node(bvh, bvh->nodes[id].right);
+    fix_node(bvh, id);
+}
+
+extern void
+bvh_refit(VIDEO_BVH *bvh) {
+    assert(bvh != NULL);
+
+    if (bvh->root != BVH_NULL_NODE)
+        refit_node(bvh, bvh->root);
+}
+
+extern uint32_t
+bvh_get_user(const VIDEO_BVH *bvh, int32_t proxy) {
+    assert(bvh != NULL);
+    assert(proxy >= 0 && (uint32_t)proxy < bvh->capacity);
+
+    return bvh->nodes[proxy].user;
+}
+
+extern int32_t
+bvh_height(const VIDEO_BVH *bvh) {
+    assert(bvh != NULL);
+
+    return bvh->root == BVH_NULL_NODE ? 0 : bvh->nodes[bvh->root].height;
+}
+
+// traversal stack on the C stack, spills to the heap when a degenerate tree runs deeper
+struct TraversalStack {
+    int32_t     *items;
+    int         top;
+    int         capacity;
+    int32_t     local[BVH_STACK_SIZE];
+};
+
+static inline void
+stack_begin(struct TraversalStack *stack, int32_t id) {
+    stack->items = stack->local;
+    stack->capacity = BVH_STACK_SIZE;
+    stack->items[0] = id;
+    stack->top = 1;
+}
+
+static void
+stack_grow(struct TraversalStack *stack) {
+    const int capacity = stack->capacity * 2;
+    int32_t *items = malloc(sizeof(int32_t) * capacity);
+    if (!items) {
+        LOG_CRITICAL("%s\n", "Can't alloc memory");
+        exit(EXIT_FAILURE);
+    }
+
+    memcpy(items, stack->items, sizeof(int32_t) * stack->top);
+
+    if (stack->items != stack->local)
+        free(stack->items);
+
+    stack->items = items;
+    stack->capacity = capacity;
+}
+
+static inline void
+stack_push(struct TraversalStack *stack, int32_t id) {
+    if (stack->top == stack->capacity)
+        stack_grow(stack);
+
+    stack->items[stack->top++] = id;
+}
+
+static inline void
+stack_end(struct TraversalStack *stack) {
+    if (stack->items != stack->local)
+        free(stack->items);
+}
+
+extern uint32_t
+bvh_query_aabb(const VIDEO_BVH *bvh, const AABB *bound, uint32_t *users, uint32_t max_count) {
+    assert(bvh != NULL);
+    assert(bound != NULL);
+
+    if (bvh->root == BVH_NULL_NODE)
+        return 0;
+
+    struct TraversalStack stack;
+    uint32_t n = 0;
+
+    stack_begin(&stack, bvh->root);
+
+    while (stack.top > 0 && n < max_count) {
+        const BVH_NODE *node = &bvh->nodes[stack.items[--stack.top]];
+
+        if (!aabb_overlaps(&node->bound, bound))
+            continue;
+
+        if (node->height == 0)
+            users[n++] = node->user;
+        else {
+            stack_push(&stack, node->left);
+            stack_push(&stack, node->right);
+        }
+    }
+
+    stack_end(&stack);
+
+    return n;
+}
+
+enum {
+    FRUSTUM_OUTSIDE,
+    FRUSTUM_INTERSECT,
+    FRUSTUM_INSIDE
+};
+
+static inline int
+classify_frustum(const VIDEO_FRUSTUM *frustum, const AABB *bound) {
+    int result = FRUSTUM_INSIDE;
+
+    for (int p = 0; p < FRUSTUM_PLANES_NUM; p++) {
+        const float *pl = frustum->planes[p];
+
+        const float dist_max = pl[0] * (pl[0] > 0.f ? bound->max[0] : bound->min[0])
+                        + pl[1] * (pl[1] > 0.f ? bound->max[1] : bound->min[1])
+                        + pl[2] * (pl[2] > 0.f ? bound->max[2] : bound->min[2]) + pl[3];
+        if (dist_max < 0.f)
+            return FRUSTUM_OUTSIDE;
+
+        const float dist_min = pl[0] * (pl[0] > 0.f ? bound->min[0] : bound->max[0])
+                         + pl[1] * (pl[1] > 0.f ? bound->min[1] : bound->max[1])
+                         + pl[2] * (pl[2] > 0.f ? bound->min[2] : bound->max[2]) + pl[3];
+        if (dist_min < 0.f)
+            result = FRUSTUM_INTERSECT;
+    }
+
+    return result;
+}
+
+// emits every leaf below id without further plane tests
+static uint32_t
+collect_leaves(const VIDEO_BVH *bvh, int32_t id, uint32_t *users, uint32_t n, uint32_t max_count) {
+    struct TraversalStack stack;
+
+    stack_begin(&stack, id);
+
+    while (stack.top > 0 && n < max_count) {
+        const BVH_NODE *node = &bvh->nodes[stack.items[--stack.top]];
+
+        if (node->height == 0)
+            users[n++] = node->user;
+        else {
+            stack_push(&stack, node->left);
+            stack_push(&stack, node->right);
+        }
+    }
+
+    stack_end(&stack);
+
+    return n;
+}
+
+extern uint32_t
+bvh_query_frustum(const VIDEO_BVH *bvh, const VIDEO_FRUSTUM *frustum, uint32_t *users, uint32_t max_count) {
+    assert(bvh != NULL);
+    assert(frustum != NULL);
+
+    if (bvh->root == BVH_NULL_NODE)
+        return 0;
+
+    struct TraversalStack stack;
+    uint32_t n = 0;
+
+    stack_begin(&stack, bvh->root);
+
+    while (stack.top > 0 && n < max_count) {
+        const int32_t id = stack.items[--stack.top];
+        const BVH_NODE *node = &bvh->nodes[id];
+
+        const int c = classify_frustum(frustum, &node->bound);
+        if (c == FRUSTUM_OUTSIDE)
+            continue;
+
+        if (node->height == 0)
+            users[n++] = node->user;
+        else if (c == FRUSTUM_INSIDE)
+            n = collect_leaves(bvh, id, users, n, max_count);
+        else {
+            stack_push(&stack, node->left);
+            stack_push(&stack, node->right);
+        }
+    }
+
+    stack_end(&stack);
+
+    return n;
+}
+
+// slab test, returns entry distance or a negative value on miss, a zero inv_dir marks an axis the ray doesn't move on
+static inline float
+ray_aabb(const float3 origin, const float3 inv_dir, float max_t, const AABB *bound) {
+    float tmin = 0.f, tmax = max_t;
+
+    for (int i = 0; i < 3; i++) {
+        // parallel to the slab, 0 * inf would give NaN
+        if (inv_dir[i] == 0.f) {
+            if (origin[i] < bound->min[i] || origin[i] > bound->max[i])
+                return -1.f;
+            continue;
+        }
+
+        float t0 = (bound->min[i] - origin[i]) * inv_dir[i];
+        float t1 = (bound->max[i] - origin[i]) * inv_dir[i];
+
+        if (t0 > t1) {
+            const float tmp = t0;
+            t0 = t1;
+            t1 = tmp;
+        }
+
+        tmin = t0 > tmin ? t0 : tmin;
+        tmax = t1 < tmax ? t1 : tmax;
+
+        if (tmin > tmax)
+            return -1.f;
+    }
+
+    return tmin;
+}
+
+extern bool
+bvh_raycast(const VIDEO_BVH *bvh, const float3 origin, const float3 dir, float max_t, uint32_t *user, float *t) {
+    assert(bvh != NULL);
+
+    if (bvh->root == BVH_NULL_NODE)
+        return false;
+
+    // zero and denormal components would invert to inf
+    float3 inv_dir;
+    for (int i = 0; i < 3; i++)
+        inv_dir[i] = fabsf(dir[i]) < FLT_MIN ? 0.f : 1.f / dir[i];
+
+    struct TraversalStack stack;
+    float best = max_t;
+    bool hit = false;
+
+    stack_begin(&stack, bvh->root);
+
+    while (stack.top > 0) {
+        const BVH_NODE *node = &bvh->nodes[stack.items[--stack.top]];
+
+        const float d = ray_aabb(origin, inv_dir, best, &node->bound);
+        if (d < 0.f)
+            continue;
+
+        if (node->height == 0) {
+            best = d;
+            hit = true;
+            if (user)
+                *user = node->user;
+        } else {
+            stack_push(&stack, node->left);
+            stack_push(&stack, node->right);
+        }
+    }
+
+    stack_end(&stack);
+
+    if (hit && t)
+        *t = best;
+
+    return hit;
+}
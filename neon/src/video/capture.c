@@ -0,0 +1,1759 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <video/gl.h>
+#include <memtrack.h>
+
+#include "core/logerr.h"
+#include "core/video.h"
+#include "video/capture.h"
+#include "video/instancing.h"
+#include "video/shader.h"
+#include "video/state.h"
+
+#define CAPTURE_FILENAME_SIZE 256
+#define CAPTURE_MAX_SHADERS 4
+#define CAPTURE_MAX_ATTRIBUTES 32
+#define CAPTURE_MAX_TEXTURE_LEVELS 16
+#define CAPTURE_MAX_DRAW_BUFFERS 8
+#define CAPTURE_COMMAND_WORDS 6
+
+#ifndef GL_ES_VERSION_2_0
+
+static const uint32_t texture_params[] = {
+    GL_TEXTURE_MIN_FILTER, GL_TEXTURE_MAG_FILTER,
+    GL_TEXTURE_WRAP_S, GL_TEXTURE_WRAP_T, GL_TEXTURE_WRAP_R,
+    GL_TEXTURE_BASE_LEVEL, GL_TEXTURE_MAX_LEVEL,
+    GL_TEXTURE_COMPARE_MODE, GL_TEXTURE_COMPARE_FUNC,
+    GL_TEXTURE_SWIZZLE_R, GL_TEXTURE_SWIZZLE_G, GL_TEXTURE_SWIZZLE_B, GL_TEXTURE_SWIZZLE_A
+};
+
+static const uint32_t sampler_params[] = {
+    GL_TEXTURE_MIN_FILTER, GL_TEXTURE_MAG_FILTER,
+    GL_TEXTURE_WRAP_S, GL_TEXTURE_WRAP_T, GL_TEXTURE_WRAP_R,
+    GL_TEXTURE_COMPARE_MODE, GL_TEXTURE_COMPARE_FUNC
+};
+
+#define TEXTURE_PARAMS_NUM (sizeof(texture_params) / sizeof(texture_params[0]))
+#define SAMPLER_PARAMS_NUM (sizeof(sampler_params) / sizeof(sampler_params[0]))
+
+struct CaptureStream {
+    uint8_t     *data;
+    size_t      size;
+    size_t      capacity;
+};
+
+struct NameSet {
+    uint32_t    *names;
+    uint32_t    count;
+    uint32_t    capacity;
+};
+
+static struct {
+    bool                    active;
+    char                    filename[CAPTURE_FILENAME_SIZE];
+    struct CaptureStream    stream;
+    struct NameSet          captured[CAPTURE_OBJECT_TYPES];
+} capture;
+
+static void
+stream_put(struct CaptureStream *stream, const void *data, size_t size) {
+    if (stream->size + size > stream->capacity) {
+        size_t capacity = stream->capacity ? stream->capacity : 65536;
+        while (capacity < stream->size + size)
+            capacity *= 2;
+
+        stream->data = realloc(stream->data, capacity);
+        if (!stream->data) {
+            LOG_CRITICAL("%s\n", "Can't alloc memory");
+            exit(EXIT_FAILURE);
+        }
+
+        stream->capacity = capacity;
+    }
+
+    memcpy(stream->data + stream->size, data, size);
+    stream->size += size;
+}
+
+static inline void
+put_u32(uint32_t value) {
+    stream_put(&capture.stream, &value, sizeof(value));
+}
+
+static inline void
+put_i32(int32_t value) {
+    stream_put(&capture.stream, &value, sizeof(value));
+}
+
+static inline void
+put_bytes(const void *data, size_t size) {
+    stream_put(&capture.stream, data, size);
+}
+
+static void
+put_string(const char *s) {
+    const uint32_t length = (uint32_t)strlen(s);
+
+    put_u32(length);
+    put_bytes(s, length);
+}
+
+// records are tagged with their size, the size is patched when the record ends
+static size_t
+begin_record(uint32_t type) {
+    put_u32(type);
+    put_u32(0);
+
+    return capture.stream.size;
+}
+
+static void
+end_record(size_t start) {
+    const uint32_t size = (uint32_t)(capture.stream.size - start);
+    memcpy(capture.stream.data + start - sizeof(uint32_t), &size, sizeof(size));
+}
+
+// true when the name was not captured yet
+static bool
+name_set_add(struct NameSet *set, uint32_t name) {
+    for (uint32_t i = 0; i < set->count; i++)
+        if (set->names[i] == name)
+            return false;
+
+    if (set->count == set->capacity) {
+        set->capacity = set->capacity ? set->capacity * 2 : 64;
+        set->names = realloc(set->names, sizeof(uint32_t) * set->capacity);
+
+        if (!set->names) {
+            LOG_CRITICAL("%s\n", "Can't alloc memory");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    set->names[set->count++] = name;
+
+    return true;
+}
+
+static uint32_t
+uniform_components(uint32_t type) {
+    switch (type) {
+    case GL_FLOAT: case GL_INT: case GL_UNSIGNED_INT: case GL_BOOL:
+        return 1;
+    case GL_FLOAT_VEC2: case GL_INT_VEC2: case GL_UNSIGNED_INT_VEC2: case GL_BOOL_VEC2:
+        return 2;
+    case GL_FLOAT_VEC3: case GL_INT_VEC3: case GL_UNSIGNED_INT_VEC3: case GL_BOOL_VEC3:
+        return 3;
+    case GL_FLOAT_VEC4: case GL_INT_VEC4: case GL_UNSIGNED_INT_VEC4: case GL_BOOL_VEC4:
+    case GL_FLOAT_MAT2:
+        return 4;
+    case GL_FLOAT_MAT2x3: case GL_FLOAT_MAT3x2:
+        return 6;
+    case GL_FLOAT_MAT2x4: case GL_FLOAT_MAT4x2:
+        return 8;
+    case GL_FLOAT_MAT3:
+        return 9;
+    case GL_FLOAT_MAT3x4: case GL_FLOAT_MAT4x3:
+        return 12;
+    case GL_FLOAT_MAT4:
+        return 16;
+    }
+
+    return 1; // samplers
+}
+
+static bool
+uniform_is_float(uint32_t type) {
+    switch (type) {
+    case GL_FLOAT: case GL_FLOAT_VEC2: case GL_FLOAT_VEC3: case GL_FLOAT_VEC4:
+    case GL_FLOAT_MAT2: case GL_FLOAT_MAT3: case GL_FLOAT_MAT4:
+    case GL_FLOAT_MAT2x3: case GL_FLOAT_MAT2x4: case GL_FLOAT_MAT3x2:
+    case GL_FLOAT_MAT3x4: case GL_FLOAT_MAT4x2: case GL_FLOAT_MAT4x3:
+        return true;
+    }
+
+    return false;
+}
+
+static bool
+uniform_is_unsigned(uint32_t type) {
+    return type == GL_UNSIGNED_INT || type == GL_UNSIGNED_INT_VEC2 ||
+            type == GL_UNSIGNED_INT_VEC3 || type == GL_UNSIGNED_INT_VEC4;
+}
+
+// "name[0]" -> "name[i]"
+static void
+uniform_element_name(char *dest, size_t size, const char *name, int element) {
+    const char *bracket = strrchr(name, '[');
+    const int length = bracket ? (int)(bracket - name) : (int)strlen(name);
+
+    snprintf(dest, size, "%.*s[%d]", length, name, element);
+}
+
+static void
+capture_program(uint32_t program) {
+    if (program == 0 || !name_set_add(&capture.captured[CAPTURE_PROGRAM], program))
+        return;
+
+    if (!glIsProgram(program)) {
+        LOG_WARNING("Capture: %u is not a program\n", program);
+        return;
+    }
+
+    GLuint shaders[CAPTURE_MAX_SHADERS];
+    GLsizei shaders_count = 0;
+    glGetAttachedShaders(program, CAPTURE_MAX_SHADERS, &shaders_count, shaders);
+
+    const size_t record = begin_record(CAPTURE_PROGRAM);
+    put_u32(program);
+
+    put_u32(shaders_count);
+    for (GLsizei i = 0; i < shaders_count; i++) {
+        GLint type = 0, length = 0;
+        glGetShaderiv(shaders[i], GL_SHADER_TYPE, &type);
+        glGetShaderiv(shaders[i], GL_SHADER_SOURCE_LENGTH, &length);
+
+        char *source = malloc(length + 1);
+        GLsizei written = 0;
+        glGetShaderSource(shaders[i], length + 1, &written, source);
+
+        put_u32(type);
+        put_u32(written);
+        put_bytes(source, written);
+
+        free(source);
+    }
+
+    char name[MAX_UNIFORM_NAME_SIZE];
+    GLint attributes_count = 0;
+    glGetProgramiv(program, GL_ACTIVE_ATTRIBUTES, &attributes_count);
+
+    put_u32(attributes_count);
+    for (GLint i = 0; i < attributes_count; i++) {
+        GLint size = 0;
+        GLenum type = 0;
+        glGetActiveAttrib(program, i, sizeof(name), NULL, &size, &type, name);
+
+        put_string(name);
+        put_i32(glGetAttribLocation(program, name));
+    }
+
+    GLint uniforms_count = 0;
+    glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &uniforms_count);
+
+    put_u32(uniforms_count);
+    for (GLint i = 0; i < uniforms_count; i++) {
+        GLint size = 0;
+        GLenum type = 0;
+        glGetActiveUniform(program, i, sizeof(name), NULL, &size, &type, name);
+
+        // block members have no location, the block contents are not captured
+        if (glGetUniformLocation(program, name) < 0)
+            size = 0;
+
+        put_string(name);
+        put_u32(type);
+        put_u32(size);
+
+        // current values, uniforms set outside command buffers are part of the frame
+        for (GLint e = 0; e < size; e++) {
+            char element[MAX_UNIFORM_NAME_SIZE + 16];
+            uniform_element_name(element, sizeof(element), name, e);
+
+            const int location = e == 0 ? glGetUniformLocation(program, name) : glGetUniformLocation(program, element);
+            uint32_t values[16] = {0};
+
+            if (location >= 0) {
+                if (uniform_is_float(type))
+                    glGetUniformfv(program, location, (GLfloat*)values);
+                else if (uniform_is_unsigned(type))
+                    glGetUniformuiv(program, location, values);
+                else
+                    glGetUniformiv(program, location, (GLint*)values);
+            }
+
+            put_i32(location);
+            put_bytes(values, sizeof(uint32_t) * uniform_components(type));
+        }
+    }
+
+    // block contents stream with the commands, only their bindings belong to the program
+    GLint blocks_count = 0;
+    glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCKS, &blocks_count);
+
+    put_u32(blocks_count);
+    for (GLint i = 0; i < blocks_count; i++) {
+        GLint binding = 0;
+        glGetActiveUniformBlockName(program, i, sizeof(name), NULL, name);
+        glGetActiveUniformBlockiv(program, i, GL_UNIFORM_BLOCK_BINDING, &binding);
+
+        put_string(name);
+        put_i32(binding);
+    }
+
+    end_record(record);
+}
+
+static void
+readback_format(uint32_t target, int level, int internalformat, uint32_t *format, uint32_t *type, uint32_t *pixel_size) {
+    switch (internalformat) {
+    case GL_DEPTH_COMPONENT:
+    case GL_DEPTH_COMPONENT16:
+    case GL_DEPTH_COMPONENT24:
+    case GL_DEPTH_COMPONENT32:
+    case GL_DEPTH_COMPONENT32F:
+        *format = GL_DEPTH_COMPONENT;
+        *type = GL_FLOAT;
+        *pixel_size = 4;
+        return;
+    case GL_DEPTH_STENCIL:
+    case GL_DEPTH24_STENCIL8:
+        *format = GL_DEPTH_STENCIL;
+        *type = GL_UNSIGNED_INT_24_8;
+        *pixel_size = 4;
+        return;
+    case GL_DEPTH32F_STENCIL8:
+        *format = GL_DEPTH_STENCIL;
+        *type = GL_FLOAT_32_UNSIGNED_INT_24_8_REV;
+        *pixel_size = 8;
+        return;
+    }
+
+    GLint red_type = GL_NONE, red_size = 0;
+    glGetTexLevelParameteriv(target, level, GL_TEXTURE_RED_TYPE, &red_type);
+    glGetTexLevelParameteriv(target, level, GL_TEXTURE_RED_SIZE, &red_size);
+
+    if (red_type == GL_INT || red_type == GL_UNSIGNED_INT) {
+        *format = GL_RGBA_INTEGER;
+        *type = red_type;
+        *pixel_size = 16;
+    } else if (red_type == GL_FLOAT || red_size > 8) {
+        *format = GL_RGBA;
+        *type = GL_FLOAT;
+        *pixel_size = 16;
+    } else {
+        // raw bytes, sRGB data stays encoded both ways
+        *format = GL_RGBA;
+        *type = GL_UNSIGNED_BYTE;
+        *pixel_size = 4;
+    }
+}
+
+static void
+capture_texture(uint32_t texture, uint32_t target) {
+    if (texture == 0 || !name_set_add(&capture.captured[CAPTURE_TEXTURE], texture))
+        return;
+
+    if (target >= GL_TEXTURE_CUBE_MAP_POSITIVE_X && target <= GL_TEXTURE_CUBE_MAP_NEGATIVE_Z)
+        target = GL_TEXTURE_CUBE_MAP;
+
+    if (target != GL_TEXTURE_2D && target != GL_TEXTURE_2D_ARRAY && target != GL_TEXTURE_3D &&
+            target != GL_TEXTURE_CUBE_MAP && target != GL_TEXTURE_2D_MULTISAMPLE) {
+        LOG_WARNING("Capture: texture %u target 0x%x not supported\n", texture, target);
+        return;
+    }
+
+    state_bind_texture(0, target, texture);
+
+    const uint32_t faces = target == GL_TEXTURE_CUBE_MAP ? 6 : 1;
+    const uint32_t image_target = target == GL_TEXTURE_CUBE_MAP ? GL_TEXTURE_CUBE_MAP_POSITIVE_X : target;
+
+    uint32_t levels = 0;
+    while (levels < CAPTURE_MAX_TEXTURE_LEVELS) {
+        GLint width = 0;
+        glGetTexLevelParameteriv(image_target, levels, GL_TEXTURE_WIDTH, &width);
+
+        if (width == 0)
+            break;
+
+        levels++;
+    }
+
+    const size_t record = begin_record(CAPTURE_TEXTURE);
+    put_u32(texture);
+    put_u32(target);
+
+    GLint samples = 0;
+    if (target == GL_TEXTURE_2D_MULTISAMPLE)
+        glGetTexLevelParameteriv(target, 0, GL_TEXTURE_SAMPLES, &samples);
+    put_i32(samples);
+
+    for (size_t i = 0; i < TEXTURE_PARAMS_NUM; i++) {
+        GLint value = 0;
+        if (target != GL_TEXTURE_2D_MULTISAMPLE)
+            glGetTexParameteriv(target, texture_params[i], &value);
+        put_i32(value);
+    }
+
+    put_u32(levels);
+    for (uint32_t level = 0; level < levels; level++) {
+        GLint width = 0, height = 0, depth = 0, internalformat = 0, compressed = 0;
+        glGetTexLevelParameteriv(image_target, level, GL_TEXTURE_WIDTH, &width);
+        glGetTexLevelParameteriv(image_target, level, GL_TEXTURE_HEIGHT, &height);
+        glGetTexLevelParameteriv(image_target, level, GL_TEXTURE_DEPTH, &depth);
+        glGetTexLevelParameteriv(image_target, level, GL_TEXTURE_INTERNAL_FORMAT, &internalformat);
+        glGetTexLevelParameteriv(image_target, level, GL_TEXTURE_COMPRESSED, &compressed);
+
+        put_i32(width);
+        put_i32(height);
+        put_i32(depth);
+        put_i32(internalformat);
+        put_u32(compressed);
+
+        for (uint32_t face = 0; face < faces; face++) {
+            const uint32_t face_target = image_target + face;
+            uint32_t format = 0, type = 0, pixel_size = 0, size = 0;
+
+            // multisample contents can't be read back
+            if (target == GL_TEXTURE_2D_MULTISAMPLE) {
+                size = 0;
+            } else if (compressed) {
+                GLint compressed_size = 0;
+                glGetTexLevelParameteriv(face_target, level, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &compressed_size);
+                size = compressed_size;
+            } else {
+                readback_format(face_target, level, internalformat, &format, &type, &pixel_size);
+                size = (uint32_t)width * height * depth * pixel_size;
+            }
+
+            void *pixels = size ? malloc(size) : NULL;
+
+            if (size && compressed)
+                glGetCompressedTexImage(face_target, level, pixels);
+            else if (size)
+                glGetTexImage(face_target, level, format, type, pixels);
+
+            put_u32(format);
+            put_u32(type);
+            put_u32(size);
+            put_bytes(pixels, size);
+
+            free(pixels);
+        }
+    }
+
+    end_record(record);
+}
+
+static void
+capture_sampler(uint32_t sampler) {
+    if (sampler == 0 || !name_set_add(&capture.captured[CAPTURE_SAMPLER], sampler))
+        return;
+
+    const size_t record = begin_record(CAPTURE_SAMPLER);
+    put_u32(sampler);
+
+    for (size_t i = 0; i < SAMPLER_PARAMS_NUM; i++) {
+        GLint value = 0;
+        glGetSamplerParameteriv(sampler, sampler_params[i], &value);
+        put_i32(value);
+    }
+
+    end_record(record);
+}
+
+static void
+capture_buffer(uint32_t buffer) {
+    if (buffer == 0 || !name_set_add(&capture.captured[CAPTURE_BUFFER], buffer))
+        return;
+
+    // the copy target leaves vertex array and array buffer bindings alone
+    glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+
+    GLint size = 0, usage = 0;
+    glGetBufferParameteriv(GL_COPY_READ_BUFFER, GL_BUFFER_SIZE, &size);
+    glGetBufferParameteriv(GL_COPY_READ_BUFFER, GL_BUFFER_USAGE, &usage);
+
+    void *data = size ? malloc(size) : NULL;
+    if (size)
+        glGetBufferSubData(GL_COPY_READ_BUFFER, 0, size, data);
+
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+    const size_t record = begin_record(CAPTURE_BUFFER);
+    put_u32(buffer);
+    put_u32(usage);
+    put_u32(size);
+    put_bytes(data, size);
+    end_record(record);
+
+    free(data);
+}
+
+struct CaptureAttribute {
+    uint32_t    index;
+    GLint       size;
+    GLint       type;
+    GLint       normalized;
+    GLint       integer;
+    GLint       stride;
+    GLint       divisor;
+    GLint       buffer;
+    uint64_t    offset;
+};
+
+static void
+capture_vertex_array(uint32_t array) {
+    if (array == 0 || !name_set_add(&capture.captured[CAPTURE_VERTEX_ARRAY], array))
+        return;
+
+    state_bind_vertex_array(array);
+
+    GLint elements = 0, max_attributes = 0;
+    glGetIntegerv(GL_ELEMENT_ARRAY_BUFFER_BINDING, &elements);
+    glGetIntegerv(GL_MAX_VERTEX_ATTRIBS, &max_attributes);
+
+    if (max_attributes > CAPTURE_MAX_ATTRIBUTES)
+        max_attributes = CAPTURE_MAX_ATTRIBUTES;
+
+    struct CaptureAttribute attributes[CAPTURE_MAX_ATTRIBUTES];
+    uint32_t attributes_count = 0;
+
+    for (GLint i = 0; i < max_attributes; i++) {
+        GLint enabled = 0;
+        glGetVertexAttribiv(i, GL_VERTEX_ATTRIB_ARRAY_ENABLED, &enabled);
+
+        if (!enabled)
+            continue;
+
+        struct CaptureAttribute *a = &attributes[attributes_count++];
+        a->index = i;
+        glGetVertexAttribiv(i, GL_VERTEX_ATTRIB_ARRAY_SIZE, &a->size);
+        glGetVertexAttribiv(i, GL_VERTEX_ATTRIB_ARRAY_TYPE, &a->type);
+        glGetVertexAttribiv(i, GL_VERTEX_ATTRIB_ARRAY_NORMALIZED, &a->normalized);
+        glGetVertexAttribiv(i, GL_VERTEX_ATTRIB_ARRAY_INTEGER, &a->integer);
+        glGetVertexAttribiv(i, GL_VERTEX_ATTRIB_ARRAY_STRIDE, &a->stride);
+        glGetVertexAttribiv(i, GL_VERTEX_ATTRIB_ARRAY_DIVISOR, &a->divisor);
+        glGetVertexAttribiv(i, GL_VERTEX_ATTRIB_ARRAY_BUFFER_BINDING, &a->buffer);
+
+        void *pointer = NULL;
+        glGetVertexAttribPointerv(i, GL_VERTEX_ATTRIB_ARRAY_POINTER, &pointer);
+        a->offset = (uint64_t)(uintptr_t)pointer;
+    }
+
+    // buffers go first so the loader can resolve them
+    capture_buffer(elements);
+    for (uint32_t i = 0; i < attributes_count; i++)
+        capture_buffer(attributes[i].buffer);
+
+    const size_t record = begin_record(CAPTURE_VERTEX_ARRAY);
+    put_u32(array);
+    put_u32(elements);
+
+    put_u32(attributes_count);
+    for (uint32_t i = 0; i < attributes_count; i++) {
+        const struct CaptureAttribute *a = &attributes[i];
+
+        put_u32(a->index);
+        put_i32(a->size);
+        put_u32(a->type);
+        put_u32(a->normalized);
+        put_u32(a->integer);
+        put_i32(a->stride);
+        put_u32(a->divisor);
+        put_u32(a->buffer);
+        put_bytes(&a->offset, sizeof(a->offset));
+    }
+
+    end_record(record);
+}
+
+static void
+capture_renderbuffer(uint32_t renderbuffer) {
+    if (renderbuffer == 0 || !name_set_add(&capture.captured[CAPTURE_RENDERBUFFER], renderbuffer))
+        return;
+
+    glBindRenderbuffer(GL_RENDERBUFFER, renderbuffer);
+
+    GLint width = 0, height = 0, internalformat = 0, samples = 0;
+    glGetRenderbufferParameteriv(GL_RENDERBUFFER, GL_RENDERBUFFER_WIDTH, &width);
+    glGetRenderbufferParameteriv(GL_RENDERBUFFER, GL_RENDERBUFFER_HEIGHT, &height);
+    glGetRenderbufferParameteriv(GL_RENDERBUFFER, GL_RENDERBUFFER_INTERNAL_FORMAT, &internalformat);
+    glGetRenderbufferParameteriv(GL_RENDERBUFFER, GL_RENDERBUFFER_SAMPLES, &samples);
+
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    const size_t record = begin_record(CAPTURE_RENDERBUFFER);
+    put_u32(renderbuffer);
+    put_i32(width);
+    put_i32(height);
+    put_i32(internalformat);
+    put_i32(samples);
+    end_record(record);
+}
+
+struct CaptureAttachment {
+    uint32_t    attachment;
+    GLint       type;
+    GLint       name;
+    GLint       level;
+    GLint       face;
+    GLint       layer;
+    GLint       layered;
+};
+
+static void
+capture_framebuffer(uint32_t framebuffer) {
+    if (framebuffer == 0 || !name_set_add(&capture.captured[CAPTURE_FRAMEBUFFER], framebuffer))
+        return;
+
+    state_bind_framebuffer(framebuffer);
+
+    GLint max_color = 0;
+    glGetIntegerv(GL_MAX_COLOR_ATTACHMENTS, &max_color);
+    if (max_color > CAPTURE_MAX_DRAW_BUFFERS)
+        max_color = CAPTURE_MAX_DRAW_BUFFERS;
+
+    struct CaptureAttachment attachments[CAPTURE_MAX_DRAW_BUFFERS + 2];
+    uint32_t attachments_count = 0;
+
+    for (GLint i = 0; i < max_color + 2; i++) {
+        const uint32_t attachment = i < max_color ? (uint32_t)(GL_COLOR_ATTACHMENT0 + i) :
+                                                    i == max_color ? GL_DEPTH_ATTACHMENT : GL_STENCIL_ATTACHMENT;
+        struct CaptureAttachment a = {.attachment = attachment};
+
+        glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, attachment, GL_FRAMEBUFFER_ATTACHMENT_OBJECT_TYPE, &a.type);
+        if (a.type != GL_TEXTURE && a.type != GL_RENDERBUFFER)
+            continue;
+
+        glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, attachment, GL_FRAMEBUFFER_ATTACHMENT_OBJECT_NAME, &a.name);
+
+        if (a.type == GL_TEXTURE) {
+            glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, attachment, GL_FRAMEBUFFER_ATTACHMENT_TEXTURE_LEVEL, &a.level);
+            glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, attachment, GL_FRAMEBUFFER_ATTACHMENT_TEXTURE_CUBE_MAP_FACE, &a.face);
+            glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, attachment, GL_FRAMEBUFFER_ATTACHMENT_TEXTURE_LAYER, &a.layer);
+            glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, attachment, GL_FRAMEBUFFER_ATTACHMENT_LAYERED, &a.layered);
+        }
+
+        attachments[attachments_count++] = a;
+    }
+
+    GLint draw_buffers[CAPTURE_MAX_DRAW_BUFFERS];
+    for (uint32_t i = 0; i < CAPTURE_MAX_DRAW_BUFFERS; i++)
+        glGetIntegerv(GL_DRAW_BUFFER0 + i, &draw_buffers[i]);
+
+    for (uint32_t i = 0; i < attachments_count; i++) {
+        const struct CaptureAttachment *a = &attachments[i];
+
+        if (a->type == GL_RENDERBUFFER)
+            capture_renderbuffer(a->name);
+        else if (a->face != 0)
+            capture_texture(a->name, GL_TEXTURE_CUBE_MAP);
+        else if (a->layered || a->layer != 0)
+            capture_texture(a->name, GL_TEXTURE_2D_ARRAY);
+        else
+            capture_texture(a->name, GL_TEXTURE_2D);
+    }
+
+    const size_t record = begin_record(CAPTURE_FRAMEBUFFER);
+    put_u32(framebuffer);
+
+    put_u32(attachments_count);
+    for (uint32_t i = 0; i < attachments_count; i++) {
+        const struct CaptureAttachment *a = &attachments[i];
+
+        put_u32(a->attachment);
+        put_u32(a->type);
+        put_u32(a->name);
+        put_i32(a->level);
+        put_u32(a->face);
+        put_i32(a->layer);
+        put_u32(a->layered);
+    }
+
+    for (uint32_t i = 0; i < CAPTURE_MAX_DRAW_BUFFERS; i++)
+        put_u32(draw_buffers[i]);
+
+    end_record(record);
+}
+
+static void
+capture_command_objects(const VIDEO_COMMAND *command) {
+    switch (command->type) {
+    case VC_BIND_FRAMEBUFFER_COMMAND:
+        capture_framebuffer(command->bind_framebuffer.framebuffer);
+        break;
+    case VC_BIND_TARGET_COMMAND:
+        capture_texture(command->bind_target.texture, command->bind_target.target);
+        break;
+    case VC_BIND_SHADER_COMMAND:
+        capture_program(command->bind_shader.program);
+        break;
+    case VC_BIND_TEXTURE_COMMAND:
+        capture_texture(command->bind_texture.texture, command->bind_texture.target);
+        capture_sampler(command->bind_texture.sampler);
+        break;
+    case VC_BIND_VERTEX_ARRAY_COMMAND:
+        capture_vertex_array(command->bind_vertex_array.array);
+        break;
+    case VC_DRAW_PACKET_COMMAND: {
+        const VIDEO_DRAW_PACKET *packet = command->draw_packet.packet;
+
+        capture_program(packet->program);
+        capture_vertex_array(packet->vertex_array);
+        for (uint32_t i = 0; i < packet->textures_count; i++)
+            capture_command_objects(&packet->textures[i]);
+    }
+        break;
+    case VC_BUNDLE_COMMAND: {
+        VIDEO_COMMAND_ITERATOR it = first_command(&command->bundle.bundle->commands);
+        VIDEO_COMMAND nested;
+
+        while (next_command(&it, &nested))
+            capture_command_objects(&nested);
+    }
+        break;
+    }
+}
+
+static void put_commands(const VIDEO_COMMAND_BUFFER *buffer);
+
+static void
+put_command(const VIDEO_COMMAND *command) {
+    // references are captured with the values they have now
+    put_u32(command->type == VC_UNIFORM_REFERENCE_COMMAND ? VC_UNIFORM_COMMAND : (uint32_t)command->type);
+
+    switch (command->type) {
+    case VC_UNIFORM_COMMAND:
+    case VC_UNIFORM_REFERENCE_COMMAND:
+        put_i32(command->uniform.location);
+        put_u32(command->uniform.type);
+        put_u32(command->uniform.size);
+        put_u32(command->uniform.count);
+        put_bytes(command->uniform.data, command->uniform.size);
+        break;
+    case VC_DRAW_PACKET_COMMAND: {
+        const VIDEO_DRAW_PACKET *packet = command->draw_packet.packet;
+
+        put_bytes(&command->draw_packet.key, sizeof(command->draw_packet.key));
+        put_u32(packet->program);
+        put_u32(packet->vertex_array);
+        put_u32(packet->textures_count);
+        put_u32(packet->uniforms_count);
+
+        for (uint32_t i = 0; i < packet->textures_count; i++)
+            put_command(&packet->textures[i]);
+        for (uint32_t i = 0; i < packet->uniforms_count; i++)
+            put_command(&packet->uniforms[i]);
+
+        put_command(&packet->draw);
+    }
+        break;
+    case VC_BUNDLE_COMMAND: {
+        // written out again wherever it is spliced
+        const VIDEO_COMMAND_BUFFER *bundle = &command->bundle.bundle->commands;
+
+        put_u32(bundle->flags);
+        put_u32(bundle->mask);
+        put_bytes(bundle->color, sizeof(bundle->color));
+        put_commands(bundle);
+    }
+        break;
+    default: {
+        // every other command is a few 32 bit fields
+        uint32_t words[CAPTURE_COMMAND_WORDS];
+        memcpy(words, &command->viewport, sizeof(words));
+        put_bytes(words, sizeof(words));
+    }
+        break;
+    }
+}
+
+static void
+put_buffer(const VIDEO_COMMAND_BUFFER *buffer) {
+    put_u32(buffer->flags);
+    put_u32(buffer->mask);
+    put_bytes(buffer->color, sizeof(buffer->color));
+
+    put_u32(buffer->blend.enable);
+    put_u32(buffer->blend.sfactor);
+    put_u32(buffer->blend.dfactor);
+
+    put_u32(buffer->rasterizer.fill_mode);
+    put_u32(buffer->rasterizer.cull_mode);
+    put_u32(buffer->rasterizer.discard);
+
+    const DEPTH_STENCIL_STATE *depth = &buffer->depth;
+    put_u32(depth->depth_test);
+    put_u32(depth->depth_write);
+    put_u32(depth->depth_clamp);
+    put_u32(depth->depth_func);
+    put_u32(depth->stencil_test);
+    put_u32(depth->front.func);
+    put_u32(depth->front.mask);
+    put_u32(depth->front.sfail);
+    put_u32(depth->front.dpfail);
+    put_u32(depth->front.dppass);
+    put_u32(depth->back.func);
+    put_u32(depth->back.mask);
+    put_u32(depth->back.sfail);
+    put_u32(depth->back.dpfail);
+    put_u32(depth->back.dppass);
+
+    put_commands(buffer);
+}
+
+static void
+put_commands(const VIDEO_COMMAND_BUFFER *buffer) {
+    put_u32(buffer->commands_count);
+
+    VIDEO_COMMAND_ITERATOR it = first_command(buffer);
+    VIDEO_COMMAND command;
+
+    // put_command writes whole union words, keep the unused ones zero
+    memset(&command, 0, sizeof(command));
+    while (next_command(&it, &command)) {
+        put_command(&command);
+        memset(&command, 0, sizeof(command));
+    }
+}
+
+static void
+capture_group(bool merged, uint32_t count, VIDEO_COMMAND_BUFFER *const *list, VIDEO_COMMAND_BUFFER *array) {
+    for (uint32_t j = 0; j < count; j++) {
+        VIDEO_COMMAND_ITERATOR it = first_command(list ? list[j] : &array[j]);
+        VIDEO_COMMAND command;
+
+        while (next_command(&it, &command))
+            capture_command_objects(&command);
+    }
+
+    const size_t record = begin_record(CAPTURE_GROUP);
+    put_u32(merged);
+    put_u32(count);
+
+    for (uint32_t j = 0; j < count; j++)
+        put_buffer(list ? list[j] : &array[j]);
+
+    end_record(record);
+}
+
+extern void
+capture_frame(const char *filename) {
+    assert(filename != NULL);
+
+    if (capture.active)
+        LOG_WARNING("Capture: restarted, %s is dropped\n", capture.filename);
+
+    strncpy(capture.filename, filename, CAPTURE_FILENAME_SIZE - 1);
+    capture.filename[CAPTURE_FILENAME_SIZE - 1] = 0;
+    capture.stream.size = 0;
+
+    for (int i = 0; i < CAPTURE_OBJECT_TYPES; i++)
+        capture.captured[i].count = 0;
+
+    put_u32(VIDEO_CAPTURE_MAGIC);
+    put_u32(VIDEO_CAPTURE_VERSION);
+    put_i32(screen.width);
+    put_i32(screen.height);
+
+    capture.active = true;
+}
+
+extern bool
+capture_active(void) {
+    return capture.active;
+}
+
+extern void
+capture_submit_buffers(size_t count, VIDEO_COMMAND_BUFFER **buffers) {
+    if (!capture.active)
+        return;
+
+    for (size_t j = 0; j < count && buffers[j]; j++)
+        capture_group(false, 1, &buffers[j], NULL);
+}
+
+extern void
+capture_submit_passes(size_t count, VIDEO_COMMAND_PASS **passes) {
+    if (!capture.active)
+        return;
+
+    for (size_t j = 0; j < count && passes[j]; j++)
+        capture_group(true, passes[j]->buffers_count, NULL, passes[j]->buffers);
+}
+
+extern void
+capture_frame_end(void) {
+    if (!capture.active)
+        return;
+
+    capture.active = false;
+
+    FILE *fp = fopen(capture.filename, "wb");
+
+    if (!fp || fwrite(capture.stream.data, capture.stream.size, 1, fp) != 1)
+        LOG_ERROR("Capture: can't write %s\n", capture.filename);
+    else
+        LOG("Capture: %s %zu bytes\n", capture.filename, capture.stream.size);
+
+    if (fp)
+        fclose(fp);
+
+    free(capture.stream.data);
+    memset(&capture.stream, 0, sizeof(capture.stream));
+
+    for (int i = 0; i < CAPTURE_OBJECT_TYPES; i++) {
+        free(capture.captured[i].names);
+        memset(&capture.captured[i], 0, sizeof(struct NameSet));
+    }
+}
+
+struct CaptureReader {
+    const uint8_t   *p;
+    const uint8_t   *end;
+    bool            failed;
+};
+
+static const void *
+get_bytes(struct CaptureReader *r, size_t size) {
+    if (r->failed || (size_t)(r->end - r->p) < size) {
+        r->failed = true;
+        return NULL;
+    }
+
+    const void *p = r->p;
+    r->p += size;
+
+    return p;
+}
+
+static uint32_t
+get_u32(struct CaptureReader *r) {
+    uint32_t value = 0;
+    const void *p = get_bytes(r, sizeof(value));
+
+    if (p)
+        memcpy(&value, p, sizeof(value));
+
+    return value;
+}
+
+static inline int32_t
+get_i32(struct CaptureReader *r) {
+    return (int32_t)get_u32(r);
+}
+
+static void
+get_string(struct CaptureReader *r, char *dest, size_t size) {
+    const uint32_t length = get_u32(r);
+    const char *s = get_bytes(r, length);
+
+    if (!s || length >= size) {
+        r->failed = true;
+        dest[0] = 0;
+        return;
+    }
+
+    memcpy(dest, s, length);
+    dest[length] = 0;
+}
+
+static void *
+append(void *array, uint32_t count, size_t size) {
+    // grows by powers of two
+    if (count == 0 || (count & (count - 1)) == 0) {
+        array = realloc(array, size * (count ? count * 2 : 16));
+
+        if (!array) {
+            LOG_CRITICAL("%s\n", "Can't alloc memory");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    return array;
+}
+
+static void
+add_object(VIDEO_CAPTURE *cap, uint32_t type, uint32_t captured, uint32_t id) {
+    cap->objects[type] = append(cap->objects[type], cap->objects_count[type], sizeof(VIDEO_CAPTURE_REMAP));
+    cap->objects[type][cap->objects_count[type]++] = (VIDEO_CAPTURE_REMAP){captured, id};
+}
+
+static uint32_t
+remap_object(const VIDEO_CAPTURE *cap, uint32_t type, uint32_t captured) {
+    if (captured == 0)
+        return 0;
+
+    for (uint32_t i = 0; i < cap->objects_count[type]; i++)
+        if (cap->objects[type][i].captured == captured)
+            return cap->objects[type][i].id;
+
+    return 0;
+}
+
+static int
+remap_location(const VIDEO_CAPTURE *cap, uint32_t program, int captured) {
+    if (captured < 0 || IS_INSTANCE_LOCATION(captured))
+        return captured;
+
+    for (uint32_t i = 0; i < cap->locations_count; i++)
+        if (cap->locations[i].program == program && cap->locations[i].captured == captured)
+            return cap->locations[i].location;
+
+    return -1;
+}
+
+static void
+upload_uniform(int location, uint32_t type, const void *values) {
+    const GLfloat *f = values;
+    const GLint *i = values;
+    const GLuint *u = values;
+
+    switch (type) {
+    case GL_FLOAT: glUniform1fv(location, 1, f); break;
+    case GL_FLOAT_VEC2: glUniform2fv(location, 1, f); break;
+    case GL_FLOAT_VEC3: glUniform3fv(location, 1, f); break;
+    case GL_FLOAT_VEC4: glUniform4fv(location, 1, f); break;
+    case GL_FLOAT_MAT2: glUniformMatrix2fv(location, 1, GL_FALSE, f); break;
+    case GL_FLOAT_MAT3: glUniformMatrix3fv(location, 1, GL_FALSE, f); break;
+    case GL_FLOAT_MAT4: glUniformMatrix4fv(location, 1, GL_FALSE, f); break;
+    case GL_FLOAT_MAT2x3: glUniformMatrix2x3fv(location, 1, GL_FALSE, f); break;
+    case GL_FLOAT_MAT2x4: glUniformMatrix2x4fv(location, 1, GL_FALSE, f); break;
+    case GL_FLOAT_MAT3x2: glUniformMatrix3x2fv(location, 1, GL_FALSE, f); break;
+    case GL_FLOAT_MAT3x4: glUniformMatrix3x4fv(location, 1, GL_FALSE, f); break;
+    case GL_FLOAT_MAT4x2: glUniformMatrix4x2fv(location, 1, GL_FALSE, f); break;
+    case GL_FLOAT_MAT4x3: glUniformMatrix4x3fv(location, 1, GL_FALSE, f); break;
+    case GL_INT_VEC2: case GL_BOOL_VEC2: glUniform2iv(location, 1, i); break;
+    case GL_INT_VEC3: case GL_BOOL_VEC3: glUniform3iv(location, 1, i); break;
+    case GL_INT_VEC4: case GL_BOOL_VEC4: glUniform4iv(location, 1, i); break;
+    case GL_UNSIGNED_INT: glUniform1uiv(location, 1, u); break;
+    case GL_UNSIGNED_INT_VEC2: glUniform2uiv(location, 1, u); break;
+    case GL_UNSIGNED_INT_VEC3: glUniform3uiv(location, 1, u); break;
+    case GL_UNSIGNED_INT_VEC4: glUniform4uiv(location, 1, u); break;
+    default: glUniform1iv(location, 1, i); break; // int, bool and samplers
+    }
+}
+
+static bool
+load_program(VIDEO_CAPTURE *cap, struct CaptureReader *r) {
+    const uint32_t captured = get_u32(r);
+    const uint32_t shaders_count = get_u32(r);
+
+    if (shaders_count > CAPTURE_MAX_SHADERS)
+        return false;
+
+    GLuint program = glCreateProgram();
+
+    for (uint32_t i = 0; i < shaders_count && !r->failed; i++) {
+        const uint32_t type = get_u32(r);
+        const GLint length = get_i32(r);
+        const GLchar *source = get_bytes(r, length);
+
+        if (!source)
+            break;
+
+        GLuint shader = glCreateShader(type);
+        glShaderSource(shader, 1, &source, &length);
+        glCompileShader(shader);
+
+        GLint status = 0;
+        glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+        if (!status)
+            LOG_ERROR("Capture: program %u shader 0x%x doesn't compile\n", captured, type);
+
+        glAttachShader(program, shader);
+        glDeleteShader(shader);
+    }
+
+    char name[MAX_UNIFORM_NAME_SIZE];
+    const uint32_t attributes_count = get_u32(r);
+
+    for (uint32_t i = 0; i < attributes_count && !r->failed; i++) {
+        get_string(r, name, sizeof(name));
+        const int location = get_i32(r);
+
+        if (location >= 0)
+            glBindAttribLocation(program, location, name);
+    }
+
+    glLinkProgram(program);
+
+    GLint status = 0;
+    glGetProgramiv(program, GL_LINK_STATUS, &status);
+    if (!status)
+        LOG_ERROR("Capture: program %u doesn't link\n", captured);
+
+    add_object(cap, CAPTURE_PROGRAM, captured, program);
+    state_use_program(program);
+
+    if (glGetUniformLocation(program, "neon_instance_data") >= 0)
+        instanced_program(program);
+
+    const uint32_t uniforms_count = get_u32(r);
+
+    for (uint32_t i = 0; i < uniforms_count && !r->failed; i++) {
+        get_string(r, name, sizeof(name));
+        const uint32_t type = get_u32(r);
+        const uint32_t size = get_u32(r);
+
+        for (uint32_t e = 0; e < size && !r->failed; e++) {
+            char element[MAX_UNIFORM_NAME_SIZE + 16];
+            uniform_element_name(element, sizeof(element), name, e);
+
+            const int captured_location = get_i32(r);
+            const void *values = get_bytes(r, sizeof(uint32_t) * uniform_components(type));
+            const int location = glGetUniformLocation(program, e == 0 ? name : element);
+
+            if (captured_location < 0 || location < 0 || !values)
+                continue;
+
+            cap->locations = append(cap->locations, cap->locations_count, sizeof(VIDEO_CAPTURE_LOCATION));
+            cap->locations[cap->locations_count++] = (VIDEO_CAPTURE_LOCATION){captured, captured_location, location};
+
+            uint32_t aligned[16];
+            memcpy(aligned, values, sizeof(uint32_t) * uniform_components(type));
+            upload_uniform(location, type, aligned);
+        }
+    }
+
+    const uint32_t blocks_count = get_u32(r);
+
+    for (uint32_t i = 0; i < blocks_count && !r->failed; i++) {
+        get_string(r, name, sizeof(name));
+        const int binding = get_i32(r);
+        const GLuint index = glGetUniformBlockIndex(program, name);
+
+        if (index != GL_INVALID_INDEX)
+            glUniformBlockBinding(program, index, binding);
+    }
+
+    return !r->failed;
+}
+
+static bool
+load_texture(VIDEO_CAPTURE *cap, struct CaptureReader *r) {
+    const uint32_t captured = get_u32(r);
+    const uint32_t target = get_u32(r);
+    const int samples = get_i32(r);
+
+    GLint params[TEXTURE_PARAMS_NUM];
+    for (size_t i = 0; i < TEXTURE_PARAMS_NUM; i++)
+        params[i] = get_i32(r);
+
+    GLuint texture = 0;
+    glGenTextures(1, &texture);
+    state_bind_texture(0, target, texture);
+    add_object(cap, CAPTURE_TEXTURE, captured, texture);
+
+    const uint32_t faces = target == GL_TEXTURE_CUBE_MAP ? 6 : 1;
+    const uint32_t image_target = target == GL_TEXTURE_CUBE_MAP ? GL_TEXTURE_CUBE_MAP_POSITIVE_X : target;
+    const uint32_t levels = get_u32(r);
+
+    for (uint32_t level = 0; level < levels && !r->failed; level++) {
+        const int width = get_i32(r);
+        const int height = get_i32(r);
+        const int depth = get_i32(r);
+        const int internalformat = get_i32(r);
+        const uint32_t compressed = get_u32(r);
+
+        for (uint32_t face = 0; face < faces && !r->failed; face++) {
+            const uint32_t format = get_u32(r);
+            const uint32_t type = get_u32(r);
+            const uint32_t size = get_u32(r);
+            const void *pixels = get_bytes(r, size);
+            const uint32_t face_target = image_target + face;
+
+            if (r->failed)
+                break;
+
+            if (target == GL_TEXTURE_2D_MULTISAMPLE)
+                glTexImage2DMultisample(target, samples, internalformat, width, height, GL_TRUE);
+            else if (compressed && (target == GL_TEXTURE_2D_ARRAY || target == GL_TEXTURE_3D))
+                glCompressedTexImage3D(target, level, internalformat, width, height, depth, 0, size, pixels);
+            else if (compressed)
+                glCompressedTexImage2D(face_target, level, internalformat, width, height, 0, size, pixels);
+            else if (target == GL_TEXTURE_2D_ARRAY || target == GL_TEXTURE_3D)
+                glTexImage3D(target, level, internalformat, width, height, depth, 0, format, type, pixels);
+            else
+                glTexImage2D(face_target, level, internalformat, width, height, 0, format, type, pixels);
+        }
+    }
+
+    if (target != GL_TEXTURE_2D_MULTISAMPLE)
+        for (size_t i = 0; i < TEXTURE_PARAMS_NUM; i++)
+            glTexParameteri(target, texture_params[i], params[i]);
+
+    return !r->failed;
+}
+
+static bool
+load_sampler(VIDEO_CAPTURE *cap, struct CaptureReader *r) {
+    const uint32_t captured = get_u32(r);
+
+    GLuint sampler = 0;
+    glGenSamplers(1, &sampler);
+    add_object(cap, CAPTURE_SAMPLER, captured, sampler);
+
+    for (size_t i = 0; i < SAMPLER_PARAMS_NUM; i++)
+        glSamplerParameteri(sampler, sampler_params[i], get_i32(r));
+
+    return !r->failed;
+}
+
+static bool
+load_buffer(VIDEO_CAPTURE *cap, struct CaptureReader *r) {
+    const uint32_t captured = get_u32(r);
+    const uint32_t usage = get_u32(r);
+    const uint32_t size = get_u32(r);
+    const void *data = get_bytes(r, size);
+
+    if (r->failed)
+        return false;
+
+    GLuint buffer = 0;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, size, data, usage);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    add_object(cap, CAPTURE_BUFFER, captured, buffer);
+
+    return true;
+}
+
+static bool
+load_vertex_array(VIDEO_CAPTURE *cap, struct CaptureReader *r) {
+    const uint32_t captured = get_u32(r);
+    const uint32_t elements = get_u32(r);
+
+    GLuint array = 0;
+    glGenVertexArrays(1, &array);
+    state_bind_vertex_array(array);
+    add_object(cap, CAPTURE_VERTEX_ARRAY, captured, array);
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, remap_object(cap, CAPTURE_BUFFER, elements));
+
+    const uint32_t attributes_count = get_u32(r);
+
+    for (uint32_t i = 0; i < attributes_count && !r->failed; i++) {
+        struct CaptureAttribute a;
+        a.index = get_u32(r);
+        a.size = get_i32(r);
+        a.type = get_u32(r);
+        a.normalized = get_u32(r);
+        a.integer = get_u32(r);
+        a.stride = get_i32(r);
+        a.divisor = get_u32(r);
+        a.buffer = get_u32(r);
+
+        const void *offset = get_bytes(r, sizeof(a.offset));
+        if (!offset)
+            break;
+        memcpy(&a.offset, offset, sizeof(a.offset));
+
+        glBindBuffer(GL_ARRAY_BUFFER, remap_object(cap, CAPTURE_BUFFER, a.buffer));
+
+        if (a.integer)
+            glVertexAttribIPointer(a.index, a.size, a.type, a.stride, (const GLvoid*)(uintptr_t)a.offset);
+        else
+            glVertexAttribPointer(a.index, a.size, a.type, a.normalized ? GL_TRUE : GL_FALSE, a.stride, (const GLvoid*)(uintptr_t)a.offset);
+
+        glVertexAttribDivisor(a.index, a.divisor);
+        glEnableVertexAttribArray(a.index);
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    state_bind_vertex_array(0);
+
+    return !r->failed;
+}
+
+static bool
+load_renderbuffer(VIDEO_CAPTURE *cap, struct CaptureReader *r) {
+    const uint32_t captured = get_u32(r);
+    const int width = get_i32(r);
+    const int height = get_i32(r);
+    const int internalformat = get_i32(r);
+    const int samples = get_i32(r);
+
+    GLuint renderbuffer = 0;
+    glGenRenderbuffers(1, &renderbuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, renderbuffer);
+    glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, internalformat, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    add_object(cap, CAPTURE_RENDERBUFFER, captured, renderbuffer);
+
+    return !r->failed;
+}
+
+static bool
+load_framebuffer(VIDEO_CAPTURE *cap, struct CaptureReader *r) {
+    const uint32_t captured = get_u32(r);
+
+    GLuint framebuffer = 0;
+    glGenFramebuffers(1, &framebuffer);
+    state_bind_framebuffer(framebuffer);
+    add_object(cap, CAPTURE_FRAMEBUFFER, captured, framebuffer);
+
+    const uint32_t attachments_count = get_u32(r);
+
+    for (uint32_t i = 0; i < attachments_count && !r->failed; i++) {
+        struct CaptureAttachment a;
+        a.attachment = get_u32(r);
+        a.type = get_u32(r);
+        a.name = get_u32(r);
+        a.level = get_i32(r);
+        a.face = get_u32(r);
+        a.layer = get_i32(r);
+        a.layered = get_u32(r);
+
+        if (a.type == GL_RENDERBUFFER) {
+            glFramebufferRenderbuffer(GL_FRAMEBUFFER, a.attachment, GL_RENDERBUFFER, remap_object(cap, CAPTURE_RENDERBUFFER, a.name));
+            continue;
+        }
+
+        const GLuint texture = remap_object(cap, CAPTURE_TEXTURE, a.name);
+
+        if (a.face != 0)
+            glFramebufferTexture2D(GL_FRAMEBUFFER, a.attachment, a.face, texture, a.level);
+        else if (a.layered)
+            glFramebufferTexture(GL_FRAMEBUFFER, a.attachment, texture, a.level);
+        else if (a.layer != 0)
+            glFramebufferTextureLayer(GL_FRAMEBUFFER, a.attachment, texture, a.level, a.layer);
+        else
+            glFramebufferTexture(GL_FRAMEBUFFER, a.attachment, texture, a.level);
+    }
+
+    GLenum draw_buffers[CAPTURE_MAX_DRAW_BUFFERS];
+    for (uint32_t i = 0; i < CAPTURE_MAX_DRAW_BUFFERS; i++)
+        draw_buffers[i] = get_u32(r);
+
+    glDrawBuffers(CAPTURE_MAX_DRAW_BUFFERS, draw_buffers);
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        LOG_WARNING("Capture: framebuffer %u is incomplete\n", captured);
+
+    state_bind_framebuffer(0);
+
+    return !r->failed;
+}
+
+// program is the captured name of the current program, updated by shader binds
+static void
+get_command(const VIDEO_CAPTURE *cap, struct CaptureReader *r, uint32_t type, VIDEO_COMMAND *command, uint32_t *program) {
+    memset(command, 0, sizeof(VIDEO_COMMAND));
+
+    // the type indexes the encoder tables, packets and bundles are read by the callers and
+    // references are stored as plain uniforms, anything else is a corrupt file
+    if (type == VC_DRAW_PACKET_COMMAND || type == VC_UNIFORM_REFERENCE_COMMAND || type >= VC_BUNDLE_COMMAND) {
+        r->failed = true;
+        return;
+    }
+
+    command->type = type;
+
+    if (type == VC_UNIFORM_COMMAND) {
+        const int location = get_i32(r);
+        command->uniform.type = get_u32(r);
+        // blocks are bound by binding point, which the program keeps
+        command->uniform.location = command->uniform.type == UNIFORM_BLOCK ? location : remap_location(cap, *program, location);
+        command->uniform.size = get_u32(r);
+        command->uniform.count = get_u32(r);
+
+        // decoding recomputes the size from type and count, both have to agree
+        const size_t value_size = uniform_size(command->uniform.type);
+        if (value_size == 0 || (uint64_t)value_size * command->uniform.count != command->uniform.size) {
+            r->failed = true;
+            return;
+        }
+
+        command->uniform.data = get_bytes(r, command->uniform.size);
+        return;
+    }
+
+    const void *words = get_bytes(r, sizeof(uint32_t) * CAPTURE_COMMAND_WORDS);
+    if (!words)
+        return;
+
+    memcpy(&command->viewport, words, sizeof(uint32_t) * CAPTURE_COMMAND_WORDS);
+
+    switch (type) {
+    case VC_BIND_FRAMEBUFFER_COMMAND:
+        command->bind_framebuffer.framebuffer = remap_object(cap, CAPTURE_FRAMEBUFFER, command->bind_framebuffer.framebuffer);
+        break;
+    case VC_BIND_TARGET_COMMAND:
+        command->bind_target.texture = remap_object(cap, CAPTURE_TEXTURE, command->bind_target.texture);
+        break;
+    case VC_BIND_SHADER_COMMAND:
+        *program = command->bind_shader.program;
+        command->bind_shader.program = remap_object(cap, CAPTURE_PROGRAM, command->bind_shader.program);
+        break;
+    case VC_BIND_TEXTURE_COMMAND:
+        command->bind_texture.texture = remap_object(cap, CAPTURE_TEXTURE, command->bind_texture.texture);
+        command->bind_texture.sampler = remap_object(cap, CAPTURE_SAMPLER, command->bind_texture.sampler);
+        command->bind_texture.location = remap_location(cap, *program, command->bind_texture.location);
+        break;
+    case VC_BIND_VERTEX_ARRAY_COMMAND:
+        command->bind_vertex_array.array = remap_object(cap, CAPTURE_VERTEX_ARRAY, command->bind_vertex_array.array);
+        break;
+    }
+}
+
+static void get_commands(VIDEO_CAPTURE *cap, struct CaptureReader *r, VIDEO_COMMAND_BUFFER *buffer, uint32_t *program);
+
+static void
+get_bundle(VIDEO_CAPTURE *cap, struct CaptureReader *r, VIDEO_COMMAND_BUFFER *buffer, uint32_t *program) {
+    VIDEO_COMMAND_BUNDLE *bundle = malloc(sizeof(VIDEO_COMMAND_BUNDLE));
+
+    if (!bundle) {
+        LOG_CRITICAL("%s\n", "Can't alloc memory");
+        exit(EXIT_FAILURE);
+    }
+
+    cap->bundles = append(cap->bundles, cap->bundles_count, sizeof(VIDEO_COMMAND_BUNDLE*));
+    cap->bundles[cap->bundles_count++] = bundle;
+
+    bundle->commands = new_command_buffer(NULL);
+    bundle->commands.flags = get_u32(r);
+    bundle->commands.mask = get_u32(r);
+
+    const void *color = get_bytes(r, sizeof(bundle->commands.color));
+    if (color)
+        memcpy(bundle->commands.color, color, sizeof(bundle->commands.color));
+
+    // packets were stored in submit order, VCB_BUNDLE_BIT keeps them so
+    get_commands(cap, r, &bundle->commands, program);
+
+    if (!r->failed)
+        bundle_command(buffer, bundle);
+}
+
+static void
+get_packet(const VIDEO_CAPTURE *cap, struct CaptureReader *r, VIDEO_COMMAND_BUFFER *buffer) {
+    VIDEO_COMMAND textures[VIDEO_PACKET_MAX_TEXTURES];
+    VIDEO_COMMAND uniforms[VIDEO_PACKET_MAX_UNIFORMS];
+    VIDEO_DRAW_PACKET packet;
+    VIDEO_COMMAND command = {.type = VC_DRAW_PACKET_COMMAND};
+
+    const void *key = get_bytes(r, sizeof(command.draw_packet.key));
+    if (key)
+        memcpy(&command.draw_packet.key, key, sizeof(command.draw_packet.key));
+
+    uint32_t program = get_u32(r);
+    packet.program = remap_object(cap, CAPTURE_PROGRAM, program);
+    packet.vertex_array = remap_object(cap, CAPTURE_VERTEX_ARRAY, get_u32(r));
+    packet.textures_count = get_u32(r);
+    packet.uniforms_count = get_u32(r);
+
+    if (packet.textures_count > VIDEO_PACKET_MAX_TEXTURES || packet.uniforms_count > VIDEO_PACKET_MAX_UNIFORMS) {
+        r->failed = true;
+        return;
+    }
+
+    for (uint32_t i = 0; i < packet.textures_count; i++)
+        get_command(cap, r, get_u32(r), &textures[i], &program);
+    for (uint32_t i = 0; i < packet.uniforms_count; i++)
+        get_command(cap, r, get_u32(r), &uniforms[i], &program);
+    get_command(cap, r, get_u32(r), &packet.draw, &program);
+
+    if (r->failed)
+        return;
+
+    packet.textures = textures;
+    packet.uniforms = uniforms;
+    command.draw_packet.packet = &packet;
+
+    copy_command(buffer, &command);
+}
+
+static void
+get_buffer(VIDEO_CAPTURE *cap, struct CaptureReader *r, VIDEO_COMMAND_BUFFER *buffer) {
+    buffer->flags = get_u32(r);
+    buffer->mask = get_u32(r);
+
+    const void *color = get_bytes(r, sizeof(buffer->color));
+    if (color)
+        memcpy(buffer->color, color, sizeof(buffer->color));
+
+    buffer->blend.enable = get_u32(r);
+    buffer->blend.sfactor = get_u32(r);
+    buffer->blend.dfactor = get_u32(r);
+
+    buffer->rasterizer.fill_mode = get_u32(r);
+    buffer->rasterizer.cull_mode = get_u32(r);
+    buffer->rasterizer.discard = get_u32(r);
+
+    DEPTH_STENCIL_STATE *depth = &buffer->depth;
+    depth->depth_test = get_u32(r);
+    depth->depth_write = get_u32(r);
+    depth->depth_clamp = get_u32(r);
+    depth->depth_func = get_u32(r);
+    depth->stencil_test = get_u32(r);
+    depth->front.func = get_u32(r);
+    depth->front.mask = get_u32(r);
+    depth->front.sfail = get_u32(r);
+    depth->front.dpfail = get_u32(r);
+    depth->front.dppass = get_u32(r);
+    depth->back.func = get_u32(r);
+    depth->back.mask = get_u32(r);
+    depth->back.sfail = get_u32(r);
+    depth->back.dpfail = get_u32(r);
+    depth->back.dppass = get_u32(r);
+
+    uint32_t program = 0;
+    get_commands(cap, r, buffer, &program);
+}
+
+static void
+get_commands(VIDEO_CAPTURE *cap, struct CaptureReader *r, VIDEO_COMMAND_BUFFER *buffer, uint32_t *program) {
+    const uint32_t commands_count = get_u32(r);
+
+    for (uint32_t i = 0; i < commands_count && !r->failed; i++) {
+        const uint32_t type = get_u32(r);
+
+        if (type == VC_DRAW_PACKET_COMMAND) {
+            get_packet(cap, r, buffer);
+            continue;
+        }
+
+        if (type == VC_BUNDLE_COMMAND) {
+            get_bundle(cap, r, buffer, program);
+            continue;
+        }
+
+        VIDEO_COMMAND command;
+        get_command(cap, r, type, &command, program);
+
+        if (!r->failed)
+            copy_command(buffer, &command);
+    }
+}
+
+static bool
+load_group(VIDEO_CAPTURE *cap, struct CaptureReader *r) {
+    const bool merged = get_u32(r);
+    const uint32_t count = get_u32(r);
+
+    if (r->failed || count == 0)
+        return false;
+
+    cap->groups = append(cap->groups, cap->groups_count, sizeof(VIDEO_CAPTURE_GROUP));
+    VIDEO_CAPTURE_GROUP *group = &cap->groups[cap->groups_count++];
+
+    group->merged = merged;
+    group->pass = new_command_pass(NULL, count);
+
+    for (uint32_t i = 0; i < count && !r->failed; i++)
+        get_buffer(cap, r, &group->pass.buffers[i]);
+
+    // a pass applies the states of its first buffer
+    const VIDEO_COMMAND_BUFFER *first = &group->pass.buffers[0];
+    group->pass.flags = first->flags;
+    group->pass.mask = first->mask;
+    memcpy(group->pass.color, first->color, sizeof(first->color));
+    group->pass.blend = first->blend;
+    group->pass.rasterizer = first->rasterizer;
+    group->pass.depth = first->depth;
+
+    return !r->failed;
+}
+
+extern bool
+load_capture(VIDEO_CAPTURE *cap, const char *filename) {
+    assert(cap != NULL);
+    assert(filename != NULL);
+
+    memset(cap, 0, sizeof(VIDEO_CAPTURE));
+
+    FILE *fp = fopen(filename, "rb");
+
+    if (!fp) {
+        LOG_ERROR("Capture: can't open %s\n", filename);
+        return false;
+    }
+
+    fseek(fp, 0, SEEK_END);
+    const long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    uint8_t *data = size > 0 ? malloc(size) : NULL;
+
+    if (!data || fread(data, size, 1, fp) != 1) {
+        LOG_ERROR("Capture: can't read %s\n", filename);
+        fclose(fp);
+        free(data);
+        return false;
+    }
+
+    fclose(fp);
+
+    struct CaptureReader reader = {.p = data, .end = data + size, .failed = false};
+    struct CaptureReader *r = &reader;
+
+    if (get_u32(r) != VIDEO_CAPTURE_MAGIC || get_u32(r) != VIDEO_CAPTURE_VERSION) {
+        LOG_ERROR("Capture: %s is not a capture of version %d\n", filename, VIDEO_CAPTURE_VERSION);
+        free(data);
+        return false;
+    }
+
+    cap->width = get_i32(r);
+    cap->height = get_i32(r);
+
+    while (!r->failed && r->p < r->end) {
+        const uint32_t type = get_u32(r);
+        const uint32_t record_size = get_u32(r);
+        const uint8_t *record = get_bytes(r, record_size);
+
+        if (!record)
+            break;
+
+        struct CaptureReader body = {.p = record, .end = record + record_size, .failed = false};
+        bool loaded = true;
+
+        switch (type) {
+        case CAPTURE_PROGRAM:
+            loaded = load_program(cap, &body);
+            break;
+        case CAPTURE_TEXTURE:
+            loaded = load_texture(cap, &body);
+            break;
+        case CAPTURE_SAMPLER:
+            loaded = load_sampler(cap, &body);
+            break;
+        case CAPTURE_BUFFER:
+            loaded = load_buffer(cap, &body);
+            break;
+        case CAPTURE_VERTEX_ARRAY:
+            loaded = load_vertex_array(cap, &body);
+            break;
+        case CAPTURE_RENDERBUFFER:
+            loaded = load_renderbuffer(cap, &body);
+            break;
+        case CAPTURE_FRAMEBUFFER:
+            loaded = load_framebuffer(cap, &body);
+            break;
+        case CAPTURE_GROUP:
+            loaded = load_group(cap, &body);
+            break;
+        default:
+            LOG_WARNING("Capture: unknown record %u skipped\n", type);
+            break;
+        }
+
+        if (!loaded)
+            r->failed = true;
+    }
+
+    free(data);
+
+    state_use_program(0);
+
+    if (r->failed) {
+        LOG_ERROR("Capture: %s is damaged\n", filename);
+        free_capture(cap);
+        return false;
+    }
+
+    return true;
+}
+
+extern void
+free_capture(VIDEO_CAPTURE *cap) {
+    assert(cap != NULL);
+
+    for (uint32_t i = 0; i < cap->groups_count; i++)
+        free_command_pass(&cap->groups[i].pass);
+
+    for (uint32_t i = 0; i < cap->bundles_count; i++) {
+        free_command_bundle(cap->bundles[i]);
+        free(cap->bundles[i]);
+    }
+
+    for (uint32_t i = 0; i < cap->objects_count[CAPTURE_PROGRAM]; i++) {
+        glDeleteProgram(cap->objects[CAPTURE_PROGRAM][i].id);
+        forget_instanced_program(cap->objects[CAPTURE_PROGRAM][i].id);
+    }
+    for (uint32_t i = 0; i < cap->objects_count[CAPTURE_TEXTURE]; i++)
+        glDeleteTextures(1, &cap->objects[CAPTURE_TEXTURE][i].id);
+    for (uint32_t i = 0; i < cap->objects_count[CAPTURE_SAMPLER]; i++)
+        glDeleteSamplers(1, &cap->objects[CAPTURE_SAMPLER][i].id);
+    for (uint32_t i = 0; i < cap->objects_count[CAPTURE_BUFFER]; i++)
+        glDeleteBuffers(1, &cap->objects[CAPTURE_BUFFER][i].id);
+    for (uint32_t i = 0; i < cap->objects_count[CAPTURE_VERTEX_ARRAY]; i++)
+        glDeleteVertexArrays(1, &cap->objects[CAPTURE_VERTEX_ARRAY][i].id);
+    for (uint32_t i = 0; i < cap->objects_count[CAPTURE_RENDERBUFFER]; i++)
+        glDeleteRenderbuffers(1, &cap->objects[CAPTURE_RENDERBUFFER][i].id);
+    for (uint32_t i = 0; i < cap->objects_count[CAPTURE_FRAMEBUFFER]; i++)
+        glDeleteFramebuffers(1, &cap->objects[CAPTURE_FRAMEBUFFER][i].id);
+
+    for (int i = 0; i < CAPTURE_OBJECT_TYPES; i++)
+        free(cap->objects[i]);
+
+    free(cap->groups);
+    free(cap->bundles);
+    free(cap->locations);
+    memset(cap, 0, sizeof(VIDEO_CAPTURE));
+
+    reset_state_cache();
+}
+
+extern int
+replay_capture_group(VIDEO_CAPTURE *cap, uint32_t group) {
+    assert(cap != NULL);
+    assert(group < cap->groups_count);
+
+    VIDEO_CAPTURE_GROUP *g = &cap->groups[group];
+
+    if (g->merged) {
+        VIDEO_COMMAND_PASS *passes[1] = {&g->pass};
+        return submit_command_passes(1, passes);
+    }
+
+    VIDEO_COMMAND_BUFFER *buffers[1] = {&g->pass.buffers[0]};
+    return submit_command_buffers(1, buffers);
+}
+
+#else
+
+extern void
+capture_frame(const char *filename) {
+    LOG_WARNING("Capture: not supported, %s is not written\n", filename);
+}
+
+extern bool
+capture_active(void) {
+    return false;
+}
+
+extern void
+capture_frame_end(void) {
+}
+
+extern void
+capture_submit_buffers(size_t count, VIDEO_COMMAND_BUFFER **buffers) {
+    (void)count;
+    (void)buffers;
+}
+
+extern void
+capture_submit_passes(size_t count, VIDEO_COMMAND_PASS **passes) {
+    (void)count;
+    (void)passes;
+}
+
+extern bool
+load_capture(VIDEO_CAPTURE *cap, const char *filename) {
+    memset(cap, 0, sizeof(VIDEO_CAPTURE));
+    LOG_ERROR("Capture: not supported, %s is not loaded\n", filename);
+
+    return false;
+}
+
+extern void
+free_capture(VIDEO_CAPTURE *cap) {
+    memset(cap, 0, sizeof(VIDEO_CAPTURE));
+}
+
+extern int
+replay_capture_group(VIDEO_CAPTURE *cap, uint32_t group) {
+    (void)cap;
+    (void)group;
+
+    return -1;
+}
+
+#endif // NO GL_ES_VERSION_2_0
@@ -1,14 +1,39 @@
 #include "video/commandbuffer.h"
 #include "video/stats.h"
+#include "video/state.h"
+#include "video/capture.h"
+#include "video/instancing.h"
+#include "video/shader.h"
+#include "video/uniformring.h"
 #include "core/common.h"
+#include "core/logerr.h"
 #include <video/gl.h>
 #include <assert.h>
+#include <SDL2/SDL_atomic.h>
 #include <memtrack.h>
 
 // maximum uniforms is 1024 or check max_uniform_components
-#define DEFAULT_MEMORY_CACHE_SIZE (1024 * sizeof(float) * 4)
+#define DEFAULT_MEMORY_CACHE_SIZE (1024 * sizeof(float) * 16)
+#define MULTI_DRAW_MAX 256
 
-static size_t
+// sort scratch of the submitting thread, recorded buffers and bundles are never grown on submit
+#define SUBMIT_SCRATCH_SIZE (256 * 1024)
+
+static ARENA submit_scratch;
+
+// consecutive element draws with no state change in between, issued as one multi-draw
+static struct {
+    uint32_t    mode;
+    uint32_t    type;
+    GLsizei     count;
+    GLsizei     counts[MULTI_DRAW_MAX];
+    const void  *indices[MULTI_DRAW_MAX];
+    GLint       base_vertices[MULTI_DRAW_MAX];
+} draw_batch;
+
+static void flush_draws(void);
+
+extern size_t
 uniform_size(unsigned int type) {
     size_t sz = 0;
     switch (type) {
@@ -33,6 +58,9 @@ uniform_size(unsigned int type) {
     case UNIFORM_MATRIX4:
         sz = sizeof(float) * 16;
         break;
+    case UNIFORM_BLOCK:
+        sz = sizeof(float) * 4;
+        break;
     }
 
     return sz;
@@ -69,64 +97,63 @@ get_gl_uniform_type(unsigned int type) {
 }
 
 static inline void
-dispatch_uniform(const VIDEO_COMMAND_BUFFER *restrict buffer, uint32_t offset, int location, uint32_t type, uint32_t count) {
+dispatch_uniform(const void *restrict data, int location, uint32_t type, uint32_t count) {
     switch (type) {
     case UNIFORM_INT:
-        glUniform1iv(location, count, (const int*)((const char*)buffer->memory + offset));
+        glUniform1iv(location, count, (const int*)data);
         break;
     case UNIFORM_FLOAT:
-        glUniform1fv(location, count, (const float*)((const char*)buffer->memory + offset));
+        glUniform1fv(location, count, (const float*)data);
         break;
     case UNIFORM_FLOAT2:
-        glUniform2fv(location, count, (const float*)((const char*)buffer->memory + offset));
+        glUniform2fv(location, count, (const float*)data);
         break;
     case UNIFORM_FLOAT3:
-        glUniform3fv(location, count, (const float*)((const char*)buffer->memory + offset));
+        glUniform3fv(location, count, (const float*)data);
         break;
     case UNIFORM_FLOAT4:
-        glUniform4fv(location, count, (const float*)((const char*)buffer->memory + offset));
+        glUniform4fv(location, count, (const float*)data);
         break;
     case UNIFORM_MATRIX3:
-        glUniformMatrix3fv(location, count, GL_FALSE, (const float*)((const char*)buffer->memory + offset));
+        glUniformMatrix3fv(location, count, GL_FALSE, (const float*)data);
         break;
     case UNIFORM_MATRIX4:
-        glUniformMatrix4fv(location, count, GL_FALSE, (const float*)((const char*)buffer->memory + offset));
+        glUniformMatrix4fv(location, count, GL_FALSE, (const float*)data);
         break;
     }
 }
 
-static void
-apply_default_states(const VIDEO_COMMAND_BUFFER *buffer) {
-    if (buffer->flags & VCB_NO_STATES_BIT)
+extern void
+set_uniform(int location, uint32_t type, const void *data, uint32_t count) {
+    if (location < 0)
         return;
 
-    if (buffer->texture_bindings) {
+    if (type == UNIFORM_BLOCK) {
+        flush_draws();
+        bind_uniform_block(location, data, uniform_size(type) * count);
+        return;
     }
 
-    if (buffer->shader_bindings)
-        glUseProgram(0);
-
-    glDepthMask(GL_TRUE);
-    glDisable(GL_DEPTH_TEST);
-
-#ifndef GL_ES_VERSION_2_0
-    glDisable(GL_DEPTH_CLAMP);
-#endif
-
-    if (buffer->depth.stencil_test) {
-        glStencilOpSeparate(GL_FRONT_AND_BACK, GL_KEEP, GL_KEEP, GL_KEEP);
-        glDisable(GL_STENCIL_TEST);
+    if (!uniform_shadow_changed(find_uniform_shadow(state_current_program()), location, data, uniform_size(type) * count)) {
+        video_stats.uniform_elided++;
+        return;
     }
 
-#ifndef GL_ES_VERSION_2_0
-    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-    glDisable(GL_RASTERIZER_DISCARD);
-#endif
-    glDisable(GL_CULL_FACE);
+    flush_draws();
+    video_stats.uniform_calls++;
+    dispatch_uniform(data, location, type, count);
+}
+
+// restores GL defaults once after all buffers, the state cache elides what is already there
+static void
+apply_default_states(void) {
+    state_use_program(0);
 
-    glDisable(GL_BLEND);
+    clear_color_blend_state();
+    clear_rasterizer_state();
+    clear_depth_stencil_state();
 
-    glBindFramebuffer(GL_FRAMEBUFFER, 0); // set default framebuffer
+    state_bind_framebuffer(0); // set default framebuffer
 }
 
 static void
@@ -134,76 +161,350 @@ apply_states(const VIDEO_COMMAND_BUFFER *buffer) {
     if (buffer->flags & VCB_NO_STATES_BIT)
         return;
 
-    if (buffer->blend.enable) {
-        glEnable(GL_BLEND);
-        glBlendFunc(buffer->blend.sfactor, buffer->blend.dfactor); // TODO : more blend control
-    }
+    set_color_blend_state(&buffer->blend);
+    set_rasterizer_state(&buffer->rasterizer);
+    set_depth_stencil_state(&buffer->depth);
+}
 
-    if (buffer->rasterizer.cull_mode != GL_NONE) {
-        glEnable(GL_CULL_FACE);
-        glCullFace(buffer->rasterizer.cull_mode);
-    }
+extern VIDEO_COMMAND_BUFFER
+new_command_buffer(const VIDEO_COMMAND_BUFFER_INFO *info) {
+    static SDL_atomic_t cmd_buffer_id;
+    size_t sz = info ? info->memory_cache_size : 0;
+
+    if (sz == 0)
+        sz = DEFAULT_MEMORY_CACHE_SIZE;
+
+    return (VIDEO_COMMAND_BUFFER){.id = (uint32_t)SDL_AtomicAdd(&cmd_buffer_id, 1), .flags = 0, .arena = new_arena(sz)};
+}
+
+extern void
+free_command_buffer(VIDEO_COMMAND_BUFFER *buffer) {
+    free_arena(&buffer->arena);
+    buffer->first_block = NULL;
+    buffer->last_block = NULL;
+    buffer->commands_count = 0;
+    buffer->flags = 0;
+}
+
+// alignment filler between commands, skipped on decode
+#define PAD_OPCODE 0xff
+
+static inline uint8_t *
+write_u8(uint8_t *p, uint8_t v) {
+    *p = v;
+    return p + 1;
+}
+
+static inline uint8_t *
+write_u16(uint8_t *p, uint32_t v) {
+    assert(v <= UINT16_MAX);
+
+    const uint16_t u = (uint16_t)v;
+    memcpy(p, &u, sizeof(u));
+    return p + sizeof(u);
+}
+
+static inline uint8_t *
+write_u32(uint8_t *p, uint32_t v) {
+    memcpy(p, &v, sizeof(v));
+    return p + sizeof(v);
+}
+
+static inline const uint8_t *
+read_u16(const uint8_t *p, uint32_t *v) {
+    uint16_t u;
+    memcpy(&u, p, sizeof(u));
+    *v = u;
+    return p + sizeof(u);
+}
 
-#ifndef GL_ES_VERSION_2_0
-    if (buffer->rasterizer.fill_mode != GL_NONE) {
-        glPolygonMode(GL_FRONT_AND_BACK, buffer->rasterizer.fill_mode);
+static inline const uint8_t *
+read_u32(const uint8_t *p, void *v) {
+    memcpy(v, p, sizeof(uint32_t));
+    return p + sizeof(uint32_t);
+}
+
+// opcode included, GL enums for modes, index types and texture targets fit in 16 bits
+static const uint8_t encoded_sizes[] = {
+    [VC_VIEWPORT_COMMAND] = 1 + 16,
+    [VC_CLEAR_COMMAND] = 1,
+    [VC_DRAW_ARRAY_COMMAND] = 1 + 2 + 8,
+    [VC_DRAW_ELEMENTS_COMMAND] = 1 + 4 + 12,
+    [VC_DRAW_ELEMENTS_INSTANCED_COMMAND] = 1 + 4 + 16,
+    [VC_TARGET_DRAW_BUFFER_COMMAND] = 1 + 8,
+    [VC_BIND_FRAMEBUFFER_COMMAND] = 1 + 4,
+    [VC_BIND_TARGET_COMMAND] = 1 + 12,
+    [VC_BIND_SHADER_COMMAND] = 1 + 4,
+    [VC_BIND_TEXTURE_COMMAND] = 1 + 1 + 2 + 12,
+    [VC_BIND_VERTEX_ARRAY_COMMAND] = 1 + 4,
+    [VC_UNIFORM_COMMAND] = 1 + 1 + 2 + 4, // values follow
+    [VC_DRAW_PACKET_COMMAND] = 1 + sizeof(uint64_t) + sizeof(const VIDEO_DRAW_PACKET*),
+    [VC_UNIFORM_REFERENCE_COMMAND] = 1 + 1 + 2 + 4 + sizeof(const void*),
+    [VC_BUNDLE_COMMAND] = 1 + sizeof(VIDEO_COMMAND_BUNDLE*)
+};
+
+static uint8_t *
+reserve_command(VIDEO_COMMAND_BUFFER *cb, uint32_t size, uint32_t align) {
+    VIDEO_COMMAND_BLOCK *block = cb->last_block;
+    uint32_t offset = block ? (block->size + align - 1) & ~(align - 1) : 0;
+
+    if (!block || offset + size > block->capacity) {
+        const uint32_t capacity = size > VIDEO_COMMAND_BLOCK_BYTES ? size : VIDEO_COMMAND_BLOCK_BYTES;
+
+        // block data keeps the arena alignment
+        block = arena_alloc(&cb->arena, sizeof(VIDEO_COMMAND_BLOCK) + capacity);
+        block->next = NULL;
+        block->size = 0;
+        block->capacity = capacity;
+
+        if (cb->last_block)
+            cb->last_block->next = block;
+        else
+            cb->first_block = block;
+
+        cb->last_block = block;
+        offset = 0;
     }
 
-    if (buffer->rasterizer.discard)
-        glEnable(GL_RASTERIZER_DISCARD);
-#endif
+    if (offset > block->size)
+        memset(&block->data[block->size], PAD_OPCODE, offset - block->size);
+
+    block->size = offset + size;
+
+    cb->commands_count++;
+    if (cb->commands_count > cb->commands_peak)
+        cb->commands_peak = cb->commands_count;
+
+    return &block->data[offset];
+}
 
-    if (buffer->depth.depth_test) {
-        glEnable(GL_DEPTH_TEST);
-        glDepthFunc(buffer->depth.depth_func);
+// GL enums, texture units and uniform counts are stored narrow, a value past the field would decode as another one
+static bool
+fits_encoding(const VIDEO_COMMAND *command) {
+    switch (command->type) {
+    case VC_DRAW_ARRAY_COMMAND:
+        return command->draw_array.mode <= UINT16_MAX;
+    case VC_DRAW_ELEMENTS_COMMAND:
+        return command->draw_elements.mode <= UINT16_MAX && command->draw_elements.type <= UINT16_MAX;
+    case VC_DRAW_ELEMENTS_INSTANCED_COMMAND:
+        return command->draw_elements_instanced.mode <= UINT16_MAX && command->draw_elements_instanced.type <= UINT16_MAX;
+    case VC_BIND_TEXTURE_COMMAND:
+        return command->bind_texture.unit <= UINT8_MAX && command->bind_texture.target <= UINT16_MAX;
+    case VC_UNIFORM_COMMAND:
+    case VC_UNIFORM_REFERENCE_COMMAND:
+        return command->uniform.type <= UINT8_MAX && command->uniform.count <= UINT16_MAX;
     }
 
-    if (buffer->depth.depth_write)
-        glDepthMask(GL_TRUE);
-    else
-        glDepthMask(GL_FALSE);
+    return true;
+}
 
-#ifndef GL_ES_VERSION_2_0
-    if (buffer->depth.depth_clamp) {
-        glEnable(GL_DEPTH_CLAMP);
-        //glDepthRange(1.f, 1000.f);
+static void
+push_command(VIDEO_COMMAND_BUFFER *cb, const VIDEO_COMMAND *command) {
+    if (!fits_encoding(command)) {
+        LOG_ERROR("Command %d doesn't fit the command stream, dropped\n", command->type);
+        return;
     }
-    else
-        glDisable(GL_DEPTH_CLAMP);
-#endif // NO GL_ES_VERSION_2_0
 
-    if (buffer->depth.stencil_test) {
-        glEnable(GL_STENCIL_TEST);
+    // uniform values follow an 8 byte header and are read in place, keep them aligned
+    const bool uniform = command->type == VC_UNIFORM_COMMAND;
+    const uint32_t size = encoded_sizes[command->type] + (uniform ? (uint32_t)command->uniform.size : 0);
+    uint8_t *p = write_u8(reserve_command(cb, size, uniform ? 4 : 1), (uint8_t)command->type);
+
+    switch (command->type) {
+    case VC_VIEWPORT_COMMAND:
+        p = write_u32(p, (uint32_t)command->viewport.x);
+        p = write_u32(p, (uint32_t)command->viewport.y);
+        p = write_u32(p, (uint32_t)command->viewport.width);
+        write_u32(p, (uint32_t)command->viewport.height);
+        break;
+    case VC_CLEAR_COMMAND:
+        break;
+    case VC_DRAW_ARRAY_COMMAND:
+        p = write_u16(p, command->draw_array.mode);
+        p = write_u32(p, command->draw_array.count);
+        write_u32(p, command->draw_array.first);
+        break;
+    case VC_DRAW_ELEMENTS_COMMAND:
+        p = write_u16(p, command->draw_elements.mode);
+        p = write_u16(p, command->draw_elements.type);
+        p = write_u32(p, command->draw_elements.count);
+        p = write_u32(p, command->draw_elements.base_vertex);
+        write_u32(p, command->draw_elements.indices_offset);
+        break;
+    case VC_DRAW_ELEMENTS_INSTANCED_COMMAND:
+        p = write_u16(p, command->draw_elements_instanced.mode);
+        p = write_u16(p, command->draw_elements_instanced.type);
+        p = write_u32(p, command->draw_elements_instanced.count);
+        p = write_u32(p, command->draw_elements_instanced.instances);
+        p = write_u32(p, command->draw_elements_instanced.base_vertex);
+        write_u32(p, command->draw_elements_instanced.indices_offset);
+        break;
+    case VC_TARGET_DRAW_BUFFER_COMMAND:
+        p = write_u32(p, command->target_draw_buffer.target);
+        write_u32(p, command->target_draw_buffer.buf);
+        break;
+    case VC_BIND_FRAMEBUFFER_COMMAND:
+        write_u32(p, command->bind_framebuffer.framebuffer);
+        break;
+    case VC_BIND_TARGET_COMMAND:
+        p = write_u32(p, command->bind_target.attachment);
+        p = write_u32(p, command->bind_target.target);
+        write_u32(p, command->bind_target.texture);
+        break;
+    case VC_BIND_SHADER_COMMAND:
+        write_u32(p, command->bind_shader.program);
+        break;
+    case VC_BIND_TEXTURE_COMMAND:
+        p = write_u8(p, (uint8_t)command->bind_texture.unit);
+        p = write_u16(p, command->bind_texture.target);
+        p = write_u32(p, command->bind_texture.texture);
+        p = write_u32(p, command->bind_texture.sampler);
+        write_u32(p, (uint32_t)command->bind_texture.location);
+        break;
+    case VC_BIND_VERTEX_ARRAY_COMMAND:
+        write_u32(p, command->bind_vertex_array.array);
+        break;
+    case VC_UNIFORM_COMMAND:
+        p = write_u8(p, (uint8_t)command->uniform.type);
+        p = write_u16(p, command->uniform.count);
+        p = write_u32(p, (uint32_t)command->uniform.location);
+        memcpy(p, command->uniform.data, command->uniform.size);
+        break;
+    case VC_DRAW_PACKET_COMMAND:
+        memcpy(p, &command->draw_packet.key, sizeof(uint64_t));
+        memcpy(p + sizeof(uint64_t), &command->draw_packet.packet, sizeof(const VIDEO_DRAW_PACKET*));
+        break;
+    case VC_UNIFORM_REFERENCE_COMMAND:
+        p = write_u8(p, (uint8_t)command->uniform.type);
+        p = write_u16(p, command->uniform.count);
+        p = write_u32(p, (uint32_t)command->uniform.location);
+        memcpy(p, &command->uniform.data, sizeof(const void*));
+        break;
+    case VC_BUNDLE_COMMAND:
+        memcpy(p, &command->bundle.bundle, sizeof(VIDEO_COMMAND_BUNDLE*));
+        break;
+    }
+}
 
-        // initial func GL_ALWAYS
-        glStencilFuncSeparate(GL_FRONT, buffer->depth.front.func, 0, buffer->depth.front.mask);
-        glStencilFuncSeparate(GL_BACK, buffer->depth.back.func, 0, buffer->depth.back.mask);
+static inline const uint8_t *
+decode_command(const uint8_t *p, VIDEO_COMMAND *command) {
+    command->type = *p++;
 
-        // initial value is GL_KEEP for all
-        glStencilOpSeparate(GL_FRONT, buffer->depth.front.sfail, buffer->depth.front.dpfail, buffer->depth.front.dppass);
-        glStencilOpSeparate(GL_BACK, buffer->depth.back.sfail, buffer->depth.back.dpfail, buffer->depth.back.dppass);
+    switch (command->type) {
+    case VC_VIEWPORT_COMMAND:
+        p = read_u32(p, &command->viewport.x);
+        p = read_u32(p, &command->viewport.y);
+        p = read_u32(p, &command->viewport.width);
+        p = read_u32(p, &command->viewport.height);
+        break;
+    case VC_CLEAR_COMMAND:
+        break;
+    case VC_DRAW_ARRAY_COMMAND:
+        p = read_u16(p, &command->draw_array.mode);
+        p = read_u32(p, &command->draw_array.count);
+        p = read_u32(p, &command->draw_array.first);
+        break;
+    case VC_DRAW_ELEMENTS_COMMAND:
+        p = read_u16(p, &command->draw_elements.mode);
+        p = read_u16(p, &command->draw_elements.type);
+        p = read_u32(p, &command->draw_elements.count);
+        p = read_u32(p, &command->draw_elements.base_vertex);
+        p = read_u32(p, &command->draw_elements.indices_offset);
+        break;
+    case VC_DRAW_ELEMENTS_INSTANCED_COMMAND:
+        p = read_u16(p, &command->draw_elements_instanced.mode);
+        p = read_u16(p, &command->draw_elements_instanced.type);
+        p = read_u32(p, &command->draw_elements_instanced.count);
+        p = read_u32(p, &command->draw_elements_instanced.instances);
+        p = read_u32(p, &command->draw_elements_instanced.base_vertex);
+        p = read_u32(p, &command->draw_elements_instanced.indices_offset);
+        break;
+    case VC_TARGET_DRAW_BUFFER_COMMAND:
+        p = read_u32(p, &command->target_draw_buffer.target);
+        p = read_u32(p, &command->target_draw_buffer.buf);
+        break;
+    case VC_BIND_FRAMEBUFFER_COMMAND:
+        p = read_u32(p, &command->bind_framebuffer.framebuffer);
+        break;
+    case VC_BIND_TARGET_COMMAND:
+        p = read_u32(p, &command->bind_target.attachment);
+        p = read_u32(p, &command->bind_target.target);
+        p = read_u32(p, &command->bind_target.texture);
+        break;
+    case VC_BIND_SHADER_COMMAND:
+        p = read_u32(p, &command->bind_shader.program);
+        break;
+    case VC_BIND_TEXTURE_COMMAND:
+        command->bind_texture.unit = *p++;
+        p = read_u16(p, &command->bind_texture.target);
+        p = read_u32(p, &command->bind_texture.texture);
+        p = read_u32(p, &command->bind_texture.sampler);
+        p = read_u32(p, &command->bind_texture.location);
+        break;
+    case VC_BIND_VERTEX_ARRAY_COMMAND:
+        p = read_u32(p, &command->bind_vertex_array.array);
+        break;
+    case VC_UNIFORM_COMMAND:
+        command->uniform.type = *p++;
+        p = read_u16(p, &command->uniform.count);
+        p = read_u32(p, &command->uniform.location);
+        command->uniform.size = uniform_size(command->uniform.type) * command->uniform.count;
+        command->uniform.data = p;
+        p += command->uniform.size;
+        break;
+    case VC_DRAW_PACKET_COMMAND:
+        memcpy(&command->draw_packet.key, p, sizeof(uint64_t));
+        memcpy(&command->draw_packet.packet, p + sizeof(uint64_t), sizeof(const VIDEO_DRAW_PACKET*));
+        p += sizeof(uint64_t) + sizeof(const VIDEO_DRAW_PACKET*);
+        break;
+    case VC_UNIFORM_REFERENCE_COMMAND:
+        command->uniform.type = *p++;
+        p = read_u16(p, &command->uniform.count);
+        p = read_u32(p, &command->uniform.location);
+        command->uniform.size = uniform_size(command->uniform.type) * command->uniform.count;
+        memcpy(&command->uniform.data, p, sizeof(const void*));
+        p += sizeof(const void*);
+        break;
+    case VC_BUNDLE_COMMAND:
+        memcpy(&command->bundle.bundle, p, sizeof(VIDEO_COMMAND_BUNDLE*));
+        p += sizeof(VIDEO_COMMAND_BUNDLE*);
+        break;
     }
+
+    return p;
 }
 
-extern VIDEO_COMMAND_BUFFER
-new_command_buffer(const VIDEO_COMMAND_BUFFER_INFO *info) {
-    static uint32_t cmd_buffer_id = 0;
-    size_t sz = info->memory_cache_size;
+extern VIDEO_COMMAND_ITERATOR
+first_command(const VIDEO_COMMAND_BUFFER *cb) {
+    assert(cb != NULL);
+
+    return (VIDEO_COMMAND_ITERATOR){.block = cb->first_block, .offset = 0};
+}
+
+static inline bool
+decode_next(VIDEO_COMMAND_ITERATOR *it, VIDEO_COMMAND *command) {
+    while (it->block) {
+        const VIDEO_COMMAND_BLOCK *block = it->block;
 
-    // TODO: whats wrong?
-    //sif (sz == 0)
-        sz = 65536;//DEFAULT_MEMORY_CACHE_SIZE;
+        while (it->offset < block->size && block->data[it->offset] == PAD_OPCODE)
+            it->offset++;
 
-    void *mem = malloc(sz);
+        if (it->offset < block->size) {
+            const uint8_t *next = decode_command(&block->data[it->offset], command);
+            it->offset = (uint32_t)(next - block->data);
+            return true;
+        }
+
+        it->block = block->next;
+        it->offset = 0;
+    }
 
-    return (VIDEO_COMMAND_BUFFER){.id = cmd_buffer_id++, .flags = 0, .memory = mem, .memory_size = sz, .memory_offset = 0};
+    return false;
 }
 
-extern void
-free_command_buffer(VIDEO_COMMAND_BUFFER *buffer) {
-    free(buffer->memory);
-    buffer->memory = NULL;
-    buffer->flags = 0;
+extern bool
+next_command(VIDEO_COMMAND_ITERATOR *it, VIDEO_COMMAND *command) {
+    return decode_next(it, command);
 }
 
 // NOTE: static dispatching is better?
@@ -227,13 +528,462 @@ clear_command_buffers(size_t count, VIDEO_COMMAND_BUFFER **buffers) {
         buffer->shader_bindings = 0;
         buffer->texture_bindings = 0;
         buffer->commands_count = 0;
-        buffer->memory_offset = 0;
+        buffer->first_block = NULL;
+        buffer->last_block = NULL;
+
+        VIDEO_SORT_STATE *sort = &buffer->sort;
+        sort->layer = 0;
+        sort->translucent = false;
+        sort->depth = 0.f;
+        sort->program = 0;
+        sort->vertex_array = 0;
+        sort->textures_count = 0;
+        sort->uniforms_count = 0;
+        sort->textures_snapshot = NULL;
+        sort->uniforms_snapshot = NULL;
+        sort->last_copy = NULL;
+
+        arena_reset(&buffer->arena);
+    }
+}
+
+static void
+flush_draws(void) {
+    if (draw_batch.count == 0)
+        return;
+
+    if (draw_batch.count == 1)
+        glDrawElementsBaseVertex(draw_batch.mode, draw_batch.counts[0], draw_batch.type,
+                                 draw_batch.indices[0], draw_batch.base_vertices[0]);
+    else
+        glMultiDrawElementsBaseVertex(draw_batch.mode, draw_batch.counts, draw_batch.type,
+                                      draw_batch.indices, draw_batch.count, draw_batch.base_vertices);
+
+    video_stats.dips++;
+    draw_batch.count = 0;
+}
+
+static void
+batch_draw(const VIDEO_COMMAND *command) {
+    if (draw_batch.count > 0 && (draw_batch.count == MULTI_DRAW_MAX ||
+                                 draw_batch.mode != command->draw_elements.mode ||
+                                 draw_batch.type != command->draw_elements.type))
+        flush_draws();
+
+    const GLsizei i = draw_batch.count++;
+
+    draw_batch.mode = command->draw_elements.mode;
+    draw_batch.type = command->draw_elements.type;
+    draw_batch.counts[i] = command->draw_elements.count;
+    draw_batch.indices[i] = (const void*)(uintptr_t)command->draw_elements.indices_offset;
+    draw_batch.base_vertices[i] = command->draw_elements.base_vertex;
+
+    video_stats.draws++;
+}
+
+static void submit_bundle(VIDEO_COMMAND_BUNDLE *bundle);
+
+// pending draws go out when the state cache or the uniform shadow let a change through, or before
+// anything that isn't cached
+static void
+dispatch_command(VIDEO_COMMAND_BUFFER *buffer, const VIDEO_COMMAND *command) {
+    switch (command->type) {
+    case VC_VIEWPORT_COMMAND:
+        state_viewport(command->viewport.x, command->viewport.y, command->viewport.width, command->viewport.height);
+        break;
+    case VC_CLEAR_COMMAND:
+        flush_draws();
+        glClearColor(buffer->color[0], buffer->color[1], buffer->color[2], buffer->color[3]);
+        glClear(buffer->mask);
+        break;
+
+    case VC_DRAW_ARRAY_COMMAND:
+        flush_draws();
+        glDrawArrays(command->draw_array.mode, command->draw_array.first, command->draw_array.count);
+        video_stats.draws++;
+        video_stats.dips++;
+        break;
+    case VC_DRAW_ELEMENTS_COMMAND:
+        batch_draw(command);
+        break;
+    case VC_DRAW_ELEMENTS_INSTANCED_COMMAND:
+        flush_draws();
+        glDrawElementsInstancedBaseVertex(command->draw_elements_instanced.mode,
+                                          command->draw_elements_instanced.count,
+                                          command->draw_elements_instanced.type,
+                                          (const void*)(uintptr_t)command->draw_elements_instanced.indices_offset,
+                                          command->draw_elements_instanced.instances,
+                                          command->draw_elements_instanced.base_vertex);
+        video_stats.draws++;
+        video_stats.dips++;
+        break;
+
+    case VC_TARGET_DRAW_BUFFER_COMMAND:
+        flush_draws();
+        glDrawBuffer(command->target_draw_buffer.buf);
+        break;
+    case VC_BIND_FRAMEBUFFER_COMMAND:
+        state_bind_framebuffer(command->bind_framebuffer.framebuffer);
+        break;
+    case VC_BIND_TARGET_COMMAND:
+        flush_draws();
+        glFramebufferTexture2D(GL_FRAMEBUFFER, command->bind_target.attachment, command->bind_target.target, command->bind_target.texture, 0);
+        break;
+    case VC_BIND_SHADER_COMMAND:
+        state_use_program(command->bind_shader.program);
+        buffer->shader_bindings++;
+        video_stats.shader_binds++;
+        break;
+    case VC_BIND_TEXTURE_COMMAND:
+        state_bind_texture(command->bind_texture.unit, command->bind_texture.target, command->bind_texture.texture);
+        state_bind_sampler(command->bind_texture.unit, command->bind_texture.sampler);
+        state_sampler_uniform(command->bind_texture.location, command->bind_texture.unit);
+        buffer->texture_bindings++;
+        video_stats.texture_binds++;
+        break;
+    case VC_BIND_VERTEX_ARRAY_COMMAND:
+        state_bind_vertex_array(command->bind_vertex_array.array);
+        break;
+
+    case VC_UNIFORM_COMMAND:
+    case VC_UNIFORM_REFERENCE_COMMAND:
+        if (IS_INSTANCE_LOCATION(command->uniform.location))
+            break;
+
+        set_uniform(command->uniform.location, command->uniform.type, command->uniform.data, command->uniform.count);
+        break;
+
+    case VC_BUNDLE_COMMAND:
+        submit_bundle(command->bundle.bundle);
+        break;
+    }
+}
+
+struct SortItem {
+    uint64_t                    key;
+    const VIDEO_DRAW_PACKET     *packet;
+};
+
+// LSD radix sort by bytes, stable, skips bytes shared by every key
+static struct SortItem *
+radix_sort_items(struct SortItem *items, struct SortItem *temp, uint32_t count) {
+    uint32_t histogram[8][256];
+    memset(histogram, 0, sizeof(histogram));
+
+    for (uint32_t i = 0; i < count; i++)
+        for (int b = 0; b < 8; b++)
+            histogram[b][(items[i].key >> (b * 8)) & 0xff]++;
+
+    struct SortItem *src = items, *dst = temp;
+
+    for (int b = 0; b < 8; b++) {
+        uint32_t *h = histogram[b];
+
+        if (h[(src[0].key >> (b * 8)) & 0xff] == count)
+            continue;
+
+        uint32_t sum = 0;
+        for (int k = 0; k < 256; k++) {
+            const uint32_t c = h[k];
+            h[k] = sum;
+            sum += c;
+        }
+
+        for (uint32_t i = 0; i < count; i++)
+            dst[h[(src[i].key >> (b * 8)) & 0xff]++] = src[i];
+
+        struct SortItem *t = src;
+        src = dst;
+        dst = t;
+    }
+
+    return src;
+}
+
+static uint32_t
+instance_stride(const VIDEO_DRAW_PACKET *packet) {
+    uint32_t stride = 1;
+
+    for (uint32_t u = 0; u < packet->uniforms_count; u++) {
+        const VIDEO_COMMAND *uniform = &packet->uniforms[u];
+
+        if (!IS_INSTANCE_LOCATION(uniform->uniform.location))
+            continue;
+
+        const uint32_t end = (uint32_t)(uniform->uniform.location - INSTANCE_LOCATION_BASE) +
+                instance_uniform_texels(uniform->uniform.type) * uniform->uniform.count;
+
+        if (end > stride)
+            stride = end;
+    }
+
+    return stride < INSTANCE_BUFFER_TEXELS ? stride : INSTANCE_BUFFER_TEXELS;
+}
+
+// same draw, vertex array, textures and shared uniforms, instance uniforms have the same layout
+static bool
+instance_compatible(const VIDEO_DRAW_PACKET *a, const VIDEO_DRAW_PACKET *b) {
+    if (a->program != b->program || a->vertex_array != b->vertex_array || a->draw.type != b->draw.type ||
+        a->textures_count != b->textures_count || a->uniforms_count != b->uniforms_count)
+        return false;
+
+    if (memcmp(&a->draw.draw_elements, &b->draw.draw_elements, sizeof(a->draw.draw_elements)) != 0)
+        return false;
+
+    for (uint32_t t = 0; t < a->textures_count; t++)
+        if (memcmp(&a->textures[t].bind_texture, &b->textures[t].bind_texture, sizeof(a->textures[t].bind_texture)) != 0)
+            return false;
+
+    if (a->uniforms == b->uniforms)
+        return true;
+
+    for (uint32_t u = 0; u < a->uniforms_count; u++) {
+        const VIDEO_COMMAND *ua = &a->uniforms[u], *ub = &b->uniforms[u];
+
+        if (ua->uniform.location != ub->uniform.location || ua->uniform.type != ub->uniform.type ||
+            ua->uniform.count != ub->uniform.count)
+            return false;
+
+        if (!IS_INSTANCE_LOCATION(ua->uniform.location) &&
+            memcmp(ua->uniform.data, ub->uniform.data, ua->uniform.size) != 0)
+            return false;
+    }
+
+    return true;
+}
+
+// instance uniforms into vec4 texels, matrices by column
+static void
+pack_instance(float *texels, const VIDEO_DRAW_PACKET *packet, uint32_t stride) {
+    for (uint32_t u = 0; u < packet->uniforms_count; u++) {
+        const VIDEO_COMMAND *uniform = &packet->uniforms[u];
+
+        if (!IS_INSTANCE_LOCATION(uniform->uniform.location))
+            continue;
+
+        const uint32_t offset = (uint32_t)(uniform->uniform.location - INSTANCE_LOCATION_BASE);
+        const uint32_t columns = instance_uniform_texels(uniform->uniform.type);
+        const uint32_t components = (uint32_t)(uniform_size(uniform->uniform.type) / sizeof(float)) / columns;
+
+        for (uint32_t c = 0; c < columns * uniform->uniform.count && offset + c < stride; c++)
+            for (uint32_t k = 0; k < components; k++) {
+                const uint32_t i = c * components + k;
+
+                texels[(offset + c) * 4 + k] = uniform->uniform.type == UNIFORM_INT ?
+                            (float)((const int*)uniform->uniform.data)[i] : ((const float*)uniform->uniform.data)[i];
+            }
+    }
+}
+
+// draws a run of compatible packets of an instanced program, returns how many it took
+static uint32_t
+dispatch_instances(VIDEO_COMMAND_BUFFER *buffer, const INSTANCED_PROGRAM *instanced, const struct SortItem *items, uint32_t count) {
+    const VIDEO_DRAW_PACKET *first = items[0].packet;
+    const uint32_t stride = instance_stride(first);
+    const uint32_t max = INSTANCE_BUFFER_TEXELS / stride;
+
+    uint32_t n = 1;
+    if (first->draw.type == VC_DRAW_ELEMENTS_COMMAND)
+        while (n < count && n < max && instance_compatible(first, items[n].packet))
+            n++;
+
+    // texels are appended, pending draws keep reading theirs and the base uniform flushes them when it moves
+    uint32_t base = 0;
+    float *texels = begin_instances(n * stride, &base);
+    memset(texels, 0, sizeof(float) * 4 * n * stride);
+
+    for (uint32_t i = 0; i < n; i++)
+        pack_instance(&texels[i * stride * 4], items[i].packet, stride);
+
+    end_instances(base, n * stride);
+    bind_instances(instanced, base, stride);
+
+    if (n == 1) {
+        dispatch_command(buffer, &first->draw);
+        return 1;
+    }
+
+    flush_draws();
+    glDrawElementsInstancedBaseVertex(first->draw.draw_elements.mode,
+                                      first->draw.draw_elements.count,
+                                      first->draw.draw_elements.type,
+                                      (const void*)(uintptr_t)first->draw.draw_elements.indices_offset,
+                                      n,
+                                      first->draw.draw_elements.base_vertex);
+    video_stats.draws += n;
+    video_stats.dips++;
+
+    return n;
+}
+
+static void
+dispatch_packets(VIDEO_COMMAND_BUFFER *buffer, struct SortItem *items, struct SortItem *temp, uint32_t count, bool presorted) {
+    if (count == 0)
+        return;
+
+    const struct SortItem *sorted = presorted ? items : radix_sort_items(items, temp, count);
+
+    uint32_t program = 0, vertex_array = 0;
+    bool bound = false;
+    const VIDEO_COMMAND *units[VIDEO_PACKET_MAX_TEXTURES] = {NULL};
+    const VIDEO_COMMAND *uniforms = NULL;
+    const INSTANCED_PROGRAM *instanced = NULL;
+
+    for (uint32_t i = 0; i < count;) {
+        const VIDEO_DRAW_PACKET *packet = sorted[i].packet;
+
+        if (!bound || packet->program != program) {
+            state_use_program(packet->program);
+            buffer->shader_bindings++;
+            video_stats.shader_binds++;
+
+            // sampler uniforms belong to the program
+            memset(units, 0, sizeof(units));
+            uniforms = NULL;
+            program = packet->program;
+            instanced = find_instanced_program(program);
+        }
+
+        for (uint32_t t = 0; t < packet->textures_count; t++) {
+            const VIDEO_COMMAND *texture = &packet->textures[t];
+            const VIDEO_COMMAND *current = units[texture->bind_texture.unit];
+
+            if (current && memcmp(&current->bind_texture, &texture->bind_texture, sizeof(texture->bind_texture)) == 0)
+                continue;
+
+            dispatch_command(buffer, texture);
+            units[texture->bind_texture.unit] = texture;
+        }
+
+        // packets share a snapshot until a uniform changes, the program still holds its values
+        // a new snapshot with the same values is elided by the shadow and keeps the draws batched
+        if (packet->uniforms != uniforms) {
+            for (uint32_t u = 0; u < packet->uniforms_count; u++)
+                dispatch_command(buffer, &packet->uniforms[u]);
+
+            uniforms = packet->uniforms;
+        }
+
+        if (!bound || packet->vertex_array != vertex_array) {
+            state_bind_vertex_array(packet->vertex_array);
+            vertex_array = packet->vertex_array;
+        }
+
+        bound = true;
+
+        if (instanced) {
+            i += dispatch_instances(buffer, instanced, &sorted[i], count - i);
+            continue;
+        }
+
+        dispatch_command(buffer, &packet->draw);
+        i++;
+    }
+}
+
+// buffers are one stream, packets are sorted across them and only move between barriers
+static void
+submit_sorted(size_t buffers_count, VIDEO_COMMAND_BUFFER **buffers) {
+    size_t total = 0;
+    for (size_t j = 0; j < buffers_count; j++)
+        total += buffers[j]->commands_count;
+
+    if (total == 0)
+        return;
+
+    // bundles submit nested, the mark keeps the items of the outer buffer
+    VIDEO_COMMAND_BUFFER *first = buffers[0];
+    const ARENA_MARK mark = arena_mark(&submit_scratch);
+    struct SortItem *items = arena_alloc(&submit_scratch, sizeof(struct SortItem) * total * 2);
+    struct SortItem *temp = items + total;
+    uint32_t count = 0;
+
+    // bundles were sorted when baked
+    const bool presorted = (first->flags & VCB_BUNDLE_BIT) != 0;
+
+    for (size_t j = 0; j < buffers_count; j++) {
+        VIDEO_COMMAND_BUFFER *buffer = buffers[j];
+
+        VIDEO_COMMAND_ITERATOR it = first_command(buffer);
+        VIDEO_COMMAND command;
+
+        while (decode_next(&it, &command)) {
+            if (command.type == VC_DRAW_PACKET_COMMAND) {
+                items[count++] = (struct SortItem){command.draw_packet.key, command.draw_packet.packet};
+                continue;
+            }
+
+            dispatch_packets(first, items, temp, count, presorted);
+            count = 0;
+
+            dispatch_command(buffer, &command);
+        }
     }
+
+    dispatch_packets(first, items, temp, count, presorted);
+    flush_draws();
+
+    arena_rewind(&submit_scratch, mark);
+}
+
+static void
+submit_linear(VIDEO_COMMAND_BUFFER *buffer) {
+    VIDEO_COMMAND_ITERATOR it = first_command(buffer);
+    VIDEO_COMMAND command;
+
+    while (decode_next(&it, &command))
+        dispatch_command(buffer, &command);
+
+    flush_draws();
+}
+
+// the bundle keeps its own clear values, states are the ones of the buffer it was spliced into
+// sorting goes through the submit scratch, the bundle's arena is only read
+static void
+submit_bundle(VIDEO_COMMAND_BUNDLE *bundle) {
+    VIDEO_COMMAND_BUFFER *buffer = &bundle->commands;
+    const size_t used = buffer->arena.used;
+
+    video_stats.commands += buffer->commands_count;
+
+    if (buffer->flags & VCB_SORTED_BIT)
+        submit_sorted(1, &buffer);
+    else
+        submit_linear(buffer);
+
+    assert(buffer->arena.used == used);
+    (void)used;
+}
+
+static void
+account_buffer(const VIDEO_COMMAND_BUFFER *buffer) {
+    video_stats.commands += buffer->commands_count;
+    video_stats.commands_peak += buffer->commands_peak;
+    video_stats.commands_memory += buffer->arena.used;
+    video_stats.commands_memory_peak += buffer->arena.peak;
+    video_stats.commands_memory_reserved += buffer->arena.reserved;
+}
+
+static void
+prepare_submit_scratch(void) {
+    if (!submit_scratch.first)
+        submit_scratch = new_arena(SUBMIT_SCRATCH_SIZE);
+
+    state_set_change_callback(flush_draws);
+}
+
+extern void
+command_buffers_cleanup(void) {
+    if (submit_scratch.first)
+        free_arena(&submit_scratch);
 }
 
 extern int
 submit_command_buffers(size_t count, VIDEO_COMMAND_BUFFER **buffers) {
+    prepare_submit_scratch();
     videostats_reset();
+    capture_submit_buffers(count, buffers);
+    reset_instances();
 
     for (size_t j = 0; j < count; j++) {
         VIDEO_COMMAND_BUFFER *buffer = buffers[j];
@@ -241,92 +991,207 @@ submit_command_buffers(size_t count, VIDEO_COMMAND_BUFFER **buffers) {
         if (!buffer)
             break;
 
+        account_buffer(buffer);
         apply_states(buffer);
 
-        for (int i = 0; i < buffer->commands_count; i++) {
-            VIDEO_COMMAND *command = &buffer->commands[i];
-
-            switch (buffer->commands[i].type) {
-            case VC_VIEWPORT_COMMAND:
-                glViewport(command->viewport.x, command->viewport.y, command->viewport.width, command->viewport.height);
-                break;
-            case VC_CLEAR_COMMAND:
-                glClearColor(buffer->color[0], buffer->color[1], buffer->color[2], buffer->color[3]);
-                glClear(buffer->mask);
-                break;
-
-            case VC_DRAW_ARRAY_COMMAND:
-                glDrawArrays(command->draw_array.mode, command->draw_array.first, command->draw_array.count);
-                break;
-            case VC_DRAW_ELEMENTS_COMMAND:
-                glDrawElementsBaseVertex(command->draw_elements.mode,
-                                         command->draw_elements.count,
-                                         command->draw_elements.type,
-                                         (const void*)(uintptr_t)command->draw_elements.indices_offset,
-                                         command->draw_elements.base_vertex);
-                video_stats.dips++;
-                break;
-            case VC_DRAW_ELEMENTS_INSTANCED_COMMAND:
-                glDrawElementsInstancedBaseVertex(command->draw_elements_instanced.mode,
-                                                  command->draw_elements_instanced.count,
-                                                  command->draw_elements_instanced.type,
-                                                  (const void*)(uintptr_t)command->draw_elements_instanced.indices_offset,
-                                                  command->draw_elements_instanced.instances,
-                                                  command->draw_elements_instanced.base_vertex);
-                break;
-
-            case VC_TARGET_DRAW_BUFFER_COMMAND:
-                glDrawBuffer(command->target_draw_buffer.buf);
-                break;
-            case VC_BIND_FRAMEBUFFER_COMMAND:
-                glBindFramebuffer(GL_FRAMEBUFFER, command->bind_framebuffer.framebuffer);
-                break;
-            case VC_BIND_TARGET_COMMAND:
-                glFramebufferTexture2D(GL_FRAMEBUFFER, command->bind_target.attachment, command->bind_target.target, command->bind_target.texture, 0);
-                break;
-            case VC_BIND_SHADER_COMMAND:
-                glUseProgram(command->bind_shader.program);
-                buffer->shader_bindings++;
-                break;
-            case VC_BIND_TEXTURE_COMMAND:
-                glActiveTexture(GL_TEXTURE0 + command->bind_texture.unit);
-                glBindTexture(command->bind_texture.target, command->bind_texture.texture);
-                glBindSampler(command->bind_texture.unit, command->bind_texture.sampler);
-
-                glUniform1i(command->bind_texture.location, command->bind_texture.unit);
-                buffer->texture_bindings++;
-                break;
-            case VC_BIND_VERTEX_ARRAY_COMMAND:
-                glBindVertexArray(command->bind_vertex_array.array);
-                break;
-
-            case VC_UNIFORM_COMMAND:
-                dispatch_uniform(buffer, command->uniform.offset, command->uniform.location, command->uniform.type, command->uniform.count);
-                break;
-            }
+        if (buffer->flags & VCB_SORTED_BIT)
+            submit_sorted(1, &buffers[j]);
+        else
+            submit_linear(buffer);
+    }
+
+    apply_default_states();
+
+    return 0;
+}
+
+extern VIDEO_COMMAND_PASS
+new_command_pass(const VIDEO_COMMAND_BUFFER_INFO *info, uint32_t workers) {
+    VIDEO_COMMAND_PASS pass;
+    memset(&pass, 0, sizeof(pass));
+
+    pass.buffers_count = workers > 0 ? workers : 1;
+    pass.buffers = malloc(sizeof(VIDEO_COMMAND_BUFFER) * pass.buffers_count);
+
+    if (!pass.buffers) {
+        LOG_CRITICAL("%s\n", "Can't alloc memory");
+        exit(EXIT_FAILURE);
+    }
+
+    for (uint32_t i = 0; i < pass.buffers_count; i++)
+        pass.buffers[i] = new_command_buffer(info);
+
+    return pass;
+}
+
+extern void
+free_command_pass(VIDEO_COMMAND_PASS *pass) {
+    assert(pass != NULL);
+
+    for (uint32_t i = 0; i < pass->buffers_count; i++)
+        free_command_buffer(&pass->buffers[i]);
+
+    free(pass->buffers);
+    memset(pass, 0, sizeof(VIDEO_COMMAND_PASS));
+}
+
+extern void
+begin_command_pass(VIDEO_COMMAND_PASS *pass) {
+    assert(pass != NULL);
+
+    for (uint32_t i = 0; i < pass->buffers_count; i++) {
+        VIDEO_COMMAND_BUFFER *buffer = &pass->buffers[i];
+
+        buffer->flags = pass->flags;
+        buffer->mask = pass->mask;
+        memcpy(buffer->color, pass->color, sizeof(buffer->color));
+        buffer->blend = pass->blend;
+        buffer->rasterizer = pass->rasterizer;
+        buffer->depth = pass->depth;
+
+        VIDEO_COMMAND_BUFFER *buffers[1] = {buffer};
+        clear_command_buffers(1, buffers);
+    }
+}
+
+extern VIDEO_COMMAND_BUFFER *
+pass_command_buffer(VIDEO_COMMAND_PASS *pass, uint32_t worker) {
+    assert(pass != NULL);
+    assert(worker < pass->buffers_count);
+
+    return &pass->buffers[worker];
+}
+
+extern int
+submit_command_passes(size_t count, VIDEO_COMMAND_PASS **passes) {
+    prepare_submit_scratch();
+    videostats_reset();
+    capture_submit_passes(count, passes);
+    reset_instances();
+
+    for (size_t j = 0; j < count; j++) {
+        VIDEO_COMMAND_PASS *pass = passes[j];
+
+        if (!pass)
+            break;
+
+        const ARENA_MARK mark = arena_mark(&submit_scratch);
+        VIDEO_COMMAND_BUFFER **buffers = arena_alloc(&submit_scratch, sizeof(VIDEO_COMMAND_BUFFER*) * pass->buffers_count);
+        for (uint32_t i = 0; i < pass->buffers_count; i++) {
+            buffers[i] = &pass->buffers[i];
+            account_buffer(buffers[i]);
         }
 
-        apply_default_states(buffer);
+        apply_states(buffers[0]);
+
+        if (pass->flags & VCB_SORTED_BIT)
+            submit_sorted(pass->buffers_count, buffers);
+        else
+            for (uint32_t i = 0; i < pass->buffers_count; i++)
+                submit_linear(buffers[i]);
+
+        arena_rewind(&submit_scratch, mark);
     }
 
+    apply_default_states();
+
     return 0;
 }
 
+static uint64_t
+make_sort_key(const VIDEO_COMMAND_BUFFER *cb) {
+    const VIDEO_SORT_STATE *sort = &cb->sort;
+
+    const float depth = sort->depth < 0.f ? 0.f : sort->depth > 1.f ? 1.f : sort->depth;
+    uint64_t d = (uint64_t)(depth * 0xffffff);
+
+    if (sort->translucent || (sort->back_to_front[sort->layer / 32] & (1u << (sort->layer % 32))))
+        d = 0xffffff - d;
+
+    const uint64_t shader = sort->program & 0x3ff;
+    const uint64_t texture = (sort->textures_count > 0 ? sort->textures[0].bind_texture.texture : 0) & 0xfff;
+    const uint64_t va = sort->vertex_array & 0x1ff;
+
+    uint64_t key = (uint64_t)sort->layer << 56;
+
+    if (sort->translucent)
+        key |= 1ull << 55 | d << 31 | shader << 21 | texture << 9 | va;
+    else
+        key |= shader << 45 | texture << 33 | va << 24 | d;
+
+    return key;
+}
+
+static void
+push_draw(VIDEO_COMMAND_BUFFER *cb, const VIDEO_COMMAND *draw) {
+    if (!(cb->flags & VCB_SORTED_BIT)) {
+        push_command(cb, draw);
+        return;
+    }
+
+    VIDEO_SORT_STATE *sort = &cb->sort;
+
+    if (!sort->textures_snapshot && sort->textures_count > 0) {
+        VIDEO_COMMAND *textures = arena_alloc(&cb->arena, sizeof(VIDEO_COMMAND) * sort->textures_count);
+        memcpy(textures, sort->textures, sizeof(VIDEO_COMMAND) * sort->textures_count);
+        sort->textures_snapshot = textures;
+    }
+
+    if (!sort->uniforms_snapshot && sort->uniforms_count > 0) {
+        VIDEO_COMMAND *uniforms = arena_alloc(&cb->arena, sizeof(VIDEO_COMMAND) * sort->uniforms_count);
+        memcpy(uniforms, sort->uniforms, sizeof(VIDEO_COMMAND) * sort->uniforms_count);
+        sort->uniforms_snapshot = uniforms;
+    }
+
+    VIDEO_DRAW_PACKET *packet = arena_alloc(&cb->arena, sizeof(VIDEO_DRAW_PACKET));
+    packet->program = sort->program;
+    packet->vertex_array = sort->vertex_array;
+    packet->textures_count = sort->textures_count;
+    packet->uniforms_count = sort->uniforms_count;
+    packet->textures = sort->textures_snapshot;
+    packet->uniforms = sort->uniforms_snapshot;
+    packet->draw = *draw;
+
+    VIDEO_COMMAND cmd;
+    cmd.type = VC_DRAW_PACKET_COMMAND;
+    cmd.draw_packet.key = make_sort_key(cb);
+    cmd.draw_packet.packet = packet;
+
+    push_command(cb, &cmd);
+}
+
+extern void
+draw_sort_params(VIDEO_COMMAND_BUFFER *cb, uint8_t layer, bool translucent, float depth) {
+    assert(cb != NULL);
+
+    cb->sort.layer = layer;
+    cb->sort.translucent = translucent;
+    cb->sort.depth = depth;
+}
+
+extern void
+layer_depth_order(VIDEO_COMMAND_BUFFER *cb, uint8_t layer, uint32_t order) {
+    assert(cb != NULL);
+
+    if (order == DEPTH_ORDER_BACK_TO_FRONT)
+        cb->sort.back_to_front[layer / 32] |= 1u << (layer % 32);
+    else
+        cb->sort.back_to_front[layer / 32] &= ~(1u << (layer % 32));
+}
+
 extern void
 clear_command(VIDEO_COMMAND_BUFFER *cb) {
     assert(cb != NULL);
 
-    cb->commands[cb->commands_count] = (VIDEO_COMMAND) {.type = VC_CLEAR_COMMAND};
-    cb->commands_count++;
+    push_command(cb, &(VIDEO_COMMAND) {.type = VC_CLEAR_COMMAND});
 }
 
 extern void
 viewport_command(VIDEO_COMMAND_BUFFER *cb, int viewport[4]) {
     assert(cb != NULL);
 
-    cb->commands[cb->commands_count] = (VIDEO_COMMAND) {.type = VC_VIEWPORT_COMMAND,
-            .viewport = {viewport[0], viewport[1], viewport[2], viewport[3]}};
-    cb->commands_count++;
+    push_command(cb, &(VIDEO_COMMAND) {.type = VC_VIEWPORT_COMMAND,
+            .viewport = {viewport[0], viewport[1], viewport[2], viewport[3]}});
 }
 
 extern void
@@ -338,8 +1203,7 @@ draw_array_command(VIDEO_COMMAND_BUFFER *cb, uint32_t mode, uint32_t count) {
     cmd.draw_array.mode = mode;
     cmd.draw_array.first = 0;
     cmd.draw_array.count = count;
-    cb->commands[cb->commands_count] = cmd;
-    cb->commands_count++;
+    push_draw(cb, &cmd);
 }
 
 extern void
@@ -353,8 +1217,7 @@ draw_elements_command(VIDEO_COMMAND_BUFFER *cb, uint32_t mode, uint32_t type, ui
     cmd.draw_elements.type = type;
     cmd.draw_elements.base_vertex = base_vertex;
     cmd.draw_elements.indices_offset = offset;
-    cb->commands[cb->commands_count] = cmd;
-    cb->commands_count++;
+    push_draw(cb, &cmd);
 }
 
 extern void
@@ -369,17 +1232,15 @@ draw_elements_instanced_command(VIDEO_COMMAND_BUFFER *cb, uint32_t mode, uint32_
     cmd.draw_elements_instanced.base_vertex = base_vertex;
     cmd.draw_elements_instanced.indices_offset = offset;
     cmd.draw_elements_instanced.instances = instances;
-    cb->commands[cb->commands_count] = cmd;
-    cb->commands_count++;
+    push_draw(cb, &cmd);
 }
 
 extern void
 target_draw_buffer_command(VIDEO_COMMAND_BUFFER *cb, uint32_t target, uint32_t buf) {
     assert(cb != NULL);
 
-    cb->commands[cb->commands_count] = (VIDEO_COMMAND){.type = VC_TARGET_DRAW_BUFFER_COMMAND,
-            .target_draw_buffer = {.target = target, .buf = buf}};
-    cb->commands_count++;
+    push_command(cb, &(VIDEO_COMMAND){.type = VC_TARGET_DRAW_BUFFER_COMMAND,
+            .target_draw_buffer = {.target = target, .buf = buf}});
 }
 
 extern void
@@ -389,8 +1250,7 @@ bind_framebuffer_command(VIDEO_COMMAND_BUFFER *cb, uint32_t franmebuffer) {
     VIDEO_COMMAND cmd;
     cmd.type = VC_BIND_FRAMEBUFFER_COMMAND;
     cmd.bind_framebuffer.framebuffer = franmebuffer;
-    cb->commands[cb->commands_count] = cmd;
-    cb->commands_count++;
+    push_command(cb, &cmd);
 }
 
 extern void
@@ -402,19 +1262,28 @@ bind_target_command(VIDEO_COMMAND_BUFFER *cb, uint32_t attachment, uint32_t targ
     cmd.bind_target.attachment = attachment;
     cmd.bind_target.target = target;
     cmd.bind_target.texture = texture;
-    cb->commands[cb->commands_count] = cmd;
-    cb->commands_count++;
+    push_command(cb, &cmd);
 }
 
 extern void
 bind_shader_command(VIDEO_COMMAND_BUFFER *cb, uint32_t program) {
     assert(cb != NULL);
 
+    if (cb->flags & VCB_SORTED_BIT) {
+        VIDEO_SORT_STATE *sort = &cb->sort;
+
+        sort->program = program;
+        sort->textures_count = 0;
+        sort->uniforms_count = 0;
+        sort->textures_snapshot = NULL;
+        sort->uniforms_snapshot = NULL;
+        return;
+    }
+
     VIDEO_COMMAND cmd;
     cmd.type = VC_BIND_SHADER_COMMAND;
     cmd.bind_shader.program = program;
-    cb->commands[cb->commands_count] = cmd;
-    cb->commands_count++;
+    push_command(cb, &cmd);
 }
 
 extern void
@@ -428,40 +1297,244 @@ bind_texture_command(VIDEO_COMMAND_BUFFER *cb, uint32_t target, uint32_t unit, u
     cmd.bind_texture.texture = texture;
     cmd.bind_texture.sampler = sampler;
     cmd.bind_texture.location = location;
-    cb->commands[cb->commands_count] = cmd;
-    cb->commands_count++;
+
+    if (cb->flags & VCB_SORTED_BIT) {
+        VIDEO_SORT_STATE *sort = &cb->sort;
+        assert(unit < VIDEO_PACKET_MAX_TEXTURES);
+
+        uint32_t i = 0;
+        while (i < sort->textures_count && sort->textures[i].bind_texture.unit != unit)
+            i++;
+
+        if (i == sort->textures_count)
+            sort->textures_count++;
+
+        sort->textures[i] = cmd;
+        sort->textures_snapshot = NULL;
+        return;
+    }
+
+    push_command(cb, &cmd);
 }
 
 extern void
 bind_vertex_array_command(VIDEO_COMMAND_BUFFER *cb, uint32_t va) {
     assert(cb != NULL);
 
-    cb->commands[cb->commands_count] = (VIDEO_COMMAND) {.type = VC_BIND_VERTEX_ARRAY_COMMAND,
-            .bind_vertex_array = {.array = va}};
-    cb->commands_count++;
+    if (cb->flags & VCB_SORTED_BIT) {
+        cb->sort.vertex_array = va;
+        return;
+    }
+
+    push_command(cb, &(VIDEO_COMMAND) {.type = VC_BIND_VERTEX_ARRAY_COMMAND,
+            .bind_vertex_array = {.array = va}});
 }
 
-extern void
-uniform_command(VIDEO_COMMAND_BUFFER *cb, int location, uint32_t type, const void *ptr, uint32_t count) {
+static void
+copy_uniform_data(VIDEO_COMMAND_BUFFER *cb, VIDEO_COMMAND *command) {
+    if (command->type != VC_UNIFORM_COMMAND)
+        return;
+
+    void *data = arena_alloc(&cb->arena, command->uniform.size);
+    memcpy(data, command->uniform.data, command->uniform.size);
+    command->uniform.data = data;
+}
+
+static void
+record_uniform(VIDEO_COMMAND_BUFFER *cb, int command_type, int location, uint32_t type, const void *ptr, uint32_t count) {
     assert(cb != NULL);
     assert(ptr != NULL);
-    assert(cb->memory_offset < cb->memory_size);
 
     if (location < 0)
         return;
 
-    size_t sz = uniform_size(type) * count;
-    memcpy((char*)cb->memory + cb->memory_offset, ptr, sz);
-
     VIDEO_COMMAND cmd;
-    cmd.type = VC_UNIFORM_COMMAND;
+    cmd.type = command_type;
     cmd.uniform.location = location;
     cmd.uniform.type = type;
-    cmd.uniform.size = sz;
+    cmd.uniform.size = uniform_size(type) * count;
     cmd.uniform.count = count;
-    cmd.uniform.offset = cb->memory_offset;
+    cmd.uniform.data = ptr;
 
-    cb->commands[cb->commands_count] = cmd;
-    cb->commands_count++;
-    cb->memory_offset += cmd.uniform.size;
+    if (cb->flags & VCB_SORTED_BIT) {
+        VIDEO_SORT_STATE *sort = &cb->sort;
+
+        uint32_t i = 0;
+        // binding points and locations overlap, blocks only replace blocks
+        while (i < sort->uniforms_count && (sort->uniforms[i].uniform.location != location ||
+                                            (sort->uniforms[i].uniform.type == UNIFORM_BLOCK) != (type == UNIFORM_BLOCK)))
+            i++;
+
+        if (i == VIDEO_PACKET_MAX_UNIFORMS) {
+            LOG_ERROR("Too many uniforms for draw packet (%d)\n", location);
+            return;
+        }
+
+        if (i == sort->uniforms_count)
+            sort->uniforms_count++;
+
+        // packets point at the value, linear buffers store it inline, references stay with the caller
+        copy_uniform_data(cb, &cmd);
+
+        sort->uniforms[i] = cmd;
+        sort->uniforms_snapshot = NULL;
+        return;
+    }
+
+    push_command(cb, &cmd);
+}
+
+extern void
+uniform_command(VIDEO_COMMAND_BUFFER *cb, int location, uint32_t type, const void *ptr, uint32_t count) {
+    record_uniform(cb, VC_UNIFORM_COMMAND, location, type, ptr, count);
+}
+
+extern void
+uniform_reference_command(VIDEO_COMMAND_BUFFER *cb, int location, uint32_t type, const void *ptr, uint32_t count) {
+    record_uniform(cb, VC_UNIFORM_REFERENCE_COMMAND, location, type, ptr, count);
+}
+
+extern void
+uniform_block_command(VIDEO_COMMAND_BUFFER *cb, int binding, const void *ptr, size_t size) {
+    assert(size % 16 == 0);
+
+    record_uniform(cb, VC_UNIFORM_COMMAND, binding, UNIFORM_BLOCK, ptr, (uint32_t)(size / 16));
+}
+
+extern void
+frame_uniform_block_command(VIDEO_COMMAND_BUFFER *cb, int binding, const void *ptr, size_t size) {
+    assert(cb != NULL);
+    assert(ptr != NULL);
+    assert(size % 16 == 0);
+
+    if (binding < 0)
+        return;
+
+    push_command(cb, &(VIDEO_COMMAND) {.type = VC_UNIFORM_COMMAND,
+            .uniform = {.location = binding, .type = UNIFORM_BLOCK, .size = (uint32_t)size, .count = (uint32_t)(size / 16), .data = ptr}});
+}
+
+static bool
+same_uniforms(const VIDEO_COMMAND *a, const VIDEO_COMMAND *b, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++)
+        if (a[i].type != b[i].type || (a[i].type == VC_UNIFORM_REFERENCE_COMMAND && a[i].uniform.data != b[i].uniform.data) ||
+            a[i].uniform.location != b[i].uniform.location || a[i].uniform.type != b[i].uniform.type ||
+            a[i].uniform.size != b[i].uniform.size || memcmp(a[i].uniform.data, b[i].uniform.data, a[i].uniform.size) != 0)
+            return false;
+
+    return true;
+}
+
+static const VIDEO_COMMAND *
+copy_commands(VIDEO_COMMAND_BUFFER *cb, const VIDEO_COMMAND *commands, uint32_t count) {
+    if (count == 0)
+        return NULL;
+
+    VIDEO_COMMAND *copy = arena_alloc(&cb->arena, sizeof(VIDEO_COMMAND) * count);
+    memcpy(copy, commands, sizeof(VIDEO_COMMAND) * count);
+
+    for (uint32_t i = 0; i < count; i++)
+        copy_uniform_data(cb, &copy[i]);
+
+    return copy;
+}
+
+extern void
+copy_command(VIDEO_COMMAND_BUFFER *cb, const VIDEO_COMMAND *command) {
+    assert(cb != NULL);
+    assert(command != NULL);
+
+    if (command->type == VC_DRAW_PACKET_COMMAND) {
+        const VIDEO_DRAW_PACKET *source = command->draw_packet.packet;
+        VIDEO_DRAW_PACKET *packet = arena_alloc(&cb->arena, sizeof(VIDEO_DRAW_PACKET));
+
+        *packet = *source;
+        packet->textures = copy_commands(cb, source->textures, source->textures_count);
+
+        // keep consecutive packets sharing uniforms like recorded ones, so submit can skip them
+        const VIDEO_DRAW_PACKET *last = cb->sort.last_copy;
+        if (last && last->uniforms_count == source->uniforms_count &&
+            same_uniforms(last->uniforms, source->uniforms, source->uniforms_count))
+            packet->uniforms = last->uniforms;
+        else
+            packet->uniforms = copy_commands(cb, source->uniforms, source->uniforms_count);
+
+        cb->sort.last_copy = packet;
+
+        VIDEO_COMMAND cmd = *command;
+        cmd.draw_packet.packet = packet;
+        push_command(cb, &cmd);
+        return;
+    }
+
+    push_command(cb, command);
+}
+
+extern VIDEO_COMMAND_BUNDLE
+bake_command_bundle(const VIDEO_COMMAND_BUFFER *recorded) {
+    assert(recorded != NULL);
+
+    VIDEO_COMMAND_BUNDLE bundle;
+    bundle.commands = new_command_buffer(&(VIDEO_COMMAND_BUFFER_INFO){.memory_cache_size = recorded->arena.used});
+
+    VIDEO_COMMAND_BUFFER *cb = &bundle.commands;
+    cb->flags = (recorded->flags & VCB_SORTED_BIT) | VCB_BUNDLE_BIT;
+    cb->mask = recorded->mask;
+    memcpy(cb->color, recorded->color, sizeof(cb->color));
+
+    struct SortItem *items = NULL, *temp = NULL;
+
+    if (recorded->commands_count > 0 && (recorded->flags & VCB_SORTED_BIT)) {
+        items = malloc(sizeof(struct SortItem) * recorded->commands_count * 2);
+
+        if (!items) {
+            LOG_CRITICAL("%s\n", "Can't alloc memory");
+            exit(EXIT_FAILURE);
+        }
+
+        temp = items + recorded->commands_count;
+    }
+
+    VIDEO_COMMAND_ITERATOR it = first_command(recorded);
+    VIDEO_COMMAND command;
+    uint32_t count = 0;
+
+    for (bool more = true; more;) {
+        more = decode_next(&it, &command);
+
+        if (more && command.type == VC_DRAW_PACKET_COMMAND) {
+            items[count++] = (struct SortItem){command.draw_packet.key, command.draw_packet.packet};
+            continue;
+        }
+
+        // packets are stored in submit order, keys are kept for captures
+        const struct SortItem *sorted = count > 0 ? radix_sort_items(items, temp, count) : NULL;
+        for (uint32_t i = 0; i < count; i++)
+            copy_command(cb, &(VIDEO_COMMAND){.type = VC_DRAW_PACKET_COMMAND,
+                    .draw_packet = {.key = sorted[i].key, .packet = sorted[i].packet}});
+        count = 0;
+
+        if (more)
+            copy_command(cb, &command);
+    }
+
+    free(items);
+
+    return bundle;
+}
+
+extern void
+free_command_bundle(VIDEO_COMMAND_BUNDLE *bundle) {
+    assert(bundle != NULL);
+
+    free_command_buffer(&bundle->commands);
+}
+
+extern void
+bundle_command(VIDEO_COMMAND_BUFFER *cb, VIDEO_COMMAND_BUNDLE *bundle) {
+    assert(cb != NULL);
+    assert(bundle != NULL);
+
+    push_command(cb, &(VIDEO_COMMAND) {.type = VC_BUNDLE_COMMAND,
+            .bundle = {.bundle = bundle}});
 }
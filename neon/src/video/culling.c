@@ -0,0 +1,316 @@
+#include <assert.h>
+#include <math.h>
+#include <float.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <memtrack.h>
+
+#include "core/common.h"
+#include "core/logerr.h"
+#include "video/vertex.h"
+#include "video/culling.h"
+#include "video/geometry.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define CULLING_AVX
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define CULLING_SSE2
+#endif
+
+static uint32_t
+round_capacity(uint32_t capacity) {
+    return (capacity + CULLING_SET_BATCH - 1) & ~(uint32_t)(CULLING_SET_BATCH - 1);
+}
+
+static float *
+alloc_lane(uint32_t capacity) {
+    float *p = malloc(capacity * sizeof(float));
+
+    if (!p) {
+        LOG_CRITICAL("%s\n", "Can't alloc memory");
+        exit(EXIT_FAILURE);
+    }
+
+    return p;
+}
+
+static void
+resize_lane(float **lane, uint32_t count, uint32_t capacity, float pad) {
+    float *p = alloc_lane(capacity);
+
+    if (*lane)
+        memcpy(p, *lane, count * sizeof(float));
+
+    // padding never passes the plane test
+    for (uint32_t i = count; i < capacity; i++)
+        p[i] = pad;
+
+    free(*lane);
+    *lane = p;
+}
+
+static void
+culling_set_resize(CULLING_SET *set, uint32_t capacity) {
+    capacity = round_capacity(capacity);
+
+    resize_lane(&set->min_x, set->count, capacity, FLT_MAX);
+    resize_lane(&set->min_y, set->count, capacity, FLT_MAX);
+    resize_lane(&set->min_z, set->count, capacity, FLT_MAX);
+    resize_lane(&set->max_x, set->count, capacity, -FLT_MAX);
+    resize_lane(&set->max_y, set->count, capacity, -FLT_MAX);
+    resize_lane(&set->max_z, set->count, capacity, -FLT_MAX);
+
+    uint32_t *user = realloc(set->user, capacity * sizeof(uint32_t));
+    if (!user) {
+        LOG_CRITICAL("%s\n", "Can't alloc memory");
+        exit(EXIT_FAILURE);
+    }
+
+    set->user = user;
+    set->capacity = capacity;
+}
+
+extern CULLING_SET
+new_culling_set(uint32_t capacity) {
+    CULLING_SET set;
+    memset(&set, 0, sizeof(set));
+
+    culling_set_resize(&set, capacity > 0 ? capacity : CULLING_SET_BATCH);
+
+    return set;
+}
+
+extern void
+free_culling_set(CULLING_SET *set) {
+    assert(set != NULL);
+
+    free(set->min_x);
+    free(set->min_y);
+    free(set->min_z);
+    free(set->max_x);
+    free(set->max_y);
+    free(set->max_z);
+    free(set->user);
+
+    memset(set, 0, sizeof(CULLING_SET));
+}
+
+extern void
+culling_set_clear(CULLING_SET *set) {
+    assert(set != NULL);
+
+    for (uint32_t i = 0; i < set->count; i++) {
+        set->min_x[i] = set->min_y[i] = set->min_z[i] = FLT_MAX;
+        set->max_x[i] = set->max_y[i] = set->max_z[i] = -FLT_MAX;
+    }
+
+    set->count = 0;
+}
+
+extern void
+culling_set_update(CULLING_SET *set, uint32_t index, const AABB *bound, matrix4 transform) {
+    assert(set != NULL);
+    assert(bound != NULL);
+    assert(index < set->count);
+
+    // transform center and extents (Arvo), the result encloses the rotated box
+    float c[3], e[3];
+    for (int k = 0; k < 3; k++) {
+        c[k] = (bound->max[k] + bound->min[k]) * 0.5f;
+        e[k] = (bound->max[k] - bound->min[k]) * 0.5f;
+    }
+
+    float wc[3], we[3];
+    for (int j = 0; j < 3; j++) {
+        wc[j] = c[0] * transform[0][j] + c[1] * transform[1][j] + c[2] * transform[2][j] + transform[3][j];
+        we[j] = e[0] * fabsf(transform[0][j]) + e[1] * fabsf(transform[1][j]) + e[2] * fabsf(transform[2][j]);
+    }
+
+    set->min_x[index] = wc[0] - we[0];
+    set->min_y[index] = wc[1] - we[1];
+    set->min_z[index] = wc[2] - we[2];
+    set->max_x[index] = wc[0] + we[0];
+    set->max_y[index] = wc[1] + we[1];
+    set->max_z[index] = wc[2] + we[2];
+}
+
+extern uint32_t
+culling_set_add(CULLING_SET *set, const AABB *bound, matrix4 transform, uint32_t user) {
+    assert(set != NULL);
+
+    if (set->count >= set->capacity)
+        culling_set_resize(set, set->capacity * 2);
+
+    const uint32_t index = set->count++;
+
+    set->user[index] = user;
+    culling_set_update(set, index, bound, transform);
+
+    return index;
+}
+
+extern void
+culling_set_add_objects(CULLING_SET *set, const VIDEO_VERTICES_INFO *info, matrix4 transform) {
+    assert(info != NULL);
+
+    for (uint32_t i = 0; i < info->objects_count; i++)
+        culling_set_add(set, &info->objects[i].bound, transform, i);
+}
+
+static void
+normalize_plane(float4 p) {
+    const float len = sqrtf(p[0] * p[0] + p[1] * p[1] + p[2] * p[2]);
+
+    if (len <= FLT_EPSILON)
+        return;
+
+    p[0] /= len;
+    p[1] /= len;
+    p[2] /= len;
+    p[3] /= len;
+}
+
+extern void
+frustum_from_matrix(VIDEO_FRUSTUM *frustum, matrix4 m) {
+    assert(frustum != NULL);
+
+    // row vector convention, clip = v * m, so each clip component is a column of m
+    for (int i = 0; i < 4; i++) {
+        frustum->planes[FRUSTUM_LEFT][i]   = m[i][3] + m[i][0];
+        frustum->planes[FRUSTUM_RIGHT][i]  = m[i][3] - m[i][0];
+        frustum->planes[FRUSTUM_BOTTOM][i] = m[i][3] + m[i][1];
+        frustum->planes[FRUSTUM_TOP][i]    = m[i][3] - m[i][1];
+        frustum->planes[FRUSTUM_NEAR][i]   = m[i][3] + m[i][2];
+        frustum->planes[FRUSTUM_FAR][i]    = m[i][3] - m[i][2];
+    }
+
+    for (int i = 0; i < FRUSTUM_PLANES_NUM; i++)
+        normalize_plane(frustum->planes[i]);
+}
+
+// per plane pick the box corner furthest along the normal, once for the whole set
+struct PlaneLanes {
+    const float *x, *y, *z;
+};
+
+static void
+select_lanes(const CULLING_SET *set, const VIDEO_FRUSTUM *frustum, struct PlaneLanes lanes[FRUSTUM_PLANES_NUM]) {
+    for (int p = 0; p < FRUSTUM_PLANES_NUM; p++) {
+        lanes[p].x = frustum->planes[p][0] > 0.f ? set->max_x : set->min_x;
+        lanes[p].y = frustum->planes[p][1] > 0.f ? set->max_y : set->min_y;
+        lanes[p].z = frustum->planes[p][2] > 0.f ? set->max_z : set->min_z;
+    }
+}
+
+static inline uint32_t
+emit_visible(const CULLING_SET *set, uint32_t base, unsigned mask, uint32_t *visible, uint32_t n) {
+    while (mask) {
+        const unsigned bit = __builtin_ctz(mask);
+        const uint32_t index = base + bit;
+
+        if (index < set->count)
+            visible[n++] = set->user[index];
+
+        mask &= mask - 1;
+    }
+
+    return n;
+}
+
+extern uint32_t
+cull_frustum(const CULLING_SET *set, const VIDEO_FRUSTUM *frustum, uint32_t *visible) {
+    assert(set != NULL);
+    assert(frustum != NULL);
+    assert(visible != NULL);
+
+    struct PlaneLanes lanes[FRUSTUM_PLANES_NUM];
+    select_lanes(set, frustum, lanes);
+
+    uint32_t n = 0;
+
+#if defined(CULLING_AVX)
+    __m256 pa[FRUSTUM_PLANES_NUM], pb[FRUSTUM_PLANES_NUM], pc[FRUSTUM_PLANES_NUM], pd[FRUSTUM_PLANES_NUM];
+    for (int p = 0; p < FRUSTUM_PLANES_NUM; p++) {
+        pa[p] = _mm256_set1_ps(frustum->planes[p][0]);
+        pb[p] = _mm256_set1_ps(frustum->planes[p][1]);
+        pc[p] = _mm256_set1_ps(frustum->planes[p][2]);
+        pd[p] = _mm256_set1_ps(-frustum->planes[p][3]);
+    }
+
+    for (uint32_t i = 0; i < set->count; i += 8) {
+        __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+
+        for (int p = 0; p < FRUSTUM_PLANES_NUM; p++) {
+            __m256 d = _mm256_mul_ps(pa[p], _mm256_loadu_ps(lanes[p].x + i));
+            d = _mm256_add_ps(d, _mm256_mul_ps(pb[p], _mm256_loadu_ps(lanes[p].y + i)));
+            d = _mm256_add_ps(d, _mm256_mul_ps(pc[p], _mm256_loadu_ps(lanes[p].z + i)));
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(d, pd[p], _CMP_GE_OQ));
+        }
+
+        n = emit_visible(set, i, _mm256_movemask_ps(inside), visible, n);
+    }
+#elif defined(CULLING_SSE2)
+    __m128 pa[FRUSTUM_PLANES_NUM], pb[FRUSTUM_PLANES_NUM], pc[FRUSTUM_PLANES_NUM], pd[FRUSTUM_PLANES_NUM];
+    for (int p = 0; p < FRUSTUM_PLANES_NUM; p++) {
+        pa[p] = _mm_set1_ps(frustum->planes[p][0]);
+        pb[p] = _mm_set1_ps(frustum->planes[p][1]);
+        pc[p] = _mm_set1_ps(frustum->planes[p][2]);
+        pd[p] = _mm_set1_ps(-frustum->planes[p][3]);
+    }
+
+    for (uint32_t i = 0; i < set->count; i += 4) {
+        __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+
+        for (int p = 0; p < FRUSTUM_PLANES_NUM; p++) {
+            __m128 d = _mm_mul_ps(pa[p], _mm_loadu_ps(lanes[p].x + i));
+            d = _mm_add_ps(d, _mm_mul_ps(pb[p], _mm_loadu_ps(lanes[p].y + i)));
+            d = _mm_add_ps(d, _mm_mul_ps(pc[p], _mm_loadu_ps(lanes[p].z + i)));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(d, pd[p]));
+        }
+
+        n = emit_visible(set, i, _mm_movemask_ps(inside), visible, n);
+    }
+#else
+    for (uint32_t i = 0; i < set->count; i++) {
+        bool inside = true;
+
+        for (int p = 0; p < FRUSTUM_PLANES_NUM && inside; p++) {
+            const float *pl = frustum->planes[p];
+            inside = pl[0] * lanes[p].x[i] + pl[1] * lanes[p].y[i] + pl[2] * lanes[p].z[i] + pl[3] >= 0.f;
+        }
+
+        if (inside)
+            visible[n++] = set->user[i];
+    }
+#endif
+
+    return n;
+}
+
+extern void
+draw_objects_command(VIDEO_COMMAND_BUFFER *cb, const VIDEO_VERTICES_INFO *info, const uint32_t *objects, const uint32_t *lods, uint32_t count) {
+    assert(cb != NULL);
+    assert(info != NULL);
+
+    if (count == 0)
+        return;
+
+    const uint32_t type = info->desc.ef == IF_UI32 ? GL_UNSIGNED_INT : GL_UNSIGNED_SHORT;
+    const GEOMETRY_PLACEMENT placement = geometry_placement(info->geometry);
+
+    bind_vertex_array_command(cb, info->array.id);
+
+    for (uint32_t i = 0; i < count; i++) {
+        const struct VerticesObjectInfo *obj = &info->objects[objects[i]];
+        const uint32_t base_vertex = placement.base_vertex + obj->base_vertex;
+
+        if (lods && lods[i] > 0 && lods[i] < obj->lods_count) {
+            const struct VerticesLod *lod = &obj->lods[lods[i]];
+            draw_elements_command(cb, info->desc.primitive, type, lod->count, placement.ib_offset + lod->ib_offset, base_vertex);
+        } else
+            draw_elements_command(cb, info->desc.primitive, type, obj->count, placement.ib_offset + obj->ib_offset, base_vertex);
+    }
+}
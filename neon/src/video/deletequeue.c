@@ -0,0 +1,236 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <video/gl.h>
+#include <memtrack.h>
+
+#include "core/logerr.h"
+#include "core/video.h"
+#include "video/state.h"
+#include "video/stats.h"
+#include "video/deletequeue.h"
+
+#define DELETE_QUEUE_FENCES 8
+
+typedef struct DeleteEntry {
+    uint32_t    type;
+    uint32_t    id;
+    uint32_t    frame;  // video_frame_fence when freed
+} DELETE_ENTRY;
+
+static struct {
+    DELETE_ENTRY    *entries;
+    uint32_t        head;
+    uint32_t        count;
+    uint32_t        capacity;
+
+    uint32_t        frames;     // ended on the GL thread
+    uint32_t        retired;    // frames the GPU is done with
+    #ifndef GL_ES_VERSION_2_0
+    GLsync          fences[DELETE_QUEUE_FENCES];
+    uint32_t        fenced[DELETE_QUEUE_FENCES];
+    uint32_t        fences_head;
+    uint32_t        fences_count;
+    #endif // NO GL_ES_VERSION_2_0
+
+    uint32_t        live[VIDEO_OBJECT_TYPES];
+} queue;
+
+static const char *object_names[VIDEO_OBJECT_TYPES] = {
+    [VIDEO_OBJECT_TEXTURE] = "texture",
+    [VIDEO_OBJECT_SAMPLER] = "sampler",
+    [VIDEO_OBJECT_RENDERBUFFER] = "renderbuffer",
+    [VIDEO_OBJECT_FRAMEBUFFER] = "framebuffer",
+    [VIDEO_OBJECT_BUFFER] = "buffer",
+    [VIDEO_OBJECT_VERTEX_ARRAY] = "vertex array",
+    [VIDEO_OBJECT_PROGRAM] = "program",
+    [VIDEO_OBJECT_SHADER] = "shader",
+};
+
+extern void
+track_video_object(uint32_t type) {
+    assert(type < VIDEO_OBJECT_TYPES);
+
+    queue.live[type]++;
+}
+
+extern void
+delete_video_object(uint32_t type, uint32_t id) {
+    assert(type < VIDEO_OBJECT_TYPES);
+
+    if (id == 0)
+        return;
+
+    if (queue.count == queue.capacity) {
+        // reclaim what was deleted before growing
+        if (queue.head > 0) {
+            memmove(queue.entries, &queue.entries[queue.head], sizeof(DELETE_ENTRY) * (queue.count - queue.head));
+            queue.count -= queue.head;
+            queue.head = 0;
+        }
+
+        if (queue.count == queue.capacity) {
+            queue.capacity = queue.capacity ? queue.capacity * 2 : 256;
+
+            DELETE_ENTRY *entries = realloc(queue.entries, sizeof(DELETE_ENTRY) * queue.capacity);
+            if (!entries) {
+                LOG_CRITICAL("%s\n", "Can't alloc memory");
+                exit(EXIT_FAILURE);
+            }
+
+            queue.entries = entries;
+        }
+    }
+
+    queue.entries[queue.count++] = (DELETE_ENTRY){.type = type, .id = id, .frame = video_frame_fence()};
+}
+
+static void
+delete_object(const DELETE_ENTRY *entry) {
+    switch (entry->type) {
+    case VIDEO_OBJECT_TEXTURE:
+        glDeleteTextures(1, &entry->id);
+        break;
+    case VIDEO_OBJECT_RENDERBUFFER:
+        glDeleteRenderbuffers(1, &entry->id);
+        break;
+    case VIDEO_OBJECT_FRAMEBUFFER:
+        glDeleteFramebuffers(1, &entry->id);
+        break;
+    case VIDEO_OBJECT_BUFFER:
+        glDeleteBuffers(1, &entry->id);
+        break;
+    case VIDEO_OBJECT_PROGRAM:
+        glDeleteProgram(entry->id);
+        break;
+    case VIDEO_OBJECT_SHADER:
+        glDeleteShader(entry->id);
+        break;
+    #ifndef GL_ES_VERSION_2_0
+    case VIDEO_OBJECT_SAMPLER:
+        glDeleteSamplers(1, &entry->id);
+        break;
+    case VIDEO_OBJECT_VERTEX_ARRAY:
+        glDeleteVertexArrays(1, &entry->id);
+        break;
+    #endif // NO GL_ES_VERSION_2_0
+    default:
+        break;
+    }
+
+    if (queue.live[entry->type] > 0)
+        queue.live[entry->type]--;
+    else
+        LOG_WARNING("Delete of untracked %s %u\n", object_names[entry->type], entry->id);
+}
+
+static uint32_t
+delete_objects(uint32_t budget) {
+    uint32_t deleted = 0;
+
+    while (queue.head < queue.count && deleted < budget) {
+        const DELETE_ENTRY *entry = &queue.entries[queue.head];
+
+        if ((int32_t)(queue.retired - entry->frame) < 0)
+            break;
+
+        delete_object(entry);
+        queue.head++;
+        deleted++;
+    }
+
+    if (queue.head == queue.count)
+        queue.head = queue.count = 0;
+
+    // names may have been bound and can be reused
+    if (deleted > 0)
+        reset_state_cache();
+
+    return deleted;
+}
+
+#ifndef GL_ES_VERSION_2_0
+
+static void
+retire_frames(void) {
+    while (queue.fences_count > 0) {
+        GLsync fence = queue.fences[queue.fences_head];
+
+        const GLenum result = glClientWaitSync(fence, 0, 0);
+        if (result != GL_ALREADY_SIGNALED && result != GL_CONDITION_SATISFIED)
+            break;
+
+        queue.retired = queue.fenced[queue.fences_head];
+        glDeleteSync(fence);
+
+        queue.fences_head = (queue.fences_head + 1) % DELETE_QUEUE_FENCES;
+        queue.fences_count--;
+    }
+}
+
+static void
+fence_frame(void) {
+    // a later fence covers this frame too
+    if (queue.head == queue.count || queue.fences_count == DELETE_QUEUE_FENCES)
+        return;
+
+    const uint32_t slot = (queue.fences_head + queue.fences_count) % DELETE_QUEUE_FENCES;
+    queue.fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    queue.fenced[slot] = queue.frames;
+    queue.fences_count++;
+}
+
+static void
+delete_fences(void) {
+    for (; queue.fences_count > 0; queue.fences_count--) {
+        glDeleteSync(queue.fences[queue.fences_head]);
+        queue.fences_head = (queue.fences_head + 1) % DELETE_QUEUE_FENCES;
+    }
+}
+
+#else
+
+// no fences, frames are assumed done a few swaps later
+static void
+retire_frames(void) {
+    if (queue.frames > DELETE_QUEUE_LATENCY)
+        queue.retired = queue.frames - DELETE_QUEUE_LATENCY;
+}
+
+static void
+fence_frame(void) {
+}
+
+static void
+delete_fences(void) {
+}
+
+#endif // NO GL_ES_VERSION_2_0
+
+extern void
+delete_queue_next_frame(void) {
+    queue.frames++;
+
+    retire_frames();
+    fence_frame();
+
+    video_stats.deletes += delete_objects(DELETE_QUEUE_BUDGET);
+    video_stats.deletes_queued = queue.count - queue.head;
+}
+
+extern void
+delete_queue_cleanup(void) {
+    delete_fences();
+
+    // nothing draws anymore
+    queue.retired = video_frame_fence();
+    delete_objects(UINT32_MAX);
+
+    free(queue.entries);
+    queue.entries = NULL;
+    queue.capacity = 0;
+
+    for (uint32_t type = 0; type < VIDEO_OBJECT_TYPES; type++)
+        if (queue.live[type] > 0)
+            LOG_WARNING("%u %s objects leaked\n", queue.live[type], object_names[type]);
+}
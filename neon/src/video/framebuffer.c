@@ -1,11 +1,14 @@
 #include <assert.h>
 #include "video/framebuffer.h"
+#include "video/state.h"
+#include "video/deletequeue.h"
 #include "core/logerr.h"
 
 extern RENDERBUFFER
 new_renderbuffer(GLenum internalformat, GLsizei width, GLsizei height, GLsizei samples) {
     GLuint buffer = 0;
     glGenRenderbuffers(1, &buffer);
+    track_video_object(VIDEO_OBJECT_RENDERBUFFER);
     glBindRenderbuffer(GL_RENDERBUFFER, buffer);
 
 #ifdef GL_ES_VERSION_2_0
@@ -24,8 +27,7 @@ extern void
 free_renderbuffer(RENDERBUFFER *renderbuffer) {
     assert(renderbuffer != NULL);
 
-    if (glIsRenderbuffer(renderbuffer->id))
-        glDeleteRenderbuffers(1, &renderbuffer->id);
+    delete_video_object(VIDEO_OBJECT_RENDERBUFFER, renderbuffer->id);
 
     renderbuffer->id = 0;
 }
@@ -79,7 +81,8 @@ new_framebuffer(const FRAMEBUFFER_ATTACHMENT *attachments, size_t count, GLsizei
 
     if (attachments) {
         glGenFramebuffers(1, &framebuffer);
-        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        track_video_object(VIDEO_OBJECT_FRAMEBUFFER);
+        state_bind_framebuffer(framebuffer);
 
         for (size_t i = 0; i < count; i++) {
 
@@ -111,7 +114,7 @@ new_framebuffer(const FRAMEBUFFER_ATTACHMENT *attachments, size_t count, GLsizei
 
     framebuffer_check();
 
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    state_bind_framebuffer(0);
 
     LOG("NEW FRAMEBUFFER %u\n", framebuffer);
 
@@ -126,7 +129,8 @@ extern FRAMEBUFFER
 new_framebuffer_ext(const FRAMEBUFFER_INFO *info) {
     GLuint framebuffer = 0;
     glGenFramebuffers(1, &framebuffer);
-    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    track_video_object(VIDEO_OBJECT_FRAMEBUFFER);
+    state_bind_framebuffer(framebuffer);
 
     for (uint32_t i = 0; i < info->attachments_count; i++) {
         switch (info->attachments[i].target) {
@@ -150,7 +154,7 @@ new_framebuffer_ext(const FRAMEBUFFER_INFO *info) {
 
     framebuffer_check();
 
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    state_bind_framebuffer(0);
 
     LOG("NEW FRAMEBUFFER EXT %u\n", framebuffer);
 
@@ -165,10 +169,9 @@ extern void
 free_framebuffer(FRAMEBUFFER *framebuffer) {
     assert(framebuffer != NULL);
 
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    state_bind_framebuffer(0);
 
-    if (glIsFramebuffer(framebuffer->id))
-        glDeleteFramebuffers(1, &framebuffer->id);
+    delete_video_object(VIDEO_OBJECT_FRAMEBUFFER, framebuffer->id);
 
     framebuffer->id = 0;
 }
@@ -0,0 +1,510 @@
+#include <assert.h>
+#include <string.h>
+#include <video/gl.h>
+#include <memtrack.h>
+
+#include "core/common.h"
+#include "core/logerr.h"
+#include "video/geometry.h"
+#include "video/vertex.h"
+#include "video/vertices.h"
+#include "video/deletequeue.h"
+
+#define GEOMETRY_FORMATS (VF_V3T2N3T3 + 1)
+#define NO_RANGE UINT32_MAX
+
+#ifndef GL_ES_VERSION_2_0
+
+typedef struct GeometryRange {
+    uint32_t    offset;
+    uint32_t    size;
+} GEOMETRY_RANGE;
+
+// free ranges sorted by offset, neighbours are merged on free
+typedef struct GeometryRanges {
+    GEOMETRY_RANGE  *free;
+    uint32_t        free_count;
+    uint32_t        free_capacity;
+    uint32_t        capacity;
+} GEOMETRY_RANGES;
+
+typedef struct GeometryAllocation {
+    uint32_t        vf;         // VF_UNKNOWN when the slot is free
+    GEOMETRY_RANGE  vertices;   // in vertices
+    GEOMETRY_RANGE  indices;    // in bytes
+} GEOMETRY_ALLOCATION;
+
+static struct {
+    VIDEO_BUFFER    vertices;
+    VERTEX_ARRAY    array;
+    GEOMETRY_RANGES ranges;
+} heaps[GEOMETRY_FORMATS];
+
+static struct {
+    VIDEO_BUFFER    elements;
+    GEOMETRY_RANGES ranges;
+} indices_heap;
+
+static GEOMETRY_ALLOCATION *allocations;
+static uint32_t allocations_count;
+static uint32_t allocations_capacity;
+
+static void
+insert_range(GEOMETRY_RANGES *ranges, uint32_t at, GEOMETRY_RANGE range) {
+    if (ranges->free_count == ranges->free_capacity) {
+        ranges->free_capacity = ranges->free_capacity ? ranges->free_capacity * 2 : 16;
+        ranges->free = realloc(ranges->free, sizeof(GEOMETRY_RANGE) * ranges->free_capacity);
+
+        if (!ranges->free) {
+            LOG_CRITICAL("%s\n", "Can't alloc memory");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    memmove(&ranges->free[at + 1], &ranges->free[at], sizeof(GEOMETRY_RANGE) * (ranges->free_count - at));
+    ranges->free[at] = range;
+    ranges->free_count++;
+}
+
+static void
+remove_range(GEOMETRY_RANGES *ranges, uint32_t at) {
+    memmove(&ranges->free[at], &ranges->free[at + 1], sizeof(GEOMETRY_RANGE) * (ranges->free_count - at - 1));
+    ranges->free_count--;
+}
+
+static void
+release_range(GEOMETRY_RANGES *ranges, GEOMETRY_RANGE range) {
+    if (range.size == 0)
+        return;
+
+    uint32_t at = 0;
+    while (at < ranges->free_count && ranges->free[at].offset < range.offset)
+        at++;
+
+    if (at > 0 && ranges->free[at - 1].offset + ranges->free[at - 1].size == range.offset) {
+        at--;
+        ranges->free[at].size += range.size;
+    } else {
+        insert_range(ranges, at, range);
+    }
+
+    if (at + 1 < ranges->free_count && ranges->free[at].offset + ranges->free[at].size == ranges->free[at + 1].offset) {
+        ranges->free[at].size += ranges->free[at + 1].size;
+        remove_range(ranges, at + 1);
+    }
+}
+
+// first fit, returns NO_RANGE when no free range is big enough
+static uint32_t
+reserve_range(GEOMETRY_RANGES *ranges, uint32_t size, uint32_t align) {
+    for (uint32_t i = 0; i < ranges->free_count; i++) {
+        const GEOMETRY_RANGE range = ranges->free[i];
+        const uint32_t offset = (range.offset + align - 1) / align * align;
+
+        if (offset + size > range.offset + range.size)
+            continue;
+
+        const GEOMETRY_RANGE tail = {offset + size, range.offset + range.size - offset - size};
+
+        if (offset > range.offset) {
+            ranges->free[i].size = offset - range.offset;
+            if (tail.size > 0)
+                insert_range(ranges, i + 1, tail);
+        } else if (tail.size > 0) {
+            ranges->free[i] = tail;
+        } else {
+            remove_range(ranges, i);
+        }
+
+        return offset;
+    }
+
+    return NO_RANGE;
+}
+
+static void
+grow_ranges(GEOMETRY_RANGES *ranges, uint32_t capacity) {
+    release_range(ranges, (GEOMETRY_RANGE){ranges->capacity, capacity - ranges->capacity});
+    ranges->capacity = capacity;
+}
+
+// created through the copy binding, the element binding belongs to whatever vertex array is bound
+static VIDEO_BUFFER
+new_heap_buffer(uint32_t target, size_t size) {
+    GLuint buffer = 0;
+    glGenBuffers(1, &buffer);
+    track_video_object(VIDEO_OBJECT_BUFFER);
+
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, size, NULL, GL_STATIC_DRAW);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    return (VIDEO_BUFFER){.id = buffer, .target = target, .size = size};
+}
+
+// points the vertex array at the heap buffers, after they are created or replaced
+static void
+connect_heap(uint32_t vf) {
+    bind_vertex_arrays(&heaps[vf].array);
+
+    glBindBuffer(GL_ARRAY_BUFFER, heaps[vf].vertices.id);
+    vertices_array_format(&heaps[vf].array, &heaps[vf].vertices, vf);
+
+    if (indices_heap.elements.id)
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices_heap.elements.id);
+
+    unbind_vertex_array(&heaps[vf].array);
+}
+
+static void
+copy_buffer(const VIDEO_BUFFER *from, const VIDEO_BUFFER *to, size_t from_offset, size_t to_offset, size_t size) {
+    if (size == 0)
+        return;
+
+    glBindBuffer(GL_COPY_READ_BUFFER, from->id);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, to->id);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, from_offset, to_offset, size);
+}
+
+static void
+unbind_copy_buffers(void) {
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+static uint32_t
+grown_capacity(uint32_t capacity, uint32_t initial, uint32_t needed) {
+    uint32_t grown = capacity ? capacity * 2 : initial;
+
+    while (grown < capacity + needed)
+        grown *= 2;
+
+    return grown;
+}
+
+// ranges keep their offsets, the data is copied into a bigger buffer
+static void
+grow_vertices(uint32_t vf, uint32_t needed) {
+    const size_t stride = vertex_format_size(vf);
+    const uint32_t capacity = grown_capacity(heaps[vf].ranges.capacity, GEOMETRY_HEAP_VERTICES, needed);
+
+    VIDEO_BUFFER vertices = new_heap_buffer(GL_ARRAY_BUFFER, stride * capacity);
+
+    if (heaps[vf].vertices.id) {
+        copy_buffer(&heaps[vf].vertices, &vertices, 0, 0, heaps[vf].vertices.size);
+        unbind_copy_buffers();
+        free_video_buffer(&heaps[vf].vertices);
+    }
+
+    if (!heaps[vf].array.id)
+        heaps[vf].array = new_vertex_array();
+
+    heaps[vf].vertices = vertices;
+    grow_ranges(&heaps[vf].ranges, capacity);
+    connect_heap(vf);
+
+    LOG("Geometry heap %u: %u vertices\n", vf, capacity);
+}
+
+static void
+grow_indices(uint32_t needed) {
+    const uint32_t capacity = grown_capacity(indices_heap.ranges.capacity, GEOMETRY_HEAP_INDICES, needed);
+
+    VIDEO_BUFFER elements = new_heap_buffer(GL_ELEMENT_ARRAY_BUFFER, capacity);
+
+    if (indices_heap.elements.id) {
+        copy_buffer(&indices_heap.elements, &elements, 0, 0, indices_heap.elements.size);
+        unbind_copy_buffers();
+        free_video_buffer(&indices_heap.elements);
+    }
+
+    indices_heap.elements = elements;
+    grow_ranges(&indices_heap.ranges, capacity);
+
+    for (uint32_t vf = 0; vf < GEOMETRY_FORMATS; vf++)
+        if (heaps[vf].array.id)
+            connect_heap(vf);
+
+    LOG("Geometry heap indices: %u bytes\n", capacity);
+}
+
+static void
+upload_range(const VIDEO_BUFFER *buffer, size_t offset, const void *data, size_t size) {
+    if (size == 0)
+        return;
+
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer->id);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, offset, size, data);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+static uint32_t
+new_allocation(void) {
+    for (uint32_t i = 0; i < allocations_count; i++)
+        if (allocations[i].vf == (uint32_t)VF_UNKNOWN)
+            return i;
+
+    if (allocations_count == allocations_capacity) {
+        allocations_capacity = allocations_capacity ? allocations_capacity * 2 : 64;
+        allocations = realloc(allocations, sizeof(GEOMETRY_ALLOCATION) * allocations_capacity);
+
+        if (!allocations) {
+            LOG_CRITICAL("%s\n", "Can't alloc memory");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    return allocations_count++;
+}
+
+extern uint32_t
+geometry_alloc(uint32_t vf, const void *vertices, uint32_t vertices_count, const void *indices, size_t indices_size) {
+    if (vf >= GEOMETRY_FORMATS || vertex_format_size(vf) == 0) {
+        LOG_ERROR("Geometry heap doesn't take vertex format %u\n", vf);
+        return 0;
+    }
+
+    const uint32_t index_bytes = (uint32_t)indices_size;
+    const uint32_t index_space = (index_bytes + GEOMETRY_INDEX_ALIGN - 1) / GEOMETRY_INDEX_ALIGN * GEOMETRY_INDEX_ALIGN;
+
+    // index heap first, growing it reconnects the vertex arrays
+    uint32_t ib_offset = index_space ? reserve_range(&indices_heap.ranges, index_space, GEOMETRY_INDEX_ALIGN) : 0;
+    if (ib_offset == NO_RANGE) {
+        grow_indices(index_space);
+        ib_offset = reserve_range(&indices_heap.ranges, index_space, GEOMETRY_INDEX_ALIGN);
+    }
+
+    uint32_t base_vertex = heaps[vf].array.id ? reserve_range(&heaps[vf].ranges, vertices_count, 1) : NO_RANGE;
+    if (base_vertex == NO_RANGE) {
+        grow_vertices(vf, vertices_count);
+        base_vertex = reserve_range(&heaps[vf].ranges, vertices_count, 1);
+    }
+
+    upload_range(&heaps[vf].vertices, (size_t)base_vertex * vertex_format_size(vf), vertices, (size_t)vertices_count * vertex_format_size(vf));
+    upload_range(&indices_heap.elements, ib_offset, indices, index_bytes);
+
+    const uint32_t id = new_allocation();
+    allocations[id] = (GEOMETRY_ALLOCATION){.vf = vf, .vertices = {base_vertex, vertices_count}, .indices = {ib_offset, index_space}};
+
+    return id + 1;
+}
+
+extern void
+geometry_free(uint32_t geometry) {
+    if (geometry == 0 || geometry > allocations_count)
+        return;
+
+    GEOMETRY_ALLOCATION *allocation = &allocations[geometry - 1];
+    if (allocation->vf == (uint32_t)VF_UNKNOWN)
+        return;
+
+    release_range(&heaps[allocation->vf].ranges, allocation->vertices);
+    release_range(&indices_heap.ranges, allocation->indices);
+
+    allocation->vf = (uint32_t)VF_UNKNOWN;
+}
+
+extern GEOMETRY_PLACEMENT
+geometry_placement(uint32_t geometry) {
+    if (geometry == 0 || geometry > allocations_count)
+        return (GEOMETRY_PLACEMENT){0, 0};
+
+    const GEOMETRY_ALLOCATION *allocation = &allocations[geometry - 1];
+
+    return (GEOMETRY_PLACEMENT){allocation->vertices.offset, allocation->indices.offset};
+}
+
+extern VERTEX_ARRAY *
+geometry_vertex_array(uint32_t vf) {
+    if (vf >= GEOMETRY_FORMATS || !heaps[vf].array.id)
+        return NULL;
+
+    return &heaps[vf].array;
+}
+
+static int
+compare_by_vertices(const void *a, const void *b) {
+    const GEOMETRY_ALLOCATION *const *x = a;
+    const GEOMETRY_ALLOCATION *const *y = b;
+
+    return (int)((*x)->vertices.offset > (*y)->vertices.offset) - (int)((*x)->vertices.offset < (*y)->vertices.offset);
+}
+
+static int
+compare_by_indices(const void *a, const void *b) {
+    const GEOMETRY_ALLOCATION *const *x = a;
+    const GEOMETRY_ALLOCATION *const *y = b;
+
+    return (int)((*x)->indices.offset > (*y)->indices.offset) - (int)((*x)->indices.offset < (*y)->indices.offset);
+}
+
+// live allocations of a format, all of them for VF_UNKNOWN, in heap order
+static uint32_t
+live_allocations(GEOMETRY_ALLOCATION **live, uint32_t vf) {
+    uint32_t count = 0;
+
+    for (uint32_t i = 0; i < allocations_count; i++)
+        if (allocations[i].vf != (uint32_t)VF_UNKNOWN && (vf == (uint32_t)VF_UNKNOWN || allocations[i].vf == vf))
+            live[count++] = &allocations[i];
+
+    qsort(live, count, sizeof(GEOMETRY_ALLOCATION*), vf == (uint32_t)VF_UNKNOWN ? compare_by_indices : compare_by_vertices);
+
+    return count;
+}
+
+// free space other than one range at the end
+static bool
+fragmented(const GEOMETRY_RANGES *ranges) {
+    if (ranges->free_count == 0)
+        return false;
+
+    return ranges->free_count > 1 || ranges->free[0].offset + ranges->free[0].size != ranges->capacity;
+}
+
+static void
+reset_ranges(GEOMETRY_RANGES *ranges, uint32_t used) {
+    ranges->free_count = 0;
+    release_range(ranges, (GEOMETRY_RANGE){used, ranges->capacity - used});
+}
+
+static bool
+defragment_vertices(uint32_t vf, GEOMETRY_ALLOCATION **live) {
+    if (!fragmented(&heaps[vf].ranges))
+        return false;
+
+    const size_t stride = vertex_format_size(vf);
+    const uint32_t count = live_allocations(live, vf);
+
+    VIDEO_BUFFER vertices = new_heap_buffer(GL_ARRAY_BUFFER, heaps[vf].vertices.size);
+    uint32_t used = 0;
+
+    for (uint32_t i = 0; i < count; i++) {
+        copy_buffer(&heaps[vf].vertices, &vertices, stride * live[i]->vertices.offset, stride * used, stride * live[i]->vertices.size);
+        live[i]->vertices.offset = used;
+        used += live[i]->vertices.size;
+    }
+
+    unbind_copy_buffers();
+    free_video_buffer(&heaps[vf].vertices);
+    heaps[vf].vertices = vertices;
+
+    reset_ranges(&heaps[vf].ranges, used);
+    connect_heap(vf);
+
+    return true;
+}
+
+static bool
+defragment_indices(GEOMETRY_ALLOCATION **live) {
+    if (!fragmented(&indices_heap.ranges))
+        return false;
+
+    const uint32_t count = live_allocations(live, (uint32_t)VF_UNKNOWN);
+
+    VIDEO_BUFFER elements = new_heap_buffer(GL_ELEMENT_ARRAY_BUFFER, indices_heap.elements.size);
+    uint32_t used = 0;
+
+    for (uint32_t i = 0; i < count; i++) {
+        copy_buffer(&indices_heap.elements, &elements, live[i]->indices.offset, used, live[i]->indices.size);
+        live[i]->indices.offset = used;
+        used += live[i]->indices.size;
+    }
+
+    unbind_copy_buffers();
+    free_video_buffer(&indices_heap.elements);
+    indices_heap.elements = elements;
+
+    reset_ranges(&indices_heap.ranges, used);
+
+    for (uint32_t vf = 0; vf < GEOMETRY_FORMATS; vf++)
+        if (heaps[vf].array.id)
+            connect_heap(vf);
+
+    return true;
+}
+
+extern bool
+geometry_defragment(void) {
+    if (allocations_count == 0)
+        return false;
+
+    GEOMETRY_ALLOCATION **live = malloc(sizeof(GEOMETRY_ALLOCATION*) * allocations_count);
+    if (!live) {
+        LOG_CRITICAL("%s\n", "Can't alloc memory");
+        exit(EXIT_FAILURE);
+    }
+
+    bool moved = defragment_indices(live);
+
+    for (uint32_t vf = 0; vf < GEOMETRY_FORMATS; vf++)
+        if (heaps[vf].array.id)
+            moved |= defragment_vertices(vf, live);
+
+    free(live);
+
+    return moved;
+}
+
+extern void
+geometry_cleanup(void) {
+    for (uint32_t vf = 0; vf < GEOMETRY_FORMATS; vf++) {
+        free_video_buffer(&heaps[vf].vertices);
+        if (heaps[vf].array.id)
+            free_vertex_array(&heaps[vf].array);
+        free(heaps[vf].ranges.free);
+    }
+
+    free_video_buffer(&indices_heap.elements);
+    free(indices_heap.ranges.free);
+    free(allocations);
+
+    memset(heaps, 0, sizeof(heaps));
+    memset(&indices_heap, 0, sizeof(indices_heap));
+    allocations = NULL;
+    allocations_count = 0;
+    allocations_capacity = 0;
+}
+
+#else
+
+extern uint32_t
+geometry_alloc(uint32_t vf, const void *vertices, uint32_t vertices_count, const void *indices, size_t indices_size) {
+    UNUSED(vf);
+    UNUSED(vertices);
+    UNUSED(vertices_count);
+    UNUSED(indices);
+    UNUSED(indices_size);
+
+    LOG_CRITICAL("%s\n", "Geometry heaps need vertex arrays and buffer copies");
+    exit(EXIT_FAILURE);
+}
+
+extern void
+geometry_free(uint32_t geometry) {
+    UNUSED(geometry);
+}
+
+extern GEOMETRY_PLACEMENT
+geometry_placement(uint32_t geometry) {
+    UNUSED(geometry);
+
+    return (GEOMETRY_PLACEMENT){0, 0};
+}
+
+extern VERTEX_ARRAY *
+geometry_vertex_array(uint32_t vf) {
+    UNUSED(vf);
+
+    return NULL;
+}
+
+extern bool
+geometry_defragment(void) {
+    return false;
+}
+
+extern void
+geometry_cleanup(void) {
+}
+
+#endif // NO GL_ES_VERSION_2_0
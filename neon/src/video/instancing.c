@@ -0,0 +1,205 @@
+#include <assert.h>
+#include <string.h>
+#include <video/gl.h>
+#include <memtrack.h>
+
+#include "core/common.h"
+#include "core/logerr.h"
+#include "video/buffer.h"
+#include "video/commandbuffer.h"
+#include "video/instancing.h"
+#include "video/state.h"
+
+#define MAX_INSTANCED_PROGRAMS 32
+#define TEXEL_FLOATS 4
+
+static INSTANCED_PROGRAM programs[MAX_INSTANCED_PROGRAMS];
+static uint32_t programs_count;
+
+// one stream per frame, orphaned on reset and when full
+static struct {
+    VIDEO_BUFFER    buffer;
+    GLuint          texture;
+    float           *staging;
+    uint32_t        used; // texels
+} instances;
+
+extern void
+instanced_program(uint32_t program) {
+    INSTANCED_PROGRAM instanced = {
+        .program = program,
+        .data_location = glGetUniformLocation(program, "neon_instance_data"),
+        .base_location = glGetUniformLocation(program, "neon_instance_base"),
+        .stride_location = glGetUniformLocation(program, "neon_instance_stride")
+    };
+
+    if (instanced.data_location < 0)
+        LOG_WARNING("Program %u doesn't read instance data, build it with INSTANCE_SHADER_DEFINITIONS\n", program);
+
+    for (uint32_t i = 0; i < programs_count; i++)
+        if (programs[i].program == program) {
+            programs[i] = instanced;
+            return;
+        }
+
+    if (programs_count == MAX_INSTANCED_PROGRAMS) {
+        LOG_ERROR("%s\n", "Too many instanced programs");
+        return;
+    }
+
+    programs[programs_count++] = instanced;
+}
+
+extern void
+instanced_shader(const SHADER *shader) {
+    assert(shader != NULL);
+
+    instanced_program(shader->pid);
+}
+
+extern void
+forget_instanced_program(uint32_t program) {
+    for (uint32_t i = 0; i < programs_count; i++)
+        if (programs[i].program == program) {
+            programs[i] = programs[--programs_count];
+            return;
+        }
+}
+
+extern const INSTANCED_PROGRAM *
+find_instanced_program(uint32_t program) {
+    for (uint32_t i = 0; i < programs_count; i++)
+        if (programs[i].program == program)
+            return &programs[i];
+
+    return NULL;
+}
+
+extern uint32_t
+instance_uniform_texels(uint32_t type) {
+    switch (type) {
+    case UNIFORM_MATRIX3:
+        return 3;
+    case UNIFORM_MATRIX4:
+        return 4;
+    }
+
+    return 1;
+}
+
+#ifndef GL_ES_VERSION_2_0
+
+static void
+create_instances(void) {
+    const size_t size = sizeof(float) * TEXEL_FLOATS * INSTANCE_BUFFER_TEXELS;
+
+    instances.buffer = new_texture_buffer(NULL, size, GL_STREAM_DRAW);
+    instances.staging = malloc(size);
+
+    if (!instances.staging) {
+        LOG_CRITICAL("%s\n", "Can't alloc memory");
+        exit(EXIT_FAILURE);
+    }
+
+    glGenTextures(1, &instances.texture);
+    state_bind_texture(INSTANCE_TEXTURE_UNIT, GL_TEXTURE_BUFFER, instances.texture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, instances.buffer.id);
+}
+
+extern float *
+begin_instances(uint32_t texels, uint32_t *base) {
+    assert(texels <= INSTANCE_BUFFER_TEXELS);
+    assert(base != NULL);
+
+    if (!instances.staging)
+        create_instances();
+
+    if (instances.used + texels > INSTANCE_BUFFER_TEXELS)
+        reset_instances();
+
+    *base = instances.used;
+    instances.used += texels;
+
+    return &instances.staging[*base * TEXEL_FLOATS];
+}
+
+extern void
+end_instances(uint32_t base, uint32_t texels) {
+    glBindBuffer(GL_TEXTURE_BUFFER, instances.buffer.id);
+    glBufferSubData(GL_TEXTURE_BUFFER, sizeof(float) * TEXEL_FLOATS * base,
+                    sizeof(float) * TEXEL_FLOATS * texels, &instances.staging[base * TEXEL_FLOATS]);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+extern void
+bind_instances(const INSTANCED_PROGRAM *instanced, uint32_t base, uint32_t stride) {
+    state_bind_texture(INSTANCE_TEXTURE_UNIT, GL_TEXTURE_BUFFER, instances.texture);
+    state_bind_sampler(INSTANCE_TEXTURE_UNIT, 0);
+    state_sampler_uniform(instanced->data_location, INSTANCE_TEXTURE_UNIT);
+
+    // through the shadow so recorded uniform commands to the same locations stay in sync
+    set_uniform(instanced->base_location, UNIFORM_INT, &(GLint){(GLint)base}, 1);
+    set_uniform(instanced->stride_location, UNIFORM_INT, &(GLint){(GLint)stride}, 1);
+}
+
+extern void
+reset_instances(void) {
+    if (instances.used == 0)
+        return;
+
+    // orphan, draws already issued keep the old storage
+    glBindBuffer(GL_TEXTURE_BUFFER, instances.buffer.id);
+    glBufferData(GL_TEXTURE_BUFFER, instances.buffer.size, NULL, GL_STREAM_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+    instances.used = 0;
+}
+
+extern void
+instancing_cleanup(void) {
+    if (instances.texture) {
+        glDeleteTextures(1, &instances.texture);
+        reset_state_cache();
+    }
+
+    free_video_buffer(&instances.buffer);
+    free(instances.staging);
+
+    memset(&instances, 0, sizeof(instances));
+    programs_count = 0;
+}
+
+#else
+
+extern float *
+begin_instances(uint32_t texels, uint32_t *base) {
+    UNUSED(texels);
+    UNUSED(base);
+
+    LOG_CRITICAL("%s\n", "Instancing needs texture buffers");
+    exit(EXIT_FAILURE);
+}
+
+extern void
+end_instances(uint32_t base, uint32_t texels) {
+    UNUSED(base);
+    UNUSED(texels);
+}
+
+extern void
+bind_instances(const INSTANCED_PROGRAM *instanced, uint32_t base, uint32_t stride) {
+    UNUSED(instanced);
+    UNUSED(base);
+    UNUSED(stride);
+}
+
+extern void
+reset_instances(void) {
+}
+
+extern void
+instancing_cleanup(void) {
+    programs_count = 0;
+}
+
+#endif // NO GL_ES_VERSION_2_0
@@ -0,0 +1,528 @@
+#include <assert.h>
+#include <math.h>
+#include <float.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <memtrack.h>
+
+#include "core/common.h"
+#include "core/logerr.h"
+#include "video/vertex.h"
+#include "video/vertices.h"
+#include "video/lod.h"
+
+#define EMPTY_SLOT UINT32_MAX
+
+typedef struct Quadric {
+    double a2, ab, ac, ad;
+    double b2, bc, bd;
+    double c2, cd;
+    double d2;
+} QUADRIC;
+
+struct Collapse {
+    uint32_t    from;
+    uint32_t    to;
+    double      cost;
+};
+
+static void *
+alloc_memory(size_t size) {
+    void *p = malloc(size);
+
+    if (!p) {
+        LOG_CRITICAL("%s\n", "Can't alloc memory");
+        exit(EXIT_FAILURE);
+    }
+
+    return p;
+}
+
+static inline const float *
+vertex_position(const void *vertices, size_t stride, uint32_t i) {
+    return (const float *)((const uint8_t *)vertices + i * stride);
+}
+
+static inline uint32_t
+hash_position(const float *p) {
+    uint32_t h[3];
+    memcpy(h, p, sizeof(h));
+
+    return (h[0] * 73856093u) ^ (h[1] * 19349663u) ^ (h[2] * 83492791u);
+}
+
+static inline uint32_t
+hash_edge(uint32_t a, uint32_t b) {
+    return a * 0x9e3779b1u ^ b * 0x85ebca6bu;
+}
+
+static uint32_t
+table_size(size_t count) {
+    uint32_t size = 16;
+
+    while (size < count * 2)
+        size <<= 1;
+
+    return size;
+}
+
+// maps vertices whose first key_size bytes are equal onto the first one, the position
+// for seams, the whole vertex for welding
+static void
+build_remap(uint32_t *remap, const void *vertices, size_t stride, size_t count, size_t key_size) {
+    const uint32_t size = table_size(count);
+    uint32_t *table = alloc_memory(size * sizeof(uint32_t));
+    memset(table, 0xff, size * sizeof(uint32_t));
+
+    for (uint32_t i = 0; i < count; i++) {
+        const float *p = vertex_position(vertices, stride, i);
+        uint32_t slot = hash_position(p) & (size - 1);
+
+        for (;;) {
+            if (table[slot] == EMPTY_SLOT) {
+                table[slot] = i;
+                remap[i] = i;
+                break;
+            }
+
+            if (memcmp(vertex_position(vertices, stride, table[slot]), p, key_size) == 0) {
+                remap[i] = table[slot];
+                break;
+            }
+
+            slot = (slot + 1) & (size - 1);
+        }
+    }
+
+    free(table);
+}
+
+// vertices on open edges in position space
+static void
+mark_border(bool *locked, const uint32_t *remap, const uint32_t *indices, size_t indices_count) {
+    const uint32_t size = table_size(indices_count);
+    uint32_t (*table)[2] = alloc_memory(size * sizeof(uint32_t[2]));
+    memset(table, 0xff, size * sizeof(uint32_t[2]));
+
+    for (size_t t = 0; t < indices_count; t += 3)
+        for (int e = 0; e < 3; e++) {
+            const uint32_t a = remap[indices[t + e]];
+            const uint32_t b = remap[indices[t + (e + 1) % 3]];
+            uint32_t slot = hash_edge(a, b) & (size - 1);
+
+            while (table[slot][0] != EMPTY_SLOT && !(table[slot][0] == a && table[slot][1] == b))
+                slot = (slot + 1) & (size - 1);
+
+            table[slot][0] = a;
+            table[slot][1] = b;
+        }
+
+    for (size_t t = 0; t < indices_count; t += 3)
+        for (int e = 0; e < 3; e++) {
+            const uint32_t a = remap[indices[t + e]];
+            const uint32_t b = remap[indices[t + (e + 1) % 3]];
+            uint32_t slot = hash_edge(b, a) & (size - 1);
+            bool found = false;
+
+            while (table[slot][0] != EMPTY_SLOT) {
+                if (table[slot][0] == b && table[slot][1] == a) {
+                    found = true;
+                    break;
+                }
+
+                slot = (slot + 1) & (size - 1);
+            }
+
+            if (!found)
+                locked[a] = locked[b] = true;
+        }
+
+    free(table);
+}
+
+static inline void
+quadric_add(QUADRIC *q, const QUADRIC *r) {
+    q->a2 += r->a2; q->ab += r->ab; q->ac += r->ac; q->ad += r->ad;
+    q->b2 += r->b2; q->bc += r->bc; q->bd += r->bd;
+    q->c2 += r->c2; q->cd += r->cd;
+    q->d2 += r->d2;
+}
+
+static inline double
+quadric_error(const QUADRIC *q, const float *p) {
+    const double x = p[0], y = p[1], z = p[2];
+
+    return q->a2 * x * x + 2 * q->ab * x * y + 2 * q->ac * x * z + 2 * q->ad * x
+         + q->b2 * y * y + 2 * q->bc * y * z + 2 * q->bd * y
+         + q->c2 * z * z + 2 * q->cd * z
+         + q->d2;
+}
+
+static inline void
+triangle_normal(float n[3], const float *a, const float *b, const float *c) {
+    const float e0[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+    const float e1[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+
+    n[0] = e0[1] * e1[2] - e0[2] * e1[1];
+    n[1] = e0[2] * e1[0] - e0[0] * e1[2];
+    n[2] = e0[0] * e1[1] - e0[1] * e1[0];
+}
+
+static void
+fill_quadrics(QUADRIC *quadrics, const uint32_t *remap, const uint32_t *indices, size_t indices_count,
+              const void *vertices, size_t stride) {
+    for (size_t t = 0; t < indices_count; t += 3) {
+        const float *p0 = vertex_position(vertices, stride, indices[t + 0]);
+        const float *p1 = vertex_position(vertices, stride, indices[t + 1]);
+        const float *p2 = vertex_position(vertices, stride, indices[t + 2]);
+
+        float n[3];
+        triangle_normal(n, p0, p1, p2);
+
+        const double len = sqrt((double)n[0] * n[0] + (double)n[1] * n[1] + (double)n[2] * n[2]);
+        if (len <= 0.0)
+            continue;
+
+        // area weighted plane
+        const double a = n[0] / len, b = n[1] / len, c = n[2] / len;
+        const double d = -(a * p0[0] + b * p0[1] + c * p0[2]);
+        const double w = len * 0.5;
+
+        const QUADRIC q = {
+            w * a * a, w * a * b, w * a * c, w * a * d,
+            w * b * b, w * b * c, w * b * d,
+            w * c * c, w * c * d,
+            w * d * d
+        };
+
+        for (int k = 0; k < 3; k++)
+            quadric_add(&quadrics[remap[indices[t + k]]], &q);
+    }
+}
+
+static int
+compare_collapses(const void *a, const void *b) {
+    const double ca = ((const struct Collapse *)a)->cost;
+    const double cb = ((const struct Collapse *)b)->cost;
+
+    return (ca > cb) - (ca < cb);
+}
+
+// moving from onto to must not turn any remaining triangle around from over
+static bool
+collapse_flips(const uint32_t *indices, const uint32_t *adjacency, const uint32_t *offsets,
+               const void *vertices, size_t stride, uint32_t from, uint32_t to) {
+    const float *pt = vertex_position(vertices, stride, to);
+
+    for (uint32_t i = offsets[from]; i < offsets[from + 1]; i++) {
+        const uint32_t *tri = &indices[adjacency[i] * 3];
+
+        if (tri[0] == to || tri[1] == to || tri[2] == to)
+            continue;
+
+        const float *p[3], *q[3];
+        for (int k = 0; k < 3; k++) {
+            p[k] = vertex_position(vertices, stride, tri[k]);
+            q[k] = tri[k] == from ? pt : p[k];
+        }
+
+        float n0[3], n1[3];
+        triangle_normal(n0, p[0], p[1], p[2]);
+        triangle_normal(n1, q[0], q[1], q[2]);
+
+        if (n0[0] * n1[0] + n0[1] * n1[1] + n0[2] * n1[2] <= 0.f)
+            return true;
+    }
+
+    return false;
+}
+
+extern size_t
+simplify_mesh(uint32_t *destination, const uint32_t *indices, size_t indices_count,
+              const void *vertices, size_t stride, size_t vertices_count,
+              size_t target_count, float *error) {
+    assert(destination != NULL);
+    assert(indices != NULL);
+    assert(indices_count % 3 == 0);
+
+    memcpy(destination, indices, indices_count * sizeof(uint32_t));
+
+    if (error)
+        *error = 0.f;
+
+    if (indices_count <= target_count || vertices_count == 0)
+        return indices_count;
+
+    uint32_t *weld = alloc_memory(vertices_count * sizeof(uint32_t));
+    uint32_t *remap = alloc_memory(vertices_count * sizeof(uint32_t));
+    uint32_t *collapse_remap = alloc_memory(vertices_count * sizeof(uint32_t));
+    uint32_t *offsets = alloc_memory((vertices_count + 1) * sizeof(uint32_t));
+    uint32_t *adjacency = alloc_memory(indices_count * sizeof(uint32_t));
+    bool *locked = alloc_memory(vertices_count * sizeof(bool));
+    bool *touched = alloc_memory(vertices_count * sizeof(bool));
+    QUADRIC *quadrics = alloc_memory(vertices_count * sizeof(QUADRIC));
+    struct Collapse *collapses = alloc_memory(indices_count * sizeof(struct Collapse));
+
+    // unindexed or split meshes repeat whole vertices, weld them so their triangles connect
+    build_remap(weld, vertices, stride, vertices_count, stride);
+    for (size_t i = 0; i < indices_count; i++)
+        destination[i] = weld[destination[i]];
+
+    build_remap(remap, vertices, stride, vertices_count, sizeof(float) * 3);
+
+    // the welded vertices left sharing a position differ in uv or normal, keep those seams
+    memset(locked, 0, vertices_count * sizeof(bool));
+    for (uint32_t i = 0; i < vertices_count; i++)
+        if (weld[i] == i && remap[i] != i)
+            locked[i] = locked[remap[i]] = true;
+
+    mark_border(locked, remap, destination, indices_count);
+    for (uint32_t i = 0; i < vertices_count; i++)
+        locked[i] = locked[remap[i]];
+
+    memset(quadrics, 0, vertices_count * sizeof(QUADRIC));
+    fill_quadrics(quadrics, remap, destination, indices_count, vertices, stride);
+
+    float extent_min[3] = {FLT_MAX, FLT_MAX, FLT_MAX}, extent_max[3] = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+    for (uint32_t i = 0; i < vertices_count; i++) {
+        const float *p = vertex_position(vertices, stride, i);
+        for (int k = 0; k < 3; k++) {
+            extent_min[k] = fminf(extent_min[k], p[k]);
+            extent_max[k] = fmaxf(extent_max[k], p[k]);
+        }
+    }
+    const float extent = fmaxf(extent_max[0] - extent_min[0], fmaxf(extent_max[1] - extent_min[1], extent_max[2] - extent_min[2]));
+
+    size_t count = indices_count;
+    double max_cost = 0.0;
+
+    while (count > target_count) {
+        // vertex to triangle adjacency of the current mesh
+        memset(offsets, 0, (vertices_count + 1) * sizeof(uint32_t));
+        for (size_t i = 0; i < count; i++)
+            offsets[destination[i] + 1]++;
+        for (uint32_t i = 0; i < vertices_count; i++)
+            offsets[i + 1] += offsets[i];
+        for (size_t i = 0; i < count; i++)
+            adjacency[offsets[destination[i]]++] = (uint32_t)(i / 3);
+        for (uint32_t i = vertices_count; i > 0; i--)
+            offsets[i] = offsets[i - 1];
+        offsets[0] = 0;
+
+        size_t collapses_count = 0;
+        for (size_t t = 0; t < count; t += 3)
+            for (int e = 0; e < 3; e++) {
+                const uint32_t a = destination[t + e];
+                const uint32_t b = destination[t + (e + 1) % 3];
+
+                if (locked[a])
+                    continue;
+
+                QUADRIC q = quadrics[a];
+                quadric_add(&q, &quadrics[remap[b]]);
+
+                collapses[collapses_count++] = (struct Collapse){a, b, quadric_error(&q, vertex_position(vertices, stride, b))};
+            }
+
+        if (collapses_count == 0)
+            break;
+
+        qsort(collapses, collapses_count, sizeof(struct Collapse), compare_collapses);
+
+        for (uint32_t i = 0; i < vertices_count; i++)
+            collapse_remap[i] = i;
+        memset(touched, 0, vertices_count * sizeof(bool));
+
+        // each collapse removes about two triangles
+        size_t remaining = count;
+        size_t applied = 0;
+
+        for (size_t c = 0; c < collapses_count && remaining > target_count; c++) {
+            const uint32_t from = collapses[c].from;
+            const uint32_t to = collapses[c].to;
+
+            if (touched[from] || touched[to])
+                continue;
+
+            if (collapse_flips(destination, adjacency, offsets, vertices, stride, from, to))
+                continue;
+
+            collapse_remap[from] = to;
+            quadric_add(&quadrics[remap[to]], &quadrics[from]);
+
+            for (uint32_t i = offsets[from]; i < offsets[from + 1]; i++) {
+                const uint32_t *tri = &destination[adjacency[i] * 3];
+                touched[tri[0]] = touched[tri[1]] = touched[tri[2]] = true;
+            }
+
+            if (collapses[c].cost > max_cost)
+                max_cost = collapses[c].cost;
+
+            remaining = remaining > 6 ? remaining - 6 : 0;
+            applied++;
+        }
+
+        if (applied == 0)
+            break;
+
+        // remap and drop degenerate triangles
+        size_t n = 0;
+        for (size_t t = 0; t < count; t += 3) {
+            const uint32_t a = collapse_remap[destination[t + 0]];
+            const uint32_t b = collapse_remap[destination[t + 1]];
+            const uint32_t c = collapse_remap[destination[t + 2]];
+
+            if (a == b || b == c || c == a)
+                continue;
+
+            destination[n++] = a;
+            destination[n++] = b;
+            destination[n++] = c;
+        }
+
+        count = n;
+    }
+
+    if (error)
+        *error = extent > 0.f ? (float)sqrt(fabs(max_cost)) / extent : 0.f;
+
+    free(collapses);
+    free(quadrics);
+    free(touched);
+    free(locked);
+    free(adjacency);
+    free(offsets);
+    free(collapse_remap);
+    free(remap);
+    free(weld);
+
+    return count;
+}
+
+extern uint32_t
+generate_lods(const VERTICES_DATA *data, uint32_t vf, uint32_t ef, uint32_t levels,
+              void *lod_indices[], uint32_t lod_counts[], float lod_errors[]) {
+    assert(data != NULL);
+
+    const size_t stride = vertex_format_size(vf);
+
+    if (stride == 0 || data->indices_num < 3 || !data->indices)
+        return 0;
+
+    if (levels > VIDEO_MAX_LODS - 1)
+        levels = VIDEO_MAX_LODS - 1;
+
+    uint32_t *source = alloc_memory(data->indices_num * sizeof(uint32_t));
+    uint32_t *lod = alloc_memory(data->indices_num * sizeof(uint32_t));
+    const size_t triangles_count = data->indices_num - data->indices_num % 3;
+
+    for (size_t i = 0; i < triangles_count; i++)
+        source[i] = ef == IF_UI32 ? ((const uint32_t *)data->indices)[i] : ((const uint16_t *)data->indices)[i];
+
+    size_t previous = triangles_count;
+    uint32_t generated = 0;
+
+    for (uint32_t l = 0; l < levels; l++) {
+        const size_t target = (size_t)(previous * VIDEO_LOD_RATIO) / 3 * 3;
+        float error = 0.f;
+
+        const size_t count = simplify_mesh(lod, source, triangles_count, data->vertices, stride, data->vertices_num, target, &error);
+
+        // locked seams can stop the reduction, a level that is barely smaller is not worth it
+        if (count == 0 || count > previous * 0.9f)
+            break;
+
+        const size_t index_size = ef == IF_UI32 ? sizeof(uint32_t) : sizeof(uint16_t);
+        lod_indices[l] = alloc_memory(count * index_size);
+
+        for (size_t i = 0; i < count; i++) {
+            if (ef == IF_UI32)
+                ((uint32_t *)lod_indices[l])[i] = lod[i];
+            else
+                ((uint16_t *)lod_indices[l])[i] = (uint16_t)lod[i];
+        }
+
+        lod_counts[l] = count;
+        lod_errors[l] = error;
+        previous = count;
+        generated++;
+    }
+
+    free(lod);
+    free(source);
+
+    return generated;
+}
+
+extern float
+lod_pixel_scale(float fovy, int viewport_height) {
+    return viewport_height / (2.f * tanf(fovy * (float)M_PI / 360.f));
+}
+
+static uint32_t
+lod_for_size(float size, uint32_t count) {
+    uint32_t level = 0;
+    float threshold = VIDEO_LOD_SCREEN_SIZE;
+
+    while (level + 1 < count && size < threshold) {
+        level++;
+        threshold *= VIDEO_LOD_RATIO;
+    }
+
+    return level;
+}
+
+extern uint32_t
+select_lod(const struct VerticesObjectInfo *object, matrix4 transform, const float3 eye,
+           float pixel_scale, uint32_t current) {
+    assert(object != NULL);
+
+    if (object->lods_count < 2)
+        return 0;
+
+    // bounding sphere of the transformed box
+    float center[3], radius = 0.f;
+    for (int j = 0; j < 3; j++) {
+        const float c[3] = {
+            (object->bound.min[0] + object->bound.max[0]) * 0.5f,
+            (object->bound.min[1] + object->bound.max[1]) * 0.5f,
+            (object->bound.min[2] + object->bound.max[2]) * 0.5f
+        };
+        center[j] = c[0] * transform[0][j] + c[1] * transform[1][j] + c[2] * transform[2][j] + transform[3][j];
+    }
+
+    float scale = 0.f;
+    for (int i = 0; i < 3; i++) {
+        const float s = transform[i][0] * transform[i][0] + transform[i][1] * transform[i][1] + transform[i][2] * transform[i][2];
+        scale = fmaxf(scale, s);
+    }
+
+    for (int k = 0; k < 3; k++) {
+        const float e = (object->bound.max[k] - object->bound.min[k]) * 0.5f;
+        radius += e * e;
+    }
+    radius = sqrtf(radius * scale);
+
+    const float dx = center[0] - eye[0], dy = center[1] - eye[1], dz = center[2] - eye[2];
+    const float distance = sqrtf(dx * dx + dy * dy + dz * dz);
+
+    if (distance <= radius)
+        return 0;
+
+    const float size = 2.f * radius * pixel_scale / distance;
+
+    if (current >= object->lods_count)
+        return lod_for_size(size, object->lods_count);
+
+    // only switch once the size is clearly past the threshold
+    const uint32_t coarser = lod_for_size(size / (1.f - VIDEO_LOD_HYSTERESIS), object->lods_count);
+    if (coarser > current)
+        return coarser;
+
+    const uint32_t finer = lod_for_size(size / (1.f + VIDEO_LOD_HYSTERESIS), object->lods_count);
+    if (finer < current)
+        return finer;
+
+    return current;
+}
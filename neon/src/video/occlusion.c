@@ -0,0 +1,516 @@
+#include <assert.h>
+#include <math.h>
+#include <float.h>
+#include <stdlib.h>
+#include <string.h>
+#include <memtrack.h>
+#include <SDL2/SDL_cpuinfo.h>
+
+#include "core/common.h"
+#include "core/logerr.h"
+#include "video/vertex.h"
+#include "video/occlusion.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define OCCLUSION_SSE2
+#endif
+
+// screen space, z is NDC depth
+struct OcclusionTriangle {
+    float       x[3], y[3], z[3];
+};
+
+struct OcclusionBin {
+    uint32_t    *triangles;
+    uint32_t    count;
+    uint32_t    capacity;
+};
+
+static void *
+alloc_memory(size_t size) {
+    void *p = malloc(size);
+
+    if (!p) {
+        LOG_CRITICAL("%s\n", "Can't alloc memory");
+        exit(EXIT_FAILURE);
+    }
+
+    return p;
+}
+
+static void
+mul_matrix(matrix4 out, matrix4 a, matrix4 b) {
+    for (int i = 0; i < 4; i++)
+        for (int j = 0; j < 4; j++)
+            out[i][j] = a[i][0] * b[0][j] + a[i][1] * b[1][j] + a[i][2] * b[2][j] + a[i][3] * b[3][j];
+}
+
+static inline void
+transform_point(float4 out, const float *p, matrix4 m) {
+    for (int j = 0; j < 4; j++)
+        out[j] = p[0] * m[0][j] + p[1] * m[1][j] + p[2] * m[2][j] + m[3][j];
+}
+
+static void
+rasterize_tile(OCCLUSION_BUFFER *buffer, uint32_t tile) {
+    const uint32_t tx = tile % buffer->tiles_x;
+    const uint32_t ty = tile / buffer->tiles_x;
+    const int x0 = tx * OCCLUSION_TILE_WIDTH;
+    const int y0 = ty * OCCLUSION_TILE_HEIGHT;
+    const int x1 = x0 + OCCLUSION_TILE_WIDTH;
+    const int y1 = y0 + OCCLUSION_TILE_HEIGHT;
+
+    for (int y = y0; y < y1; y++)
+        for (int x = x0; x < x1; x++)
+            buffer->depth[y * buffer->width + x] = 1.f;
+
+    const struct OcclusionBin *bin = &buffer->bins[tile];
+
+    for (uint32_t t = 0; t < bin->count; t++) {
+        const struct OcclusionTriangle *tri = &buffer->triangles[bin->triangles[t]];
+
+        const float area = (tri->x[1] - tri->x[0]) * (tri->y[2] - tri->y[0]) - (tri->x[2] - tri->x[0]) * (tri->y[1] - tri->y[0]);
+        if (fabsf(area) < FLT_EPSILON)
+            continue;
+
+        // edge i is opposite vertex i, positive inside for either winding
+        const float sign = area > 0.f ? 1.f : -1.f;
+        float ea[3], eb[3], ec[3];
+        for (int i = 0; i < 3; i++) {
+            const int j = (i + 1) % 3, k = (i + 2) % 3;
+            ea[i] = sign * (tri->y[j] - tri->y[k]);
+            eb[i] = sign * (tri->x[k] - tri->x[j]);
+            ec[i] = sign * (tri->x[j] * tri->y[k] - tri->x[k] * tri->y[j]);
+        }
+
+        // depth plane z = za * x + zb * y + zc
+        const float inv_area = 1.f / (sign * area);
+        float za = 0.f, zb = 0.f, zc = 0.f;
+        for (int i = 0; i < 3; i++) {
+            za += ea[i] * tri->z[i] * inv_area;
+            zb += eb[i] * tri->z[i] * inv_area;
+            zc += ec[i] * tri->z[i] * inv_area;
+        }
+
+        const float minx = fminf(tri->x[0], fminf(tri->x[1], tri->x[2]));
+        const float maxx = fmaxf(tri->x[0], fmaxf(tri->x[1], tri->x[2]));
+        const float miny = fminf(tri->y[0], fminf(tri->y[1], tri->y[2]));
+        const float maxy = fmaxf(tri->y[0], fmaxf(tri->y[1], tri->y[2]));
+
+        // 4 pixel aligned span inside the tile
+        const int bx0 = (int)fmaxf((float)x0, floorf(minx)) & ~3;
+        const int bx1 = (int)fminf((float)x1, ceilf(maxx) + 1.f);
+        const int by0 = (int)fmaxf((float)y0, floorf(miny));
+        const int by1 = (int)fminf((float)y1, ceilf(maxy) + 1.f);
+
+#ifdef OCCLUSION_SSE2
+        const __m128 step = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+        const __m128 zero = _mm_setzero_ps();
+        __m128 va[3], vb[3], vc[3];
+        for (int i = 0; i < 3; i++) {
+            va[i] = _mm_set1_ps(ea[i]);
+            vb[i] = _mm_set1_ps(eb[i]);
+            vc[i] = _mm_set1_ps(ec[i]);
+        }
+        const __m128 vza = _mm_set1_ps(za);
+        const __m128 vzb = _mm_set1_ps(zb);
+        const __m128 vzc = _mm_set1_ps(zc);
+
+        for (int y = by0; y < by1; y++) {
+            const __m128 py = _mm_set1_ps((float)y + 0.5f);
+            float *row = &buffer->depth[y * buffer->width];
+
+            for (int x = bx0; x < bx1; x += 4) {
+                const __m128 px = _mm_add_ps(_mm_set1_ps((float)x), step);
+
+                __m128 mask = _mm_castsi128_ps(_mm_set1_epi32(-1));
+                for (int i = 0; i < 3; i++) {
+                    const __m128 e = _mm_add_ps(_mm_add_ps(_mm_mul_ps(va[i], px), _mm_mul_ps(vb[i], py)), vc[i]);
+                    mask = _mm_and_ps(mask, _mm_cmpge_ps(e, zero));
+                }
+
+                if (_mm_movemask_ps(mask) == 0)
+                    continue;
+
+                const __m128 z = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vza, px), _mm_mul_ps(vzb, py)), vzc);
+                const __m128 d = _mm_loadu_ps(row + x);
+                const __m128 nd = _mm_min_ps(d, z);
+
+                _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(mask, nd), _mm_andnot_ps(mask, d)));
+            }
+        }
+#else
+        for (int y = by0; y < by1; y++) {
+            const float py = (float)y + 0.5f;
+            float *row = &buffer->depth[y * buffer->width];
+
+            for (int x = bx0; x < bx1; x++) {
+                const float px = (float)x + 0.5f;
+
+                if (ea[0] * px + eb[0] * py + ec[0] < 0.f ||
+                    ea[1] * px + eb[1] * py + ec[1] < 0.f ||
+                    ea[2] * px + eb[2] * py + ec[2] < 0.f)
+                    continue;
+
+                const float z = za * px + zb * py + zc;
+                if (z < row[x])
+                    row[x] = z;
+            }
+        }
+#endif
+    }
+
+    // farthest depth per block, a bound is hidden only when it lies behind all of it
+    const uint32_t hiz_width = buffer->width / OCCLUSION_HIZ_BLOCK;
+    for (int by = y0; by < y1; by += OCCLUSION_HIZ_BLOCK)
+        for (int bx = x0; bx < x1; bx += OCCLUSION_HIZ_BLOCK) {
+            float d = -FLT_MAX;
+
+            for (int y = by; y < by + OCCLUSION_HIZ_BLOCK; y++)
+                for (int x = bx; x < bx + OCCLUSION_HIZ_BLOCK; x++)
+                    d = fmaxf(d, buffer->depth[y * buffer->width + x]);
+
+            buffer->hiz[(by / OCCLUSION_HIZ_BLOCK) * hiz_width + bx / OCCLUSION_HIZ_BLOCK] = d;
+        }
+}
+
+static void
+rasterize_tiles(OCCLUSION_BUFFER *buffer) {
+    const int tiles = buffer->tiles_x * buffer->tiles_y;
+    int tile;
+
+    while ((tile = SDL_AtomicAdd(&buffer->next_tile, 1)) < tiles)
+        rasterize_tile(buffer, tile);
+}
+
+static int
+occlusion_worker(void *data) {
+    OCCLUSION_BUFFER *buffer = data;
+
+    for (;;) {
+        SDL_SemWait(buffer->start);
+
+        if (SDL_AtomicGet(&buffer->quit))
+            break;
+
+        rasterize_tiles(buffer);
+        SDL_SemPost(buffer->done);
+    }
+
+    return 0;
+}
+
+extern OCCLUSION_BUFFER *
+new_occlusion_buffer(uint32_t width, uint32_t height, int threads) {
+    OCCLUSION_BUFFER *buffer = alloc_memory(sizeof(OCCLUSION_BUFFER));
+    memset(buffer, 0, sizeof(OCCLUSION_BUFFER));
+
+    buffer->tiles_x = (width + OCCLUSION_TILE_WIDTH - 1) / OCCLUSION_TILE_WIDTH;
+    buffer->tiles_y = (height + OCCLUSION_TILE_HEIGHT - 1) / OCCLUSION_TILE_HEIGHT;
+    buffer->width = buffer->tiles_x * OCCLUSION_TILE_WIDTH;
+    buffer->height = buffer->tiles_y * OCCLUSION_TILE_HEIGHT;
+
+    const size_t pixels = buffer->width * buffer->height;
+    buffer->depth = alloc_memory(pixels * sizeof(float));
+    buffer->hiz = alloc_memory(pixels / (OCCLUSION_HIZ_BLOCK * OCCLUSION_HIZ_BLOCK) * sizeof(float));
+
+    const uint32_t tiles = buffer->tiles_x * buffer->tiles_y;
+    buffer->bins = alloc_memory(tiles * sizeof(struct OcclusionBin));
+    memset(buffer->bins, 0, tiles * sizeof(struct OcclusionBin));
+
+    for (size_t i = 0; i < pixels; i++)
+        buffer->depth[i] = 1.f;
+    for (size_t i = 0; i < pixels / (OCCLUSION_HIZ_BLOCK * OCCLUSION_HIZ_BLOCK); i++)
+        buffer->hiz[i] = 1.f;
+
+    if (threads < 0)
+        threads = 0;
+    else if (threads == 0)
+        threads = SDL_GetCPUCount() - 1;
+
+    if ((uint32_t)threads > tiles - 1)
+        threads = tiles - 1;
+
+    buffer->start = SDL_CreateSemaphore(0);
+    buffer->done = SDL_CreateSemaphore(0);
+    SDL_AtomicSet(&buffer->quit, 0);
+
+    if (threads > 0) {
+        buffer->workers = alloc_memory(threads * sizeof(SDL_Thread *));
+
+        for (int i = 0; i < threads; i++) {
+            buffer->workers[i] = SDL_CreateThread(occlusion_worker, "occlusion", buffer);
+
+            if (!buffer->workers[i]) {
+                LOG_ERROR("Can't create occlusion worker: %s\n", SDL_GetError());
+                break;
+            }
+
+            buffer->workers_count++;
+        }
+    }
+
+    LOG("Occlusion buffer %ux%u, %u tiles, %u workers\n", buffer->width, buffer->height, tiles, buffer->workers_count);
+
+    return buffer;
+}
+
+extern void
+free_occlusion_buffer(OCCLUSION_BUFFER *buffer) {
+    if (!buffer)
+        return;
+
+    SDL_AtomicSet(&buffer->quit, 1);
+
+    for (uint32_t i = 0; i < buffer->workers_count; i++)
+        SDL_SemPost(buffer->start);
+
+    for (uint32_t i = 0; i < buffer->workers_count; i++)
+        SDL_WaitThread(buffer->workers[i], NULL);
+
+    SDL_DestroySemaphore(buffer->start);
+    SDL_DestroySemaphore(buffer->done);
+
+    for (uint32_t i = 0; i < buffer->tiles_x * buffer->tiles_y; i++)
+        free(buffer->bins[i].triangles);
+
+    free(buffer->workers);
+    free(buffer->bins);
+    free(buffer->triangles);
+    free(buffer->hiz);
+    free(buffer->depth);
+    free(buffer);
+}
+
+extern void
+occlusion_begin(OCCLUSION_BUFFER *buffer, matrix4 projection_view) {
+    assert(buffer != NULL);
+
+    memcpy(buffer->projection_view, projection_view, sizeof(matrix4));
+
+    buffer->triangles_count = 0;
+    for (uint32_t i = 0; i < buffer->tiles_x * buffer->tiles_y; i++)
+        buffer->bins[i].count = 0;
+
+    memset(&buffer->stats, 0, sizeof(OCCLUSION_STATS));
+}
+
+static void
+bin_triangle(OCCLUSION_BUFFER *buffer, const float4 v[3]) {
+    struct OcclusionTriangle tri;
+
+    for (int i = 0; i < 3; i++) {
+        const float inv_w = 1.f / v[i][3];
+        tri.x[i] = (v[i][0] * inv_w * 0.5f + 0.5f) * buffer->width;
+        tri.y[i] = (v[i][1] * inv_w * 0.5f + 0.5f) * buffer->height;
+        tri.z[i] = v[i][2] * inv_w;
+    }
+
+    const float minx = fminf(tri.x[0], fminf(tri.x[1], tri.x[2]));
+    const float maxx = fmaxf(tri.x[0], fmaxf(tri.x[1], tri.x[2]));
+    const float miny = fminf(tri.y[0], fminf(tri.y[1], tri.y[2]));
+    const float maxy = fmaxf(tri.y[0], fmaxf(tri.y[1], tri.y[2]));
+
+    if (maxx < 0.f || maxy < 0.f || minx >= buffer->width || miny >= buffer->height)
+        return;
+
+    if (buffer->triangles_count >= buffer->triangles_capacity) {
+        const uint32_t capacity = buffer->triangles_capacity > 0 ? buffer->triangles_capacity * 2 : 1024;
+        struct OcclusionTriangle *triangles = realloc(buffer->triangles, capacity * sizeof(struct OcclusionTriangle));
+        if (!triangles) {
+            LOG_CRITICAL("%s\n", "Can't alloc memory");
+            exit(EXIT_FAILURE);
+        }
+
+        buffer->triangles = triangles;
+        buffer->triangles_capacity = capacity;
+    }
+
+    const uint32_t index = buffer->triangles_count++;
+    buffer->triangles[index] = tri;
+
+    const int tx0 = (int)fmaxf(0.f, minx) / OCCLUSION_TILE_WIDTH;
+    const int ty0 = (int)fmaxf(0.f, miny) / OCCLUSION_TILE_HEIGHT;
+    const int tx1 = (int)fminf(buffer->width - 1, maxx) / OCCLUSION_TILE_WIDTH;
+    const int ty1 = (int)fminf(buffer->height - 1, maxy) / OCCLUSION_TILE_HEIGHT;
+
+    for (int ty = ty0; ty <= ty1; ty++)
+        for (int tx = tx0; tx <= tx1; tx++) {
+            struct OcclusionBin *bin = &buffer->bins[ty * buffer->tiles_x + tx];
+
+            if (bin->count >= bin->capacity) {
+                const uint32_t capacity = bin->capacity > 0 ? bin->capacity * 2 : 64;
+                uint32_t *triangles = realloc(bin->triangles, capacity * sizeof(uint32_t));
+                if (!triangles) {
+                    LOG_CRITICAL("%s\n", "Can't alloc memory");
+                    exit(EXIT_FAILURE);
+                }
+
+                bin->triangles = triangles;
+                bin->capacity = capacity;
+            }
+
+            bin->triangles[bin->count++] = index;
+            buffer->stats.binned_triangles++;
+        }
+}
+
+// clips against the near plane z + w >= 0 and bins the remaining fan
+static void
+clip_triangle(OCCLUSION_BUFFER *buffer, const float4 v[3]) {
+    float4 out[4];
+    int n = 0;
+
+    for (int i = 0; i < 3; i++) {
+        const float *a = v[i];
+        const float *b = v[(i + 1) % 3];
+        const float da = a[2] + a[3];
+        const float db = b[2] + b[3];
+
+        if (da >= 0.f)
+            memcpy(out[n++], a, sizeof(float4));
+
+        if ((da >= 0.f) != (db >= 0.f)) {
+            const float t = da / (da - db);
+            for (int k = 0; k < 4; k++)
+                out[n][k] = a[k] + (b[k] - a[k]) * t;
+            n++;
+        }
+    }
+
+    for (int i = 2; i < n; i++) {
+        float4 tri[3];
+        memcpy(tri[0], out[0], sizeof(float4));
+        memcpy(tri[1], out[i - 1], sizeof(float4));
+        memcpy(tri[2], out[i], sizeof(float4));
+
+        if (tri[0][3] > FLT_EPSILON && tri[1][3] > FLT_EPSILON && tri[2][3] > FLT_EPSILON)
+            bin_triangle(buffer, (const float4 *)tri);
+    }
+}
+
+static inline uint32_t
+occluder_index(const void *indices, uint32_t ef, size_t i) {
+    if (!indices)
+        return (uint32_t)i;
+
+    if (ef == IF_UI32)
+        return ((const uint32_t *)indices)[i];
+
+    return ((const uint16_t *)indices)[i];
+}
+
+extern void
+occlusion_add_occluder(OCCLUSION_BUFFER *buffer, const void *vertices, size_t stride,
+                       const void *indices, uint32_t ef, size_t indices_count, matrix4 transform) {
+    assert(buffer != NULL);
+    assert(vertices != NULL);
+
+    matrix4 mvp;
+    mul_matrix(mvp, transform, buffer->projection_view);
+
+    const uint8_t *base = vertices;
+
+    for (size_t t = 0; t + 2 < indices_count; t += 3) {
+        float4 v[3];
+
+        for (int i = 0; i < 3; i++) {
+            const float *p = (const float *)(base + occluder_index(indices, ef, t + i) * stride);
+            transform_point(v[i], p, mvp);
+        }
+
+        clip_triangle(buffer, (const float4 *)v);
+        buffer->stats.occluder_triangles++;
+    }
+}
+
+extern void
+occlusion_rasterize(OCCLUSION_BUFFER *buffer) {
+    assert(buffer != NULL);
+
+    SDL_AtomicSet(&buffer->next_tile, 0);
+
+    for (uint32_t i = 0; i < buffer->workers_count; i++)
+        SDL_SemPost(buffer->start);
+
+    rasterize_tiles(buffer);
+
+    for (uint32_t i = 0; i < buffer->workers_count; i++)
+        SDL_SemWait(buffer->done);
+}
+
+extern bool
+occlusion_test_aabb(OCCLUSION_BUFFER *buffer, const AABB *bound, matrix4 transform) {
+    assert(buffer != NULL);
+    assert(bound != NULL);
+
+    buffer->stats.tested++;
+
+    matrix4 mvp;
+    mul_matrix(mvp, transform, buffer->projection_view);
+
+    float minx = FLT_MAX, miny = FLT_MAX, maxx = -FLT_MAX, maxy = -FLT_MAX, minz = FLT_MAX;
+
+    for (int c = 0; c < 8; c++) {
+        const float p[3] = {
+            c & 1 ? bound->max[0] : bound->min[0],
+            c & 2 ? bound->max[1] : bound->min[1],
+            c & 4 ? bound->max[2] : bound->min[2]
+        };
+
+        float4 v;
+        transform_point(v, p, mvp);
+
+        // crossing the near plane, treat as visible
+        if (v[2] + v[3] < 0.f || v[3] <= FLT_EPSILON)
+            return true;
+
+        const float inv_w = 1.f / v[3];
+        const float x = (v[0] * inv_w * 0.5f + 0.5f) * buffer->width;
+        const float y = (v[1] * inv_w * 0.5f + 0.5f) * buffer->height;
+
+        minx = fminf(minx, x);
+        maxx = fmaxf(maxx, x);
+        miny = fminf(miny, y);
+        maxy = fmaxf(maxy, y);
+        minz = fminf(minz, v[2] * inv_w);
+    }
+
+    if (maxx < 0.f || maxy < 0.f || minx >= buffer->width || miny >= buffer->height) {
+        buffer->stats.occluded++;
+        return false;
+    }
+
+    const uint32_t hiz_width = buffer->width / OCCLUSION_HIZ_BLOCK;
+    const int bx0 = (int)fmaxf(0.f, minx) / OCCLUSION_HIZ_BLOCK;
+    const int by0 = (int)fmaxf(0.f, miny) / OCCLUSION_HIZ_BLOCK;
+    const int bx1 = (int)fminf(buffer->width - 1, maxx) / OCCLUSION_HIZ_BLOCK;
+    const int by1 = (int)fminf(buffer->height - 1, maxy) / OCCLUSION_HIZ_BLOCK;
+
+    for (int by = by0; by <= by1; by++)
+        for (int bx = bx0; bx <= bx1; bx++)
+            if (minz <= buffer->hiz[by * hiz_width + bx])
+                return true;
+
+    buffer->stats.occluded++;
+
+    return false;
+}
+
+extern uint32_t
+occlusion_cull_objects(OCCLUSION_BUFFER *buffer, const VIDEO_VERTICES_INFO *info, matrix4 transform,
+                       const uint32_t *objects, uint32_t count, uint32_t *visible) {
+    assert(info != NULL);
+
+    uint32_t n = 0;
+
+    for (uint32_t i = 0; i < count; i++) {
+        const uint32_t object = objects[i];
+
+        if (occlusion_test_aabb(buffer, &info->objects[object].bound, transform))
+            visible[n++] = object;
+    }
+
+    return n;
+}
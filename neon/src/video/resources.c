@@ -1,18 +1,257 @@
 #include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <memtrack.h>
 #include <core/logerr.h>
+#include <core/video.h>
 #include <video/vertex.h>
 #include <video/resources.h>
 #include <video/resources_detail.h>
+#include <video/geometry.h>
+
+#define POOL_CHUNK_SLOTS    64
+#define HANDLE_INDEX_BITS   19
+#define HANDLE_TYPE_BITS    3
+#define HANDLE_GENERATIONS  1023 // 10 bits, never 0 so no handle is VIDEO_NULL_HANDLE
+#define MAX_POOL_SLOTS      (1u << HANDLE_INDEX_BITS)
+#define SLOT_HEADER         ((sizeof(RESOURCE_SLOT) + 15) & ~(size_t)15)
+
+typedef struct ResourceSlot {
+    uint32_t    generation;
+    uint32_t    refs;
+    uint32_t    type;
+    uint32_t    index;
+    uint32_t    next_free;  // slot + 1
+    uint32_t    hash_next;  // slot + 1
+    uint32_t    hash;       // 0 when not shared
+    bool        live;
+    bool        pending;    // unreferenced, freed by resources_process
+} RESOURCE_SLOT;
+
+// chunks never move, resources are found by pointer or by handle
+typedef struct ResourcePool {
+    size_t          item_size;
+    size_t          slot_size;
+    uint8_t         **chunks;
+    uint32_t        chunks_count;
+    uint32_t        slots_count;
+    uint32_t        free_list;  // slot + 1
+    uint32_t        live;
+    uint32_t        *buckets;   // hash chains, slot + 1
+    uint32_t        buckets_count;
+    void            (*release)(void *resource);
+} RESOURCE_POOL;
+
+static void
+release_texture(void *resource) {
+    free_texture(resource);
+}
+
+static void
+release_sampler(void *resource) {
+    free_sampler(resource);
+}
+
+static void
+release_renderbuffer(void *resource) {
+    free_renderbuffer(resource);
+}
+
+static void
+release_framebuffer(void *resource) {
+    free_framebuffer(resource);
+}
 
-VIDEO_RESOURCES all_resources;
+static void
+release_buffer(void *resource) {
+    free_video_buffer(resource);
+}
 
-size_t textures_count;
-size_t samplers_count;
-size_t renderbuffers_count;
-size_t framebuffers_count;
-size_t buffers_count;
-size_t vertex_arrays_count;
-size_t shaders_count;
+static void
+release_vertex_array(void *resource) {
+    free_vertex_array(resource);
+}
+
+static void
+release_shader(void *resource) {
+    free_shader(resource);
+}
+
+static RESOURCE_POOL pools[RESOURCE_TYPES] = {
+    [RESOURCE_TEXTURE] = {.item_size = sizeof(TEXTURE), .release = release_texture},
+    [RESOURCE_SAMPLER] = {.item_size = sizeof(SAMPLER), .release = release_sampler},
+    [RESOURCE_RENDERBUFFER] = {.item_size = sizeof(RENDERBUFFER), .release = release_renderbuffer},
+    [RESOURCE_FRAMEBUFFER] = {.item_size = sizeof(FRAMEBUFFER), .release = release_framebuffer},
+    [RESOURCE_BUFFER] = {.item_size = sizeof(VIDEO_BUFFER), .release = release_buffer},
+    [RESOURCE_VERTEX_ARRAY] = {.item_size = sizeof(VERTEX_ARRAY), .release = release_vertex_array},
+    [RESOURCE_SHADER] = {.item_size = sizeof(SHADER), .release = release_shader},
+};
+
+static VIDEO_HANDLE *pending;
+static uint32_t pending_count;
+static uint32_t pending_capacity;
+
+static inline RESOURCE_SLOT *
+slot_at(const RESOURCE_POOL *pool, uint32_t index) {
+    return (RESOURCE_SLOT*)(pool->chunks[index / POOL_CHUNK_SLOTS] + (index % POOL_CHUNK_SLOTS) * pool->slot_size);
+}
+
+static inline void *
+slot_item(RESOURCE_SLOT *slot) {
+    return (uint8_t*)slot + SLOT_HEADER;
+}
+
+static inline VIDEO_HANDLE
+slot_handle(const RESOURCE_SLOT *slot) {
+    return (slot->generation << (HANDLE_INDEX_BITS + HANDLE_TYPE_BITS)) | (slot->type << HANDLE_INDEX_BITS) | slot->index;
+}
+
+static RESOURCE_SLOT *
+find_slot(VIDEO_HANDLE handle) {
+    const uint32_t type = (handle >> HANDLE_INDEX_BITS) & ((1u << HANDLE_TYPE_BITS) - 1);
+    const uint32_t index = handle & (MAX_POOL_SLOTS - 1);
+
+    if (handle == VIDEO_NULL_HANDLE || type >= RESOURCE_TYPES || index >= pools[type].slots_count)
+        return NULL;
+
+    RESOURCE_SLOT *slot = slot_at(&pools[type], index);
+
+    return slot->live && slot_handle(slot) == handle ? slot : NULL;
+}
+
+static void *
+alloc_memory(void *ptr, size_t size) {
+    ptr = realloc(ptr, size);
+
+    if (!ptr) {
+        LOG_CRITICAL("%s\n", "Can't alloc memory");
+        exit(EXIT_FAILURE);
+    }
+
+    return ptr;
+}
+
+static RESOURCE_SLOT *
+new_slot(RESOURCE_POOL *pool, uint32_t type) {
+    if (pool->free_list) {
+        RESOURCE_SLOT *slot = slot_at(pool, pool->free_list - 1);
+        pool->free_list = slot->next_free;
+        return slot;
+    }
+
+    if (pool->slots_count == MAX_POOL_SLOTS) {
+        LOG_CRITICAL("Too many video resources of type %u\n", type);
+        exit(EXIT_FAILURE);
+    }
+
+    if (pool->slots_count == pool->chunks_count * POOL_CHUNK_SLOTS) {
+        pool->slot_size = SLOT_HEADER + ((pool->item_size + 15) & ~(size_t)15);
+        pool->chunks = alloc_memory(pool->chunks, sizeof(uint8_t*) * (pool->chunks_count + 1));
+        pool->chunks[pool->chunks_count] = alloc_memory(NULL, pool->slot_size * POOL_CHUNK_SLOTS);
+        memset(pool->chunks[pool->chunks_count], 0, pool->slot_size * POOL_CHUNK_SLOTS);
+        pool->chunks_count++;
+    }
+
+    RESOURCE_SLOT *slot = slot_at(pool, pool->slots_count);
+    slot->index = pool->slots_count++;
+    slot->type = type;
+    slot->generation = 1;
+
+    return slot;
+}
+
+// the hash only narrows it down, same decides on the items
+static RESOURCE_SLOT *
+find_shared(const RESOURCE_POOL *pool, uint32_t hash, const void *resource, bool (*same)(const void *, const void *)) {
+    if (hash == 0 || pool->buckets_count == 0)
+        return NULL;
+
+    for (uint32_t s = pool->buckets[hash & (pool->buckets_count - 1)]; s != 0; ) {
+        RESOURCE_SLOT *slot = slot_at(pool, s - 1);
+
+        if (slot->hash == hash && same(slot_item(slot), resource))
+            return slot;
+
+        s = slot->hash_next;
+    }
+
+    return NULL;
+}
+
+static void
+link_shared(RESOURCE_POOL *pool, RESOURCE_SLOT *slot) {
+    uint32_t *bucket = &pool->buckets[slot->hash & (pool->buckets_count - 1)];
+
+    slot->hash_next = *bucket;
+    *bucket = slot->index + 1;
+}
+
+static void
+unlink_shared(RESOURCE_POOL *pool, RESOURCE_SLOT *slot) {
+    uint32_t *s = &pool->buckets[slot->hash & (pool->buckets_count - 1)];
+
+    while (*s != slot->index + 1)
+        s = &slot_at(pool, *s - 1)->hash_next;
+
+    *s = slot->hash_next;
+}
+
+// keeps chains short, one bucket per live resource at least
+static void
+grow_buckets(RESOURCE_POOL *pool) {
+    if (pool->live < pool->buckets_count)
+        return;
+
+    pool->buckets_count = pool->buckets_count ? pool->buckets_count * 2 : 64;
+    pool->buckets = alloc_memory(pool->buckets, sizeof(uint32_t) * pool->buckets_count);
+    memset(pool->buckets, 0, sizeof(uint32_t) * pool->buckets_count);
+
+    for (uint32_t i = 0; i < pool->slots_count; i++) {
+        RESOURCE_SLOT *slot = slot_at(pool, i);
+
+        if (slot->live && slot->hash)
+            link_shared(pool, slot);
+    }
+}
+
+static void *
+store_resource(uint32_t type, const void *resource, uint32_t hash) {
+    RESOURCE_POOL *pool = &pools[type];
+
+    // while the new slot is not live yet, a rehash would link it twice onto itself
+    if (hash)
+        grow_buckets(pool);
+
+    RESOURCE_SLOT *slot = new_slot(pool, type);
+    memcpy(slot_item(slot), resource, pool->item_size);
+
+    slot->refs = 1;
+    slot->hash = hash;
+    slot->live = true;
+    slot->pending = false;
+    pool->live++;
+
+    if (hash)
+        link_shared(pool, slot);
+
+    return slot_item(slot);
+}
+
+static void
+free_slot(RESOURCE_POOL *pool, RESOURCE_SLOT *slot) {
+    pool->release(slot_item(slot));
+
+    if (slot->hash)
+        unlink_shared(pool, slot);
+
+    slot->live = false;
+    slot->pending = false;
+    slot->hash = 0;
+    slot->generation = slot->generation % HANDLE_GENERATIONS + 1;
+    slot->next_free = pool->free_list;
+    pool->free_list = slot->index + 1;
+    pool->live--;
+}
 
 extern void
 resources_init(void) {
@@ -20,49 +259,125 @@ resources_init(void) {
 
 extern void
 resources_cleanup(void) {
-    for (int i = 0; i < MAX_TEXTURES; i++)
-        if (all_resources.textures[i].id != 0)
-            free_texture(&all_resources.textures[i]);
+    for (uint32_t type = 0; type < RESOURCE_TYPES; type++) {
+        RESOURCE_POOL *pool = &pools[type];
 
-    for (int i = 0; i < MAX_SAMPLERS; i++)
-        if (all_resources.samplers[i].id != 0)
-            free_sampler(&all_resources.samplers[i]);
+        for (uint32_t i = 0; i < pool->slots_count; i++) {
+            RESOURCE_SLOT *slot = slot_at(pool, i);
 
-    for (int i = 0; i < MAX_RENDERBUFFERS; i++)
-        if (all_resources.renderbuffers[i].id)
-            free_renderbuffer(&all_resources.renderbuffers[i]);
+            if (slot->live)
+                free_slot(pool, slot);
+        }
 
-    for (int i = 0; i < MAX_FRAMEBUFFERS; i++)
-        if (all_resources.framebuffers[i].id)
-            free_framebuffer(&all_resources.framebuffers[i]);
+        for (uint32_t c = 0; c < pool->chunks_count; c++)
+            free(pool->chunks[c]);
 
-    for (int i = 0; i < MAX_BUFFERS; i++)
-        if (all_resources.buffers[i].id)
-            free_video_buffer(&all_resources.buffers[i]);
+        free(pool->chunks);
+        free(pool->buckets);
 
-    for (int i = 0; i < MAX_VERTEX_ARRAYS; i++)
-        if (all_resources.arrays[i].id)
-            free_vertex_array(&all_resources.arrays[i]);
+        pool->chunks = NULL;
+        pool->chunks_count = 0;
+        pool->slots_count = 0;
+        pool->free_list = 0;
+        pool->buckets = NULL;
+        pool->buckets_count = 0;
+    }
 
-    for (int i = 0; i < MAX_SHADERS; i++)
-        free_shader(&all_resources.shaders[i]);        
+    free(pending);
+    pending = NULL;
+    pending_count = 0;
+    pending_capacity = 0;
 }
 
 void
 resources_process(void) {
+    if (pending_count == 0)
+        return;
 
+    // free_* queue GL deletes, which the render thread works on
+    video_lock_context();
+
+    for (uint32_t i = 0; i < pending_count; i++) {
+        RESOURCE_SLOT *slot = find_slot(pending[i]);
+
+        // stored again after its last release
+        if (!slot || slot->refs > 0) {
+            if (slot)
+                slot->pending = false;
+            continue;
+        }
+
+        free_slot(&pools[slot->type], slot);
+    }
+
+    pending_count = 0;
+
+    video_unlock_context();
 }
 
-static TEXTURE*
-find_texture_by_hash(const TEXTURE *tex) {
-    if (tex->hash == 0)
-        return NULL;
+extern VIDEO_HANDLE
+resource_handle(const void *resource) {
+    if (!resource)
+        return VIDEO_NULL_HANDLE;
 
-    for (size_t i = 0; i < textures_count; i++)
-        if (tex->hash == all_resources.textures[i].hash)
-            return &all_resources.textures[i];
+    const RESOURCE_SLOT *slot = (const RESOURCE_SLOT*)((const uint8_t*)resource - SLOT_HEADER);
 
-    return NULL;
+    return slot_handle(slot);
+}
+
+extern void *
+get_resource(VIDEO_HANDLE handle, uint32_t type) {
+    RESOURCE_SLOT *slot = find_slot(handle);
+
+    return slot && slot->type == type ? slot_item(slot) : NULL;
+}
+
+extern void
+acquire_resource(VIDEO_HANDLE handle) {
+    RESOURCE_SLOT *slot = find_slot(handle);
+
+    if (!slot) {
+        LOG_WARNING("Acquire of stale resource 0x%x\n", handle);
+        return;
+    }
+
+    slot->refs++;
+}
+
+extern void
+release_resource(VIDEO_HANDLE handle) {
+    RESOURCE_SLOT *slot = find_slot(handle);
+
+    if (!slot || slot->refs == 0) {
+        LOG_WARNING("Release of stale resource 0x%x\n", handle);
+        return;
+    }
+
+    if (--slot->refs > 0 || slot->pending)
+        return;
+
+    if (pending_count == pending_capacity) {
+        pending_capacity = pending_capacity ? pending_capacity * 2 : 64;
+        pending = alloc_memory(pending, sizeof(VIDEO_HANDLE) * pending_capacity);
+    }
+
+    slot->pending = true;
+    pending[pending_count++] = handle;
+}
+
+extern uint32_t
+resources_count(uint32_t type) {
+    assert(type < RESOURCE_TYPES);
+
+    return pools[type].live;
+}
+
+static bool
+same_texture(const void *a, const void *b) {
+    const TEXTURE *ta = a, *tb = b;
+
+    return ta->target == tb->target && ta->width == tb->width && ta->height == tb->height &&
+           ta->depth == tb->depth && ta->internalformat == tb->internalformat;
 }
 
 extern TEXTURE*
@@ -70,82 +385,80 @@ store_texture(const TEXTURE texture) {
     if (texture.usage != 0)
         LOG_WARNING("Texture %u already used.\n", texture.id);
 
-    TEXTURE *tex = find_texture_by_hash(&texture);
-    if (tex) {
-        tex->usage++;
+    RESOURCE_SLOT *shared = find_shared(&pools[RESOURCE_TEXTURE], texture.hash, &texture, same_texture);
+    if (shared) {
+        TEXTURE *tex = slot_item(shared);
+
+        // the same image uploaded again, keep the first copy
+        if (tex->id != texture.id) {
+            TEXTURE duplicate = texture;
+            free_texture(&duplicate);
+        }
+
+        shared->refs++;
         return tex;
     }
 
-    all_resources.textures[textures_count] = texture;
-    all_resources.textures[textures_count].usage = 1;
-
-    textures_count++;
+    TEXTURE *tex = store_resource(RESOURCE_TEXTURE, &texture, texture.hash);
+    tex->usage = 1;
 
-    return &all_resources.textures[textures_count - 1];
+    return tex;
 }
 
 extern SAMPLER*
 store_sampler(const SAMPLER sampler) {
-    all_resources.samplers[samplers_count] = sampler;
-    all_resources.samplers[samplers_count].usage = 1;
+    SAMPLER *s = store_resource(RESOURCE_SAMPLER, &sampler, 0);
+    s->usage = 1;
 
-    samplers_count++;
-
-    return &all_resources.samplers[samplers_count - 1];
+    return s;
 }
 
 extern RENDERBUFFER*
 store_renderbuffer(const RENDERBUFFER renderbuffer) {
-    all_resources.renderbuffers[renderbuffers_count] = renderbuffer;
-    all_resources.renderbuffers[renderbuffers_count].usage = 1;
-
-    renderbuffers_count++;
+    RENDERBUFFER *rb = store_resource(RESOURCE_RENDERBUFFER, &renderbuffer, 0);
+    rb->usage = 1;
 
-    return &all_resources.renderbuffers[renderbuffers_count - 1];
+    return rb;
 }
 
 extern FRAMEBUFFER*
 store_framebuffer(const FRAMEBUFFER framebuffer) {
-    all_resources.framebuffers[framebuffers_count] = framebuffer;
-    all_resources.framebuffers[framebuffers_count].usage = 1;
+    FRAMEBUFFER *fb = store_resource(RESOURCE_FRAMEBUFFER, &framebuffer, 0);
+    fb->usage = 1;
 
-    framebuffers_count++;
-
-    return &all_resources.framebuffers[framebuffers_count - 1];
+    return fb;
 }
 
 extern VIDEO_BUFFER*
 store_buffer(const VIDEO_BUFFER buffer) {
-    all_resources.buffers[buffers_count] = buffer;
-    all_resources.buffers[buffers_count].usage = 1;
-
-    buffers_count++;
+    VIDEO_BUFFER *b = store_resource(RESOURCE_BUFFER, &buffer, 0);
+    b->usage = 1;
 
-    return &all_resources.buffers[buffers_count - 1];
+    return b;
 }
 
 extern VERTEX_ARRAY*
 store_vertex_array(const VERTEX_ARRAY array) {
-    all_resources.arrays[vertex_arrays_count] = array;
-    all_resources.arrays[vertex_arrays_count].usage = 1;
+    VERTEX_ARRAY *va = store_resource(RESOURCE_VERTEX_ARRAY, &array, 0);
+    va->usage = 1;
 
-    vertex_arrays_count++;
-
-    return &all_resources.arrays[vertex_arrays_count - 1];
+    return va;
 }
 
 extern SHADER*
 store_shader(const SHADER shader) {
-    all_resources.shaders[shaders_count] = shader;
-    all_resources.shaders[shaders_count].usage = 1;
-
-    shaders_count++;
+    SHADER *s = store_resource(RESOURCE_SHADER, &shader, 0);
+    s->usage = 1;
 
-    return &all_resources.shaders[shaders_count - 1];
+    return s;
 }
 
 extern VERTEX_ARRAY*
 store_vertices_buffers(const VIDEO_VERTICES_INFO *info) {
+    // shared buffers and arrays are freed with the heaps
+    if (info->geometry)
+        return geometry_vertex_array(info->desc.vf);
+
     store_buffer(info->vertices);
     store_buffer(info->elements);
 
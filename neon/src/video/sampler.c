@@ -1,6 +1,8 @@
 #include <assert.h>
 #include <video/sampler.h>
 #include <core/common.h>
+#include <video/state.h>
+#include <video/deletequeue.h>
 
 #ifndef GL_ES_VERSION_2_0
 #include <GL/ext_texture_filter_anisotropic.h>
@@ -11,6 +13,7 @@ new_sampler(const SAMPLER_INFO *info) {
 #ifndef GL_ES_VERSION_2_0
     GLuint sid;
     glGenSamplers(1, &sid);
+    track_video_object(VIDEO_OBJECT_SAMPLER);
 
     glSamplerParameteri(sid, GL_TEXTURE_MAG_FILTER, info->mag_filter);
     glSamplerParameteri(sid, GL_TEXTURE_MIN_FILTER, info->min_filter);
@@ -57,8 +60,7 @@ free_sampler(SAMPLER *sampler) {
     assert(sampler != NULL);
 
 #ifndef GL_ES_VERSION_2_0
-    if(glIsSampler(sampler->id))
-        glDeleteSamplers(1, &sampler->id);
+    delete_video_object(VIDEO_OBJECT_SAMPLER, sampler->id);
 #endif // NO GL_ES_VERSION_2_0
 
     sampler->id = 0;
@@ -76,7 +78,7 @@ bind_sampler(uint32_t unit, SAMPLER *sam) {
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, sam->wrap_s);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, sam->wrap_t);
 #else
-    glBindSampler(unit, sam->id);
+    state_bind_sampler(unit, sam->id);
 #endif // NO GL_ES_VERSION_2_0
 }
 
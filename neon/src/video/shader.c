@@ -11,6 +11,9 @@
 #include <base/pjw.h>
 
 #include "video/shader.h"
+#include "video/state.h"
+#include "video/deletequeue.h"
+#include "video/instancing.h"
 
 #include "core/common.h"
 #include "core/logerr.h"
@@ -236,6 +239,166 @@ get_program_uniforms(GLuint pid, UNIFORM **uni) {
     return total;
 }
 
+static UNIFORM_SHADOW **shadows; // by program name
+static uint32_t shadows_capacity;
+
+static uint32_t
+uniform_type_size(GLenum type) {
+    switch (type) {
+    case GL_FLOAT:
+    case GL_INT:
+    case GL_BOOL:
+#ifndef GL_ES_VERSION_2_0
+    case GL_UNSIGNED_INT:
+#endif
+        return 4;
+    case GL_FLOAT_VEC2:
+    case GL_INT_VEC2:
+    case GL_BOOL_VEC2:
+        return 8;
+    case GL_FLOAT_VEC3:
+    case GL_INT_VEC3:
+    case GL_BOOL_VEC3:
+        return 12;
+    case GL_FLOAT_VEC4:
+    case GL_INT_VEC4:
+    case GL_BOOL_VEC4:
+    case GL_FLOAT_MAT2:
+        return 16;
+    case GL_FLOAT_MAT3:
+        return 36;
+    case GL_FLOAT_MAT4:
+        return 64;
+    }
+
+    // samplers keep their units in the state cache
+    return 0;
+}
+
+static void
+free_uniform_shadow(SHADER *shader) {
+    if (!shader->shadow)
+        return;
+
+    if (shader->shadow->program < shadows_capacity && shadows[shader->shadow->program] == shader->shadow)
+        shadows[shader->shadow->program] = NULL;
+
+    free(shader->shadow);
+    shader->shadow = NULL;
+}
+
+static void
+build_uniform_shadow(SHADER *shader) {
+    free_uniform_shadow(shader);
+
+    int locations_count = 0;
+    size_t size = 0;
+
+    for (int i = 0; i < shader->uniforms_count; i++) {
+        UNIFORM *u = &shader->uniforms[i];
+
+        u->offset = (uint32_t)size;
+        u->size = u->location >= 0 && u->location + u->num <= MAX_SHADOWED_LOCATIONS ? uniform_type_size(u->type) * u->num : 0;
+
+        if (u->size == 0)
+            continue;
+
+        size += u->size;
+        if (u->location + u->num > locations_count)
+            locations_count = u->location + u->num;
+    }
+
+    if (size == 0)
+        return;
+
+    // one block: header, values, locations, valid flags
+    const size_t values_offset = sizeof(UNIFORM_SHADOW);
+    const size_t locations_offset = values_offset + ((size + 7) & ~(size_t)7);
+    const size_t valid_offset = locations_offset + sizeof(int16_t) * locations_count;
+
+    uint8_t *block = calloc(1, valid_offset + locations_count);
+
+    if (!block) {
+        LOG_CRITICAL("%s\n", "Can't alloc memory");
+        exit(EXIT_FAILURE);
+    }
+
+    UNIFORM_SHADOW *shadow = (UNIFORM_SHADOW*)block;
+    shadow->program = shader->pid;
+    shadow->uniforms = shader->uniforms;
+    shadow->values = block + values_offset;
+    shadow->locations = (int16_t*)(block + locations_offset);
+    shadow->valid = block + valid_offset;
+    shadow->locations_count = locations_count;
+
+    for (int l = 0; l < locations_count; l++)
+        shadow->locations[l] = -1;
+
+    for (int i = 0; i < shader->uniforms_count; i++) {
+        const UNIFORM *u = &shader->uniforms[i];
+
+        for (int e = 0; e < u->num && u->size > 0; e++)
+            shadow->locations[u->location + e] = (int16_t)i;
+    }
+
+    if (shader->pid >= shadows_capacity) {
+        uint32_t capacity = shadows_capacity > 0 ? shadows_capacity : 64;
+        while (capacity <= shader->pid)
+            capacity *= 2;
+
+        UNIFORM_SHADOW **grown = realloc(shadows, sizeof(UNIFORM_SHADOW*) * capacity);
+
+        if (!grown) {
+            LOG_CRITICAL("%s\n", "Can't alloc memory");
+            exit(EXIT_FAILURE);
+        }
+
+        memset(grown + shadows_capacity, 0, sizeof(UNIFORM_SHADOW*) * (capacity - shadows_capacity));
+        shadows = grown;
+        shadows_capacity = capacity;
+    }
+
+    shadows[shader->pid] = shadow;
+    shader->shadow = shadow;
+}
+
+extern UNIFORM_SHADOW *
+find_uniform_shadow(uint32_t program) {
+    return program < shadows_capacity ? shadows[program] : NULL;
+}
+
+extern bool
+uniform_shadow_changed(UNIFORM_SHADOW *shadow, int location, const void *data, size_t size) {
+    if (!shadow || location < 0 || location >= shadow->locations_count || shadow->locations[location] < 0)
+        return true;
+
+    const UNIFORM *u = &shadow->uniforms[shadow->locations[location]];
+    const uint32_t element = u->size / u->num;
+    const uint32_t first = (uint32_t)(location - u->location);
+    const size_t offset = u->offset + first * element;
+
+    // a type that doesn't match the reflection goes through uncached and whatever it overwrote is unknown
+    if (size == 0 || size % element != 0 || first * element + size > u->size) {
+        memset(&shadow->valid[location], 0, u->num - first);
+        return true;
+    }
+
+    const uint32_t count = (uint32_t)(size / element);
+    uint8_t *values = shadow->values + offset;
+
+    bool valid = true;
+    for (uint32_t i = 0; i < count && valid; i++)
+        valid = shadow->valid[location + i];
+
+    if (valid && memcmp(values, data, size) == 0)
+        return false;
+
+    memcpy(values, data, size);
+    memset(&shadow->valid[location], 1, count);
+
+    return true;
+}
+
 extern SHADER
 new_shader_ext(const SHADER_INFO *info, const char *definitions, const ATTRIBUTE_INFO **attributes, const FEEDBACK_VARYINGS *varyings) {
     SHADER sh;
@@ -250,13 +413,15 @@ extern void
 free_shader(SHADER *shader) {
     assert(shader != NULL);
 
-    if (glIsProgram(shader->pid))
-        glDeleteProgram(shader->pid);
+    if (shader->pid) {
+        delete_video_object(VIDEO_OBJECT_PROGRAM, shader->pid);
+        forget_instanced_program(shader->pid);
+    }
+    free_uniform_shadow(shader);
     shader->pid = 0;
 
     for (int i = 0; i < MAX_SHADER_TYPES_SUPPORTED; i++) {
-        if (glIsShader(shader->shaders[i]))
-            glDeleteShader(shader->shaders[i]);
+        delete_video_object(VIDEO_OBJECT_SHADER, shader->shaders[i]);
         shader->shaders[i] = 0;
 
         if (shader->sources[i].name) {
@@ -303,8 +468,10 @@ create_shader(SHADER *shader, int type, const SHADER_SOURCE_INFO *info, const ch
     const char *text = info ? info->text : NULL;
 
     if ((shader->shaders[type] == 0) &&
-        ((shader->sources[type].source != NULL) || (text != NULL) || (name != NULL)))
+        ((shader->sources[type].source != NULL) || (text != NULL) || (name != NULL))) {
         shader->shaders[type] = glCreateShader(gl_shader_types[type]);
+        track_video_object(VIDEO_OBJECT_SHADER);
+    }
 
     if (info) {
         if (!shader->sources[type].name)
@@ -346,8 +513,10 @@ extern void
 rebuild_shader(SHADER *shader, const SHADER_INFO *info, const char *definitions, const ATTRIBUTE_INFO **attributes, const FEEDBACK_VARYINGS *varyings) {
     assert(shader != NULL);
 
-    if (shader->pid == 0)
+    if (shader->pid == 0) {
         shader->pid = glCreateProgram();
+        track_video_object(VIDEO_OBJECT_PROGRAM);
+    }
 
     create_shader(shader, ST_VERTEX, info ? &info->vs : NULL, definitions);
     create_shader(shader, ST_FRAGMENT, info ? &info->fs : NULL, definitions);
@@ -394,6 +563,9 @@ rebuild_shader(SHADER *shader, const SHADER_INFO *info, const char *definitions,
 
     shader->uniforms_count = get_program_uniforms(shader->pid, &shader->uniforms);
 
+    // relinking resets the values
+    build_uniform_shadow(shader);
+
     free(shader->attributes);
     shader->attributes = NULL;
 
@@ -554,14 +726,14 @@ upload_shader_ext(const char *names, const char *definitions, const ATTRIBUTE_IN
 
 extern void
 bind_shader(SHADER *shader) {
-    glUseProgram(shader->pid);
+    state_use_program(shader->pid);
 }
 
 extern void
 unbind_shader(SHADER *shader) {
     UNUSED(shader);
 
-    glUseProgram(0);
+    state_use_program(0);
 }
 
 /*static int
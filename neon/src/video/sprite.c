@@ -11,10 +11,10 @@ static void
 sprite_batch_create_buffers(VIDEO_SPRITE_BATCH *batch) {
     batch->va = new_vertex_array();
     bind_vertex_arrays(&batch->va);
-    batch->vb = new_vertex_buffer(NULL, batch->capacity * 4 * sizeof(v3t2c4_t), GL_DYNAMIC_DRAW);
+    batch->vb = new_stream_buffer(GL_ARRAY_BUFFER, batch->capacity * 4 * sizeof(v3t2c4_t));
     batch->ib = new_index_buffer(batch->indices, sizeof(uint16_t) * batch->capacity * 6, GL_STATIC_DRAW);
 
-    vertex_array_buffer(&batch->va, &batch->vb, 0, sizeof(v3t2c4_t));
+    vertex_array_buffer(&batch->va, &batch->vb.buffer, 0, sizeof(v3t2c4_t));
     vertex_array_format(&batch->va, POSITION_ATTRIBUTE, 3, GL_FLOAT, GL_FALSE, offsetof(v3t2c4_t, position));
     vertex_array_format(&batch->va, TEXCOORD_ATTRIBUTE, 2, GL_FLOAT, GL_FALSE, offsetof(v3t2c4_t, texcoord));
     vertex_array_format(&batch->va, COLOR_ATTRIBUTE, 4, GL_FLOAT, GL_FALSE, offsetof(v3t2c4_t, color));
@@ -23,7 +23,7 @@ sprite_batch_create_buffers(VIDEO_SPRITE_BATCH *batch) {
 
 static void
 sprite_batch_delete_buffers(VIDEO_SPRITE_BATCH *batch) {
-    free_video_buffer(&batch->vb);
+    free_stream_buffer(&batch->vb);
     free_video_buffer(&batch->ib);
     free_vertex_array(&batch->va);
 }
@@ -106,16 +106,12 @@ submit_batches(VIDEO_SPRITE_BATCH *batches, size_t batches_count, SHADER *shader
         if(batches[i].count < 1)
             continue;
 
-        video_buffer_subdata(&batches[i].vb, 0, batches[i].vertices, batches[i].vertices_count * sizeof(v3t2c4_t));
+        const size_t offset = stream_buffer_write(&batches[i].vb, batches[i].vertices, batches[i].vertices_count * sizeof(v3t2c4_t), sizeof(v3t2c4_t));
+        batches[i].base_vertex = (uint32_t)(offset / sizeof(v3t2c4_t));
     }
-    unbind_video_buffer(GL_ARRAY_BUFFER);
 
-    glUseProgram(shader->pid);
-
-    if (blend.enable) {
-        glEnable(GL_BLEND);
-        glBlendFunc(blend.sfactor, blend.dfactor);
-    }
+    bind_shader(shader);
+    set_color_blend_state(&blend);
 
     int loc_sprite = shader_get_uniform(shader, "sprite_map");
 
@@ -123,23 +119,27 @@ submit_batches(VIDEO_SPRITE_BATCH *batches, size_t batches_count, SHADER *shader
         if(batches[i].count < 1)
             continue;
 
-        glUniform1i(loc_sprite, 0);
+        state_sampler_uniform(loc_sprite, 0);
 
         bind_texture(0, batches[i].texture);
         bind_sampler(0, sampler);
 
         bind_vertex_arrays(&batches[i].va);
+#ifndef GL_ES_VERSION_2_0
+        glDrawElementsBaseVertex(GL_TRIANGLES, batches[i].indices_count, GL_UNSIGNED_SHORT, 0, batches[i].base_vertex);
+#else
         glDrawElements(GL_TRIANGLES, batches[i].indices_count, GL_UNSIGNED_SHORT, 0);
+#endif // GL_ES_VERSION_2_0
         unbind_vertex_array(&batches[i].va);
 
-        glBindTexture(GL_TEXTURE_2D, 0);
+        unbind_texture(0, GL_TEXTURE_2D);
 
         batches[i].count = 0;
         batches[i].vertices_count = 0;
         batches[i].indices_count = 0;
     }
 
-    glDisable(GL_BLEND);
+    clear_color_blend_state();
 
-    glUseProgram(0);
+    unbind_shader(shader);
 }
@@ -1,34 +1,357 @@
 #include <assert.h>
+#include <string.h>
 #include <video/gl.h>
 #include "video/state.h"
+#include "video/stats.h"
+
+enum {
+    STATE_CAP_BLEND,
+    STATE_CAP_DEPTH_TEST,
+    STATE_CAP_CULL_FACE,
+    STATE_CAP_STENCIL_TEST,
+    STATE_CAP_DEPTH_CLAMP,
+    STATE_CAP_RASTERIZER_DISCARD,
+    STATE_CAPS_NUM
+};
+
+struct StencilFaceCache {
+    uint32_t    func;
+    int         ref;
+    uint32_t    mask;
+
+    uint32_t    sfail;
+    uint32_t    dpfail;
+    uint32_t    dppass;
+};
+
+// every field starts unknown so the first call always reaches GL
+static struct GLStateCache {
+    uint32_t                caps[STATE_CAPS_NUM];
+    uint32_t                sfactor;
+    uint32_t                dfactor;
+    uint32_t                cull_face;
+    uint32_t                polygon_mode;
+    uint32_t                depth_func;
+    uint32_t                depth_mask;
+    struct StencilFaceCache front, back;
+    int                     viewport[4];
+    bool                    viewport_valid;
+
+    uint32_t                program;
+    uint32_t                vertex_array;
+    uint32_t                framebuffer;
+    uint32_t                active_unit;
+    uint32_t                textures[VIDEO_STATE_MAX_TEXTURE_UNITS];
+    uint32_t                targets[VIDEO_STATE_MAX_TEXTURE_UNITS];
+    uint32_t                samplers[VIDEO_STATE_MAX_TEXTURE_UNITS];
+
+    // sampler uniforms live in the program, valid until the program changes
+    int                     sampler_locations[VIDEO_STATE_MAX_TEXTURE_UNITS];
+} cache;
+
+static void (*change_callback)(void);
+
+// before any call that reaches GL, draws queued under the old state go out first
+static inline void
+notify_change(void) {
+    if (change_callback)
+        change_callback();
+}
+
+static inline bool
+state_changed(uint32_t *current, uint32_t value) {
+    if (*current == value) {
+        video_stats.state_elided++;
+        return false;
+    }
+
+    *current = value;
+    video_stats.state_calls++;
+    notify_change();
+
+    return true;
+}
+
+static int
+cap_index(uint32_t cap) {
+    switch (cap) {
+    case GL_BLEND:
+        return STATE_CAP_BLEND;
+    case GL_DEPTH_TEST:
+        return STATE_CAP_DEPTH_TEST;
+    case GL_CULL_FACE:
+        return STATE_CAP_CULL_FACE;
+    case GL_STENCIL_TEST:
+        return STATE_CAP_STENCIL_TEST;
+#ifndef GL_ES_VERSION_2_0
+    case GL_DEPTH_CLAMP:
+        return STATE_CAP_DEPTH_CLAMP;
+    case GL_RASTERIZER_DISCARD:
+        return STATE_CAP_RASTERIZER_DISCARD;
+#endif // NO GL_ES_VERSION_2_0
+    }
+
+    return -1;
+}
+
+static void
+forget_sampler_uniforms(void) {
+    for (uint32_t i = 0; i < VIDEO_STATE_MAX_TEXTURE_UNITS; i++)
+        cache.sampler_locations[i] = -1;
+}
+
+extern void
+reset_state_cache(void) {
+    memset(&cache, 0xff, sizeof(cache));
+    cache.viewport_valid = false;
+    forget_sampler_uniforms();
+}
+
+extern void
+state_set_change_callback(void (*callback)(void)) {
+    change_callback = callback;
+}
+
+extern void
+state_enable(uint32_t cap, bool enable) {
+    const int i = cap_index(cap);
+
+    if (i >= 0 && !state_changed(&cache.caps[i], enable))
+        return;
+
+    if (i < 0)
+        notify_change();
+
+    if (enable)
+        glEnable(cap);
+    else
+        glDisable(cap);
+}
+
+extern void
+state_blend_func(uint32_t sfactor, uint32_t dfactor) {
+    if (cache.sfactor == sfactor && cache.dfactor == dfactor) {
+        video_stats.state_elided++;
+        return;
+    }
+
+    cache.sfactor = sfactor;
+    cache.dfactor = dfactor;
+    video_stats.state_calls++;
+    notify_change();
+
+    glBlendFunc(sfactor, dfactor);
+}
+
+extern void
+state_cull_face(uint32_t mode) {
+    if (state_changed(&cache.cull_face, mode))
+        glCullFace(mode);
+}
+
+extern void
+state_polygon_mode(uint32_t mode) {
+#ifndef GL_ES_VERSION_2_0
+    if (state_changed(&cache.polygon_mode, mode))
+        glPolygonMode(GL_FRONT_AND_BACK, mode);
+#else
+    (void)mode;
+#endif // NO GL_ES_VERSION_2_0
+}
+
+extern void
+state_depth_func(uint32_t func) {
+    if (state_changed(&cache.depth_func, func))
+        glDepthFunc(func);
+}
+
+extern void
+state_depth_mask(bool write) {
+    if (state_changed(&cache.depth_mask, write))
+        glDepthMask(write ? GL_TRUE : GL_FALSE);
+}
+
+static bool
+stencil_func_changed(struct StencilFaceCache *face, uint32_t func, int ref, uint32_t mask) {
+    if (face->func == func && face->ref == ref && face->mask == mask)
+        return false;
+
+    face->func = func;
+    face->ref = ref;
+    face->mask = mask;
+
+    return true;
+}
+
+extern void
+state_stencil_func(uint32_t face, uint32_t func, int ref, uint32_t mask) {
+    bool changed = false;
+
+    if (face == GL_FRONT || face == GL_FRONT_AND_BACK)
+        changed |= stencil_func_changed(&cache.front, func, ref, mask);
+
+    if (face == GL_BACK || face == GL_FRONT_AND_BACK)
+        changed |= stencil_func_changed(&cache.back, func, ref, mask);
+
+    if (!changed) {
+        video_stats.state_elided++;
+        return;
+    }
+
+    video_stats.state_calls++;
+    notify_change();
+    glStencilFuncSeparate(face, func, ref, mask);
+}
+
+static bool
+stencil_op_changed(struct StencilFaceCache *face, uint32_t sfail, uint32_t dpfail, uint32_t dppass) {
+    if (face->sfail == sfail && face->dpfail == dpfail && face->dppass == dppass)
+        return false;
+
+    face->sfail = sfail;
+    face->dpfail = dpfail;
+    face->dppass = dppass;
+
+    return true;
+}
+
+extern void
+state_stencil_op(uint32_t face, uint32_t sfail, uint32_t dpfail, uint32_t dppass) {
+    bool changed = false;
+
+    if (face == GL_FRONT || face == GL_FRONT_AND_BACK)
+        changed |= stencil_op_changed(&cache.front, sfail, dpfail, dppass);
+
+    if (face == GL_BACK || face == GL_FRONT_AND_BACK)
+        changed |= stencil_op_changed(&cache.back, sfail, dpfail, dppass);
+
+    if (!changed) {
+        video_stats.state_elided++;
+        return;
+    }
+
+    video_stats.state_calls++;
+    notify_change();
+    glStencilOpSeparate(face, sfail, dpfail, dppass);
+}
+
+extern void
+state_viewport(int x, int y, int width, int height) {
+    const int viewport[4] = {x, y, width, height};
+
+    if (cache.viewport_valid && memcmp(cache.viewport, viewport, sizeof(viewport)) == 0) {
+        video_stats.state_elided++;
+        return;
+    }
+
+    memcpy(cache.viewport, viewport, sizeof(viewport));
+    cache.viewport_valid = true;
+    video_stats.state_calls++;
+    notify_change();
+
+    glViewport(x, y, width, height);
+}
+
+extern void
+state_use_program(uint32_t program) {
+    if (!state_changed(&cache.program, program))
+        return;
+
+    forget_sampler_uniforms();
+    glUseProgram(program);
+}
+
+extern uint32_t
+state_current_program(void) {
+    return cache.program;
+}
+
+extern void
+state_bind_vertex_array(uint32_t array) {
+    if (state_changed(&cache.vertex_array, array))
+        glBindVertexArray(array);
+}
+
+extern void
+state_bind_framebuffer(uint32_t framebuffer) {
+    if (state_changed(&cache.framebuffer, framebuffer))
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+}
+
+extern void
+state_bind_texture(uint32_t unit, uint32_t target, uint32_t texture) {
+    assert(unit < VIDEO_STATE_MAX_TEXTURE_UNITS);
+
+    if (cache.textures[unit] == texture && cache.targets[unit] == target) {
+        video_stats.state_elided++;
+        return;
+    }
+
+    if (state_changed(&cache.active_unit, unit))
+        glActiveTexture(GL_TEXTURE0 + unit);
+
+    cache.textures[unit] = texture;
+    cache.targets[unit] = target;
+    video_stats.state_calls++;
+    notify_change();
+
+    glBindTexture(target, texture);
+}
+
+extern void
+state_bind_sampler(uint32_t unit, uint32_t sampler) {
+    assert(unit < VIDEO_STATE_MAX_TEXTURE_UNITS);
+
+    if (state_changed(&cache.samplers[unit], sampler))
+        glBindSampler(unit, sampler);
+}
+
+extern void
+state_sampler_uniform(int location, uint32_t unit) {
+    assert(unit < VIDEO_STATE_MAX_TEXTURE_UNITS);
+
+    if (location < 0)
+        return;
+
+    if (cache.sampler_locations[unit] == location) {
+        video_stats.state_elided++;
+        return;
+    }
+
+    // one location maps to one unit
+    for (uint32_t i = 0; i < VIDEO_STATE_MAX_TEXTURE_UNITS; i++)
+        if (cache.sampler_locations[i] == location)
+            cache.sampler_locations[i] = -1;
+
+    cache.sampler_locations[unit] = location;
+    video_stats.state_calls++;
+    notify_change();
+
+    glUniform1i(location, unit);
+}
 
 void
 set_color_blend_state(const COLOR_BLEND_STATE *restrict state) {
     assert(state != NULL);
 
-    if (!state->enable)
-        return;
+    state_enable(GL_BLEND, state->enable);
 
-    glEnable(GL_BLEND);
-    glBlendFunc(state->sfactor, state->dfactor); // TODO : more blend control
+    if (state->enable)
+        state_blend_func(state->sfactor, state->dfactor); // TODO : more blend control
 }
 
 void
 set_rasterizer_state(const RASTERIZER_STATE *restrict state) {
     assert(state != NULL);
 
-    if (state->cull_mode != GL_NONE) {
-        glEnable(GL_CULL_FACE);
-        glCullFace(state->cull_mode);
-    }
+    state_enable(GL_CULL_FACE, state->cull_mode != GL_NONE);
 
-#ifndef GL_ES_VERSION_2_0
-    if (state->fill_mode != GL_NONE) {
-        glPolygonMode(GL_FRONT_AND_BACK, state->fill_mode);
-    }
+    if (state->cull_mode != GL_NONE)
+        state_cull_face(state->cull_mode);
 
-    if (state->discard)
-        glEnable(GL_RASTERIZER_DISCARD);
+#ifndef GL_ES_VERSION_2_0
+    state_polygon_mode(state->fill_mode != GL_NONE ? state->fill_mode : GL_FILL);
+    state_enable(GL_RASTERIZER_DISCARD, state->discard);
 #endif // NO GL_ES_VERSION_2_0
 }
 
@@ -36,61 +359,53 @@ void
 set_depth_stencil_state(const DEPTH_STENCIL_STATE *restrict state) {
     assert(state != NULL);
 
-    if (state->depth_test) {
-        glEnable(GL_DEPTH_TEST);
-        glDepthFunc(state->depth_func);
-    }
+    state_enable(GL_DEPTH_TEST, state->depth_test);
 
-    if (state->depth_write)
-        glDepthMask(GL_TRUE);
-    else
-        glDepthMask(GL_FALSE);
+    if (state->depth_test)
+        state_depth_func(state->depth_func);
+
+    state_depth_mask(state->depth_write);
 
 #ifndef GL_ES_VERSION_2_0
-    if (state->depth_clamp) {
-        glEnable(GL_DEPTH_CLAMP);
-        //glDepthRange(1.f, 1000.f);
-    }
-    else
-        glDisable(GL_DEPTH_CLAMP);
+    state_enable(GL_DEPTH_CLAMP, state->depth_clamp);
 #endif // NO GL_ES_VERSION_2_0
 
-    if (state->stencil_test) {
-        glEnable(GL_STENCIL_TEST);
+    state_enable(GL_STENCIL_TEST, state->stencil_test);
 
+    if (state->stencil_test) {
         // initial func GL_ALWAYS
-        glStencilFuncSeparate(GL_FRONT, state->front.func, 0, state->front.mask);
-        glStencilFuncSeparate(GL_BACK, state->back.func, 0, state->back.mask);
+        state_stencil_func(GL_FRONT, state->front.func, 0, state->front.mask);
+        state_stencil_func(GL_BACK, state->back.func, 0, state->back.mask);
 
         // initial value is GL_KEEP for all
-        glStencilOpSeparate(GL_FRONT, state->front.sfail, state->front.dpfail, state->front.dppass);
-        glStencilOpSeparate(GL_BACK, state->back.sfail, state->back.dpfail, state->back.dppass);
+        state_stencil_op(GL_FRONT, state->front.sfail, state->front.dpfail, state->front.dppass);
+        state_stencil_op(GL_BACK, state->back.sfail, state->back.dpfail, state->back.dppass);
     }
 }
 
 void
 clear_color_blend_state(void) {
-    glDisable(GL_BLEND);
+    state_enable(GL_BLEND, false);
 }
 
 void
 clear_rasterizer_state(void) {
 #ifndef GL_ES_VERSION_2_0
-    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-    glDisable(GL_RASTERIZER_DISCARD);
+    state_polygon_mode(GL_FILL);
+    state_enable(GL_RASTERIZER_DISCARD, false);
 #endif // NO GL_ES_VERSION_2_0
-    glDisable(GL_CULL_FACE);
+    state_enable(GL_CULL_FACE, false);
 }
 
 void
 clear_depth_stencil_state(void) {
-    glDepthMask(GL_TRUE);
-    glDisable(GL_DEPTH_TEST);
+    state_depth_mask(true);
+    state_enable(GL_DEPTH_TEST, false);
 
 #ifndef GL_ES_VERSION_2_0
-    glDisable(GL_DEPTH_CLAMP);
+    state_enable(GL_DEPTH_CLAMP, false);
 #endif
 
-    glStencilOpSeparate(GL_FRONT_AND_BACK, GL_KEEP, GL_KEEP, GL_KEEP);
-    glDisable(GL_STENCIL_TEST);
+    state_stencil_op(GL_FRONT_AND_BACK, GL_KEEP, GL_KEEP, GL_KEEP);
+    state_enable(GL_STENCIL_TEST, false);
 }
@@ -0,0 +1,179 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <video/gl.h>
+#include <memtrack.h>
+
+#include "core/common.h"
+#include "core/logerr.h"
+#include "video/stats.h"
+#include "video/streambuffer.h"
+
+#define FENCE_TIMEOUT 1000000000 // 1s, then waits again
+
+static uint32_t stream_frame;
+
+extern VIDEO_STREAM_BUFFER
+new_stream_buffer(uint32_t target, size_t frame_size) {
+    assert(frame_size > 0);
+
+    VIDEO_STREAM_BUFFER stream;
+    memset(&stream, 0, sizeof(stream));
+
+    const size_t size = frame_size * STREAM_BUFFER_FRAMES;
+
+    switch (target) {
+    case GL_ARRAY_BUFFER:
+        stream.buffer = new_vertex_buffer(NULL, size, GL_STREAM_DRAW);
+        break;
+    case GL_ELEMENT_ARRAY_BUFFER:
+        stream.buffer = new_index_buffer(NULL, size, GL_STREAM_DRAW);
+        break;
+#ifndef GL_ES_VERSION_2_0
+    case GL_PIXEL_UNPACK_BUFFER:
+        stream.buffer = new_pixel_buffer(NULL, size, GL_STREAM_DRAW);
+        break;
+#endif // NO GL_ES_VERSION_2_0
+    default:
+        LOG_CRITICAL("Can't stream buffer target %#x\n", target);
+        exit(EXIT_FAILURE);
+    }
+
+    stream.region_size = frame_size;
+    stream.frame = stream_frame;
+
+    return stream;
+}
+
+extern void
+stream_buffers_next_frame(void) {
+    stream_frame++;
+}
+
+#ifndef GL_ES_VERSION_2_0
+
+static void
+wait_region(VIDEO_STREAM_BUFFER *stream, uint32_t region) {
+    GLsync fence = stream->fences[region];
+
+    if (!fence)
+        return;
+
+    GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+    GLenum result;
+
+    while ((result = glClientWaitSync(fence, flags, FENCE_TIMEOUT)) == GL_TIMEOUT_EXPIRED)
+        flags = 0;
+
+    if (result != GL_ALREADY_SIGNALED)
+        video_stats.stream_waits++;
+
+    glDeleteSync(fence);
+    stream->fences[region] = NULL;
+}
+
+static void
+delete_fences(VIDEO_STREAM_BUFFER *stream) {
+    for (uint32_t i = 0; i < STREAM_BUFFER_FRAMES; i++)
+        if (stream->fences[i]) {
+            glDeleteSync(stream->fences[i]);
+            stream->fences[i] = NULL;
+        }
+}
+
+static void
+orphan_stream(VIDEO_STREAM_BUFFER *stream) {
+    glBufferData(GL_COPY_WRITE_BUFFER, stream->buffer.size, NULL, GL_STREAM_DRAW);
+    delete_fences(stream);
+
+    stream->region = 0;
+    stream->head = 0;
+
+    video_stats.stream_orphans++;
+}
+
+extern size_t
+stream_buffer_write(VIDEO_STREAM_BUFFER *stream, const void *data, size_t size, size_t alignment) {
+    assert(stream != NULL);
+    assert(data != NULL);
+    assert(alignment > 0);
+
+    if (size > stream->region_size) {
+        LOG_ERROR("Stream write of %zu bytes doesn't fit a frame of %zu\n", size, stream->region_size);
+        return 0;
+    }
+
+    // the copy binding leaves vertex array and element bindings alone
+    glBindBuffer(GL_COPY_WRITE_BUFFER, stream->buffer.id);
+
+    if (stream->frame != stream_frame) {
+        stream->fences[stream->region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        stream->region = (stream->region + 1) % STREAM_BUFFER_FRAMES;
+        stream->head = (size_t)stream->region * stream->region_size;
+        stream->frame = stream_frame;
+
+        wait_region(stream, stream->region);
+    }
+
+    size_t offset = (stream->head + alignment - 1) / alignment * alignment;
+
+    if (offset + size > (size_t)(stream->region + 1) * stream->region_size) {
+        orphan_stream(stream);
+        offset = 0;
+    }
+
+    void *ptr = glMapBufferRange(GL_COPY_WRITE_BUFFER, offset, size,
+                                 GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+
+    if (ptr) {
+        memcpy(ptr, data, size);
+        glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+    } else {
+        glBufferSubData(GL_COPY_WRITE_BUFFER, offset, size, data);
+    }
+
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    stream->head = offset + size;
+    video_stats.stream_bytes += size;
+
+    return offset;
+}
+
+extern void
+free_stream_buffer(VIDEO_STREAM_BUFFER *stream) {
+    delete_fences(stream);
+    free_video_buffer(&stream->buffer);
+}
+
+#else
+
+// no fences, every write orphans and lands at the start of fresh storage
+extern size_t
+stream_buffer_write(VIDEO_STREAM_BUFFER *stream, const void *data, size_t size, size_t alignment) {
+    assert(stream != NULL);
+    assert(data != NULL);
+    UNUSED(alignment);
+
+    if (size > stream->region_size) {
+        LOG_ERROR("Stream write of %zu bytes doesn't fit a frame of %zu\n", size, stream->region_size);
+        return 0;
+    }
+
+    glBindBuffer(stream->buffer.target, stream->buffer.id);
+    glBufferData(stream->buffer.target, stream->buffer.size, NULL, GL_STREAM_DRAW);
+    glBufferSubData(stream->buffer.target, 0, size, data);
+
+    stream->frame = stream_frame;
+    video_stats.stream_orphans++;
+    video_stats.stream_bytes += size;
+
+    return 0;
+}
+
+extern void
+free_stream_buffer(VIDEO_STREAM_BUFFER *stream) {
+    free_video_buffer(&stream->buffer);
+}
+
+#endif // NO GL_ES_VERSION_2_0
@@ -7,27 +7,59 @@
 #include "core/logerr.h"
 #include "video/texture.h"
 #include "core/video.h"
+#include "video/state.h"
+#include "video/deletequeue.h"
+#include "video/textureupload.h"
 
 #ifndef GL_ES_VERSION_2_0
 #include <GL/ext_texture_filter_anisotropic.h>
 #endif // NO GL_ES_VERSION_2_0
 
+extern void
+upload_texture_levels(const IMAGE_DATA *image) {
+    const uint32_t pixel_size = texture_pixel_size(image->format, image->type);
+    const uint8_t *pixels = image->pixels;
+
+    // levels are packed back to back, a row of a narrow level isn't 4 byte aligned
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    for (int level = 0; level < image->levels; level++) {
+        const int width = image->width >> level > 0 ? image->width >> level : 1;
+        const int height = image->height >> level > 0 ? image->height >> level : 1;
+
+        glTexImage2D(GL_TEXTURE_2D, level, image->internalformat, width, height, 0, image->format, image->type, pixels);
+        pixels += (size_t)width * height * pixel_size;
+    }
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+#ifndef GL_ES_VERSION_2_0
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, image->levels - 1);
+#endif // NO GL_ES_VERSION_2_0
+}
+
 extern TEXTURE
 new_texture2D(const IMAGE_DATA *image) {
     GLuint tex = 0;
     glGenTextures(1, &tex);
-    glBindTexture(GL_TEXTURE_2D, tex);
-
-    glTexImage2D(GL_TEXTURE_2D, 0, image->internalformat, image->width , image->height, 0, image->format, image->type,
-                 image->pixels);
+    track_video_object(VIDEO_OBJECT_TEXTURE);
+    state_bind_texture(0, GL_TEXTURE_2D, tex);
 
     unsigned int flags = 0;
 
-    if(image->mipmaps) {
-        //glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
-        //glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 4);
-        glGenerateMipmap(GL_TEXTURE_2D);
+    if (image->levels > 1 && image->pixels) {
+        upload_texture_levels(image);
         flags |= TEXTURE_MIPMAPS_BIT;
+    } else {
+        glTexImage2D(GL_TEXTURE_2D, 0, image->internalformat, image->width , image->height, 0, image->format, image->type,
+                     image->pixels);
+
+        if (image->mipmaps) {
+            //glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+            //glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 4);
+            glGenerateMipmap(GL_TEXTURE_2D);
+            flags |= TEXTURE_MIPMAPS_BIT;
+        }
     }
     uint32_t hash = 0;
 
@@ -39,12 +71,12 @@ new_texture2D(const IMAGE_DATA *image) {
     /*if (image->swizzle == GL_TEXTURE_SWIZZLE_RGBA)
         glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, image->swizzle_colors);*/
 
-    glBindTexture(GL_TEXTURE_2D, 0);
+    state_bind_texture(0, GL_TEXTURE_2D, 0);
 
     LOG("New texture %d\n", tex);
 
     return (TEXTURE){.id = tex,.target = GL_TEXTURE_2D, .flags = flags, .width = image->width, .height = image->height,
-                .hash = hash};
+                .internalformat = image->internalformat, .hash = hash};
 }
 
 extern TEXTURE
@@ -54,7 +86,8 @@ new_texture_array(const IMAGE_DATA *images, int count) {
 
     GLuint tex = 0;
     glGenTextures(1, &tex);
-    glBindTexture(GL_TEXTURE_2D_ARRAY, tex);
+    track_video_object(VIDEO_OBJECT_TEXTURE);
+    state_bind_texture(0, GL_TEXTURE_2D_ARRAY, tex);
 
     glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, images->internalformat, images->width, images->height, depth, 0,
                  images->format, images->type, NULL);
@@ -70,7 +103,7 @@ new_texture_array(const IMAGE_DATA *images, int count) {
         glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
     }
 
-    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    state_bind_texture(0, GL_TEXTURE_2D_ARRAY, 0);
 
     unsigned int flags = 0;
     uint32_t hash = 0;
@@ -78,7 +111,7 @@ new_texture_array(const IMAGE_DATA *images, int count) {
     // http://stackoverflow.com/questions/12372058/how-to-use-gl-texture-2d-array-in-opengl-3-2
 
     return (TEXTURE){.id = tex,.target = GL_TEXTURE_2D_ARRAY, .flags = flags, .width = images->width,
-                .depth = images->depth, .height = images->height, .hash = hash};
+                .depth = images->depth, .height = images->height, .internalformat = images->internalformat, .hash = hash};
 #else
     UNUSED(images);
     UNUSED(count);
@@ -93,7 +126,8 @@ extern TEXTURE
 new_texture_cube(const IMAGE_DATA *images) {
     GLuint tex = 0;
     glGenTextures(1, &tex);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, tex);
+    track_video_object(VIDEO_OBJECT_TEXTURE);
+    state_bind_texture(0, GL_TEXTURE_CUBE_MAP, tex);
 
     for (int i = 0; i < 6; i++)
         glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, images[i].internalformat, images[i].width, images[i].height,
@@ -102,21 +136,24 @@ new_texture_cube(const IMAGE_DATA *images) {
     if(images->mipmaps)
         glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
 
-    glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+    state_bind_texture(0, GL_TEXTURE_CUBE_MAP, 0);
 
     unsigned int flags = 0;
     uint32_t hash = 0;
 
     return (TEXTURE){.id = tex,.target = GL_TEXTURE_CUBE_MAP, .flags = flags, .width = images->width,
-                .depth = images->depth, .height = images->height, .hash = hash};
+                .depth = images->depth, .height = images->height, .internalformat = images->internalformat, .hash = hash};
 }
 
 extern void
 free_texture(TEXTURE *texture) {
     assert(texture != NULL);
 
+    if (texture->flags & TEXTURE_PENDING_BIT)
+        cancel_texture_upload(texture->id);
+
     /*if(glIsTexture(texture->id))*/ {
-        glDeleteTextures(1, &texture->id);
+        delete_video_object(VIDEO_OBJECT_TEXTURE, texture->id);
 
         LOG("Delete texture %d", texture->id);
     }
@@ -147,7 +184,9 @@ upload_texture(const char *name) {
     if (read_texture(name, &image) != 0)
         exit(EXIT_FAILURE);
 
-    image.mipmaps = 1;
+    // cooked textures bring their chain
+    if (image.levels <= 1)
+        image.mipmaps = 1;
 
     LOG("LOAD %s\n", name);
 
@@ -239,14 +278,12 @@ upload_cubemap_textures(const char *name) {
 
 extern void
 bind_texture(uint32_t unit, TEXTURE *tex) {
-    glActiveTexture(GL_TEXTURE0 + (unit));
-    glBindTexture(tex->target, tex->id);
+    state_bind_texture(unit, tex->target, tex->id);
 }
 
 extern void
 unbind_texture(uint32_t unit, uint32_t target) {
-    glActiveTexture(GL_TEXTURE0 + (unit));
-    glBindTexture(target, 0);
+    state_bind_texture(unit, target, 0);
 }
 
 extern void
@@ -254,3 +291,50 @@ generate_mipmap_texture(TEXTURE *tex) {
     if (tex->flags & TEXTURE_MIPMAPS_BIT)
         glGenerateMipmap(GL_TEXTURE_2D);
 }
+
+extern uint32_t
+texture_pixel_size(uint32_t format, uint32_t type) {
+    uint32_t components = 0;
+
+    switch (format) {
+#ifndef GL_ES_VERSION_2_0
+    case GL_RED:
+    case GL_DEPTH_COMPONENT:
+        components = 1;
+        break;
+    case GL_RG:
+        components = 2;
+        break;
+    case GL_BGR:
+        components = 3;
+        break;
+    case GL_BGRA:
+        components = 4;
+        break;
+#endif // NO GL_ES_VERSION_2_0
+    case GL_RGB:
+        components = 3;
+        break;
+    case GL_RGBA:
+        components = 4;
+        break;
+    }
+
+    switch (type) {
+    case GL_UNSIGNED_BYTE:
+    case GL_BYTE:
+        return components;
+    case GL_UNSIGNED_SHORT:
+    case GL_SHORT:
+#ifndef GL_ES_VERSION_2_0
+    case GL_HALF_FLOAT:
+#endif // NO GL_ES_VERSION_2_0
+        return components * 2;
+    case GL_UNSIGNED_INT:
+    case GL_INT:
+    case GL_FLOAT:
+        return components * 4;
+    }
+
+    return 0;
+}
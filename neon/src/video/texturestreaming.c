@@ -0,0 +1,351 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <memtrack.h>
+
+#include "core/asset.h"
+#include "core/logerr.h"
+#include "core/texfile.h"
+#include "core/video.h"
+#include "video/textureupload.h"
+#include "video/texturestreaming.h"
+
+typedef struct StreamedEntry {
+    char            *name;
+    TEXFILE_HEADER  header;
+    TEXTURE         texture;
+    uint32_t        level;          // first level of texture
+    uint32_t        placeholder;    // first level always resident
+    uint32_t        target;         // granted by the budget
+    TEXTURE         incoming;
+    uint32_t        incoming_level;
+    bool            loading;
+    float           screen_size;
+    float           priority;
+    uint32_t        requested;      // frame of the last request
+} STREAMED_ENTRY;
+
+static struct {
+    STREAMED_ENTRY  *entries;
+    uint32_t        count;
+    uint32_t        capacity;
+    uint32_t        *order;
+    size_t          budget;
+    size_t          resident;
+    uint32_t        frame;
+} streaming = {.budget = STREAMING_MEMORY_BUDGET};
+
+static STREAMED_ENTRY*
+get_entry(STREAMED_TEXTURE texture) {
+    assert(texture > 0 && texture <= streaming.count);
+    assert(streaming.entries[texture - 1].name != NULL);
+
+    return &streaming.entries[texture - 1];
+}
+
+// bytes of the chain from level down
+static size_t
+chain_size(const TEXFILE_HEADER *header, uint32_t level) {
+    size_t size = 0;
+
+    for (uint32_t i = level; i < header->levels; i++)
+        size += header->level_sizes[i];
+
+    return size;
+}
+
+static int
+read_levels(const STREAMED_ENTRY *entry, uint32_t level, IMAGE_DATA *image) {
+    SDL_RWops *rw = asset_request(entry->name);
+    if (!rw) {
+        LOG_ERROR("Can't open texture %s\n", entry->name);
+        return -1;
+    }
+
+    const int result = read_texfile_levels(rw, &entry->header, level, image);
+    SDL_RWclose(rw);
+
+    return result;
+}
+
+extern STREAMED_TEXTURE
+load_streamed_texture(const char *name) {
+    assert(name != NULL);
+
+    uint32_t index = 0;
+    while (index < streaming.count && streaming.entries[index].name)
+        index++;
+
+    if (index == streaming.capacity) {
+        streaming.capacity = streaming.capacity ? streaming.capacity * 2 : 64;
+
+        STREAMED_ENTRY *entries = realloc(streaming.entries, sizeof(STREAMED_ENTRY) * streaming.capacity);
+        uint32_t *order = realloc(streaming.order, sizeof(uint32_t) * streaming.capacity);
+        if (!entries || !order) {
+            LOG_CRITICAL("%s\n", "Can't alloc memory");
+            exit(EXIT_FAILURE);
+        }
+
+        streaming.entries = entries;
+        streaming.order = order;
+    }
+
+    STREAMED_ENTRY *entry = &streaming.entries[index];
+    memset(entry, 0, sizeof(STREAMED_ENTRY));
+
+    SDL_RWops *rw = asset_request(name);
+    if (read_texfile_header(rw, &entry->header) != 0) {
+        LOG_CRITICAL("Can't load streamed texture %s\n", name);
+        exit(EXIT_FAILURE);
+    }
+    SDL_RWclose(rw);
+
+    const TEXFILE_HEADER *header = &entry->header;
+    uint32_t placeholder = 0;
+    while (placeholder + 1 < header->levels &&
+           (header->width >> placeholder > STREAMING_PLACEHOLDER_SIZE || header->height >> placeholder > STREAMING_PLACEHOLDER_SIZE))
+        placeholder++;
+
+    entry->name = strdup(name);
+    entry->placeholder = placeholder;
+
+    IMAGE_DATA image;
+    if (read_levels(entry, placeholder, &image) != 0) {
+        LOG_CRITICAL("Can't load streamed texture %s\n", name);
+        exit(EXIT_FAILURE);
+    }
+
+    LOG("LOAD %s (streamed from level %u)\n", name, placeholder);
+
+    entry->texture = new_texture2D(&image);
+    free(image.pixels);
+
+    entry->level = placeholder;
+    entry->target = placeholder;
+    entry->priority = 1.f;
+
+    streaming.resident += chain_size(header, placeholder);
+
+    if (index == streaming.count)
+        streaming.count++;
+
+    return index + 1;
+}
+
+extern void
+free_streamed_texture(STREAMED_TEXTURE texture) {
+    STREAMED_ENTRY *entry = get_entry(texture);
+
+    streaming.resident -= chain_size(&entry->header, entry->level);
+
+    if (entry->loading) {
+        streaming.resident -= chain_size(&entry->header, entry->incoming_level);
+        free_texture(&entry->incoming);
+    }
+
+    free_texture(&entry->texture);
+    free(entry->name);
+    entry->name = NULL;
+
+    while (streaming.count > 0 && !streaming.entries[streaming.count - 1].name)
+        streaming.count--;
+}
+
+extern TEXTURE*
+streamed_texture(STREAMED_TEXTURE texture) {
+    return &get_entry(texture)->texture;
+}
+
+extern void
+request_streamed_texture(STREAMED_TEXTURE texture, float screen_size) {
+    STREAMED_ENTRY *entry = get_entry(texture);
+
+    if (entry->requested != streaming.frame || screen_size > entry->screen_size)
+        entry->screen_size = screen_size;
+
+    entry->requested = streaming.frame;
+}
+
+extern void
+hint_streamed_texture(STREAMED_TEXTURE texture, float priority) {
+    get_entry(texture)->priority = priority;
+}
+
+extern void
+set_streaming_budget(size_t bytes) {
+    streaming.budget = bytes;
+}
+
+extern size_t
+texture_streaming_resident(void) {
+    return streaming.resident;
+}
+
+static float
+entry_priority(const STREAMED_ENTRY *entry) {
+    if (!entry->name || streaming.frame - entry->requested > STREAMING_REQUEST_FRAMES)
+        return 0.f;
+
+    return entry->screen_size * entry->priority;
+}
+
+// level whose largest side is the closest to the screen size from above
+static uint32_t
+wanted_level(const STREAMED_ENTRY *entry) {
+    if (entry_priority(entry) <= 0.f)
+        return entry->placeholder;
+
+    const uint32_t side = entry->header.width > entry->header.height ? entry->header.width : entry->header.height;
+    const float screen_size = entry->screen_size > 1.f ? entry->screen_size : 1.f;
+    const float level = floorf(log2f((float)side / screen_size));
+
+    if (level <= 0.f)
+        return 0;
+
+    return (uint32_t)level < entry->placeholder ? (uint32_t)level : entry->placeholder;
+}
+
+static int
+compare_priority(const void *a, const void *b) {
+    const float pa = entry_priority(&streaming.entries[*(const uint32_t*)a]);
+    const float pb = entry_priority(&streaming.entries[*(const uint32_t*)b]);
+
+    return (pa < pb) - (pa > pb);
+}
+
+// greedy by priority, a texture that does not fit gets the best level that does
+static void
+assign_levels(void) {
+    size_t total = 0;
+
+    for (uint32_t i = 0; i < streaming.count; i++) {
+        streaming.order[i] = i;
+
+        if (streaming.entries[i].name)
+            total += chain_size(&streaming.entries[i].header, streaming.entries[i].placeholder);
+    }
+
+    qsort(streaming.order, streaming.count, sizeof(uint32_t), compare_priority);
+
+    for (uint32_t i = 0; i < streaming.count; i++) {
+        STREAMED_ENTRY *entry = &streaming.entries[streaming.order[i]];
+        if (!entry->name)
+            continue;
+
+        const size_t placeholder_size = chain_size(&entry->header, entry->placeholder);
+        uint32_t level = wanted_level(entry);
+
+        while (level < entry->placeholder && total + chain_size(&entry->header, level) - placeholder_size > streaming.budget)
+            level++;
+
+        total += chain_size(&entry->header, level) - placeholder_size;
+        entry->target = level;
+    }
+}
+
+static bool
+has_work(void) {
+    for (uint32_t i = 0; i < streaming.count; i++) {
+        const STREAMED_ENTRY *entry = &streaming.entries[i];
+
+        if (entry->name && (entry->loading || entry->target != entry->level))
+            return true;
+    }
+
+    return false;
+}
+
+static void
+finish_loads(void) {
+    for (uint32_t i = 0; i < streaming.count; i++) {
+        STREAMED_ENTRY *entry = &streaming.entries[i];
+
+        if (!entry->name || !entry->loading || !texture_upload_done(&entry->incoming))
+            continue;
+
+        streaming.resident -= chain_size(&entry->header, entry->level);
+        free_texture(&entry->texture);
+
+        entry->texture = entry->incoming;
+        entry->level = entry->incoming_level;
+        entry->loading = false;
+    }
+}
+
+typedef struct StreamingLoad {
+    STREAMED_ENTRY  *entry;
+    IMAGE_DATA      image;
+} STREAMING_LOAD;
+
+// evictions go first, they make room for the upgrades; files are read before taking the context
+static uint32_t
+read_loads(STREAMING_LOAD *loads) {
+    uint32_t count = 0;
+
+    for (int evict = 1; evict >= 0; evict--)
+        for (uint32_t i = 0; i < streaming.count && count < STREAMING_UPLOADS; i++) {
+            STREAMED_ENTRY *entry = &streaming.entries[streaming.order[i]];
+
+            if (!entry->name || entry->loading || entry->target == entry->level)
+                continue;
+
+            if ((entry->target > entry->level) != (evict == 1))
+                continue;
+
+            // upgrades wait while the chains in flight would break the budget
+            if (!evict && streaming.resident - chain_size(&entry->header, entry->level) +
+                chain_size(&entry->header, entry->target) > streaming.budget)
+                continue;
+
+            if (read_levels(entry, entry->target, &loads[count].image) != 0)
+                continue;
+
+            loads[count++].entry = entry;
+        }
+
+    return count;
+}
+
+static void
+start_loads(STREAMING_LOAD *loads, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        STREAMED_ENTRY *entry = loads[i].entry;
+
+        entry->incoming = queue_texture2D(loads[i].image);
+        entry->incoming_level = entry->target;
+        entry->loading = true;
+
+        streaming.resident += chain_size(&entry->header, entry->target);
+    }
+}
+
+extern void
+texture_streaming_update(void) {
+    streaming.frame++;
+
+    assign_levels();
+
+    if (!has_work())
+        return;
+
+    STREAMING_LOAD loads[STREAMING_UPLOADS];
+    const uint32_t count = read_loads(loads);
+
+    video_lock_context();
+    finish_loads();
+    start_loads(loads, count);
+    video_unlock_context();
+}
+
+extern void
+texture_streaming_cleanup(void) {
+    for (uint32_t i = 0; i < streaming.count; i++)
+        if (streaming.entries[i].name)
+            free_streamed_texture(i + 1);
+
+    free(streaming.entries);
+    free(streaming.order);
+    memset(&streaming, 0, sizeof(streaming));
+    streaming.budget = STREAMING_MEMORY_BUDGET;
+}
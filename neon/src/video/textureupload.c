@@ -0,0 +1,327 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <xxhash.h>
+#include <video/gl.h>
+#include <memtrack.h>
+
+#include "core/common.h"
+#include "core/logerr.h"
+#include "core/video.h"
+#include "video/deletequeue.h"
+#include "video/info.h"
+#include "video/state.h"
+#include "video/stats.h"
+#include "video/streambuffer.h"
+#include "video/textureupload.h"
+
+#define PIXEL_ALIGNMENT 16
+
+typedef struct TextureUpload {
+    GLuint          texture;
+    IMAGE_DATA      image;
+    uint32_t        pixel_size;
+    int             levels;     // in image.pixels
+    int             level;
+    int             row;
+    size_t          offset;     // of level in image.pixels
+    bool            generate;   // the other levels from the base once it is complete
+} TEXTURE_UPLOAD;
+
+static struct {
+    TEXTURE_UPLOAD      *items;
+    uint32_t            count;
+    uint32_t            capacity;
+    #ifndef GL_ES_VERSION_2_0
+    VIDEO_STREAM_BUFFER pixels;
+    bool                created;
+    PFNGLTEXSTORAGE2DPROC tex_storage;
+    #endif // NO GL_ES_VERSION_2_0
+} uploads;
+
+static inline int
+level_size(int size, int level) {
+    return size >> level > 0 ? size >> level : 1;
+}
+
+static int
+find_upload(uint32_t texture) {
+    for (uint32_t i = 0; i < uploads.count; i++)
+        if (uploads.items[i].texture == texture)
+            return (int)i;
+
+    return -1;
+}
+
+static inline bool
+upload_complete(const TEXTURE_UPLOAD *upload) {
+    return upload->level == upload->levels;
+}
+
+// the queuing thread only, memtrack is not shared with the render thread
+static void
+remove_upload(uint32_t index) {
+    free(uploads.items[index].image.pixels);
+
+    memmove(&uploads.items[index], &uploads.items[index + 1], sizeof(TEXTURE_UPLOAD) * (uploads.count - index - 1));
+    uploads.count--;
+}
+
+extern bool
+texture_upload_done(TEXTURE *texture) {
+    assert(texture != NULL);
+
+    if (!(texture->flags & TEXTURE_PENDING_BIT))
+        return true;
+
+    const int index = find_upload(texture->id);
+
+    if (index >= 0) {
+        if (!upload_complete(&uploads.items[index]))
+            return false;
+
+        remove_upload((uint32_t)index);
+    }
+
+    texture->flags &= ~TEXTURE_PENDING_BIT;
+
+    return true;
+}
+
+extern void
+cancel_texture_upload(uint32_t texture) {
+    const int index = find_upload(texture);
+
+    if (index >= 0)
+        remove_upload((uint32_t)index);
+}
+
+#ifndef GL_ES_VERSION_2_0
+
+typedef void (*VOIDFUNC)(void);
+static inline VOIDFUNC
+fn_cast(void *ptr) {
+    union {
+        void *p;
+        VOIDFUNC f;
+    } p;
+
+    p.p = ptr;
+
+    return p.f;
+}
+
+// immutable storage wants sized formats
+static bool
+sized_format(int internalformat) {
+    switch (internalformat) {
+    case GL_RED:
+    case GL_RG:
+    case GL_RGB:
+    case GL_RGBA:
+    case GL_DEPTH_COMPONENT:
+    case GL_DEPTH_STENCIL:
+        return false;
+    }
+
+    return true;
+}
+
+static void
+create_uploads(void) {
+    uploads.pixels = new_stream_buffer(GL_PIXEL_UNPACK_BUFFER, TEXTURE_UPLOAD_BUDGET);
+
+    if (video_is_extension_supported("GL_ARB_texture_storage"))
+        uploads.tex_storage = (PFNGLTEXSTORAGE2DPROC)fn_cast(nativeGetProcAddress("glTexStorage2D"));
+
+    uploads.created = true;
+}
+
+static GLuint
+allocate_texture(const IMAGE_DATA *image, int levels) {
+    GLuint tex = 0;
+    glGenTextures(1, &tex);
+    track_video_object(VIDEO_OBJECT_TEXTURE);
+    state_bind_texture(0, GL_TEXTURE_2D, tex);
+
+    if (uploads.tex_storage && sized_format(image->internalformat)) {
+        uploads.tex_storage(GL_TEXTURE_2D, levels, image->internalformat, image->width, image->height);
+    } else {
+        for (int level = 0; level < levels; level++)
+            glTexImage2D(GL_TEXTURE_2D, level, image->internalformat, level_size(image->width, level),
+                         level_size(image->height, level), 0, image->format, image->type, NULL);
+
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+    }
+
+    state_bind_texture(0, GL_TEXTURE_2D, 0);
+
+    return tex;
+}
+
+extern TEXTURE
+queue_texture2D(IMAGE_DATA image) {
+    const uint32_t size = texture_pixel_size(image.format, image.type);
+
+    if (!image.pixels || size == 0) {
+        TEXTURE texture = new_texture2D(&image);
+        free(image.pixels);
+
+        return texture;
+    }
+
+    if (!uploads.created)
+        create_uploads();
+
+    // uploads nobody asked about again
+    for (uint32_t i = uploads.count; i > 0; i--)
+        if (upload_complete(&uploads.items[i - 1]))
+            remove_upload(i - 1);
+
+    int levels = image.levels > 1 ? image.levels : 1;
+    const bool generate = levels == 1 && image.mipmaps;
+
+    if (generate)
+        while ((image.width | image.height) >> levels)
+            levels++;
+
+    const GLuint tex = allocate_texture(&image, levels);
+
+    if (uploads.count == uploads.capacity) {
+        uploads.capacity = uploads.capacity ? uploads.capacity * 2 : 16;
+
+        TEXTURE_UPLOAD *items = realloc(uploads.items, sizeof(TEXTURE_UPLOAD) * uploads.capacity);
+        if (!items) {
+            LOG_CRITICAL("%s\n", "Can't alloc memory");
+            exit(EXIT_FAILURE);
+        }
+
+        uploads.items = items;
+    }
+
+    uploads.items[uploads.count++] = (TEXTURE_UPLOAD){.texture = tex, .image = image, .pixel_size = size,
+            .levels = generate ? 1 : levels, .generate = generate};
+
+    unsigned int flags = TEXTURE_DATA_BIT | TEXTURE_PENDING_BIT;
+    if (levels > 1)
+        flags |= TEXTURE_MIPMAPS_BIT;
+
+    return (TEXTURE){.id = tex, .target = GL_TEXTURE_2D, .flags = flags, .width = image.width, .height = image.height,
+                .internalformat = image.internalformat, .hash = XXH32(image.pixels, image.size, GL_TEXTURE_2D)};
+}
+
+// returns the budget left, rows stay whole
+static size_t
+upload_rows(TEXTURE_UPLOAD *upload, size_t budget) {
+    const IMAGE_DATA *image = &upload->image;
+
+    state_bind_texture(0, GL_TEXTURE_2D, upload->texture);
+
+    while (upload->level < upload->levels) {
+        const int width = level_size(image->width, upload->level);
+        const int height = level_size(image->height, upload->level);
+        const size_t row_size = (size_t)width * upload->pixel_size;
+
+        if (budget < row_size + PIXEL_ALIGNMENT)
+            return 0;
+
+        int rows = (int)((budget - PIXEL_ALIGNMENT) / row_size);
+        if (rows > height - upload->row)
+            rows = height - upload->row;
+
+        const size_t size = (size_t)rows * row_size;
+        const uint8_t *pixels = (const uint8_t*)image->pixels + upload->offset + (size_t)upload->row * row_size;
+        const size_t offset = stream_buffer_write(&uploads.pixels, pixels, size, PIXEL_ALIGNMENT);
+
+        glTexSubImage2D(GL_TEXTURE_2D, upload->level, 0, upload->row, width, rows, image->format, image->type,
+                        (const void*)(uintptr_t)offset);
+
+        budget -= (size + PIXEL_ALIGNMENT - 1) & ~(size_t)(PIXEL_ALIGNMENT - 1);
+        video_stats.texture_upload_bytes += size;
+
+        upload->row += rows;
+
+        if (upload->row == height) {
+            upload->offset += (size_t)height * row_size;
+            upload->level++;
+            upload->row = 0;
+        }
+    }
+
+    if (upload->generate)
+        glGenerateMipmap(GL_TEXTURE_2D);
+
+    return budget;
+}
+
+extern void
+texture_uploads_process(void) {
+    if (uploads.count == 0)
+        return;
+
+    // rows are tightly packed, regions are only aligned for the copy
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, uploads.pixels.buffer.id);
+
+    size_t budget = TEXTURE_UPLOAD_BUDGET;
+    uint32_t queued = 0;
+
+    // complete uploads stay until the main thread sees them, it frees their pixels
+    for (uint32_t i = 0; i < uploads.count; i++) {
+        TEXTURE_UPLOAD *upload = &uploads.items[i];
+
+        if (upload_complete(upload))
+            continue;
+
+        if (budget > 0)
+            budget = upload_rows(upload, budget);
+
+        queued += !upload_complete(upload);
+    }
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    state_bind_texture(0, GL_TEXTURE_2D, 0);
+
+    video_stats.texture_uploads_queued = queued;
+}
+
+extern void
+texture_uploads_cleanup(void) {
+    while (uploads.count > 0)
+        remove_upload(uploads.count - 1);
+
+    free(uploads.items);
+    uploads.items = NULL;
+    uploads.capacity = 0;
+
+    if (uploads.created) {
+        free_stream_buffer(&uploads.pixels);
+        uploads.created = false;
+    }
+}
+
+#else
+
+// no pixel unpack buffers, textures are complete at once
+extern TEXTURE
+queue_texture2D(IMAGE_DATA image) {
+    TEXTURE texture = new_texture2D(&image);
+    free(image.pixels);
+
+    return texture;
+}
+
+extern void
+texture_uploads_process(void) {
+}
+
+extern void
+texture_uploads_cleanup(void) {
+    free(uploads.items);
+    uploads.items = NULL;
+    uploads.count = 0;
+    uploads.capacity = 0;
+}
+
+#endif // NO GL_ES_VERSION_2_0
@@ -0,0 +1,194 @@
+#include <assert.h>
+#include <string.h>
+#include <video/gl.h>
+#include <memtrack.h>
+
+#include "core/common.h"
+#include "core/logerr.h"
+#include "video/buffer.h"
+#include "video/deletequeue.h"
+#include "video/info.h"
+#include "video/stats.h"
+#include "video/uniformring.h"
+
+#define SEGMENT_SIZE (UNIFORM_RING_SIZE / UNIFORM_RING_SEGMENTS)
+#define FENCE_TIMEOUT 1000000000 // 1s, then waits again
+
+#ifndef GL_ES_VERSION_2_0
+
+static struct {
+    VIDEO_BUFFER    buffer;
+    uint8_t         *mapped;    // persistent, NULL without buffer storage
+    size_t          alignment;
+    size_t          head;
+    uint32_t        segment;
+    GLsync          fences[UNIFORM_RING_SEGMENTS];
+} ring;
+
+typedef void (*VOIDFUNC)(void);
+static inline VOIDFUNC
+fn_cast(void *ptr) {
+    union {
+        void *p;
+        VOIDFUNC f;
+    } p;
+
+    p.p = ptr;
+
+    return p.f;
+}
+
+static void
+create_ring(void) {
+    GLint alignment = 256;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    ring.alignment = alignment > 0 ? (size_t)alignment : 256;
+
+    PFNGLBUFFERSTORAGEPROC buffer_storage = NULL;
+    if (video_is_extension_supported("GL_ARB_buffer_storage"))
+        buffer_storage = (PFNGLBUFFERSTORAGEPROC)fn_cast(nativeGetProcAddress("glBufferStorage"));
+
+    if (buffer_storage) {
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+        glGenBuffers(1, &ring.buffer.id);
+        track_video_object(VIDEO_OBJECT_BUFFER);
+        glBindBuffer(GL_UNIFORM_BUFFER, ring.buffer.id);
+        buffer_storage(GL_UNIFORM_BUFFER, UNIFORM_RING_SIZE, NULL, flags);
+
+        ring.buffer.target = GL_UNIFORM_BUFFER;
+        ring.buffer.binding_point = -1;
+        ring.buffer.block_index = -1;
+        ring.buffer.size = UNIFORM_RING_SIZE;
+        ring.mapped = glMapBufferRange(GL_UNIFORM_BUFFER, 0, UNIFORM_RING_SIZE, flags);
+
+        if (!ring.mapped) {
+            LOG_WARNING("%s\n", "Can't map uniform ring persistently");
+            free_video_buffer(&ring.buffer);
+        }
+    }
+
+    if (!ring.mapped)
+        ring.buffer = new_uniform_buffer(NULL, UNIFORM_RING_SIZE, GL_STREAM_DRAW);
+
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+static void
+wait_segment(uint32_t segment) {
+    GLsync fence = ring.fences[segment];
+
+    if (!fence)
+        return;
+
+    GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+    GLenum result;
+
+    while ((result = glClientWaitSync(fence, flags, FENCE_TIMEOUT)) == GL_TIMEOUT_EXPIRED)
+        flags = 0;
+
+    if (result != GL_ALREADY_SIGNALED)
+        video_stats.uniform_ring_waits++;
+
+    glDeleteSync(fence);
+    ring.fences[segment] = NULL;
+}
+
+static size_t
+ring_alloc(size_t size) {
+    if (!ring.buffer.id)
+        create_ring();
+
+    size_t offset = (ring.head + ring.alignment - 1) & ~(ring.alignment - 1);
+
+    // blocks don't straddle segments, move on to the next one once it's free
+    if (offset + size > (size_t)(ring.segment + 1) * SEGMENT_SIZE) {
+        ring.fences[ring.segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        ring.segment = (ring.segment + 1) % UNIFORM_RING_SEGMENTS;
+        wait_segment(ring.segment);
+
+        offset = (size_t)ring.segment * SEGMENT_SIZE;
+    }
+
+    ring.head = offset + size;
+
+    return offset;
+}
+
+extern void
+uniform_ring_connect(const SHADER *shader, const char *block_name, int binding_point) {
+    assert(shader != NULL);
+    assert(block_name != NULL);
+
+    if (!ring.buffer.id)
+        create_ring();
+
+    uniform_buffer_connect(binding_point, shader, &ring.buffer, block_name);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+extern void
+bind_uniform_block(int binding_point, const void *data, size_t size) {
+    if (binding_point < 0 || size == 0)
+        return;
+
+    if (size > SEGMENT_SIZE) {
+        LOG_ERROR("Uniform block of %zu bytes doesn't fit the ring\n", size);
+        return;
+    }
+
+    const size_t offset = ring_alloc(size);
+
+    if (ring.mapped) {
+        memcpy(ring.mapped + offset, data, size);
+    } else {
+        glBindBuffer(GL_UNIFORM_BUFFER, ring.buffer.id);
+        glBufferSubData(GL_UNIFORM_BUFFER, offset, size, data);
+    }
+
+    glBindBufferRange(GL_UNIFORM_BUFFER, binding_point, ring.buffer.id, offset, size);
+
+    video_stats.uniform_blocks++;
+    video_stats.uniform_block_bytes += size;
+}
+
+extern void
+uniform_ring_cleanup(void) {
+    for (uint32_t i = 0; i < UNIFORM_RING_SEGMENTS; i++)
+        if (ring.fences[i])
+            glDeleteSync(ring.fences[i]);
+
+    if (ring.mapped) {
+        glBindBuffer(GL_UNIFORM_BUFFER, ring.buffer.id);
+        glUnmapBuffer(GL_UNIFORM_BUFFER);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+
+    free_video_buffer(&ring.buffer);
+    memset(&ring, 0, sizeof(ring));
+}
+
+#else
+
+extern void
+uniform_ring_connect(const SHADER *shader, const char *block_name, int binding_point) {
+    UNUSED(shader);
+    UNUSED(block_name);
+    UNUSED(binding_point);
+
+    LOG_CRITICAL("%s\n", "Uniform blocks need uniform buffers");
+    exit(EXIT_FAILURE);
+}
+
+extern void
+bind_uniform_block(int binding_point, const void *data, size_t size) {
+    UNUSED(binding_point);
+    UNUSED(data);
+    UNUSED(size);
+}
+
+extern void
+uniform_ring_cleanup(void) {
+}
+
+#endif // NO GL_ES_VERSION_2_0
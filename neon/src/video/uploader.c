@@ -0,0 +1,535 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SDL2/SDL.h>
+#include <xxhash.h>
+#include <video/gl.h>
+#include <memtrack.h>
+
+#include "core/common.h"
+#include "core/logerr.h"
+#include "video/deletequeue.h"
+#include "video/uploader.h"
+
+enum UploadKind {
+    UPLOAD_TEXTURE2D,
+    UPLOAD_VERTEX_BUFFER,
+    UPLOAD_INDEX_BUFFER
+};
+
+enum UploadState {
+    UPLOAD_FREE,
+    UPLOAD_QUEUED,
+    UPLOAD_DONE
+};
+
+typedef struct UploadJob {
+    VIDEO_UPLOAD    upload;
+    uint32_t        kind;
+    uint32_t        state;
+
+    IMAGE_DATA      image;
+    void            *data;
+    size_t          size;
+    unsigned int    usage;
+
+    TEXTURE         texture;
+    VIDEO_BUFFER    buffer;
+    #ifndef GL_ES_VERSION_2_0
+    GLsync          fence;      // set by the loader thread
+    #endif // NO GL_ES_VERSION_2_0
+} UPLOAD_JOB;
+
+static struct {
+    SDL_Thread      *thread;
+    SDL_mutex       *lock;
+    SDL_cond        *wake;      // loader thread: upload submitted, quit
+    SDL_cond        *done;      // main thread: upload done
+
+    SDL_Window      *window;
+    SDL_GLContext   context;
+
+    // slot (upload - 1) % capacity, jobs stay where they are when the slots grow
+    UPLOAD_JOB      **jobs;
+    uint32_t        capacity;
+    uint32_t        submitted;
+    uint32_t        processed;
+
+    bool            quit;
+} loader;
+
+static inline UPLOAD_JOB **
+upload_slot(VIDEO_UPLOAD upload) {
+    return &loader.jobs[(upload - 1) % loader.capacity];
+}
+
+static void *
+alloc_memory(size_t size) {
+    void *p = malloc(size);
+
+    if (!p) {
+        LOG_CRITICAL("%s\n", "Can't alloc memory");
+        exit(EXIT_FAILURE);
+    }
+
+    return p;
+}
+
+// doubles until the slot of upload is free, live jobs keep distinct slots under any power of two
+static void
+grow_slots(VIDEO_UPLOAD upload) {
+    uint32_t capacity = loader.capacity;
+
+    for (;;) {
+        capacity *= 2;
+
+        bool taken = false;
+        for (uint32_t i = 0; i < loader.capacity && !taken; i++) {
+            const UPLOAD_JOB *job = loader.jobs[i];
+            taken = job && job->state != UPLOAD_FREE && (job->upload - 1) % capacity == (upload - 1) % capacity;
+        }
+
+        if (!taken)
+            break;
+    }
+
+    UPLOAD_JOB **jobs = alloc_memory(sizeof(UPLOAD_JOB*) * capacity);
+    memset(jobs, 0, sizeof(UPLOAD_JOB*) * capacity);
+
+    for (uint32_t i = 0; i < loader.capacity; i++) {
+        UPLOAD_JOB *job = loader.jobs[i];
+
+        if (job && job->state != UPLOAD_FREE)
+            jobs[(job->upload - 1) % capacity] = job;
+        else
+            free(job);
+    }
+
+    free(loader.jobs);
+    loader.jobs = jobs;
+    loader.capacity = capacity;
+
+    LOG_WARNING("Upload queue grown to %u, uploads are not taken\n", capacity);
+}
+
+// the free job for the next upload, the caller holds loader.lock with the thread
+static UPLOAD_JOB *
+next_job(void) {
+    if (!loader.jobs) {
+        loader.capacity = UPLOAD_QUEUE_SIZE;
+        loader.jobs = alloc_memory(sizeof(UPLOAD_JOB*) * loader.capacity);
+        memset(loader.jobs, 0, sizeof(UPLOAD_JOB*) * loader.capacity);
+    }
+
+    const VIDEO_UPLOAD upload = loader.submitted + 1;
+    UPLOAD_JOB **slot = upload_slot(upload);
+
+    if (*slot && (*slot)->state != UPLOAD_FREE) {
+        grow_slots(upload);
+        slot = upload_slot(upload);
+    }
+
+    if (!*slot)
+        *slot = alloc_memory(sizeof(UPLOAD_JOB));
+
+    return *slot;
+}
+
+static void
+release_job(UPLOAD_JOB *job) {
+    free(job->image.pixels);
+    free(job->data);
+
+    memset(job, 0, sizeof(UPLOAD_JOB));
+}
+
+// submitted right away, objects go through the state cache and are tracked at creation
+static void
+run_job_now(UPLOAD_JOB *job) {
+    switch (job->kind) {
+    case UPLOAD_TEXTURE2D:
+        job->texture = new_texture2D(&job->image);
+        break;
+    case UPLOAD_VERTEX_BUFFER:
+        job->buffer = new_vertex_buffer(job->data, job->size, job->usage);
+        break;
+    case UPLOAD_INDEX_BUFFER:
+        job->buffer = new_index_buffer(job->data, job->size, job->usage);
+        break;
+    }
+}
+
+#ifndef GL_ES_VERSION_2_0
+
+// loader context, no state cache, the objects are tracked when taken
+static void
+load_texture2D(UPLOAD_JOB *job) {
+    const IMAGE_DATA *image = &job->image;
+
+    GLuint tex = 0;
+    glGenTextures(1, &tex);
+    glBindTexture(GL_TEXTURE_2D, tex);
+
+    unsigned int flags = 0;
+
+    // cooked chains come with their levels, like new_texture2D
+    if (image->levels > 1 && image->pixels) {
+        upload_texture_levels(image);
+        flags |= TEXTURE_MIPMAPS_BIT;
+    } else {
+        glTexImage2D(GL_TEXTURE_2D, 0, image->internalformat, image->width, image->height, 0, image->format, image->type,
+                     image->pixels);
+
+        if (image->mipmaps) {
+            glGenerateMipmap(GL_TEXTURE_2D);
+            flags |= TEXTURE_MIPMAPS_BIT;
+        }
+    }
+
+    uint32_t hash = 0;
+
+    if (image->pixels) {
+        flags |= TEXTURE_DATA_BIT;
+        hash = XXH32(image->pixels, image->size, GL_TEXTURE_2D);
+    }
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    job->texture = (TEXTURE){.id = tex, .target = GL_TEXTURE_2D, .flags = flags, .width = image->width,
+                .height = image->height, .internalformat = image->internalformat, .hash = hash};
+}
+
+static void
+load_buffer(UPLOAD_JOB *job, GLenum target) {
+    GLuint buffer = 0;
+    glGenBuffers(1, &buffer);
+
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, job->size, job->data, job->usage);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    job->buffer = (VIDEO_BUFFER){.id = buffer, .target = target, .size = job->size};
+}
+
+static int
+loader_thread(void *data) {
+    UNUSED(data);
+
+    SDL_GL_MakeCurrent(loader.window, loader.context);
+
+    SDL_LockMutex(loader.lock);
+
+    for (;;) {
+        if (loader.processed == loader.submitted) {
+            if (loader.quit)
+                break;
+
+            SDL_CondWait(loader.wake, loader.lock);
+            continue;
+        }
+
+        UPLOAD_JOB *job = *upload_slot(loader.processed + 1);
+
+        // the main thread leaves queued jobs alone
+        SDL_UnlockMutex(loader.lock);
+
+        switch (job->kind) {
+        case UPLOAD_TEXTURE2D:
+            load_texture2D(job);
+            break;
+        case UPLOAD_VERTEX_BUFFER:
+            load_buffer(job, GL_ARRAY_BUFFER);
+            break;
+        case UPLOAD_INDEX_BUFFER:
+            load_buffer(job, GL_ELEMENT_ARRAY_BUFFER);
+            break;
+        }
+
+        // other contexts only see fences that reached the GPU
+        job->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        glFlush();
+
+        SDL_LockMutex(loader.lock);
+
+        job->state = UPLOAD_DONE;
+        loader.processed++;
+        SDL_CondBroadcast(loader.done);
+    }
+
+    SDL_UnlockMutex(loader.lock);
+
+    SDL_GL_MakeCurrent(loader.window, NULL);
+
+    return 0;
+}
+
+extern void
+uploader_start(SDL_Window *window, SDL_GLContext context) {
+    SDL_GL_SetAttribute(SDL_GL_SHARE_WITH_CURRENT_CONTEXT, 1);
+    loader.context = SDL_GL_CreateContext(window);
+    SDL_GL_SetAttribute(SDL_GL_SHARE_WITH_CURRENT_CONTEXT, 0);
+
+    // creating a context makes it current
+    SDL_GL_MakeCurrent(window, context);
+
+    if (!loader.context) {
+        LOG_WARNING("Can't create upload context, uploads stay on the main one: %s\n", SDL_GetError());
+        return;
+    }
+
+    loader.window = window;
+    loader.lock = SDL_CreateMutex();
+    loader.wake = SDL_CreateCond();
+    loader.done = SDL_CreateCond();
+
+    if (!loader.lock || !loader.wake || !loader.done) {
+        LOG_ERROR("%s\n", SDL_GetError());
+        exit(EXIT_FAILURE);
+    }
+
+    if ((loader.thread = SDL_CreateThread(loader_thread, "loader", NULL)) == NULL) {
+        LOG_ERROR("%s\n", SDL_GetError());
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void
+stop_loader_thread(void) {
+    SDL_LockMutex(loader.lock);
+    loader.quit = true;
+    SDL_CondSignal(loader.wake);
+    SDL_UnlockMutex(loader.lock);
+
+    // queued uploads are finished first
+    SDL_WaitThread(loader.thread, NULL);
+
+    SDL_DestroyCond(loader.done);
+    SDL_DestroyCond(loader.wake);
+    SDL_DestroyMutex(loader.lock);
+
+    loader.thread = NULL;
+}
+
+// the fence is passed once the main context waited on it, objects made by the loader get tracked
+static void
+wait_fence(UPLOAD_JOB *job, uint32_t type, uint32_t id) {
+    if (!job->fence)
+        return;
+
+    glWaitSync(job->fence, 0, GL_TIMEOUT_IGNORED);
+    glDeleteSync(job->fence);
+    job->fence = NULL;
+
+    if (id != 0)
+        track_video_object(type);
+}
+
+static void
+drop_job(UPLOAD_JOB *job) {
+    if (job->fence) {
+        glDeleteSync(job->fence);
+        job->fence = NULL;
+
+        // never tracked, gone right away as nothing drew with them
+        if (job->texture.id)
+            glDeleteTextures(1, &job->texture.id);
+        if (job->buffer.id)
+            glDeleteBuffers(1, &job->buffer.id);
+    } else {
+        if (job->texture.id)
+            free_texture(&job->texture);
+        if (job->buffer.id)
+            free_video_buffer(&job->buffer);
+    }
+}
+
+#else
+
+extern void
+uploader_start(SDL_Window *window, SDL_GLContext context) {
+    UNUSED(window);
+    UNUSED(context);
+
+    LOG_WARNING("%s\n", "Upload thread not supported, uploads stay on the main context");
+}
+
+static void
+stop_loader_thread(void) {
+}
+
+static void
+wait_fence(UPLOAD_JOB *job, uint32_t type, uint32_t id) {
+    UNUSED(job);
+    UNUSED(type);
+    UNUSED(id);
+}
+
+static void
+drop_job(UPLOAD_JOB *job) {
+    if (job->texture.id)
+        free_texture(&job->texture);
+    if (job->buffer.id)
+        free_video_buffer(&job->buffer);
+}
+
+#endif // NO GL_ES_VERSION_2_0
+
+extern void
+uploader_cleanup(void) {
+    if (loader.thread)
+        stop_loader_thread();
+
+    for (uint32_t i = 0; i < loader.capacity; i++) {
+        UPLOAD_JOB *job = loader.jobs[i];
+
+        if (job && job->state != UPLOAD_FREE) {
+            drop_job(job);
+            release_job(job);
+        }
+
+        free(job);
+    }
+
+    free(loader.jobs);
+    loader.jobs = NULL;
+    loader.capacity = 0;
+
+    if (loader.context) {
+        SDL_GL_DeleteContext(loader.context);
+        loader.context = NULL;
+    }
+
+    loader.submitted = 0;
+    loader.processed = 0;
+    loader.quit = false;
+}
+
+// uploads left untaken grow the queue, the thread that takes them may be the one submitting
+static VIDEO_UPLOAD
+submit_upload(const UPLOAD_JOB *request) {
+    if (!loader.thread) {
+        UPLOAD_JOB *job = next_job();
+
+        *job = *request;
+        job->upload = ++loader.submitted;
+        job->state = UPLOAD_DONE;
+        loader.processed++;
+
+        run_job_now(job);
+
+        return job->upload;
+    }
+
+    SDL_LockMutex(loader.lock);
+
+    // a full queue of pending uploads waits for the loader, finished ones are moved aside
+    if (loader.jobs) {
+        const UPLOAD_JOB *queued = *upload_slot(loader.submitted + 1);
+
+        while (queued && queued->state == UPLOAD_QUEUED)
+            SDL_CondWait(loader.done, loader.lock);
+    }
+
+    UPLOAD_JOB *job = next_job();
+
+    *job = *request;
+    job->upload = ++loader.submitted;
+    job->state = UPLOAD_QUEUED;
+
+    SDL_CondSignal(loader.wake);
+    SDL_UnlockMutex(loader.lock);
+
+    return job->upload;
+}
+
+extern VIDEO_UPLOAD
+upload_texture2D_async(IMAGE_DATA image) {
+    return submit_upload(&(UPLOAD_JOB){.kind = UPLOAD_TEXTURE2D, .image = image});
+}
+
+extern VIDEO_UPLOAD
+upload_vertex_buffer_async(void *vertices, size_t size, unsigned int usage) {
+    return submit_upload(&(UPLOAD_JOB){.kind = UPLOAD_VERTEX_BUFFER, .data = vertices, .size = size, .usage = usage});
+}
+
+extern VIDEO_UPLOAD
+upload_index_buffer_async(void *indices, size_t size, unsigned int usage) {
+    return submit_upload(&(UPLOAD_JOB){.kind = UPLOAD_INDEX_BUFFER, .data = indices, .size = size, .usage = usage});
+}
+
+static UPLOAD_JOB *
+find_upload(VIDEO_UPLOAD upload) {
+    if (upload == 0 || !loader.jobs)
+        return NULL;
+
+    UPLOAD_JOB *job = *upload_slot(upload);
+
+    // written by the submitting thread only, cleared when taken
+    return job && job->upload == upload ? job : NULL;
+}
+
+extern bool
+upload_done(VIDEO_UPLOAD upload) {
+    UPLOAD_JOB *job = find_upload(upload);
+
+    if (!job)
+        return false;
+
+    if (!loader.thread)
+        return job->state == UPLOAD_DONE;
+
+    SDL_LockMutex(loader.lock);
+    const bool done = job->state == UPLOAD_DONE;
+    SDL_UnlockMutex(loader.lock);
+
+    return done;
+}
+
+static UPLOAD_JOB *
+take_upload(VIDEO_UPLOAD upload, bool texture) {
+    UPLOAD_JOB *job = find_upload(upload);
+
+    if (!job || (job->kind == UPLOAD_TEXTURE2D) != texture) {
+        LOG_ERROR("Unknown upload %u\n", upload);
+        return NULL;
+    }
+
+    if (loader.thread) {
+        SDL_LockMutex(loader.lock);
+        while (job->state == UPLOAD_QUEUED)
+            SDL_CondWait(loader.done, loader.lock);
+        SDL_UnlockMutex(loader.lock);
+    }
+
+    return job;
+}
+
+extern TEXTURE
+upload_take_texture(VIDEO_UPLOAD upload) {
+    UPLOAD_JOB *job = take_upload(upload, true);
+
+    if (!job)
+        return (TEXTURE){.id = 0};
+
+    wait_fence(job, VIDEO_OBJECT_TEXTURE, job->texture.id);
+
+    const TEXTURE texture = job->texture;
+    release_job(job);
+
+    return texture;
+}
+
+extern VIDEO_BUFFER
+upload_take_buffer(VIDEO_UPLOAD upload) {
+    UPLOAD_JOB *job = take_upload(upload, false);
+
+    if (!job)
+        return (VIDEO_BUFFER){.id = 0};
+
+    wait_fence(job, VIDEO_OBJECT_BUFFER, job->buffer.id);
+
+    const VIDEO_BUFFER buffer = job->buffer;
+    release_job(job);
+
+    return buffer;
+}
@@ -5,6 +5,60 @@
 #include "video/vertex.h"
 #include "video/buffer.h"
 #include "video/vertices.h"
+#include "video/vertops.h"
+#include "video/geometry.h"
+#include "video/lod.h"
+
+extern size_t
+vertex_format_size(uint32_t vf) {
+    switch (vf) {
+    case VF_V3:
+        return sizeof(float3);
+    case VF_V3N3:
+        return sizeof(v3n3_t);
+    case VF_V3T2:
+        return sizeof(v3t2_t);
+    case VF_V3T2N3:
+        return sizeof(v3t2n3_t);
+    case VF_V3T2N3T3:
+        return sizeof(v3t2n3t3_t);
+    }
+
+    return 0;
+}
+
+extern void
+vertices_array_format(VERTEX_ARRAY *array, VIDEO_BUFFER *vertices, uint32_t vf) {
+    switch (vf) {
+    case VF_V3:
+        vertex_array_buffer(array, vertices, 0, 0);
+        vertex_array_format(array, POSITION_ATTRIBUTE, 3, GL_FLOAT, GL_FALSE, 0);
+        break;
+    case VF_V3N3:
+        vertex_array_buffer(array, vertices, 0, sizeof(v3n3_t));
+        vertex_array_format(array, POSITION_ATTRIBUTE, 3, GL_FLOAT, GL_FALSE, offsetof(v3n3_t, position));
+        vertex_array_format(array, NORMAL_ATTRIBUTE, 3, GL_FLOAT, GL_FALSE, offsetof(v3n3_t, normal));
+        break;
+    case VF_V3T2:
+        vertex_array_buffer(array, vertices, 0, sizeof(v3t2_t));
+        vertex_array_format(array, POSITION_ATTRIBUTE, 3, GL_FLOAT, GL_FALSE, offsetof(v3t2_t, position));
+        vertex_array_format(array, TEXCOORD_ATTRIBUTE, 2, GL_FLOAT, GL_FALSE, offsetof(v3t2_t, texcoord));
+        break;
+    case VF_V3T2N3:
+        vertex_array_buffer(array, vertices, 0, sizeof(v3t2n3_t));
+        vertex_array_format(array, POSITION_ATTRIBUTE, 3, GL_FLOAT, GL_FALSE, offsetof(v3t2n3_t, position));
+        vertex_array_format(array, TEXCOORD_ATTRIBUTE, 2, GL_FLOAT, GL_FALSE, offsetof(v3t2n3_t, texcoord));
+        vertex_array_format(array, NORMAL_ATTRIBUTE, 3, GL_FLOAT, GL_FALSE, offsetof(v3t2n3_t, normal));
+        break;
+    case VF_V3T2N3T3:
+        vertex_array_buffer(array, vertices, 0, sizeof(v3t2n3t3_t));
+        vertex_array_format(array, POSITION_ATTRIBUTE, 3, GL_FLOAT, GL_FALSE, offsetof(v3t2n3t3_t, position));
+        vertex_array_format(array, TEXCOORD_ATTRIBUTE, 2, GL_FLOAT, GL_FALSE, offsetof(v3t2n3t3_t, texcoord));
+        vertex_array_format(array, NORMAL_ATTRIBUTE, 3, GL_FLOAT, GL_FALSE, offsetof(v3t2n3t3_t, normal));
+        vertex_array_format(array, TANGENT_ATTRIBUTE, 3, GL_FLOAT, GL_FALSE, offsetof(v3t2n3t3_t, tangent));
+        break;
+    }
+}
 
 extern VIDEO_VERTICES_INFO
 new_vertices_buffers(VERTICES_DATA *data, size_t count, const VERTICES_DESC *desc) {
@@ -13,8 +67,12 @@ new_vertices_buffers(VERTICES_DATA *data, size_t count, const VERTICES_DESC *des
     VIDEO_VERTICES_INFO info;
     memset(&info, 0, sizeof(info));
 
-    info.array = new_vertex_array();
-    bind_vertex_arrays(&info.array);
+    const bool shared = data && desc->shared;
+
+    if (!shared) {
+        info.array = new_vertex_array();
+        bind_vertex_arrays(&info.array);
+    }
 
     if (!data) {
         LOG("NEW VIDEO VERICES %d [%d %d]\n", info.array, info.vertices, info.elements);
@@ -32,6 +90,9 @@ new_vertices_buffers(VERTICES_DATA *data, size_t count, const VERTICES_DESC *des
         size_t vb_size;
         size_t ib_size;
     } buffers_info[count];
+    void *lod_indices[count][VIDEO_MAX_LODS - 1];
+    uint32_t lod_counts[count][VIDEO_MAX_LODS - 1];
+    float lod_errors[count][VIDEO_MAX_LODS - 1];
     uint32_t base_vertex = 0;
     uint32_t base_index = 0;
 
@@ -46,25 +107,31 @@ new_vertices_buffers(VERTICES_DATA *data, size_t count, const VERTICES_DESC *des
             vertices_data_size += vd->vertices_num * sizeof(float3);
             buffers_info[i].vb_size = vd->vertices_num * sizeof(float3);
 
-            make_aabb_from_vertices((const v3_t*)vd->vertices, vd->vertices_num, info.objects[i].bound);
+            vertops_bounds(vd->vertices, sizeof(v3_t), vd->vertices_num, info.objects[i].bound.min, info.objects[i].bound.max);
             break;
         case VF_V3N3:
             vertices_data_size += vd->vertices_num * sizeof(v3n3_t);
             buffers_info[i].vb_size = vd->vertices_num * sizeof(v3n3_t);
 
-            make_aabb_from_vertices((const v3n3_t*)vd->vertices, vd->vertices_num, info.objects[i].bound);
+            vertops_bounds(vd->vertices, sizeof(v3n3_t), vd->vertices_num, info.objects[i].bound.min, info.objects[i].bound.max);
             break;
         case VF_V3T2:
             vertices_data_size += vd->vertices_num * sizeof(v3t2_t);
             buffers_info[i].vb_size = vd->vertices_num * sizeof(v3t2_t);
 
-            make_aabb_from_vertices((const v3t2_t*)vd->vertices, vd->vertices_num, info.objects[i].bound);
+            vertops_bounds(vd->vertices, sizeof(v3t2_t), vd->vertices_num, info.objects[i].bound.min, info.objects[i].bound.max);
             break;
         case VF_V3T2N3:
             vertices_data_size += vd->vertices_num * sizeof(v3t2n3_t);
             buffers_info[i].vb_size = vd->vertices_num * sizeof(v3t2n3_t);
 
-            make_aabb_from_vertices((const v3t2n3_t *)vd->vertices, vd->vertices_num, info.objects[i].bound);
+            vertops_bounds(vd->vertices, sizeof(v3t2n3_t), vd->vertices_num, info.objects[i].bound.min, info.objects[i].bound.max);
+            break;
+        case VF_V3T2N3T3:
+            vertices_data_size += vd->vertices_num * sizeof(v3t2n3t3_t);
+            buffers_info[i].vb_size = vd->vertices_num * sizeof(v3t2n3t3_t);
+
+            vertops_bounds(vd->vertices, sizeof(v3t2n3t3_t), vd->vertices_num, info.objects[i].bound.min, info.objects[i].bound.max);
             break;
         default:
             LOG_ERROR("%s\n", "Unknown vertex format");
@@ -74,17 +141,29 @@ new_vertices_buffers(VERTICES_DATA *data, size_t count, const VERTICES_DESC *des
         base_vertex += vd->vertices_num;
     }
 
-    // count index buffers size
+    // count index buffers size, simplified levels follow the object indices
     for (size_t i = 0; i < count; i++) {
         const VERTICES_DATA *vd = &data[i];
 
+        uint32_t lods = 0;
+        if (desc->lods > 0 && desc->primitive == GL_TRIANGLES)
+            lods = generate_lods(vd, desc->vf, desc->ef, desc->lods, lod_indices[i], lod_counts[i], lod_errors[i]);
+
+        uint32_t lods_indices_num = 0;
+        for (uint32_t l = 0; l < lods; l++)
+            lods_indices_num += lod_counts[i][l];
+
+        info.objects[i].lods_count = 1 + lods;
+        info.objects[i].lods[0].count = info.objects[i].count;
+        info.objects[i].lods[0].error = 0.f;
+
         switch (desc->ef) {
         case IF_UI16:
-            indices_data_size += vd->indices_num * sizeof(uint16_t);
+            indices_data_size += (vd->indices_num + lods_indices_num) * sizeof(uint16_t);
             buffers_info[i].ib_size = vd->indices_num * sizeof(uint16_t);
             break;
         case IF_UI32:
-            indices_data_size += vd->indices_num * sizeof(uint32_t);
+            indices_data_size += (vd->indices_num + lods_indices_num) * sizeof(uint32_t);
             buffers_info[i].ib_size = vd->indices_num * sizeof(uint32_t);
             break;
         default:
@@ -92,7 +171,7 @@ new_vertices_buffers(VERTICES_DATA *data, size_t count, const VERTICES_DESC *des
         }
 
         info.objects[i].base_index = base_index;
-        base_index += vd->indices_num;
+        base_index += vd->indices_num + lods_indices_num;
     }
 
     // alloc buffers
@@ -108,39 +187,38 @@ new_vertices_buffers(VERTICES_DATA *data, size_t count, const VERTICES_DESC *des
         vb_offset += buffers_info[i].vb_size;
 
         info.objects[i].ib_offset = ib_offset;
+        info.objects[i].lods[0].ib_offset = ib_offset;
         memcpy((char*)index_data + ib_offset, data[i].indices, buffers_info[i].ib_size);
         ib_offset += buffers_info[i].ib_size;
-    }
 
-    info.vertices = new_vertex_buffer(vertex_data, vertices_data_size, GL_STATIC_DRAW);
+        const size_t index_size = desc->ef == IF_UI32 ? sizeof(uint32_t) : sizeof(uint16_t);
+        for (uint32_t l = 1; l < info.objects[i].lods_count; l++) {
+            info.objects[i].lods[l].ib_offset = ib_offset;
+            info.objects[i].lods[l].count = lod_counts[i][l - 1];
+            info.objects[i].lods[l].error = lod_errors[i][l - 1];
 
-    // transfer to video memory
-    switch (desc->vf) {
-    case VF_V3:
-        vertex_array_buffer(&info.array, &info.vertices, 0, 0);
-        vertex_array_format(&info.array, POSITION_ATTRIBUTE, 3, GL_FLOAT, GL_FALSE, 0);
-        break;
-    case VF_V3N3:
-        vertex_array_buffer(&info.array, &info.vertices, 0, sizeof(v3n3_t));
-        vertex_array_format(&info.array, POSITION_ATTRIBUTE, 3, GL_FLOAT, GL_FALSE, offsetof(v3n3_t, position));
-        vertex_array_format(&info.array, NORMAL_ATTRIBUTE, 3, GL_FLOAT, GL_FALSE, offsetof(v3n3_t, normal));
-        break;
-    case VF_V3T2:
-        vertex_array_buffer(&info.array, &info.vertices, 0, sizeof(v3t2_t));
-        vertex_array_format(&info.array, POSITION_ATTRIBUTE, 3, GL_FLOAT, GL_FALSE, offsetof(v3t2_t, position));
-        vertex_array_format(&info.array, TEXCOORD_ATTRIBUTE, 2, GL_FLOAT, GL_FALSE, offsetof(v3t2_t, texcoord));
-        break;
-    case VF_V3T2N3:
-        vertex_array_buffer(&info.array, &info.vertices, 0, sizeof(v3t2n3_t));
-        vertex_array_format(&info.array, POSITION_ATTRIBUTE, 3, GL_FLOAT, GL_FALSE, offsetof(v3t2n3_t, position));
-        vertex_array_format(&info.array, TEXCOORD_ATTRIBUTE, 2, GL_FLOAT, GL_FALSE, offsetof(v3t2n3_t, texcoord));
-        vertex_array_format(&info.array, NORMAL_ATTRIBUTE, 3, GL_FLOAT, GL_FALSE, offsetof(v3t2n3_t, normal));
-        break;
+            memcpy((char*)index_data + ib_offset, lod_indices[i][l - 1], lod_counts[i][l - 1] * index_size);
+            ib_offset += lod_counts[i][l - 1] * index_size;
+
+            free(lod_indices[i][l - 1]);
+        }
     }
 
-    info.elements = new_index_buffer(index_data, indices_data_size, GL_STATIC_DRAW);
+    if (shared) {
+        info.geometry = geometry_alloc(desc->vf, vertex_data, base_vertex, index_data, indices_data_size);
 
-    unbind_vertex_array(&info.array);
+        const VERTEX_ARRAY *array = geometry_vertex_array(desc->vf);
+        if (array)
+            info.array = *array;
+    } else {
+        // transfer to video memory
+        info.vertices = new_vertex_buffer(vertex_data, vertices_data_size, GL_STATIC_DRAW);
+        vertices_array_format(&info.array, &info.vertices, desc->vf);
+
+        info.elements = new_index_buffer(index_data, indices_data_size, GL_STATIC_DRAW);
+
+        unbind_vertex_array(&info.array);
+    }
 
     free(vertex_data);
     free(index_data);
@@ -168,6 +246,14 @@ extern void
 free_vertices_info(VIDEO_VERTICES_INFO *info) {
     cleanup_vertices_info(info);
 
+    // the vertex array belongs to the heap
+    if (info->geometry) {
+        geometry_free(info->geometry);
+        info->geometry = 0;
+        memset(&info->array, 0, sizeof(info->array));
+        return;
+    }
+
     free_video_buffer(&info->vertices);
     free_video_buffer(&info->elements);
 
@@ -288,18 +374,7 @@ vertgen_cube(matrix4 transform) {
     memcpy(vs, cube_vertices_v3t2n3, sizeof(cube_vertices_v3t2n3));
     memcpy(es, cube_indices_v3t2n3, sizeof(cube_indices_v3t2n3));
 
-    for (size_t i = 0; i < CUBE_VERTICES_NUM; i++) {
-        float4 v_in;
-        float4 v_out;
-        copy_vector3(v_in, cube_vertices_v3t2n3[i].position);
-        v_in[3] = 1;
-
-        left_product_matrix4_vector4(v_out, v_in, transform);
-        copy_vector3(vs[i].position, v_out);
-
-        //printf("v_in  %f %f %f %f\n", v_in[0], v_in[1], v_in[2], v_in[3]);
-        //printf("v_out %f %f %f %f\n", v_out[0], v_out[1], v_out[2], v_out[3]);
-    }
+    vertops_transform(vs, sizeof(v3t2n3_t), CUBE_VERTICES_NUM, transform);
 
     return (VERTICES_INFO){.data = (VERTICES_DATA){.vertices = vs,
                 .indices = es,
@@ -371,22 +446,20 @@ vertgen_sphere(const GEN_SHPERE_INFO *info, matrix4 transform) {
         }
     }
 
-    for (int j = 0; j < info->rings * info->sectors; j++) {
-        float4 v_in;
-        float4 v_out;
-        copy_vector3(v_in, vertices[j].position);
-        v_in[3] = 1;
-
-        left_product_matrix4_vector4(v_out, v_in, transform);
-        copy_vector3(vertices[j].position, v_out);
-    }
+    vertops_transform(vertices, sizeof(v3t2n3_t), info->rings * info->sectors, transform);
 
-    return (VERTICES_INFO){.data = (VERTICES_DATA){.vertices = vertices,
+    VERTICES_INFO vi = {.data = (VERTICES_DATA){.vertices = vertices,
                 .indices = indices,
                 .vertices_num = info->rings * info->sectors,
                 .indices_num = info->rings * (info->sectors - 1) * 6},
                 .desc = (VERTICES_DESC){.primitive = GL_TRIANGLES,
-                .vf = VF_V3T2N3}};
+                .vf = VF_V3T2N3,
+                .ef = IF_UI16}};
+
+    if (info->tangents)
+        vertgen_tangents(&vi);
+
+    return vi;
 }
 
 extern VERTICES_INFO
@@ -397,18 +470,7 @@ vertgen_quad_plane(matrix4 transform) {
     memcpy(vs, quad_vertices, sizeof(quad_vertices));
     memcpy(es, quad_indices, sizeof(quad_indices));
 
-    for (size_t i = 0; i < QUAD_VERTICES_NUM; i++) {
-        float4 v_in;
-        float4 v_out;
-        copy_vector3(v_in, quad_vertices[i].position);
-        v_in[3] = 1;
-
-        left_product_matrix4_vector4(v_out, v_in, transform);
-        copy_vector3(vs[i].position, v_out);
-
-        //printf("v_in  %f %f %f %f\n", v_in[0], v_in[1], v_in[2], v_in[3]);
-        //printf("v_out %f %f %f %f\n", v_out[0], v_out[1], v_out[2], v_out[3]);
-    }
+    vertops_transform(vs, sizeof(v3t2n3_t), QUAD_VERTICES_NUM, transform);
 
     return (VERTICES_INFO){.data = (VERTICES_DATA){.vertices = vs,
                 .indices = es,
@@ -517,23 +579,20 @@ vertgen_torus(const GEN_TORUS_INFO *info, matrix4 transform) {
     free(texCoords);
     //free(indices);
 
-    for (size_t i = 0; i < numberVertices; i++) {
-        float4 v_in;
-        float4 v_out;
-        copy_vector3(v_in, vs[i].position);
-        v_in[3] = 1;
-
-        left_product_matrix4_vector4(v_out, v_in, transform);
-        copy_vector3(vs[i].position, v_out);
-    }
+    vertops_transform(vs, sizeof(v3t2n3_t), numberVertices, transform);
 
-    return (VERTICES_INFO){.data = (VERTICES_DATA){.vertices = vs,
+    VERTICES_INFO vi = {.data = (VERTICES_DATA){.vertices = vs,
                 .indices = indices,
                 .vertices_num = numberVertices,
                 .indices_num = numberIndices},
                 .desc = (VERTICES_DESC){.primitive = GL_TRIANGLES,
                 .vf = VF_V3T2N3,
                 .ef = IF_UI16}};
+
+    if (info->tangents)
+        vertgen_tangents(&vi);
+
+    return vi;
 }
 
 extern VERTICES_INFO
@@ -593,23 +652,20 @@ vertgen_ribbon(const GEN_RIBBON_INFO *info, matrix4 transform) {
         offset += 2.0f;
     }
 
-    for (size_t i = 0; i < vertices_count; i++) {
-        float4 v_in;
-        float4 v_out;
-        copy_vector3(v_in, vertices[i].position);
-        v_in[3] = 1;
-
-        left_product_matrix4_vector4(v_out, v_in, transform);
-        copy_vector3(vertices[i].position, v_out);
-    }
+    vertops_transform(vertices, sizeof(v3t2n3_t), vertices_count, transform);
 
-    return (VERTICES_INFO){.data = (VERTICES_DATA){.vertices = vertices,
+    VERTICES_INFO vi = {.data = (VERTICES_DATA){.vertices = vertices,
                 .indices = indices,
                 .vertices_num = info->segments * 4,
                 .indices_num = info->segments * 6},
                 .desc = (VERTICES_DESC){.primitive = GL_TRIANGLES,
                 .vf = VF_V3T2N3,
                 .ef = IF_UI16}};
+
+    if (info->tangents)
+        vertgen_tangents(&vi);
+
+    return vi;
 }
 
 extern VERTICES_INFO
@@ -694,25 +750,57 @@ vertgen_rectangular_grid_plane(const GEN_RECTANGULAR_GRID_PLANE *info, matrix4 t
         vs[i].texcoord[1] = texCoords[i * 2 + 1];
     }
 
-    for (size_t i = 0; i < numberVertices; i++) {
-        float4 v_in;
-        float4 v_out;
-        copy_vector3(v_in, vs[i].position);
-        v_in[3] = 1;
-
-        left_product_matrix4_vector4(v_out, v_in, transform);
-        copy_vector3(vs[i].position, v_out);
-    }
+    vertops_transform(vs, sizeof(v3t2n3_t), numberVertices, transform);
 
     free(vertices);
     free(normals);
     free(texCoords);    
 
-    return (VERTICES_INFO){.data = (VERTICES_DATA){.vertices = vs,
+    VERTICES_INFO vi = {.data = (VERTICES_DATA){.vertices = vs,
                 .indices = indices,
                 .vertices_num = numberVertices,
                 .indices_num = numberIndices},
                 .desc = (VERTICES_DESC){.primitive = mode,
                 .vf = VF_V3T2N3,
                 .ef = IF_UI16}};
+
+    if (info->tangents)
+        vertgen_tangents(&vi);
+
+    return vi;
+}
+
+extern void
+vertgen_tangents(VERTICES_INFO *info) {
+    assert(info != NULL);
+
+    if (info->desc.vf != VF_V3T2N3) {
+        LOG_ERROR("%s\n", "Tangents can be generated only for V3T2N3 vertices");
+        return;
+    }
+
+    if (info->desc.primitive != GL_TRIANGLES) {
+        LOG_ERROR("%s\n", "Tangents can be generated only for triangles");
+        return;
+    }
+
+    const v3t2n3_t *src = info->data.vertices;
+    v3t2n3t3_t *dst = malloc(info->data.vertices_num * sizeof(v3t2n3t3_t));
+
+    if (!dst) {
+        LOG_CRITICAL("%s\n", "Can't alloc memory");
+        exit(EXIT_FAILURE);
+    }
+
+    for (unsigned int i = 0; i < info->data.vertices_num; i++) {
+        copy_vector3(dst[i].position, src[i].position);
+        copy_vector2(dst[i].texcoord, src[i].texcoord);
+        copy_vector3(dst[i].normal, src[i].normal);
+    }
+
+    vertops_tangents(dst, info->data.vertices_num, info->data.indices, info->desc.ef, info->data.indices_num);
+
+    free(info->data.vertices);
+    info->data.vertices = dst;
+    info->desc.vf = VF_V3T2N3T3;
 }
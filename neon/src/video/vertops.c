@@ -0,0 +1,347 @@
+#include <assert.h>
+#include <math.h>
+#include <float.h>
+#include <string.h>
+#include <memtrack.h>
+
+#include "core/common.h"
+#include "video/vertex.h"
+#include "video/vertops.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define VERTOPS_AVX2
+#define VERTOPS_SSE2
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define VERTOPS_SSE2
+#endif
+
+#define VERTEX_AT(base, stride, i) ((float*)((char*)(base) + (stride) * (i)))
+#define CVERTEX_AT(base, stride, i) ((const float*)((const char*)(base) + (stride) * (i)))
+
+extern const char *
+vertops_isa(void) {
+#if defined(VERTOPS_AVX2)
+    return "AVX2";
+#elif defined(VERTOPS_SSE2)
+    return "SSE2";
+#else
+    return "scalar";
+#endif
+}
+
+#ifdef VERTOPS_SSE2
+// NOTE: never touch the 4th float, it belongs to the next attribute or to the next vertex
+static inline __m128
+load_float3(const float *p) {
+    __m128 xy = _mm_castpd_ps(_mm_load_sd((const double*)p));
+    __m128 z = _mm_load_ss(p + 2);
+
+    return _mm_movelh_ps(xy, z);
+}
+
+static inline void
+store_float3(float *p, __m128 v) {
+    _mm_store_sd((double*)p, _mm_castps_pd(v));
+    _mm_store_ss(p + 2, _mm_movehl_ps(v, v));
+}
+
+static inline __m128
+normalize_float3(__m128 v) {
+    __m128 sq = _mm_mul_ps(v, v);
+    __m128 len = _mm_add_ss(_mm_add_ss(sq, _mm_shuffle_ps(sq, sq, _MM_SHUFFLE(1, 1, 1, 1))),
+                            _mm_shuffle_ps(sq, sq, _MM_SHUFFLE(2, 2, 2, 2)));
+    len = _mm_sqrt_ss(len);
+
+    if (_mm_cvtss_f32(len) <= FLT_EPSILON)
+        return v;
+
+    return _mm_div_ps(v, _mm_shuffle_ps(len, len, _MM_SHUFFLE(0, 0, 0, 0)));
+}
+#else
+static inline void
+normalize3(float v[3]) {
+    const float len = sqrtf(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+
+    if (len <= FLT_EPSILON)
+        return;
+
+    v[0] /= len;
+    v[1] /= len;
+    v[2] /= len;
+}
+#endif // VERTOPS_SSE2
+
+static inline uint32_t
+fetch_index(const void *indices, uint32_t ef, size_t i) {
+    if (!indices)
+        return i;
+
+    if (ef == IF_UI32)
+        return ((const uint32_t*)indices)[i];
+
+    return ((const uint16_t*)indices)[i];
+}
+
+/*
+ * Transform
+ */
+
+static void
+transform_scalar(void *vertices, size_t stride, size_t first, size_t count, matrix4 m) {
+    for (size_t i = first; i < count; i++) {
+        float *p = VERTEX_AT(vertices, stride, i);
+        const float x = p[0], y = p[1], z = p[2];
+
+        p[0] = x * m[0][0] + y * m[1][0] + z * m[2][0] + m[3][0];
+        p[1] = x * m[0][1] + y * m[1][1] + z * m[2][1] + m[3][1];
+        p[2] = x * m[0][2] + y * m[1][2] + z * m[2][2] + m[3][2];
+    }
+}
+
+extern void
+vertops_transform(void *vertices, size_t stride, size_t count, matrix4 transform) {
+    assert(vertices != NULL);
+    assert(stride >= sizeof(float) * 3);
+
+    size_t i = 0;
+
+#if defined(VERTOPS_AVX2)
+    const __m256 r0 = _mm256_broadcast_ps((const __m128*)transform[0]);
+    const __m256 r1 = _mm256_broadcast_ps((const __m128*)transform[1]);
+    const __m256 r2 = _mm256_broadcast_ps((const __m128*)transform[2]);
+    const __m256 r3 = _mm256_broadcast_ps((const __m128*)transform[3]);
+
+    // two vertices per iteration, one in each 128-bit lane
+    for (; i + 2 <= count; i += 2) {
+        float *p0 = VERTEX_AT(vertices, stride, i);
+        float *p1 = VERTEX_AT(vertices, stride, i + 1);
+
+        const __m256 v = _mm256_set_m128(load_float3(p1), load_float3(p0));
+        const __m256 x = _mm256_permute_ps(v, _MM_SHUFFLE(0, 0, 0, 0));
+        const __m256 y = _mm256_permute_ps(v, _MM_SHUFFLE(1, 1, 1, 1));
+        const __m256 z = _mm256_permute_ps(v, _MM_SHUFFLE(2, 2, 2, 2));
+
+        __m256 r = _mm256_add_ps(_mm256_mul_ps(x, r0), r3);
+        r = _mm256_add_ps(_mm256_mul_ps(y, r1), r);
+        r = _mm256_add_ps(_mm256_mul_ps(z, r2), r);
+
+        store_float3(p0, _mm256_castps256_ps128(r));
+        store_float3(p1, _mm256_extractf128_ps(r, 1));
+    }
+#elif defined(VERTOPS_SSE2)
+    const __m128 r0 = _mm_loadu_ps(transform[0]);
+    const __m128 r1 = _mm_loadu_ps(transform[1]);
+    const __m128 r2 = _mm_loadu_ps(transform[2]);
+    const __m128 r3 = _mm_loadu_ps(transform[3]);
+
+    for (; i < count; i++) {
+        float *p = VERTEX_AT(vertices, stride, i);
+        const __m128 v = load_float3(p);
+
+        __m128 r = _mm_add_ps(_mm_mul_ps(_mm_shuffle_ps(v, v, _MM_SHUFFLE(0, 0, 0, 0)), r0), r3);
+        r = _mm_add_ps(_mm_mul_ps(_mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1)), r1), r);
+        r = _mm_add_ps(_mm_mul_ps(_mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 2, 2, 2)), r2), r);
+
+        store_float3(p, r);
+    }
+#endif
+
+    transform_scalar(vertices, stride, i, count, transform);
+}
+
+/*
+ * Bounds
+ */
+
+extern void
+vertops_bounds(const void *vertices, size_t stride, size_t count, float3 min, float3 max) {
+    assert(stride >= sizeof(float) * 3);
+
+    if (!vertices || count == 0) {
+        make_vector3(min, 0.f, 0.f, 0.f);
+        make_vector3(max, 0.f, 0.f, 0.f);
+        return;
+    }
+
+    size_t i = 0;
+
+#if defined(VERTOPS_AVX2)
+    __m256 vmin = _mm256_set1_ps(FLT_MAX);
+    __m256 vmax = _mm256_set1_ps(-FLT_MAX);
+
+    for (; i + 2 <= count; i += 2) {
+        const __m256 v = _mm256_set_m128(load_float3(CVERTEX_AT(vertices, stride, i + 1)),
+                                         load_float3(CVERTEX_AT(vertices, stride, i)));
+        vmin = _mm256_min_ps(vmin, v);
+        vmax = _mm256_max_ps(vmax, v);
+    }
+
+    __m128 mn = _mm_min_ps(_mm256_castps256_ps128(vmin), _mm256_extractf128_ps(vmin, 1));
+    __m128 mx = _mm_max_ps(_mm256_castps256_ps128(vmax), _mm256_extractf128_ps(vmax, 1));
+
+    for (; i < count; i++) {
+        const __m128 v = load_float3(CVERTEX_AT(vertices, stride, i));
+        mn = _mm_min_ps(mn, v);
+        mx = _mm_max_ps(mx, v);
+    }
+
+    store_float3(min, mn);
+    store_float3(max, mx);
+#elif defined(VERTOPS_SSE2)
+    __m128 mn = _mm_set1_ps(FLT_MAX);
+    __m128 mx = _mm_set1_ps(-FLT_MAX);
+
+    for (; i < count; i++) {
+        const __m128 v = load_float3(CVERTEX_AT(vertices, stride, i));
+        mn = _mm_min_ps(mn, v);
+        mx = _mm_max_ps(mx, v);
+    }
+
+    store_float3(min, mn);
+    store_float3(max, mx);
+#else
+    make_vector3(min, FLT_MAX, FLT_MAX, FLT_MAX);
+    make_vector3(max, -FLT_MAX, -FLT_MAX, -FLT_MAX);
+
+    for (; i < count; i++) {
+        const float *p = CVERTEX_AT(vertices, stride, i);
+
+        for (int k = 0; k < 3; k++) {
+            min[k] = p[k] < min[k] ? p[k] : min[k];
+            max[k] = p[k] > max[k] ? p[k] : max[k];
+        }
+    }
+#endif
+}
+
+/*
+ * Smooth normals
+ */
+
+extern void
+vertops_normals(void *vertices, size_t stride, size_t normal_offset, size_t count,
+                const void *indices, uint32_t ef, size_t indices_count) {
+    assert(vertices != NULL);
+    assert(normal_offset + sizeof(float) * 3 <= stride);
+
+    if (!indices)
+        indices_count = count;
+
+    for (size_t i = 0; i < count; i++)
+        memset((char*)vertices + stride * i + normal_offset, 0, sizeof(float) * 3);
+
+    // area weighted face normals, the cross product length is twice the triangle area
+    for (size_t t = 0; t + 2 < indices_count; t += 3) {
+        const uint32_t i0 = fetch_index(indices, ef, t + 0);
+        const uint32_t i1 = fetch_index(indices, ef, t + 1);
+        const uint32_t i2 = fetch_index(indices, ef, t + 2);
+
+        if (i0 >= count || i1 >= count || i2 >= count)
+            continue;
+
+        const float *p0 = CVERTEX_AT(vertices, stride, i0);
+        const float *p1 = CVERTEX_AT(vertices, stride, i1);
+        const float *p2 = CVERTEX_AT(vertices, stride, i2);
+
+        const float e1[3] = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+        const float e2[3] = {p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]};
+        const float n[3] = {e1[1] * e2[2] - e1[2] * e2[1],
+                            e1[2] * e2[0] - e1[0] * e2[2],
+                            e1[0] * e2[1] - e1[1] * e2[0]};
+
+        const uint32_t tri[3] = {i0, i1, i2};
+        for (int k = 0; k < 3; k++) {
+            float *dst = (float*)((char*)VERTEX_AT(vertices, stride, tri[k]) + normal_offset);
+            dst[0] += n[0];
+            dst[1] += n[1];
+            dst[2] += n[2];
+        }
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        float *n = (float*)((char*)VERTEX_AT(vertices, stride, i) + normal_offset);
+#ifdef VERTOPS_SSE2
+        store_float3(n, normalize_float3(load_float3(n)));
+#else
+        normalize3(n);
+#endif
+    }
+}
+
+/*
+ * Tangents (Lengyel's method, Gram-Schmidt orthogonalized against the normal)
+ */
+
+extern void
+vertops_tangents(v3t2n3t3_t *vertices, size_t count, const void *indices, uint32_t ef, size_t indices_count) {
+    assert(vertices != NULL);
+
+    if (!indices)
+        indices_count = count;
+
+    for (size_t i = 0; i < count; i++)
+        make_vector3(vertices[i].tangent, 0.f, 0.f, 0.f);
+
+    // accumulate directly into the tangent attribute
+    for (size_t t = 0; t + 2 < indices_count; t += 3) {
+        const uint32_t i0 = fetch_index(indices, ef, t + 0);
+        const uint32_t i1 = fetch_index(indices, ef, t + 1);
+        const uint32_t i2 = fetch_index(indices, ef, t + 2);
+
+        if (i0 >= count || i1 >= count || i2 >= count)
+            continue;
+
+        const v3t2n3t3_t *v0 = &vertices[i0];
+        const v3t2n3t3_t *v1 = &vertices[i1];
+        const v3t2n3t3_t *v2 = &vertices[i2];
+
+        const float e1[3] = {v1->position[0] - v0->position[0], v1->position[1] - v0->position[1], v1->position[2] - v0->position[2]};
+        const float e2[3] = {v2->position[0] - v0->position[0], v2->position[1] - v0->position[1], v2->position[2] - v0->position[2]};
+
+        const float s1 = v1->texcoord[0] - v0->texcoord[0];
+        const float t1 = v1->texcoord[1] - v0->texcoord[1];
+        const float s2 = v2->texcoord[0] - v0->texcoord[0];
+        const float t2 = v2->texcoord[1] - v0->texcoord[1];
+
+        const float det = s1 * t2 - s2 * t1;
+
+        if (fabsf(det) <= FLT_EPSILON)
+            continue;
+
+        const float r = 1.f / det;
+        const float sdir[3] = {(t2 * e1[0] - t1 * e2[0]) * r,
+                               (t2 * e1[1] - t1 * e2[1]) * r,
+                               (t2 * e1[2] - t1 * e2[2]) * r};
+
+        const uint32_t tri[3] = {i0, i1, i2};
+        for (int k = 0; k < 3; k++) {
+            vertices[tri[k]].tangent[0] += sdir[0];
+            vertices[tri[k]].tangent[1] += sdir[1];
+            vertices[tri[k]].tangent[2] += sdir[2];
+        }
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        v3t2n3t3_t *v = &vertices[i];
+#ifdef VERTOPS_SSE2
+        const __m128 n = load_float3(v->normal);
+        const __m128 t = load_float3(v->tangent);
+
+        __m128 d = _mm_mul_ps(n, t);
+        d = _mm_add_ss(_mm_add_ss(d, _mm_shuffle_ps(d, d, _MM_SHUFFLE(1, 1, 1, 1))), _mm_shuffle_ps(d, d, _MM_SHUFFLE(2, 2, 2, 2)));
+        d = _mm_shuffle_ps(d, d, _MM_SHUFFLE(0, 0, 0, 0));
+
+        store_float3(v->tangent, normalize_float3(_mm_sub_ps(t, _mm_mul_ps(n, d))));
+#else
+        const float d = v->normal[0] * v->tangent[0] + v->normal[1] * v->tangent[1] + v->normal[2] * v->tangent[2];
+
+        v->tangent[0] -= v->normal[0] * d;
+        v->tangent[1] -= v->normal[1] * d;
+        v->tangent[2] -= v->normal[2] * d;
+
+        normalize3(v->tangent);
+#endif
+    }
+}
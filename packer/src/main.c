@@ -6,6 +6,7 @@
 #include "base/pjw.h"
 #include "core/package.h"
 #include <core/filesystem.h>
+#include "texcook.h"
 
 #include <minilzo.h>
 #include <lz4.h>
@@ -27,6 +28,9 @@ FILE_INFO       *files;
 int             files_count;
 int             files_size;
 
+bool            cook_textures;
+MIPGEN_OPTIONS  cook_options = {.filter = MIPGEN_FILTER_BOX, .alpha_reference = 0.5f};
+
 static int search_all_files(const char *path, int *count);
 
 static int
@@ -88,6 +92,29 @@ filedata_read(const char *filename, size_t *size) {
     return data;
 }
 
+// .tga to .tmip with the whole mip chain, the entry keeps its name so lookups don't change,
+// the reader tells the two apart by the magic
+static void*
+filedata_cook(const FILE_INFO *file, void *data, size_t *size) {
+    if (!cook_textures || file->ext_hash != pjw_hash(".tga"))
+        return data;
+
+    size_t cooked_size = 0;
+    void *cooked = cook_targa(data, *size, &cook_options, &cooked_size);
+
+    if (!cooked) {
+        fprintf(stderr, "warning: can't cook %s, packed as it is\n", file->name);
+        return data;
+    }
+
+    printf("cook %s size %zu cooked size %zu\n", file->name, *size, cooked_size);
+
+    free(data);
+    *size = cooked_size;
+
+    return cooked;
+}
+
 
 static int
 package_write(const char *package_path, uint32_t flags) {
@@ -123,6 +150,8 @@ package_write(const char *package_path, uint32_t flags) {
         void *data = filedata_read(files[i].path, &sz);
 
         if (data) {
+            data = filedata_cook(&files[i], data, &sz);
+
             items[i].data_position = ftell(fp);
             items[i].data_size = sz;
             files_size += sz;
@@ -186,6 +215,8 @@ package_write(const char *package_path, uint32_t flags) {
 
                 printf("write %s position %u size %u\n", files[i].name, items[i].data_position, items[i].data_size);
             }
+
+            free(data);
         } else
             fprintf(stderr, "error: can't read file[%d] %s data\n", i, files[i].name);
     }
@@ -230,6 +261,21 @@ main(int argc, char *argv[]) {
             flags |= PACKAGE_FLAG_COMPRESS_LZ4_HC;
             continue;
         }
+
+        if (strcmp(argv[i], "-mips") == 0) {
+            cook_textures = true;
+            continue;
+        }
+
+        if (strcmp(argv[i], "-kaiser") == 0) {
+            cook_options.filter = MIPGEN_FILTER_KAISER;
+            continue;
+        }
+
+        if (strcmp(argv[i], "-coverage") == 0) {
+            cook_options.flags |= MIPGEN_ALPHA_COVERAGE;
+            continue;
+        }
     }
 
     size_t path_size = strlen(argv[1]);
@@ -0,0 +1,140 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "core/targa.h"
+#include "core/texfile.h"
+#include "texcook.h"
+
+static uint8_t*
+decode_targa(const uint8_t *data, size_t size, TARGA_HEADER *header) {
+    if (size < sizeof(TARGA_HEADER))
+        return NULL;
+
+    memcpy(header, data, sizeof(TARGA_HEADER));
+
+    if (header->bpp != 8 && header->bpp != 24 && header->bpp != 32)
+        return NULL;
+
+    const size_t bytes = header->bpp / 8;
+    const size_t pixels_size = (size_t)header->width * header->height * bytes;
+    const uint8_t *p = data + sizeof(TARGA_HEADER) + header->length;
+    const uint8_t *end = data + size;
+
+    if (p > end || pixels_size == 0)
+        return NULL;
+
+    uint8_t *pixels = malloc(pixels_size);
+    if (!pixels)
+        return NULL;
+
+    switch (header->data_type) {
+    case TARGA_DATA_TRUE_COLOR:
+    case TARGA_DATA_BLACK_AND_WHITE:
+        if ((size_t)(end - p) < pixels_size)
+            break;
+
+        memcpy(pixels, p, pixels_size);
+        return pixels;
+    case TARGA_DATA_RLE_TRUE_COLOR:
+    case TARGA_DATA_RLE_BLACK_AND_WITE: {
+        size_t written = 0;
+
+        while (written < pixels_size && p < end) {
+            const uint8_t block = *p++;
+            const size_t count = ((block & 0x7f) + 1) * bytes;
+            const size_t run = block & 0x80 ? bytes : count;
+
+            if (written + count > pixels_size || (size_t)(end - p) < run)
+                break;
+
+            if (block & 0x80)
+                for (size_t i = 0; i < count; i += bytes)
+                    memcpy(pixels + written + i, p, bytes);
+            else
+                memcpy(pixels + written, p, count);
+
+            p += run;
+            written += count;
+        }
+
+        if (written == pixels_size)
+            return pixels;
+        break;
+    }
+    }
+
+    free(pixels);
+
+    return NULL;
+}
+
+extern void*
+cook_targa(const void *data, size_t size, const MIPGEN_OPTIONS *options, size_t *cooked_size) {
+    TARGA_HEADER targa;
+    uint8_t *pixels = decode_targa(data, size, &targa);
+
+    if (!pixels)
+        return NULL;
+
+    const uint32_t levels = mipgen_levels(targa.width, targa.height);
+
+    if (levels > TEXFILE_MAX_LEVELS) {
+        free(pixels);
+        return NULL;
+    }
+
+    MIPGEN_OPTIONS mipgen = *options;
+    mipgen.components = targa.bpp / 8;
+    mipgen.flags = mipgen.components > 1 ? mipgen.flags | MIPGEN_SRGB : mipgen.flags & ~MIPGEN_SRGB;
+
+    uint8_t *chain = generate_mipmaps(pixels, targa.width, targa.height, &mipgen);
+    free(pixels);
+
+    TEXFILE_HEADER header;
+    memset(&header, 0, sizeof(header));
+    header.magic = TEXFILE_MAGIC;
+    header.version = TEXFILE_VERSION;
+    header.width = targa.width;
+    header.height = targa.height;
+    header.levels = levels;
+    header.type = GL_UNSIGNED_BYTE;
+
+    switch (targa.bpp) {
+    case 8:
+        header.internalformat = GL_R8;
+        header.format = GL_RED;
+        break;
+    case 24:
+        header.internalformat = GL_SRGB8;
+        header.format = GL_BGR;
+        header.flags = TEXFILE_FLAG_SRGB;
+        break;
+    case 32:
+        header.internalformat = GL_SRGB8_ALPHA8;
+        header.format = GL_BGRA;
+        header.flags = TEXFILE_FLAG_SRGB;
+        break;
+    }
+
+    size_t chain_size = 0;
+    for (uint32_t i = 0; i < levels; i++) {
+        const uint32_t width = targa.width >> i > 0 ? targa.width >> i : 1;
+        const uint32_t height = targa.height >> i > 0 ? targa.height >> i : 1;
+
+        header.level_sizes[i] = width * height * mipgen.components;
+        chain_size += header.level_sizes[i];
+    }
+
+    uint8_t *cooked = malloc(sizeof(header) + chain_size);
+    if (cooked) {
+        memcpy(cooked, &header, sizeof(header));
+        memcpy(cooked + sizeof(header), chain, chain_size);
+        *cooked_size = sizeof(header) + chain_size;
+    }
+
+    free(chain);
+
+    return cooked;
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "core/mipgen.h"
+
+/*
+ * A .tga in memory to a .tmip with the whole chain, so the runtime only uploads. Color
+ * images are filtered as sRGB, grayscale ones as linear. Returns NULL for layouts it can't
+ * cook, those are packed as they are.
+ */
+void* cook_targa(const void *data, size_t size, const MIPGEN_OPTIONS *options, size_t *cooked_size);
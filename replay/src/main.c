@@ -0,0 +1,166 @@
+/*
+ * Replays a captured frame and reports CPU submit and GPU time per submit group. Buffers
+ * submitted on their own get a group each, so those are timed per command buffer, a merged
+ * pass is sorted across its buffers and timed as a whole
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <SDL2/SDL.h>
+
+#include <core/logerr.h>
+#include <video/gl.h>
+#include <video/capture.h>
+#include <video/state.h>
+#include <video/stats.h>
+
+#define DEFAULT_ITERATIONS 100
+
+typedef struct GroupTimes {
+    double      cpu_sum, cpu_min, cpu_max;
+    double      gpu_sum, gpu_min, gpu_max;
+    VIDEO_STATS stats;
+} GROUP_TIMES;
+
+static void
+add_time(double t, double *sum, double *min, double *max) {
+    *sum += t;
+    if (t < *min)
+        *min = t;
+    if (t > *max)
+        *max = t;
+}
+
+static void
+report(const VIDEO_CAPTURE *capture, const GROUP_TIMES *times, int iterations) {
+    printf("%-6s %-8s %-8s %-10s %-6s %-6s %-8s %-8s %-26s %-26s\n", "group", "buffers", "commands", "bytes", "draws", "dips",
+           "state", "elided", "cpu ms avg/min/max", "gpu ms avg/min/max");
+
+    double cpu_total = 0.0, gpu_total = 0.0;
+
+    for (uint32_t i = 0; i < capture->groups_count; i++) {
+        const GROUP_TIMES *t = &times[i];
+
+        printf("%-6u %-8u %-8u %-10zu %-6u %-6u %-8u %-8u %7.3f %7.3f %7.3f    %7.3f %7.3f %7.3f\n", i,
+               capture->groups[i].pass.buffers_count, t->stats.commands, t->stats.commands_memory, t->stats.draws, t->stats.dips,
+               t->stats.state_calls, t->stats.state_elided,
+               t->cpu_sum / iterations, t->cpu_min, t->cpu_max,
+               t->gpu_sum / iterations, t->gpu_min, t->gpu_max);
+
+        cpu_total += t->cpu_sum / iterations;
+        gpu_total += t->gpu_sum / iterations;
+    }
+
+    printf("total: cpu %.3f ms, gpu %.3f ms per frame over %d iterations\n", cpu_total, gpu_total, iterations);
+}
+
+int
+main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s capture [iterations]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    const int iterations = argc > 2 ? atoi(argv[2]) : DEFAULT_ITERATIONS;
+
+    if (iterations <= 0) {
+        fprintf(stderr, "iterations must be positive\n");
+        return EXIT_FAILURE;
+    }
+
+    if (SDL_Init(SDL_INIT_VIDEO) != 0) {
+        fprintf(stderr, "%s\n", SDL_GetError());
+        return EXIT_FAILURE;
+    }
+
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, OPENGL_MAJOR_VERSION);
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, OPENGL_MINOR_VERSION);
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
+    SDL_GL_SetAttribute(SDL_GL_DEPTH_SIZE, 24);
+    SDL_GL_SetAttribute(SDL_GL_STENCIL_SIZE, 8);
+    SDL_GL_SetAttribute(SDL_GL_DOUBLEBUFFER, 1);
+
+    // resized to the captured screen once the capture is loaded
+    SDL_Window *window = SDL_CreateWindow("neon-replay", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
+                                          64, 64, SDL_WINDOW_OPENGL | SDL_WINDOW_HIDDEN);
+    SDL_GLContext context = window ? SDL_GL_CreateContext(window) : NULL;
+
+    if (!context) {
+        fprintf(stderr, "%s\n", SDL_GetError());
+        SDL_Quit();
+        return EXIT_FAILURE;
+    }
+
+    SDL_GL_SetSwapInterval(0);
+    glLoadFunctions();
+    reset_state_cache();
+
+    printf("%s\n%s\n", (const char*)glGetString(GL_RENDERER), (const char*)glGetString(GL_VERSION));
+
+    VIDEO_CAPTURE capture;
+    if (!load_capture(&capture, argv[1])) {
+        SDL_GL_DeleteContext(context);
+        SDL_DestroyWindow(window);
+        SDL_Quit();
+        return EXIT_FAILURE;
+    }
+
+    if (capture.width > 0 && capture.height > 0)
+        SDL_SetWindowSize(window, capture.width, capture.height);
+
+    GLuint *queries = malloc(sizeof(GLuint) * capture.groups_count);
+    GROUP_TIMES *times = malloc(sizeof(GROUP_TIMES) * capture.groups_count);
+
+    if (!queries || !times) {
+        LOG_CRITICAL("%s\n", "Can't alloc memory");
+        exit(EXIT_FAILURE);
+    }
+
+    glGenQueries(capture.groups_count, queries);
+
+    for (uint32_t i = 0; i < capture.groups_count; i++)
+        times[i] = (GROUP_TIMES){.cpu_min = DBL_MAX, .gpu_min = DBL_MAX};
+
+    const double frequency = (double)SDL_GetPerformanceFrequency();
+
+    // the first frame warms up driver caches and is not measured
+    for (int it = -1; it < iterations; it++) {
+        for (uint32_t i = 0; i < capture.groups_count; i++) {
+            glBeginQuery(GL_TIME_ELAPSED, queries[i]);
+
+            const Uint64 start = SDL_GetPerformanceCounter();
+            replay_capture_group(&capture, i);
+            const Uint64 end = SDL_GetPerformanceCounter();
+
+            glEndQuery(GL_TIME_ELAPSED);
+
+            if (it >= 0) {
+                add_time((double)(end - start) * 1000.0 / frequency, &times[i].cpu_sum, &times[i].cpu_min, &times[i].cpu_max);
+                times[i].stats = video_stats;
+            }
+        }
+
+        SDL_GL_SwapWindow(window);
+
+        for (uint32_t i = 0; i < capture.groups_count && it >= 0; i++) {
+            GLuint64 elapsed = 0;
+            glGetQueryObjectui64v(queries[i], GL_QUERY_RESULT, &elapsed);
+            add_time((double)elapsed / 1000000.0, &times[i].gpu_sum, &times[i].gpu_min, &times[i].gpu_max);
+        }
+    }
+
+    report(&capture, times, iterations);
+
+    glDeleteQueries(capture.groups_count, queries);
+    free(queries);
+    free(times);
+
+    free_capture(&capture);
+
+    SDL_GL_DeleteContext(context);
+    SDL_DestroyWindow(window);
+    SDL_Quit();
+
+    return EXIT_SUCCESS;
+}
@@ -46,14 +46,14 @@ void
 gameplay_on_present(int w, int h, float alpha) {
     const float angle = MIX(rotation_angle, rotation_angle - 0.005f, alpha);
 
-    glEnable(GL_DEPTH_TEST);
-    glDepthFunc(GL_LESS);
+    state_enable(GL_DEPTH_TEST, true);
+    state_depth_func(GL_LESS);
 
     glDepthRange(0.f, 100.f);
 
     glClearColor(0.4f, 0.4f, 0.4f, 1.f);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    glViewport(0, 0, screen.width, screen.height);
+    state_viewport(0, 0, screen.width, screen.height);
 
     matrix4 projection = {IDENTITY_MATRIX4};
     perspective_matrix4(projection, 45.f, screen.aspect, 0.1f, 100.f);
@@ -91,7 +91,7 @@ gameplay_on_present(int w, int h, float alpha) {
 
     unbind_texture(0, GL_TEXTURE_2D);
 
-    glDisable(GL_DEPTH_TEST);
+    state_enable(GL_DEPTH_TEST, false);
 }
 
 void